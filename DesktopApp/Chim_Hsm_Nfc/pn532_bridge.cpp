@@ -0,0 +1,397 @@
+#include "pn532_bridge.h"
+
+#include <chrono>
+#include <cstring>
+
+const char BRIDGE_START_CODE = 'X';
+const int BRIDGE_TIMEOUT_SECONDS = 2;
+
+// PN532 commands, as in Adafruit_PN532.h.
+const uint8_t PN532_COMMAND_GETFIRMWAREVERSION = 0x02;
+const uint8_t PN532_COMMAND_SAMCONFIGURATION = 0x14;
+const uint8_t PN532_COMMAND_RFCONFIGURATION = 0x32;
+const uint8_t PN532_COMMAND_INDATAEXCHANGE = 0x40;
+const uint8_t PN532_COMMAND_INLISTPASSIVETARGET = 0x4A;
+const uint8_t MIFARE_CMD_AUTH_A = 0x60;
+const uint8_t MIFARE_CMD_READ = 0x30;
+const uint8_t MIFARE_CMD_WRITE = 0xA0;
+const uint8_t MIFARE_ULTRALIGHT_CMD_WRITE = 0xA2;
+const uint8_t BLOCK_SIZE = 16;
+
+/**
+ * @return The sector holding a block of a MIFARE Classic 1K or 4K card.
+ */
+static uint8_t sectorOf(uint8_t block) {
+  return block < 128 ? block / 4 : 32 + (block - 128) / 16;
+}
+
+/**
+ * @return Whether a block is the trailer of its sector, holding its keys.
+ */
+static bool isTrailer(uint8_t block) {
+  return block < 128 ? block % 4 == 3 : (block - 128) % 16 == 15;
+}
+
+PN532Bridge::PN532Bridge(SerialTransport &port) : port(port) {}
+
+PN532Bridge::~PN532Bridge() { end(); }
+
+bool PN532Bridge::begin() {
+  received.clear();
+  if (!port.write(&BRIDGE_START_CODE, 1))
+    return false;
+
+  // "bridge=on,command=<largest command>,window=<bytes>"
+  std::string value;
+  if (!readLine("bridge=", &value) || value.compare(0, 2, "on") != 0)
+    return false;
+  size_t command = value.find("command=");
+  size_t win = value.find("window=");
+  if (command == std::string::npos || win == std::string::npos)
+    return false;
+  maxCommand = std::stoul(value.substr(command + 8));
+  window = std::stoul(value.substr(win + 7));
+  sent.clear();
+  sentBytes = 0;
+  pending.clear();
+  active = true;
+  return true;
+}
+
+void PN532Bridge::end() {
+  if (!active)
+    return;
+  std::vector<uint8_t> response;
+  while (!sent.empty())
+    receive(&response);
+  pending.clear();
+  active = false;
+  uint8_t endCode = 0;
+  std::string value;
+  if (port.write(&endCode, 1))
+    readLine("bridge=", &value);
+}
+
+/**
+ * Reads until a line starting with key has been received.
+ *
+ * @return bool Returns true if the line was found, its value after key is
+ * then in value.
+ */
+bool PN532Bridge::readLine(const std::string &key, std::string *value) {
+  char readBuff[256];
+  auto start_time = std::chrono::steady_clock::now();
+  auto timeout_duration = std::chrono::seconds(BRIDGE_TIMEOUT_SECONDS);
+  while (true) {
+    size_t pos = received.find(key);
+    size_t endLine =
+        pos == std::string::npos ? pos : received.find('\r', pos);
+    if (endLine != std::string::npos) {
+      *value = received.substr(pos + key.size(), endLine - pos - key.size());
+      if (endLine + 1 < received.size() && received[endLine + 1] == '\n')
+        endLine++;
+      received.erase(0, endLine + 1);
+      return true;
+    }
+    if (std::chrono::steady_clock::now() - start_time > timeout_duration)
+      return false;
+    received.append(readBuff, port.read(readBuff, sizeof(readBuff)));
+  }
+}
+
+/**
+ * Reads binary bytes of the responses.
+ */
+bool PN532Bridge::readBytes(uint8_t *buffer, size_t length) {
+  char readBuff[256];
+  auto start_time = std::chrono::steady_clock::now();
+  auto timeout_duration = std::chrono::seconds(BRIDGE_TIMEOUT_SECONDS);
+  while (received.size() < length) {
+    if (std::chrono::steady_clock::now() - start_time > timeout_duration)
+      return false;
+    received.append(readBuff, port.read(readBuff, sizeof(readBuff)));
+  }
+  memcpy(buffer, received.data(), length);
+  received.erase(0, length);
+  return true;
+}
+
+bool PN532Bridge::sendCommand(const uint8_t *command, uint8_t length) {
+  uint8_t frame[256];
+  frame[0] = length;
+  memcpy(frame + 1, command, length);
+  if (!port.write(frame, length + 1))
+    return false;
+  sent.push_back(length + 1);
+  sentBytes += length + 1;
+  return true;
+}
+
+bool PN532Bridge::send(const uint8_t *command, uint8_t length) {
+  if (!active || length == 0 || length > maxCommand)
+    return false;
+  // The device holds the commands it has not read in its window, the oldest
+  // one is only known to have left it once its response arrives.
+  while (!sent.empty() && sentBytes + length + 1 > window) {
+    std::vector<uint8_t> response;
+    readResponse(&response);
+    if (!active)
+      return false;
+    pending.push_back(response);
+  }
+  return sendCommand(command, length);
+}
+
+bool PN532Bridge::receive(std::vector<uint8_t> *response) {
+  if (pending.empty())
+    return readResponse(response);
+  *response = pending.front();
+  pending.pop_front();
+  return !response->empty();
+}
+
+/**
+ * Reads the response of the oldest command sent from the device.
+ */
+bool PN532Bridge::readResponse(std::vector<uint8_t> *response) {
+  response->clear();
+  if (sent.empty())
+    return false;
+
+  uint8_t length;
+  if (!readBytes(&length, 1)) {
+    // The device no longer answers, the link is lost.
+    sent.clear();
+    sentBytes = 0;
+    active = false;
+    return false;
+  }
+  sentBytes -= sent.front();
+  sent.pop_front();
+  response->resize(length);
+  if (length && !readBytes(response->data(), length)) {
+    response->clear();
+    sent.clear();
+    sentBytes = 0;
+    active = false;
+    return false;
+  }
+  return length != 0;
+}
+
+bool PN532Bridge::exchange(const uint8_t *command, uint8_t length,
+                           std::vector<uint8_t> *response) {
+  std::vector<uint8_t> previous;
+  while (!sent.empty() || !pending.empty())
+    receive(&previous); // Responses nobody waits for anymore.
+  return send(command, length) && receive(response) &&
+         (*response)[0] == command[0] + 1;
+}
+
+uint32_t PN532Bridge::getFirmwareVersion() {
+  uint8_t command[] = {PN532_COMMAND_GETFIRMWAREVERSION};
+  std::vector<uint8_t> response;
+  if (!exchange(command, sizeof(command), &response) || response.size() < 5)
+    return 0;
+  return (uint32_t)response[1] << 24 | (uint32_t)response[2] << 16 |
+         (uint32_t)response[3] << 8 | response[4];
+}
+
+bool PN532Bridge::SAMConfig() {
+  uint8_t command[] = {PN532_COMMAND_SAMCONFIGURATION, 0x01, 0x14, 0x01};
+  std::vector<uint8_t> response;
+  return exchange(command, sizeof(command), &response);
+}
+
+bool PN532Bridge::setPassiveActivationRetries(uint8_t maxRetries) {
+  uint8_t command[] = {PN532_COMMAND_RFCONFIGURATION, 5, 0xFF, 0x01,
+                       maxRetries};
+  std::vector<uint8_t> response;
+  return exchange(command, sizeof(command), &response);
+}
+
+bool PN532Bridge::readPassiveTargetID(uint8_t cardBaudRate, uint8_t *uid,
+                                      uint8_t *uidLength) {
+  uint8_t command[] = {PN532_COMMAND_INLISTPASSIVETARGET, 1, cardBaudRate};
+  std::vector<uint8_t> response;
+  // Code, NbTg, Tg, SENS_RES (2), SEL_RES, NFCIDLength, NFCID.
+  if (!exchange(command, sizeof(command), &response) || response.size() < 7 ||
+      response[1] != 1 || response[6] > sizeof(this->uid) ||
+      response.size() < 7u + response[6])
+    return false;
+  *uidLength = response[6];
+  memcpy(uid, &response[7], *uidLength);
+  memcpy(this->uid, uid, *uidLength);
+  this->uidLength = *uidLength;
+  return true;
+}
+
+bool PN532Bridge::inDataExchange(const uint8_t *send, uint8_t sendLength,
+                                 uint8_t *response, uint8_t *responseLength) {
+  uint8_t command[256];
+  if (sendLength + 2 > (int)sizeof(command))
+    return false;
+  command[0] = PN532_COMMAND_INDATAEXCHANGE;
+  command[1] = 1; // Target number.
+  memcpy(command + 2, send, sendLength);
+  std::vector<uint8_t> answer;
+  if (!exchange(command, sendLength + 2, &answer) || answer.size() < 2 ||
+      (answer[1] & 0x3F) != 0)
+    return false;
+  size_t length = answer.size() - 2;
+  if (length > *responseLength)
+    length = *responseLength;
+  memcpy(response, &answer[2], length);
+  *responseLength = (uint8_t)length;
+  return true;
+}
+
+/**
+ * Builds the InDataExchange command of a MIFARE Classic authentication.
+ *
+ * @return The length of the command.
+ */
+static uint8_t authCommand(uint8_t *command, const uint8_t *uid,
+                           uint8_t uidLength, uint8_t block, uint8_t keyNumber,
+                           const uint8_t *key) {
+  command[0] = PN532_COMMAND_INDATAEXCHANGE;
+  command[1] = 1;
+  command[2] = keyNumber ? MIFARE_CMD_AUTH_A + 1 : MIFARE_CMD_AUTH_A;
+  command[3] = block;
+  memcpy(command + 4, key, 6);
+  memcpy(command + 10, uid + uidLength - 4, 4); // Last 4 bytes of a 7 bytes UID.
+  return 14;
+}
+
+bool PN532Bridge::mifareclassic_AuthenticateBlock(const uint8_t *uid,
+                                                  uint8_t uidLength,
+                                                  uint32_t blockNumber,
+                                                  uint8_t keyNumber,
+                                                  const uint8_t *keyData) {
+  if (uidLength < 4)
+    return false;
+  uint8_t command[14];
+  std::vector<uint8_t> response;
+  authCommand(command, uid, uidLength, (uint8_t)blockNumber, keyNumber,
+              keyData);
+  return exchange(command, sizeof(command), &response) &&
+         response.size() >= 2 && (response[1] & 0x3F) == 0;
+}
+
+bool PN532Bridge::mifareclassic_ReadDataBlock(uint8_t blockNumber,
+                                              uint8_t *data) {
+  uint8_t command[] = {MIFARE_CMD_READ, blockNumber};
+  uint8_t length = BLOCK_SIZE;
+  return inDataExchange(command, sizeof(command), data, &length) &&
+         length == BLOCK_SIZE;
+}
+
+bool PN532Bridge::mifareclassic_WriteDataBlock(uint8_t blockNumber,
+                                               const uint8_t *data) {
+  uint8_t command[2 + BLOCK_SIZE] = {MIFARE_CMD_WRITE, blockNumber};
+  memcpy(command + 2, data, BLOCK_SIZE);
+  uint8_t response[1];
+  uint8_t length = 0;
+  return inDataExchange(command, sizeof(command), response, &length);
+}
+
+bool PN532Bridge::ntag2xx_ReadPage(uint8_t page, uint8_t *buffer) {
+  uint8_t command[] = {MIFARE_CMD_READ, page};
+  uint8_t data[BLOCK_SIZE];
+  uint8_t length = BLOCK_SIZE;
+  if (!inDataExchange(command, sizeof(command), data, &length) || length < 4)
+    return false;
+  memcpy(buffer, data, 4); // A read returns 4 pages, only the first is kept.
+  return true;
+}
+
+bool PN532Bridge::ntag2xx_WritePage(uint8_t page, const uint8_t *data) {
+  uint8_t command[6] = {MIFARE_ULTRALIGHT_CMD_WRITE, page};
+  memcpy(command + 2, data, 4);
+  uint8_t response[1];
+  uint8_t length = 0;
+  return inDataExchange(command, sizeof(command), response, &length);
+}
+
+bool PN532Bridge::mifareclassic_ReadBlocks(uint8_t firstBlock, uint8_t count,
+                                           uint8_t keyNumber,
+                                           const uint8_t *key, uint8_t *data,
+                                           std::vector<uint8_t> *failedSectors) {
+  return mifareclassic_Blocks(firstBlock, count, keyNumber, key, data, nullptr,
+                              failedSectors);
+}
+
+bool PN532Bridge::mifareclassic_WriteBlocks(
+    uint8_t firstBlock, uint8_t count, uint8_t keyNumber, const uint8_t *key,
+    const uint8_t *data, std::vector<uint8_t> *failedSectors) {
+  return mifareclassic_Blocks(firstBlock, count, keyNumber, key, nullptr, data,
+                              failedSectors);
+}
+
+/**
+ * Authenticates each sector of a block range and reads or writes its blocks,
+ * sending all the commands before their responses arrive. After a failed
+ * authentication the card refuses every command until it is selected again,
+ * so the sectors after it are reported as failed too.
+ */
+bool PN532Bridge::mifareclassic_Blocks(uint8_t firstBlock, uint8_t count,
+                                       uint8_t keyNumber, const uint8_t *key,
+                                       uint8_t *readData,
+                                       const uint8_t *writeData,
+                                       std::vector<uint8_t> *failedSectors) {
+  failedSectors->clear();
+  if (uidLength < 4 || firstBlock + count > 256)
+    return false;
+  if (readData)
+    memset(readData, 0, (size_t)count * BLOCK_SIZE);
+
+  std::vector<uint8_t> response;
+  while (!sent.empty() || !pending.empty())
+    receive(&response);
+
+  struct Step {
+    uint8_t sector;
+    int index; // Block in the range, -1 for the authentication.
+  };
+  std::deque<Step> steps;
+  bool linkFailed = false;
+  int previousSector = -1;
+  for (int i = 0; i < count && !linkFailed; i++) {
+    uint8_t block = firstBlock + i;
+    uint8_t sector = sectorOf(block);
+    if (writeData && isTrailer(block))
+      continue; // Its keys and access bits are not written from here.
+
+    uint8_t command[4 + BLOCK_SIZE];
+    if (sector != previousSector) {
+      authCommand(command, uid, uidLength, block, keyNumber, key);
+      linkFailed = !send(command, 14);
+      steps.push_back({sector, -1});
+      previousSector = sector;
+    }
+    command[0] = PN532_COMMAND_INDATAEXCHANGE;
+    command[1] = 1;
+    command[2] = writeData ? MIFARE_CMD_WRITE : MIFARE_CMD_READ;
+    command[3] = block;
+    if (writeData)
+      memcpy(command + 4, writeData + i * BLOCK_SIZE, BLOCK_SIZE);
+    linkFailed = linkFailed || !send(command, writeData ? 4 + BLOCK_SIZE : 4);
+    steps.push_back({sector, i});
+  }
+
+  int failedSector = -1;
+  for (const Step &step : steps) {
+    bool done = receive(&response) && response.size() >= 2 &&
+                (response[1] & 0x3F) == 0;
+    if (done && readData && step.index >= 0) {
+      done = response.size() == 2 + BLOCK_SIZE;
+      if (done)
+        memcpy(readData + step.index * BLOCK_SIZE, &response[2], BLOCK_SIZE);
+    }
+    if (!done && step.sector != failedSector) {
+      failedSector = step.sector;
+      failedSectors->push_back(step.sector);
+    }
+  }
+  return !linkFailed && failedSectors->empty();
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "serial_transport.h"
+
+// PN532 commands of the Adafruit_PN532 driver, run from the app through the
+// device's bridge mode: the device only forwards the frames to the reader, so
+// card flows can be written and changed here without reflashing it.
+//
+// Commands are pipelined: send() writes a command ahead of the responses of the
+// previous ones as long as they fit in the device's input window, and
+// receive() returns the responses in order. The Adafruit-style calls send one
+// command and wait for its response; the block calls pipeline a whole range.
+//
+// Unlike the serial_comm functions, the calls return true on success, like the
+// driver they mirror.
+class PN532Bridge {
+public:
+  explicit PN532Bridge(SerialTransport &port);
+  ~PN532Bridge();
+
+  /**
+   * Starts the bridge, the admin session must be open.
+   *
+   * @return bool Returns true if the device has entered bridge mode.
+   */
+  bool begin();
+
+  /**
+   * Reads the responses still expected, then ends the bridge.
+   */
+  void end();
+
+  /**
+   * Sends a command without waiting for its response, once the commands
+   * before it leave room in the device's window.
+   *
+   * @param command The command code and its parameters.
+   * @param length Its length, up to the largest command the device accepts.
+   * @return bool Returns true if the command has been sent.
+   */
+  bool send(const uint8_t *command, uint8_t length);
+
+  /**
+   * Waits for the response of the oldest command sent.
+   *
+   * @param response Receives the response code and its data.
+   * @return bool Returns true if the PN532 has answered.
+   */
+  bool receive(std::vector<uint8_t> *response);
+
+  /**
+   * Sends a command and waits for its response.
+   */
+  bool exchange(const uint8_t *command, uint8_t length,
+                std::vector<uint8_t> *response);
+
+  uint32_t getFirmwareVersion();
+  bool SAMConfig();
+  bool setPassiveActivationRetries(uint8_t maxRetries);
+  bool readPassiveTargetID(uint8_t cardBaudRate, uint8_t *uid,
+                           uint8_t *uidLength);
+  bool inDataExchange(const uint8_t *send, uint8_t sendLength,
+                      uint8_t *response, uint8_t *responseLength);
+  bool mifareclassic_AuthenticateBlock(const uint8_t *uid, uint8_t uidLength,
+                                       uint32_t blockNumber, uint8_t keyNumber,
+                                       const uint8_t *keyData);
+  bool mifareclassic_ReadDataBlock(uint8_t blockNumber, uint8_t *data);
+  bool mifareclassic_WriteDataBlock(uint8_t blockNumber, const uint8_t *data);
+  bool ntag2xx_ReadPage(uint8_t page, uint8_t *buffer);
+  bool ntag2xx_WritePage(uint8_t page, const uint8_t *data);
+
+  /**
+   * Reads consecutive blocks of a MIFARE Classic card selected by
+   * readPassiveTargetID(), authenticating each sector with the same key. The
+   * authentication and the reads of all the sectors are pipelined.
+   *
+   * @param data Receives 16 bytes per block, those of a failed sector are 0.
+   * @param failedSectors Receives the sectors which could not be read.
+   * @return bool Returns true if every block has been read.
+   */
+  bool mifareclassic_ReadBlocks(uint8_t firstBlock, uint8_t count,
+                                uint8_t keyNumber, const uint8_t *key,
+                                uint8_t *data,
+                                std::vector<uint8_t> *failedSectors);
+
+  /**
+   * Writes consecutive data blocks the same way, sector trailers excluded.
+   */
+  bool mifareclassic_WriteBlocks(uint8_t firstBlock, uint8_t count,
+                                 uint8_t keyNumber, const uint8_t *key,
+                                 const uint8_t *data,
+                                 std::vector<uint8_t> *failedSectors);
+
+private:
+  bool readLine(const std::string &key, std::string *value);
+  bool readBytes(uint8_t *buffer, size_t length);
+  bool readResponse(std::vector<uint8_t> *response);
+  bool sendCommand(const uint8_t *command, uint8_t length);
+  bool mifareclassic_Blocks(uint8_t firstBlock, uint8_t count,
+                            uint8_t keyNumber, const uint8_t *key,
+                            uint8_t *readData, const uint8_t *writeData,
+                            std::vector<uint8_t> *failedSectors);
+
+  SerialTransport &port;
+  bool active = false;
+  size_t maxCommand = 0;    // Largest command the device accepts.
+  size_t window = 0;        // Bytes of commands it can hold ahead.
+  std::deque<size_t> sent;  // Framed size of each command not answered yet.
+  size_t sentBytes = 0;
+  std::deque<std::vector<uint8_t>> pending; // Read by send() to make room.
+  std::string received;     // Bytes read and not consumed yet.
+  uint8_t uid[7] = {0};     // Card selected by readPassiveTargetID().
+  uint8_t uidLength = 0;
+};
@@ -0,0 +1,145 @@
+#include "response_matcher.h"
+
+const int NO_VALUE = -1;   // A message, complete with its marker.
+const int LINE_VALUE = 0;  // A text value, up to the end of the line.
+const size_t MAX_LINE_VALUE = 256; // Longer is noise, the capture is dropped.
+
+struct ResponseMarker {
+  Response type;
+  const char *text;
+  int valueLength; // NO_VALUE, LINE_VALUE, or the bytes of a binary value.
+};
+
+const ResponseMarker RESPONSE_MARKERS[] = {
+    {Response::FoundCard, "Found a card!", NO_VALUE},
+    {Response::PasswordProtected, "passwordProtected=", LINE_VALUE},
+    {Response::PasswordCreation, "passwordCreation=", LINE_VALUE},
+    {Response::PasswordCorrect, "passwordCorrect=", LINE_VALUE},
+    {Response::DualCards, "DualCards=", LINE_VALUE},
+    {Response::KeySegments, "Key segments: ", 64}, // Both keys, raw.
+    {Response::FirstCardWritten, "First card written.", NO_VALUE},
+    {Response::SecondCardWritten, "Second card written.", NO_VALUE},
+    {Response::EepromWritten, "EEPROM written.", NO_VALUE},
+    {Response::Status, "status=", LINE_VALUE},
+    {Response::BatchJob, "batchJob=", LINE_VALUE},
+    {Response::Batch, "batch=", LINE_VALUE},
+    {Response::BatchCard, "batchCard=", LINE_VALUE},
+};
+
+/**
+ * Zeroizes a value which may have held keys, without the compiler optimizing
+ * it out.
+ */
+static void zeroize(std::string *value) {
+  volatile char *bytes = &(*value)[0];
+  for (size_t i = 0; i < value->size(); i++)
+    bytes[i] = 0;
+  value->clear();
+}
+
+ResponseMatcher::ResponseMatcher() : nodes(1) {
+  // The trie of the markers.
+  for (size_t m = 0; m < sizeof(RESPONSE_MARKERS) / sizeof(RESPONSE_MARKERS[0]); m++) {
+    int node = 0;
+    for (const char *c = RESPONSE_MARKERS[m].text; *c; c++) {
+      int child = -1;
+      for (const std::pair<char, int> &edge : nodes[node].next)
+        if (edge.first == *c)
+          child = edge.second;
+      if (child < 0) {
+        child = (int)nodes.size();
+        nodes[node].next.push_back(std::make_pair(*c, child));
+        nodes.emplace_back();
+      }
+      node = child;
+    }
+    nodes[node].marker = (int)m;
+  }
+
+  // Breadth first, the failure links of a node lead to shallower ones, whose
+  // links are known by then.
+  std::deque<int> queue(1, 0);
+  while (!queue.empty()) {
+    int node = queue.front();
+    queue.pop_front();
+    for (const std::pair<char, int> &edge : nodes[node].next) {
+      Node &child = nodes[edge.second];
+      child.fail = node == 0 ? 0 : step(nodes[node].fail, edge.first);
+      if (child.marker < 0)
+        child.marker = nodes[child.fail].marker; // A marker ending within this one.
+      queue.push_back(edge.second);
+    }
+  }
+}
+
+int ResponseMatcher::step(int node, char byte) const {
+  for (;;) {
+    for (const std::pair<char, int> &edge : nodes[node].next)
+      if (edge.first == byte)
+        return edge.second;
+    if (node == 0)
+      return 0;
+    node = nodes[node].fail;
+  }
+}
+
+void ResponseMatcher::feed(const char *bytes, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    char byte = bytes[i];
+    if (capturing >= 0) {
+      // Values are not scanned for markers, a binary one can hold any byte.
+      const ResponseMarker &marker = RESPONSE_MARKERS[capturing];
+      bool complete;
+      if (marker.valueLength == LINE_VALUE) {
+        complete = byte == '\r' || byte == '\n';
+        if (!complete) {
+          captured.push_back(byte);
+          if (captured.size() <= MAX_LINE_VALUE)
+            continue;
+        }
+      } else {
+        captured.push_back(byte);
+        complete = captured.size() == (size_t)marker.valueLength;
+        if (!complete)
+          continue;
+      }
+      if (complete)
+        events.push_back({marker.type, captured});
+      zeroize(&captured);
+      capturing = -1;
+      continue;
+    }
+
+    state = step(state, byte);
+    int found = nodes[state].marker;
+    if (found < 0)
+      continue;
+    state = 0;
+    if (RESPONSE_MARKERS[found].valueLength == NO_VALUE)
+      events.push_back({RESPONSE_MARKERS[found].type, std::string()});
+    else
+      capturing = found;
+  }
+}
+
+bool ResponseMatcher::take(Response type, std::string *value) {
+  for (auto event = events.begin(); event != events.end(); ++event) {
+    if (event->type != type)
+      continue;
+    if (value)
+      *value = event->value;
+    zeroize(&event->value);
+    events.erase(event);
+    return true;
+  }
+  return false;
+}
+
+void ResponseMatcher::clear() {
+  for (ResponseEvent &event : events)
+    zeroize(&event.value);
+  events.clear();
+  zeroize(&captured);
+  capturing = -1;
+  state = 0;
+}
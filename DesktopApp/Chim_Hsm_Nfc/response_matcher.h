@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+
+// The lines the device answers with, see RESPONSE_MARKERS for their text.
+enum class Response {
+  FoundCard,
+  PasswordProtected,
+  PasswordCreation,
+  PasswordCorrect,
+  DualCards,
+  KeySegments,
+  FirstCardWritten,
+  SecondCardWritten,
+  EepromWritten,
+  Status,
+  BatchJob,
+  Batch,
+  BatchCard,
+};
+
+struct ResponseEvent {
+  Response type;
+  std::string value; // What follows the marker up to the end of the line.
+};
+
+// Finds the device's responses in the bytes received, all the markers at once
+// (Aho-Corasick), looking at each byte once whatever the chunks they arrive
+// in. The transcript is not kept: only the values are, as events queued until
+// taken, so a response received while waiting for another is not lost.
+class ResponseMatcher {
+public:
+  ResponseMatcher();
+  ~ResponseMatcher() { clear(); }
+
+  /**
+   * Runs the bytes received through the markers, queuing an event for each
+   * response completed.
+   */
+  void feed(const char *bytes, size_t length);
+
+  /**
+   * Removes the oldest event of a type from the queue, leaving the others.
+   *
+   * @param value Receives its value, may be nullptr for messages.
+   * @return bool Returns true if an event of that type was queued.
+   */
+  bool take(Response type, std::string *value);
+
+  /**
+   * Drops the events queued and the response being received, zeroizing their
+   * values since they may hold keys.
+   */
+  void clear();
+
+private:
+  struct Node {
+    std::vector<std::pair<char, int>> next;
+    int fail = 0;
+    int marker = -1; // The longest marker ending here, -1 if none.
+  };
+
+  int step(int node, char byte) const;
+
+  std::vector<Node> nodes;
+  int state = 0;
+  int capturing = -1; // Marker whose value is being received, -1 if none.
+  std::string captured;
+  std::deque<ResponseEvent> events;
+};
@@ -1,20 +1,31 @@
 #include "serial_comm.h"
 
-std::string NFCDevicePort;
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
 
-std::string line;
-char readBuff[256];
+#include "response_matcher.h"
 
-DWORD bytesRead;
-HANDLE hSerial;
-DWORD bytesWritten;
-bool found = false;
+std::string NFCDevicePort;
+
+static std::unique_ptr<SerialTransport> port;
 bool dualCards = false;
 
 // Faire un enum
 const int KEY_LENGTH = 32;
 const char WRITE_KEYS_CODE = 'e';
 const char CONTINUE_PROCESS_CODE = '~';
+const char BATCH_JOB_CODE = 'J';
+const char BATCH_START_CODE = 'B';
+const char BATCH_END_CODE = 'E';
 const int TIMEOUT_SECONDS = 2;
 
 /**
@@ -25,22 +36,201 @@ const int TIMEOUT_SECONDS = 2;
  * @return bool Returns true if initialization fails, false if successful.
  */
 bool start();
-bool waitForMessage(const std::string &expectedMessage);
-bool writeToFileHandle(const char *buffer, DWORD bufferSize);
+bool writeToPort(const char *buffer, size_t bufferSize);
+static bool waitForResponse(Response type, std::string *value = nullptr);
+
+static void defaultPrompt(const char *text, const char *caption) {
+#ifdef _WIN32
+  MessageBox(NULL, text, caption, MB_OK);
+#else
+  std::cerr << caption << (*caption ? ": " : "") << text << std::endl;
+#endif
+}
 
-// Function to find the NFC Device on available serial ports
-std::string findNFCDevice() {
-  HANDLE hSerial = INVALID_HANDLE_VALUE;
-  // Iterate over possible COM ports
-  for (int i = 1; i <= 256; i++) {
-    std::string portName = "\\\\.\\COM" + std::to_string(i); // Format port name
-    if (initializeSerialPort(hSerial, portName.c_str())) {
-      // If port is initialized, NFC Device might be connected
-      CloseHandle(hSerial); // Close the handle to the port
-      return portName;      // Return the COM port name
+static UserPrompt userPrompt = defaultPrompt;
+
+void setUserPrompt(UserPrompt prompt) {
+  userPrompt = prompt ? prompt : defaultPrompt;
+}
+
+SerialTransport *readerTransport() { return port.get(); }
+
+/**
+ * Reads the bytes received, nothing if the port is not open.
+ */
+static size_t readPort(char *buffer, size_t size) {
+  return port ? port->read(buffer, size) : 0;
+}
+
+/**
+ * Zeroizes a buffer which held keys, without the compiler optimizing it out.
+ */
+static void secureZero(void *buffer, size_t size) {
+  volatile char *bytes = static_cast<volatile char *>(buffer);
+  while (size--)
+    *bytes++ = 0;
+}
+
+/**
+ * Parses a decimal number sent by the device, the whole text must be one.
+ *
+ * @return bool Returns true if the text is a number which fits an int.
+ */
+static bool parseNumber(const std::string &text, int *number) {
+  if (text.empty())
+    return false;
+  char *end;
+  errno = 0;
+  long parsed = strtol(text.c_str(), &end, 10);
+  if (*end != '\0' || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
+    return false;
+  *number = static_cast<int>(parsed);
+  return true;
+}
+
+// The responses received and not taken yet. Card results arrive at any time in
+// batch mode, so those received while waiting for an answer are kept for
+// batchPollResult().
+static ResponseMatcher responses;
+
+/**
+ * Runs the bytes the device has sent through the matcher.
+ */
+static void readResponses() {
+  char readBuff[256];
+  size_t bytesRead = readPort(readBuff, sizeof(readBuff));
+  responses.feed(readBuff, bytesRead);
+  secureZero(readBuff, bytesRead);
+}
+
+// USB identities of the boards the firmware runs on.
+struct UsbId {
+  uint16_t vendorId;
+  uint16_t productId;
+};
+const UsbId DEVICE_USB_IDS[] = {
+    {0x2341, 0x8036}, // Arduino Leonardo
+    {0x1B4F, 0x9206}, // SparkFun Pro Micro
+};
+const char STATUS_QUERY_CODE = '?';
+const int IDENTIFY_TIMEOUT_MS = 500;
+
+static bool isDeviceUsbId(const SerialPortInfo &info) {
+  for (const UsbId &id : DEVICE_USB_IDS)
+    if (info.vendorId == id.vendorId && info.productId == id.productId)
+      return true;
+  return false;
+}
+
+/**
+ * Opens a port and checks that the device is behind it: the firmware answers
+ * the status query with a "status=" line at any time, without side effects.
+ *
+ * @return The transport, nullptr if nothing answered in time.
+ */
+static std::unique_ptr<SerialTransport> identifyDevice(const std::string &portName) {
+  std::unique_ptr<SerialTransport> transport = openSerialPort(portName);
+  if (!transport || !transport->write(&STATUS_QUERY_CODE, 1))
+    return nullptr;
+  ResponseMatcher matcher;
+  char readBuff[64];
+  auto start_time = std::chrono::steady_clock::now();
+  while (!matcher.take(Response::Status, nullptr)) {
+    if (std::chrono::steady_clock::now() - start_time >
+        std::chrono::milliseconds(IDENTIFY_TIMEOUT_MS))
+      return nullptr;
+    matcher.feed(readBuff, transport->read(readBuff, sizeof(readBuff)));
+  }
+  return transport;
+}
+
+/**
+ * @return The file keeping the port the device was last found on, empty if
+ * there is no place for it.
+ */
+static std::string cachedPortFile() {
+#ifdef _WIN32
+  char base[MAX_PATH];
+  DWORD length = GetEnvironmentVariable("LOCALAPPDATA", base, sizeof(base));
+  if (length == 0 || length >= sizeof(base))
+    return "";
+  return std::string(base) + "\\Chim_Hsm_Nfc_port.txt";
+#else
+  const char *cache = getenv("XDG_CACHE_HOME");
+  if (cache && *cache)
+    return std::string(cache) + "/chim_hsm_nfc_port";
+  const char *home = getenv("HOME");
+  if (!home)
+    return "";
+  mkdir((std::string(home) + "/.cache").c_str(), 0700);
+  return std::string(home) + "/.cache/chim_hsm_nfc_port";
+#endif
+}
+
+static std::string loadCachedPort() {
+  std::string portName;
+  std::ifstream file(cachedPortFile());
+  std::getline(file, portName);
+  return portName;
+}
+
+static void saveCachedPort(const std::string &portName) {
+  std::ofstream file(cachedPortFile(), std::ios::trunc);
+  file << portName << std::endl;
+}
+
+/**
+ * Finds the port the device is on and opens it. The port it was last found on
+ * is tried first. The other ones are identified in parallel, so the ports
+ * which do not answer cost one timeout in all: those of the boards the
+ * firmware runs on, or all the ports if none has their USB identity (a
+ * system which does not report it, or a board with another one).
+ *
+ * @param portName Set to the port found, empty if none.
+ * @return The open transport, nullptr if the device was not found.
+ */
+static std::unique_ptr<SerialTransport> discoverDevice(std::string *portName) {
+  std::string cached = loadCachedPort();
+  if (!cached.empty()) {
+    if (std::unique_ptr<SerialTransport> transport = identifyDevice(cached)) {
+      *portName = cached;
+      return transport;
     }
   }
-  return ""; // Return an empty string if no NFC Device found
+
+  std::vector<SerialPortInfo> ports = listSerialPorts();
+  std::vector<std::string> candidates;
+  for (const SerialPortInfo &info : ports)
+    if (isDeviceUsbId(info) && info.name != cached)
+      candidates.push_back(info.name);
+  if (candidates.empty())
+    for (const SerialPortInfo &info : ports)
+      if (info.name != cached)
+        candidates.push_back(info.name);
+
+  std::vector<std::unique_ptr<SerialTransport>> found(candidates.size());
+  std::vector<std::thread> probes;
+  for (size_t i = 0; i < candidates.size(); i++)
+    probes.emplace_back([&candidates, &found, i] { found[i] = identifyDevice(candidates[i]); });
+  for (std::thread &probe : probes)
+    probe.join();
+
+  // The first in the list order, the other ports are closed with their transports.
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (found[i]) {
+      *portName = candidates[i];
+      saveCachedPort(*portName);
+      return std::move(found[i]);
+    }
+  }
+  portName->clear();
+  return nullptr;
+}
+
+std::string findNFCDevice() {
+  std::string portName;
+  discoverDevice(&portName); // The port is closed when the transport is released.
+  return portName;
 }
 
 /**
@@ -51,94 +241,41 @@ std::string findNFCDevice() {
  * @return bool Returns true if initialization fails, false if successful.
  */
 bool start() {
+  // The responses left from the previous operations are stale.
+  responses.clear();
+
   //  Send a character to start operations within the board
-  if (!writeToFileHandle(&CONTINUE_PROCESS_CODE, 1)) {
+  if (!writeToPort(&CONTINUE_PROCESS_CODE, 1)) {
     // std::cerr << "Failed to send initCode\n";
-    CloseHandle(hSerial);
+    port.reset();
     return true;
   }
   // Wait for confirmation from the board that the card is deteced.
-  if (!waitForMessage("Found a card!")) {
+  if (!waitForResponse(Response::FoundCard)) {
     // std::cerr << "Failed to Find a card\n";
     return true;
   }
   return false; // Everyting is good.
 }
 
-// Function to initialize the serial port with specified settings
-bool initializeSerialPort(HANDLE& hSerial, const char* portName) {
-    // std::cout << "Creating serial file... \n";
-
-    hSerial = CreateFile(portName,                     // Port name
-        GENERIC_READ | GENERIC_WRITE, // Read/Write access
-        0,                            // No sharing
-        NULL,                         // No security attributes
-        OPEN_EXISTING,                // Opens an existing device
-        0,                            // No special attributes (using 0 here is more common)
-        NULL);                        // No template file
-
-    // Check if the handle is valid
-    if (hSerial == INVALID_HANDLE_VALUE) {
-        // std::cerr << "Error opening serial port: " << GetLastError() << "\n";
-        return false; // Return false if could not open the port
-    }
-
-    DCB dcbSerialParams = { 0 }; // Initializing DCB structure
-    dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
-
-    // Get the current settings of the serial port
-    if (!GetCommState(hSerial, &dcbSerialParams)) {
-        // std::cerr << "Error getting current serial port state: " << GetLastError() << "\n";
-        CloseHandle(hSerial); // Close handle if getting state fails
-        return false;
-    }
+bool setup_reader_serial(bool *passwordProtected, const std::string &portName) {
+  port.reset(); // A port still open from a previous connection could not be opened again.
 
-    // Configure the baud rate and other settings for the serial communication
-    dcbSerialParams.BaudRate = CBR_9600;   // Set baud rate to 9600
-    dcbSerialParams.ByteSize = 8;          // 8 bit data
-    dcbSerialParams.StopBits = ONESTOPBIT; // One stop bit
-    dcbSerialParams.Parity = NOPARITY;     // No parity bit
-
-    // Set the new state with the configured settings
-    if (!SetCommState(hSerial, &dcbSerialParams)) {
-        // std::cerr << "Error setting serial port state: " << GetLastError() << "\n";
-        CloseHandle(hSerial); // Close handle if setting state fails
-        return false;
-    }
-
-    // Setting timeouts (optional but recommended)
-    COMMTIMEOUTS timeouts = { 0 };
-    timeouts.ReadIntervalTimeout = 50;          // 50 ms
-    timeouts.ReadTotalTimeoutConstant = 50;     // 50 ms
-    timeouts.ReadTotalTimeoutMultiplier = 10;   // 10 ms per byte
-    timeouts.WriteTotalTimeoutConstant = 50;    // 50 ms
-    timeouts.WriteTotalTimeoutMultiplier = 10;  // 10 ms per byte
-
-    if (!SetCommTimeouts(hSerial, &timeouts)) {
-        // std::cerr << "Error setting timeouts: " << GetLastError() << "\n";
-        CloseHandle(hSerial); // Close handle if setting timeouts fails
-        return false;
-    }
-
-    // std::cout << "Serial port initialized successfully.\n";
-    return true; // Return true if serial port is initialized successfully
-}
-
-bool setup_reader_serial(bool *passwordProtected) {
-  // Find the NFC Device's serial port
-  NFCDevicePort = findNFCDevice();
-  if (NFCDevicePort.empty()) {
-    // std::cerr << "NFC Device not found\n";
-    return true; // Exit if NFC Device not found
+  // Find the NFC Device's serial port, already open for communication, or
+  // initialize the one given.
+  std::unique_ptr<SerialTransport> transport;
+  if (portName.empty()) {
+    transport = discoverDevice(&NFCDevicePort);
+  } else {
+    NFCDevicePort = portName;
+    transport = openSerialPort(NFCDevicePort);
   }
-
-  // std::cout << "NFC Device found on port: " << NFCDevicePort << std::endl;
-
-  // Initialize the serial port for communication
-  if (!initializeSerialPort(hSerial, NFCDevicePort.c_str())) {
+  if (!transport) {
     // std::cerr << "Failed to initialize the NFC Device port\n";
     return true; // Exit if initialization fails
   }
+  port.reset(new BufferedSerialTransport(std::move(transport)));
+  responses.clear();
 
   // Send a character to start operations within the board and wait for the card
   // to be present.
@@ -146,42 +283,19 @@ bool setup_reader_serial(bool *passwordProtected) {
 
   // Send 'a' code to tell the device to check password protection.
   char AdminPasswordCode = 'a';
-  if (!WriteFile(hSerial, &AdminPasswordCode, 1, &bytesWritten, NULL)) {
+  if (!writeToPort(&AdminPasswordCode, 1)) {
     // std::cerr << "Failed to send AdminPasswordCode\n";
-    CloseHandle(hSerial);
+    port.reset();
     return true;
   }
 
-  auto start_time = std::chrono::steady_clock::now();
-  auto timeout_duration = std::chrono::seconds(TIMEOUT_SECONDS);
-
   //  Read until the device returns passwordProtected value.
-  line.clear();
-  found = false;
-  while (!found) {
-    if (std::chrono::steady_clock::now() - start_time > timeout_duration) {
-      // std::cerr << "Operation timed out waiting for: " << "passwordProtectd=" << std::endl;
-      return false;
-    }
-    if (ReadFile(hSerial, readBuff, sizeof(readBuff) - 1, &bytesRead, NULL) &&
-        bytesRead != 0) {
-      readBuff[bytesRead] = '\0'; // Null terminate the string
-      line += readBuff;
-      size_t pos = line.find("passwordProtected=");
-      if (pos != std::string::npos) {
-        // std::cout << "Found password protection value" << std::endl;
-        size_t endLine = line.find('\r', pos);
-        if (endLine != std::string::npos) {
-          std::string value = line.substr(pos + 18, endLine - (pos + 18));
-          *passwordProtected = (value == "true");
-          // std::cout << "protected:" << *passwordProtected << std::endl;
-          found = true; // Stop reading after this to choose key retrieving
-                        // operation.
-        }
-      }
-    }
+  std::string value;
+  if (!waitForResponse(Response::PasswordProtected, &value)) {
+    // std::cerr << "Operation timed out waiting for: " << "passwordProtectd=" << std::endl;
+    return false;
   }
-
+  *passwordProtected = (value == "true");
   return false;
 }
 
@@ -193,48 +307,28 @@ bool create_admin_password(char *password) {
 
   // Send a character to set admin password operation.
   char CreateAdminPasswordCode = 'b';
-  if (!WriteFile(hSerial, &CreateAdminPasswordCode, 1, &bytesWritten, NULL)) {
+  if (!writeToPort(&CreateAdminPasswordCode, 1)) {
     // std::cerr << "Failed to send CreateAdminPasswordCode\n";
-    CloseHandle(hSerial);
+    port.reset();
     return true;
   }
 
-  Sleep(60);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
 
   // Send password.
-  if (!WriteFile(hSerial, password, 32, &bytesWritten, NULL)) {
+  if (!writeToPort(password, 32)) {
     // std::cerr << "Failed to send password\n";
-    CloseHandle(hSerial);
+    port.reset();
     return true;
   }
 
-  auto start_time = std::chrono::steady_clock::now();
-  auto timeout_duration = std::chrono::seconds(TIMEOUT_SECONDS);
   //  Read until the device returns password is created.
-  while (!found) {
-    if (std::chrono::steady_clock::now() - start_time > timeout_duration) {
-      // std::cerr << "Operation timed out waiting for: " << "passwordCreation=" << std::endl;
-      return false;
-    }
-    if (ReadFile(hSerial, readBuff, sizeof(readBuff) - 1, &bytesRead, NULL) &&
-        bytesRead != 0) {
-      readBuff[bytesRead] = '\0'; // Null terminate the string
-      line += readBuff;
-      size_t pos = line.find("passwordCreation=");
-      if (pos != std::string::npos) {
-        // std::cout << "Found password correct value" << std::endl;
-        size_t endLine = line.find('\r', pos);
-        if (endLine != std::string::npos) {
-          std::string value = line.substr(pos + 17, endLine - (pos + 17));
-          if (value == "true")
-            return true;
-          else
-            return false;
-        }
-      }
-    }
+  std::string value;
+  if (!waitForResponse(Response::PasswordCreation, &value)) {
+    // std::cerr << "Operation timed out waiting for: " << "passwordCreation=" << std::endl;
+    return false;
   }
-  return false;
+  return value == "true";
 }
 
 bool admin_password_verification(char *password) {
@@ -245,53 +339,28 @@ bool admin_password_verification(char *password) {
 
   // Send a character to set admin password operation.
   char AdminPasswordVerifCode = 'c';
-  if (!WriteFile(hSerial, &AdminPasswordVerifCode, 1, &bytesWritten, NULL)) {
+  if (!writeToPort(&AdminPasswordVerifCode, 1)) {
     // std::cerr << "Failed to send AdminPasswordVerifCode\n";
-    CloseHandle(hSerial);
+    port.reset();
     return true;
   }
 
-  Sleep(60);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
 
   // Send password.
-  if (!WriteFile(hSerial, password, 32, &bytesWritten, NULL)) {
+  if (!writeToPort(password, 32)) {
     // std::cerr << "Failed to send password\n";
-    CloseHandle(hSerial);
+    port.reset();
     return true;
   }
 
-  line.clear();
-  found = false;
-  auto start_time = std::chrono::steady_clock::now();
-  auto timeout_duration = std::chrono::seconds(TIMEOUT_SECONDS);
-  //  Read until the device returns password is created.
-  while (!found) {
-    if (std::chrono::steady_clock::now() - start_time > timeout_duration) {
-      // std::cerr << "Operation timed out waiting for: " << "passwordCorrect=" << std::endl;
-      return false;
-    }
-
-    if (ReadFile(hSerial, readBuff, sizeof(readBuff) - 1, &bytesRead, NULL) &&
-        bytesRead != 0) {
-      readBuff[bytesRead] = '\0'; // Null terminate the string
-      line += readBuff;
-     // std::cout << line << std::endl;
-      size_t pos = line.find("passwordCorrect=");
-      if (pos != std::string::npos) {
-        // std::cout << "Found password correct value" << std::endl;
-        size_t endLine = line.find('\r', pos);
-        if (endLine != std::string::npos) {
-          std::string value = line.substr(pos + 16, endLine - (pos + 16));
-          // std::cout << line.substr(pos, endLine - pos) << std::endl;
-          if (value == "true")
-            return false;
-          else
-            return true;
-        }
-      }
-    }
+  //  Read until the device tells whether the password is correct.
+  std::string value;
+  if (!waitForResponse(Response::PasswordCorrect, &value)) {
+    // std::cerr << "Operation timed out waiting for: " << "passwordCorrect=" << std::endl;
+    return false;
   }
-  return false;
+  return value != "true";
 }
 
 bool keyRecovery(std::string *key1, std::string *key2) {
@@ -302,170 +371,188 @@ bool keyRecovery(std::string *key1, std::string *key2) {
 
   // Send a character to set admin password operation.
   char keyRecoveryEEPROMnfcCode = 'd';
-  if (!WriteFile(hSerial, &keyRecoveryEEPROMnfcCode, 1, &bytesWritten, NULL)) {
+  if (!writeToPort(&keyRecoveryEEPROMnfcCode, 1)) {
     // std::cerr << "Failed to send keyRecoveryEEPROMnfcCode\n";
-    CloseHandle(hSerial);
+    port.reset();
     return true;
   }
 
-  Sleep(60);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
 
-  line.clear();
-  found = false;
-  auto start_time = std::chrono::steady_clock::now();
-  auto timeout_duration = std::chrono::seconds(TIMEOUT_SECONDS);
-  //  Read until the device returns password is created.
-  while (!found) {
-    if (std::chrono::steady_clock::now() - start_time > timeout_duration) {
-      // std::cerr << "Operation timed out waiting for: " << "DualCards=" << std::endl;
-      return false;
-    }
-
-    if (ReadFile(hSerial, readBuff, sizeof(readBuff) - 1, &bytesRead, NULL) &&
-        bytesRead != 0) {
-      readBuff[bytesRead] = '\0'; // Null terminate the string
-      line += readBuff;
-      // std::cout << line << std::endl;
-      size_t pos = line.find("DualCards=");
-      if (pos != std::string::npos) {
-        // std::cout << "Found keys" << std::endl;
-        size_t endLine = line.find('\r', pos);
-        if (endLine != std::string::npos) {
-          std::string value = line.substr(pos + 10, endLine - (pos + 10));
-          if (value == "true")
-            dualCards = true;
-          else
-            dualCards = false;
-          found = true;
-        }
-      }
-    }
+  //  Read until the device tells whether the key is split over two cards.
+  std::string value;
+  if (!waitForResponse(Response::DualCards, &value)) {
+    // std::cerr << "Operation timed out waiting for: " << "DualCards=" << std::endl;
+    return false;
   }
-  int secondCardPlaced;
+  dualCards = (value == "true");
   // std::cout << "dualcards:" << dualCards << std::endl;
-  if (dualCards) {
-    secondCardPlaced = MessageBox(NULL,
-                                  "Dual cards detected.\n\rPlace the second "
-                                  "card on reader and click ok.",
-                                  "", MB_OK);
-
-    while (secondCardPlaced != IDOK)
-      ;
-  }
+  if (dualCards)
+    userPrompt("Dual cards detected.\n\rPlace the second card on reader and click ok.", "");
 
   char continueProcessCode = '~';
-  if (!WriteFile(hSerial, &continueProcessCode, 1, &bytesWritten, NULL)) {
+  if (!writeToPort(&continueProcessCode, 1)) {
     // std::cerr << "Failed to send continueProcessCode\n";
-    CloseHandle(hSerial);
+    port.reset();
     return true;
   }
-  line.clear();
-  found = false;
-  start_time = std::chrono::steady_clock::now();
-  timeout_duration = std::chrono::seconds(TIMEOUT_SECONDS);
   //  Read until the device returns the received keys
-  while (!found) {
-    if (std::chrono::steady_clock::now() - start_time > timeout_duration) {
-      // std::cerr << "Operation timed out waiting for: " << "Key segments: " << std::endl;
-      return false;
-    }
-    if (ReadFile(hSerial, readBuff, sizeof(readBuff) - 1, &bytesRead, NULL) &&
-        bytesRead != 0) {
-      readBuff[bytesRead] = '\0'; // Null terminate the string
-      line += readBuff;
-      // std::cout << line << std::endl;
-      size_t pos = line.find("Key segments: ");
-      if (pos != std::string::npos) {
-        // std::cout << "Found keys" << std::endl;
-        size_t endLine = line.find('\r', pos);
-        if (endLine != std::string::npos) {
-          *key1 = line.substr(pos + 14, 32);
-          *key2 = line.substr(pos + 46, 32);
-          // std::cout << "key1:" << *key1 << std::endl;
-          // std::cout << "key2:" << *key2 << std::endl;
-          found = true;
-        }
-      }
-    }
+  if (!waitForResponse(Response::KeySegments, &value)) {
+    // std::cerr << "Operation timed out waiting for: " << "Key segments: " << std::endl;
+    return false;
   }
+  *key1 = value.substr(0, KEY_LENGTH);
+  *key2 = value.substr(KEY_LENGTH, KEY_LENGTH);
+  secureZero(&value[0], value.size());
+  // std::cout << "key1:" << *key1 << std::endl;
+  // std::cout << "key2:" << *key2 << std::endl;
   return false;
 }
 
 bool writeKeys(char *key1, char *key2, char dualCards) {
   start();
 
-  if (!writeToFileHandle(&WRITE_KEYS_CODE, 1)) {
+  if (!writeToPort(&WRITE_KEYS_CODE, 1)) {
     // std::cerr << "Failed to send writeKeysCode\n";
-    CloseHandle(hSerial);
+    port.reset();
     return true;
   }
 
-  Sleep(60);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
 
-  if (!writeToFileHandle(&dualCards, 1)) {
+  if (!writeToPort(&dualCards, 1)) {
     // std::cerr << "Failed to send dual card flag\n";
     return true;
   }
 
-  if (!writeToFileHandle(key1, KEY_LENGTH) ||
-      !writeToFileHandle(key2, KEY_LENGTH)) {
+  if (!writeToPort(key1, KEY_LENGTH) || !writeToPort(key2, KEY_LENGTH)) {
     // std::cerr << "Failed to send keys\n";
-    CloseHandle(hSerial);
+    port.reset();
     return true;
   }
 
-  if (!waitForMessage("First card written."))
+  if (!waitForResponse(Response::FirstCardWritten))
     return true;
 
   if (dualCards == '1') {
-    MessageBox(NULL, "Place the second card on reader and click OK.", "",
-               MB_OK);
-    if (!writeToFileHandle(&CONTINUE_PROCESS_CODE, 1)) {
+    userPrompt("Place the second card on reader and click OK.", "");
+    if (!writeToPort(&CONTINUE_PROCESS_CODE, 1)) {
       // std::cerr << "Failed to send continueProcessCode\n";
-      CloseHandle(hSerial);
+      port.reset();
       return true;
     }
-    waitForMessage("Second card written.");
-    MessageBox(NULL, "Both cards written", "Successful", MB_OK);
+    waitForResponse(Response::SecondCardWritten);
+    userPrompt("Both cards written", "Successful");
   } else {
-    waitForMessage("EEPROM written.");
-    MessageBox(NULL, "Card and EEPROM written", "Successful", MB_OK);
+    waitForResponse(Response::EepromWritten);
+    userPrompt("Card and EEPROM written", "Successful");
   }
 
   return false;
 }
 
-bool waitForMessage(const std::string &expectedMessage) {
-  std::string line;
-  char readBuff[256];
-  DWORD bytesRead;
+/**
+ * Queues a key job on the device, before or during batch enrollment. No card
+ * is needed, the job is written to the next cards tapped in batch mode.
+ *
+ * @return bool Returns true if the job could not be queued (queue full, not
+ * authenticated), false if successful.
+ */
+bool batchEnqueue(char *key1, char *key2, char dualCards, int *jobId) {
+  char job[2 + 2 * KEY_LENGTH];
+  job[0] = BATCH_JOB_CODE;
+  job[1] = dualCards;
+  memcpy(job + 2, key1, KEY_LENGTH);
+  memcpy(job + 2 + KEY_LENGTH, key2, KEY_LENGTH);
+  bool written = writeToPort(job, sizeof(job));
+  secureZero(job, sizeof(job));
+  if (!written)
+    return true;
+
+  std::string value;
+  if (!waitForResponse(Response::BatchJob, &value) || value == "full")
+    return true;
+  return !parseNumber(value.substr(0, value.find(',')), jobId); // "<id>,queued=<jobs>"
+}
+
+/**
+ * Starts batch enrollment: the device writes every new card tapped from its
+ * queue and reports each one, see batchPollResult().
+ *
+ * @return bool Returns true if batch mode could not be started.
+ */
+bool batchStart() {
+  responses.clear();
+  std::string value;
+  return !writeToPort(&BATCH_START_CODE, 1) ||
+         !waitForResponse(Response::Batch, &value) || value.compare(0, 2, "on") != 0;
+}
+
+/**
+ * Ends batch enrollment. The jobs not written stay queued.
+ *
+ * @return bool Returns true if the device did not confirm.
+ */
+bool batchEnd() {
+  std::string value;
+  return !writeToPort(&BATCH_END_CODE, 1) ||
+         !waitForResponse(Response::Batch, &value) || value.compare(0, 3, "off") != 0;
+}
+
+/**
+ * Reads what the device has sent and returns the next card result, without
+ * waiting for one longer than the port's read timeout.
+ *
+ * @return bool Returns true if a card result has been received, false if none
+ * has or if it could not be parsed.
+ */
+bool batchPollResult(BatchCardResult *result) {
+  readResponses();
+  std::string value;
+  if (!responses.take(Response::BatchCard, &value))
+    return false;
+
+  // "<uid>,job=<id>,card=<n>,slot=<slot>,status=<status>"
+  *result = BatchCardResult{ value.substr(0, value.find(',')), 0, 0, 0, "" };
+  size_t pos = value.find(',');
+  while (pos != std::string::npos) {
+    size_t next = value.find(',', pos + 1);
+    std::string field = value.substr(pos + 1, next == std::string::npos ? std::string::npos : next - pos - 1);
+    size_t equal = field.find('=');
+    std::string name = field.substr(0, equal);
+    std::string fieldValue = equal == std::string::npos ? "" : field.substr(equal + 1);
+    if ((name == "job" && !parseNumber(fieldValue, &result->job)) ||
+        (name == "card" && !parseNumber(fieldValue, &result->card)) ||
+        (name == "slot" && !parseNumber(fieldValue, &result->slot)))
+      return false;
+    if (name == "status")
+      result->status = fieldValue;
+    pos = next;
+  }
+  return true;
+}
+
+/**
+ * Reads until a response of the type has been received, or has already been.
+ *
+ * @param value Receives its value, may be nullptr for messages.
+ * @return bool Returns true if the response was received in time.
+ */
+static bool waitForResponse(Response type, std::string *value) {
   auto start_time = std::chrono::steady_clock::now();
   auto timeout_duration = std::chrono::seconds(TIMEOUT_SECONDS);
-
-  while (true) {
+  while (!responses.take(type, value)) {
     if (std::chrono::steady_clock::now() - start_time > timeout_duration) {
-      // std::cerr << "Operation timed out waiting for: " << expectedMessage  << std::endl;
+      // std::cerr << "Operation timed out waiting for a response" << std::endl;
       return false;
     }
-
-    if (ReadFile(hSerial, readBuff, sizeof(readBuff) - 1, &bytesRead, NULL) &&
-        bytesRead != 0) {
-      readBuff[bytesRead] = '\0';
-      line += readBuff;
-      // std::cout << line << std::endl;
-      size_t pos = line.find(expectedMessage);
-      if (pos != std::string::npos) {
-        // std::cout << "Message received: " << expectedMessage << std::endl;
-        return true;
-      }
-    }
+    readResponses();
   }
+  return true;
 }
 
-bool writeToFileHandle(const char *buffer, DWORD bufferSize) {
-  DWORD bytesWritten;
-  return WriteFile(hSerial, buffer, bufferSize, &bytesWritten, NULL) &&
-         bytesWritten == bufferSize;
+bool writeToPort(const char *buffer, size_t bufferSize) {
+  return port && port->write(buffer, bufferSize);
 }
 //  line.clear();
 //   found = false;
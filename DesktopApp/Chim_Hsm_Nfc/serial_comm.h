@@ -4,14 +4,61 @@
 #include <iostream>
 #include <ostream>
 #include <string>
-#include <windows.h>
 
+#include "serial_transport.h"
 
-// Serial communication prototypes
-bool initializeSerialPort(HANDLE &hSerial, const char *portName);
-bool setup_reader_serial(bool *passwordProtected);
+
+// Serial communication prototypes. The device is reached through a
+// SerialTransport, so they also run on Linux against the firmware's host build.
+
+/**
+ * Connects to the device and asks whether it is password protected.
+ *
+ * @param portName The port to use, found by findNFCDevice() if empty.
+ * @return bool Returns true if the device could not be reached.
+ */
+bool setup_reader_serial(bool *passwordProtected,
+                         const std::string &portName = std::string());
+
+/**
+ * Finds the port of the device: the one it was last found on if it still
+ * answers, else the first of listSerialPorts() to answer the status query,
+ * probed in parallel. The port found is cached for the next start.
+ *
+ * @return The port name, empty if the device was not found.
+ */
 std::string findNFCDevice();
+
+/**
+ * @return The link to the device opened by setup_reader_serial(), nullptr
+ * before. For the PN532 bridge, which runs on the same port.
+ */
+SerialTransport *readerTransport();
+
+/**
+ * Shows a message and waits for the user, before the second card of a pair.
+ */
+typedef void (*UserPrompt)(const char *text, const char *caption);
+
+/**
+ * Replaces the prompt, a message box on Windows and a line on stderr elsewhere.
+ */
+void setUserPrompt(UserPrompt prompt);
+
 bool create_admin_password(char *password);
 bool admin_password_verification(char *password);
 bool keyRecovery(std::string *key1, std::string *key2);
 bool writeKeys(char *key1, char *key2, char dualCards);
+
+// Batch enrollment: key jobs queued on the device, written to the cards as they are tapped.
+struct BatchCardResult {
+  std::string uid;    // UID of the card, in hex.
+  int job;            // Job written, 0 if the queue was empty.
+  int card;           // 1, or 2 for the second card of a dual pair.
+  int slot;           // Key store slot of a single card.
+  std::string status; // ok, first, failed, storeFull, storeFailed or empty.
+};
+bool batchEnqueue(char *key1, char *key2, char dualCards, int *jobId);
+bool batchStart();
+bool batchEnd();
+bool batchPollResult(BatchCardResult *result);
@@ -0,0 +1,350 @@
+#include "serial_transport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#include <devguid.h>
+#include <setupapi.h>
+#else
+#include <cerrno>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+const int READ_TIMEOUT_MS = 50;
+
+size_t ByteRing::push(const char *bytes, size_t length) {
+  size_t first = head.load(std::memory_order_relaxed);
+  size_t count = std::min(length, CAPACITY - (first - tail.load(std::memory_order_acquire)));
+  size_t offset = first & (CAPACITY - 1);
+  size_t chunk = std::min(count, CAPACITY - offset);
+  memcpy(buffer + offset, bytes, chunk);
+  memcpy(buffer, bytes + chunk, count - chunk);
+  head.store(first + count, std::memory_order_release);
+  return count;
+}
+
+size_t ByteRing::pop(char *bytes, size_t size) {
+  size_t first = tail.load(std::memory_order_relaxed);
+  size_t count = std::min(size, head.load(std::memory_order_acquire) - first);
+  size_t offset = first & (CAPACITY - 1);
+  size_t chunk = std::min(count, CAPACITY - offset);
+  memcpy(bytes, buffer + offset, chunk);
+  memcpy(bytes + chunk, buffer, count - chunk);
+  memset(buffer + offset, 0, chunk);
+  memset(buffer, 0, count - chunk);
+  tail.store(first + count, std::memory_order_release);
+  return count;
+}
+
+BufferedSerialTransport::BufferedSerialTransport(
+    std::unique_ptr<SerialTransport> source)
+    : source(std::move(source)) {
+  reader = std::thread(&BufferedSerialTransport::run, this);
+}
+
+BufferedSerialTransport::~BufferedSerialTransport() {
+  stopping = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+  }
+  drained.notify_one();
+  reader.join(); // Within one read timeout.
+}
+
+bool BufferedSerialTransport::write(const void *buffer, size_t length) {
+  return source->write(buffer, length);
+}
+
+size_t BufferedSerialTransport::read(void *buffer, size_t size) {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    received.wait_for(lock, std::chrono::milliseconds(READ_TIMEOUT_MS),
+                      [this] { return !ring.empty(); });
+  }
+  size_t count = ring.pop(static_cast<char *>(buffer), size);
+  if (count) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+    }
+    drained.notify_one();
+  }
+  return count;
+}
+
+void BufferedSerialTransport::run() {
+  char chunk[256];
+  while (!stopping) {
+    size_t length = source->read(chunk, sizeof(chunk));
+    size_t pushed = 0;
+    while (pushed < length && !stopping) {
+      pushed += ring.push(chunk + pushed, length - pushed);
+      // Taking the lock orders the push before a reader's check of the ring.
+      std::unique_lock<std::mutex> lock(mutex);
+      received.notify_one();
+      if (pushed < length) // Full: the protocol code is behind.
+        drained.wait(lock, [this] { return stopping || !ring.full(); });
+    }
+    memset(chunk, 0, length);
+  }
+}
+
+#ifdef _WIN32
+
+Win32SerialTransport::Win32SerialTransport(HANDLE handle)
+    : handle(handle), readEvent(CreateEvent(NULL, TRUE, FALSE, NULL)),
+      writeEvent(CreateEvent(NULL, TRUE, FALSE, NULL)) {}
+
+Win32SerialTransport::~Win32SerialTransport() {
+  CancelIo(handle);
+  CloseHandle(handle);
+  CloseHandle(readEvent);
+  CloseHandle(writeEvent);
+}
+
+/**
+ * Waits for an overlapped operation, whether it completed at once or is
+ * pending.
+ *
+ * @return bool Returns true if it succeeded.
+ */
+static bool completeIo(HANDLE handle, OVERLAPPED *io, BOOL started,
+                       DWORD *transferred) {
+  if (!started && GetLastError() != ERROR_IO_PENDING)
+    return false;
+  return GetOverlappedResult(handle, io, transferred, TRUE) != 0;
+}
+
+bool Win32SerialTransport::write(const void *buffer, size_t length) {
+  OVERLAPPED io = {0};
+  io.hEvent = writeEvent;
+  DWORD bytesWritten = 0;
+  BOOL started = WriteFile(handle, buffer, (DWORD)length, NULL, &io);
+  return completeIo(handle, &io, started, &bytesWritten) &&
+         bytesWritten == length;
+}
+
+size_t Win32SerialTransport::read(void *buffer, size_t size) {
+  OVERLAPPED io = {0};
+  io.hEvent = readEvent;
+  DWORD bytesRead = 0;
+  // Completes on the first bytes received, or after the read timeout.
+  BOOL started = ReadFile(handle, buffer, (DWORD)size, NULL, &io);
+  if (!completeIo(handle, &io, started, &bytesRead))
+    return 0;
+  return bytesRead;
+}
+
+std::unique_ptr<SerialTransport> openSerialPort(const std::string &portName) {
+  HANDLE hSerial = CreateFile(portName.c_str(),             // Port name
+                              GENERIC_READ | GENERIC_WRITE, // Read/Write access
+                              0,                            // No sharing
+                              NULL,          // No security attributes
+                              OPEN_EXISTING, // Opens an existing device
+                              FILE_FLAG_OVERLAPPED, // Concurrent read and write
+                              NULL);         // No template file
+  if (hSerial == INVALID_HANDLE_VALUE)
+    return nullptr;
+
+  DCB dcbSerialParams = {0}; // Initializing DCB structure
+  dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
+  if (!GetCommState(hSerial, &dcbSerialParams)) {
+    CloseHandle(hSerial);
+    return nullptr;
+  }
+  dcbSerialParams.BaudRate = CBR_9600;   // Set baud rate to 9600
+  dcbSerialParams.ByteSize = 8;          // 8 bit data
+  dcbSerialParams.StopBits = ONESTOPBIT; // One stop bit
+  dcbSerialParams.Parity = NOPARITY;     // No parity bit
+  if (!SetCommState(hSerial, &dcbSerialParams)) {
+    CloseHandle(hSerial);
+    return nullptr;
+  }
+
+  // Reads return the bytes already received at once, else wait up to the
+  // read timeout for the first one.
+  COMMTIMEOUTS timeouts = {0};
+  timeouts.ReadIntervalTimeout = MAXDWORD;
+  timeouts.ReadTotalTimeoutConstant = READ_TIMEOUT_MS;
+  timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+  timeouts.WriteTotalTimeoutConstant = 50;  // 50 ms
+  timeouts.WriteTotalTimeoutMultiplier = 10; // 10 ms per byte
+  if (!SetCommTimeouts(hSerial, &timeouts)) {
+    CloseHandle(hSerial);
+    return nullptr;
+  }
+  return std::unique_ptr<SerialTransport>(new Win32SerialTransport(hSerial));
+}
+
+/**
+ * Reads the hexadecimal number following tag in a hardware ID such as
+ * "USB\\VID_2341&PID_8036&REV_0100&MI_00".
+ */
+static uint16_t hardwareIdField(const char *hardwareId, const char *tag) {
+  const char *field = strstr(hardwareId, tag);
+  return field ? (uint16_t)strtoul(field + strlen(tag), NULL, 16) : 0;
+}
+
+std::vector<SerialPortInfo> listSerialPorts() {
+  std::vector<SerialPortInfo> ports;
+  HDEVINFO devices =
+      SetupDiGetClassDevs(&GUID_DEVCLASS_PORTS, NULL, NULL, DIGCF_PRESENT);
+  if (devices == INVALID_HANDLE_VALUE)
+    return ports;
+  SP_DEVINFO_DATA device = {sizeof(SP_DEVINFO_DATA)};
+  for (DWORD i = 0; SetupDiEnumDeviceInfo(devices, i, &device); i++) {
+    HKEY key = SetupDiOpenDevRegKey(devices, &device, DICS_FLAG_GLOBAL, 0,
+                                    DIREG_DEV, KEY_READ);
+    if (key == INVALID_HANDLE_VALUE)
+      continue;
+    char portName[32] = {0};
+    DWORD size = sizeof(portName) - 1;
+    DWORD type;
+    LONG status = RegQueryValueEx(key, "PortName", NULL, &type,
+                                  (LPBYTE)portName, &size);
+    RegCloseKey(key);
+    if (status != ERROR_SUCCESS || type != REG_SZ ||
+        strncmp(portName, "COM", 3) != 0)
+      continue; // LPT ports share the class.
+
+    SerialPortInfo port = {"\\\\.\\" + std::string(portName), 0, 0};
+    char hardwareId[256] = {0}; // A list of strings, the first is the most specific.
+    if (SetupDiGetDeviceRegistryProperty(devices, &device, SPDRP_HARDWAREID,
+                                         NULL, (PBYTE)hardwareId,
+                                         sizeof(hardwareId) - 2, NULL)) {
+      port.vendorId = hardwareIdField(hardwareId, "VID_");
+      port.productId = hardwareIdField(hardwareId, "PID_");
+    }
+    ports.push_back(port);
+  }
+  SetupDiDestroyDeviceInfoList(devices);
+  return ports;
+}
+
+#else
+
+PosixSerialTransport::~PosixSerialTransport() { close(fd); }
+
+bool PosixSerialTransport::write(const void *buffer, size_t length) {
+  const char *bytes = static_cast<const char *>(buffer);
+  while (length) {
+    ssize_t written = ::write(fd, bytes, length);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        return false;
+      struct pollfd out = {fd, POLLOUT, 0};
+      poll(&out, 1, READ_TIMEOUT_MS); // The tty's output queue is full.
+      continue;
+    }
+    bytes += written;
+    length -= written;
+  }
+  return true;
+}
+
+size_t PosixSerialTransport::read(void *buffer, size_t size) {
+  struct pollfd in = {fd, POLLIN, 0};
+  int ready = poll(&in, 1, READ_TIMEOUT_MS);
+  if (ready <= 0)
+    return 0;
+  if (!(in.revents & POLLIN)) {
+    // Hung up: wait all the same, the reader thread would spin otherwise.
+    std::this_thread::sleep_for(std::chrono::milliseconds(READ_TIMEOUT_MS));
+    return 0;
+  }
+  ssize_t bytesRead = ::read(fd, buffer, size);
+  return bytesRead > 0 ? bytesRead : 0;
+}
+
+std::unique_ptr<SerialTransport> openSerialPort(const std::string &portName) {
+  int fd = open(portName.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+  // No sharing, like the Win32 ports.
+  struct termios tty;
+  if (ioctl(fd, TIOCEXCL) != 0 || tcgetattr(fd, &tty) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  cfmakeraw(&tty); // 8 bit data, no parity, no echo nor line editing.
+  tty.c_cflag |= CLOCAL | CREAD;
+  tty.c_cflag &= ~(CSTOPB | CRTSCTS); // One stop bit, no flow control.
+  tty.c_cc[VMIN] = 0;
+  tty.c_cc[VTIME] = 0; // The read timeout is poll()'s.
+  cfsetispeed(&tty, B9600);
+  cfsetospeed(&tty, B9600);
+  if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<SerialTransport>(new PosixSerialTransport(fd));
+}
+
+/**
+ * Reads a hexadecimal sysfs attribute.
+ *
+ * @return The value, 0 if the file cannot be read.
+ */
+static uint16_t sysfsHex(const std::string &path) {
+  std::ifstream file(path);
+  unsigned int value = 0;
+  file >> std::hex >> value;
+  return file ? value : 0;
+}
+
+std::vector<SerialPortInfo> listSerialPorts() {
+  std::vector<SerialPortInfo> ports;
+  bool sysfs = false;
+  if (DIR *dir = opendir("/sys/class/tty")) {
+    sysfs = true;
+    while (struct dirent *entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.compare(0, 6, "ttyACM") != 0 &&
+          name.compare(0, 6, "ttyUSB") != 0)
+        continue;
+      SerialPortInfo port = {"/dev/" + name, 0, 0};
+      // The tty's device is the USB interface, or a serial converter below
+      // it: the USB device holding the identity is a few levels up.
+      char *resolved = realpath(("/sys/class/tty/" + name + "/device").c_str(), NULL);
+      std::string device = resolved ? resolved : "";
+      free(resolved);
+      for (int level = 0; level < 4 && !device.empty(); level++) {
+        device = device.substr(0, device.rfind('/'));
+        if (access((device + "/idVendor").c_str(), R_OK) == 0) {
+          port.vendorId = sysfsHex(device + "/idVendor");
+          port.productId = sysfsHex(device + "/idProduct");
+          break;
+        }
+      }
+      ports.push_back(port);
+    }
+    closedir(dir);
+  }
+  if (!sysfs) {
+    if (DIR *dir = opendir("/dev")) {
+      while (struct dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.compare(0, 11, "cu.usbmodem") == 0)
+          ports.push_back({"/dev/" + name, 0, 0});
+      }
+      closedir(dir);
+    }
+  }
+  std::sort(ports.begin(), ports.end(),
+            [](const SerialPortInfo &a, const SerialPortInfo &b) {
+              return a.name < b.name;
+            });
+  return ports;
+}
+
+#endif
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Byte link to the device, so the protocol of serial_comm.cpp and the bridge
+// run on top of any serial port: the Win32 COM ports of the app, or a POSIX
+// tty, including the pseudo terminal the firmware's host build serves
+// (Embedded/host, --pty), where the protocol can be run and timed on Linux.
+class SerialTransport {
+public:
+  virtual ~SerialTransport() {}
+
+  /**
+   * Writes all the bytes.
+   *
+   * @return bool Returns true if they have all been written.
+   */
+  virtual bool write(const void *buffer, size_t length) = 0;
+
+  /**
+   * Reads the bytes received, waiting up to the read timeout (50 ms) for the
+   * first one.
+   *
+   * @return size_t The number of bytes read, 0 on timeout or error.
+   */
+  virtual size_t read(void *buffer, size_t size) = 0;
+};
+
+#ifdef _WIN32
+// A COM port opened for overlapped I/O, so that a read pending on the reader
+// thread does not hold back the writes of the protocol code.
+class Win32SerialTransport : public SerialTransport {
+public:
+  explicit Win32SerialTransport(HANDLE handle);
+  ~Win32SerialTransport() override;
+
+  bool write(const void *buffer, size_t length) override;
+  size_t read(void *buffer, size_t size) override;
+
+private:
+  HANDLE handle;
+  HANDLE readEvent;
+  HANDLE writeEvent;
+};
+#else
+class PosixSerialTransport : public SerialTransport {
+public:
+  explicit PosixSerialTransport(int fd) : fd(fd) {}
+  ~PosixSerialTransport() override;
+
+  bool write(const void *buffer, size_t length) override;
+  size_t read(void *buffer, size_t size) override;
+
+private:
+  int fd;
+};
+#endif
+
+// Bytes passed from one producer thread to one consumer thread. Each index is
+// written by a single side, so no lock is needed.
+class ByteRing {
+public:
+  static const size_t CAPACITY = 4096; // A power of two.
+
+  /**
+   * Producer side: copies as many bytes as fit.
+   *
+   * @return size_t The number of bytes copied.
+   */
+  size_t push(const char *bytes, size_t length);
+
+  /**
+   * Consumer side: takes up to size bytes, zeroizing them in the ring since
+   * they may be keys.
+   *
+   * @return size_t The number of bytes taken.
+   */
+  size_t pop(char *bytes, size_t size);
+
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() == CAPACITY; }
+
+private:
+  size_t size() const {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+  }
+
+  char buffer[CAPACITY] = {0};
+  std::atomic<size_t> head{0}; // Free running, written by the producer.
+  std::atomic<size_t> tail{0}; // Free running, written by the consumer.
+};
+
+// Reads the device on a thread of its own as soon as bytes arrive, into a
+// ByteRing, while the protocol code is busy elsewhere. read() wakes up on the
+// bytes pushed instead of polling the port.
+class BufferedSerialTransport : public SerialTransport {
+public:
+  explicit BufferedSerialTransport(std::unique_ptr<SerialTransport> source);
+  ~BufferedSerialTransport() override;
+
+  bool write(const void *buffer, size_t length) override;
+  size_t read(void *buffer, size_t size) override;
+
+private:
+  void run();
+
+  std::unique_ptr<SerialTransport> source;
+  ByteRing ring;
+  std::mutex mutex; // Only guards the waits, not the ring.
+  std::condition_variable received;
+  std::condition_variable drained;
+  std::atomic<bool> stopping{false};
+  std::thread reader; // Last, started once the rest is built.
+};
+
+/**
+ * Opens a serial port at 9600 bauds, 8N1, with the platform's transport.
+ *
+ * @param portName "\\\\.\\COM<n>" on Windows, a device path such as
+ * /dev/ttyACM0 or /dev/pts/<n> elsewhere.
+ * @return The transport, nullptr if the port cannot be opened.
+ */
+std::unique_ptr<SerialTransport> openSerialPort(const std::string &portName);
+
+// A serial port present on the system.
+struct SerialPortInfo {
+  std::string name;   // As given to openSerialPort().
+  uint16_t vendorId;  // USB VID, 0 if unknown or not a USB device.
+  uint16_t productId; // USB PID.
+};
+
+/**
+ * Lists the serial ports present, without opening them: SetupAPI's ports
+ * class on Windows, the USB ttys of sysfs on Linux. Elsewhere, the USB modem
+ * devices of /dev, without their USB identity.
+ */
+std::vector<SerialPortInfo> listSerialPorts();
@@ -1,10 +1,38 @@
-bool nfc_begin(void);
-
+/**
+ * Makes one attempt at detecting an ISO14443A card, giving up after NFC_DETECT_RETRIES activation retries,
+ * or after NFC_DETECT_TIMEOUT_MS if the reader does not answer.
+ *
+ * @return true if a card has been found, its UID is then the target of the card operations.
+ */
+bool nfc_detect(void);
 
+/**
+ * Waits for an ISO14443A card, running the background tasks between the attempts.
+ */
 bool nfc_readPassiveTargetID();
 
+/**
+ * Checks whether the card on the reader has changed and sends "cardEvent=arrived,uid=<uid>" or
+ * "cardEvent=removed" if it has. A card already seen is checked with the Diagnose attention request test
+ * when it supports it, otherwise, or to confirm a removal, it is selected again.
+ */
+void presence_poll(void);
+
+
+/**
+ * Initializes the reader and checks its presence by retrieving its firmware version. Sends
+ * "reader=ready,chip=PN5<model>,firmware=<version>" once it answers.
+ *
+ * @return true if the reader is ready, false if it does not answer yet.
+ */
+bool nfc_chip_connect(void);
 
-void nfc_chip_connect(void);
+/**
+ * Checks that the reader still answers, restoring the settings it loses if it has been reseated.
+ *
+ * @return false if it no longer answers.
+ */
+bool nfc_chip_check(void);
 
 
 void print_card_info(void);
@@ -36,6 +64,31 @@ bool write_keys(void);
 
 
 
+/**
+ * Queues a batch enrollment job: reads the dual-card flag and the two key segments, like write_keys(), and
+ * answers "batchJob=<id>,queued=<jobs>", "batchJob=full" or "Authentication needed.".
+ */
+void batch_enqueue(void);
+
+/**
+ * Announces the start or end of batch enrollment with the number of jobs queued. The card on the
+ * reader at the start is written like a newly tapped one.
+ */
+void batch_mode(bool on);
+
+/**
+ * Polls the reader in batch enrollment. A card other than the last one handled is written from the job
+ * at the head of the queue, and its result sent as
+ * "batchCard=<uid>,job=<id>,card=<1|2>,slot=<slot>,status=<ok|first|failed|storeFull|storeFailed>",
+ * or "batchCard=<uid>,job=0,status=empty" when no job is queued. A failed card leaves its job queued.
+ */
+void batch_poll(void);
+
+/**
+ * Drops the queued jobs, zeroizing their keys.
+ */
+void batch_clear(void);
+
 /**
  * Checks if the device is password protected by examining a specific section of the EEPROM.
  * This function assumes that the admin password, if set, is stored within the first 32 blocks of the EEPROM.
@@ -54,10 +107,44 @@ bool create_admin_password(void);
 
 /**
  * Authenticates the user by comparing the input from the Serial monitor to the password stored in EEPROM.
- * The function reads each character from Serial and checks it against the corresponding EEPROM value.
+ * The function reads the 32 characters of the attempt from Serial, then compares all of them.
  */
 bool authentication(void);
 
+/**
+ * Runs iterations of each card, cipher and EEPROM primitive on the card present and sends their
+ * throughput and latency percentiles in one binary response. The byte following the request sets the
+ * number of iterations.
+ */
+void self_benchmark(void);
+
+/**
+ * Bridge mode: forwards the PN532 commands framed by the app to the reader and sends back their responses,
+ * so card algorithms can run on the host (see BRIDGE_COMMAND_SIZE for the framing). Answers
+ * "bridge=on,command=<largest command>,window=<bytes of commands that can be sent ahead>" first, and
+ * "bridge=off" once the app ends it or has been silent for BRIDGE_IDLE_MS.
+ */
+void pn532_bridge(void);
+
+/**
+ * Link test: measures the throughput, latency and error rate of the link to the PN532 with its
+ * communication line test, and runs its ROM and RAM self-tests (see LINK_VERSION for the request and the
+ * binary response). Tells a slow link from a slow card, which the self-benchmark measures.
+ */
+void link_test(void);
+
+/**
+ * Opens the admin session by expanding the segment key's AES schedule once for all the operations that follow.
+ *
+ * @return true if the cipher session is open.
+ */
+bool session_open(void);
+
+/**
+ * Closes the admin session and zeroizes the key schedule, on logout or inactivity timeout.
+ */
+void session_close(void);
+
 
 
 
@@ -14,11 +14,6 @@
  *
  *   - Implement an HID FIDO format within the device to facilitate the creation and management of identification keys.
  *
- * - Memory Management:
- *   - Develop an asynchronous method to monitor the SRAM usage percentage. This could help in managing memory
- *     efficiency and preventing overflow or memory exhaustion, which is particularly critical in embedded systems
- *     with limited memory resources.
- *
  * - User Input Validation:
  *   - Enforce character limits for each vCard field to ensure data integrity and prevent overflow. This should
  *     be implemented in the user input function where vCard details are entered:
@@ -61,6 +56,8 @@
  * Memory Map:
  *  - EEPROM: Used for storing input data and segmented keys.
  *  - Flash: Used for storing constants.
+ *  - SRAM: The 'm' request reports free SRAM, .data/.bss/heap sizes and the stack peak of each request,
+ *    measured by painting the free SRAM (see memory_stats.h). Use it instead of estimating by hand.
  *
  * Optimizations and Results:
  *  - Before optimization, the total RAM usage by various functions summed up to 86%. After optimization,
@@ -86,106 +83,397 @@
  */
 
 #include "Embedded.h"  // Include the header file that contains the NFC functionality.
+#include "key_store.h" // Key segments and admin password stored in EEPROM.
+#include "encryption.h" // AES backend selection and benchmark.
+#include "memory_stats.h" // SRAM telemetry.
+#include "profiling.h" // Latency probes.
+#include "logging.h" // Tokenized diagnostics.
+#include "scheduler.h" // Cooperative tasks of the main loop.
+#include "console.h" // Serial input received in the background.
+#include "arena.h" // Scratch buffers of the requests.
+
+// Admin session closed after this long without any request from the app.
+#define SESSION_TIMEOUT_MS 300000UL
+
+// Steps of the session task, one request after the other.
+#define SESSION_PROMPT 0    // Announce that the next request can be sent.
+#define SESSION_START 1     // Wait for the byte starting a request.
+#define SESSION_DETECT 2    // Wait for a card, the NFC task polls the reader.
+#define SESSION_MODE 3      // Wait for the mode byte, then run the request.
+#define SESSION_BATCH 4     // Batch enrollment: queue jobs, the NFC task writes the cards tapped.
+
+// Start bytes handled without waiting for a card. Any other byte starts a request.
+#define BATCH_JOB 'J'         // Followed by the dual-card flag and 64 key bytes, queued for the next cards.
+#define BATCH_START 'B'       // Writes every new card tapped from the queue, until BATCH_END.
+#define BATCH_END 'E'
+#define BRIDGE_START 'X'      // PN532 commands forwarded from the app until it ends the bridge.
+#define PRESENCE_CADENCE 'P'  // Followed by the presence check period in 10 ms units, 0 stops the checks.
+#define LINK_TEST 'L'         // Followed by the link test's iterations and payload sizes, see LINK_VERSION.
+#define STORE_FORMAT 'F'      // Erases the key store, the admin password with it.
+
+#define SESSION_COOLDOWN_MS 1000  // Pause after a request, allowing for operations to complete.
+#define SESSION_DETECT_MS 100     // Time between two detection attempts while waiting for a card.
+#define PRESENCE_UNIT_MS 10       // Unit of the presence check period.
+
+// The reader is initialized by the reader task, not by setup(), so USB answers at once. A missing reader
+// is retried with an exponential backoff, and a ready one checked between requests to notice a reseat.
+#define READER_RETRY_MIN_MS 50
+#define READER_RETRY_MAX_MS 2000
+#define READER_CHECK_MS 1000
 
 bool authenticated = false;
+unsigned long last_request = 0;  // millis() of the last request received, for the session timeout.
 
 uint8_t mode_chosen = 255;  // Global variable to store the key input by the user to select an operation mode.
 
+uint8_t session_step = SESSION_PROMPT;
+uint8_t session_task_id;
+uint8_t nfc_task_id;
+uint8_t presence_task_id;
+uint8_t reader_task_id;
+bool reader_ready = false;
+uint16_t reader_retry_ms = READER_RETRY_MIN_MS;  // Time before the next attempt while the reader is missing.
+bool reader_reported = false;                    // "reader=down" has been sent for the current outage.
 
-void setup() {
-  Serial.begin(9600);  // Initialize serial communication at 9600 bits per second.
-  delay(10);
-  while (!Serial) delay(10);  // Wait for the serial port to connect. Necessary for Arduino Leonardo, Micro, or Zero.
 
-  nfc_begin();  // Initialize the NFC module.
-
-  nfc_chip_connect();  // Connect to the NFC chip and verify its presence.
+/**
+ * Opens or closes the admin session. The cipher session holding the expanded key schedule follows it,
+ * so the schedule is only resident while the admin is logged in.
+ */
+void set_authenticated(bool state) {
+  if (state && !authenticated)
+    state = session_open();
+  else if (!state && authenticated)
+    session_close();
+  authenticated = state;
 }
 
-void loop() {
-  Serial.print(F("Start of the program.\n\r"));  // Prompt user to start the interaction.
+/**
+ * Drops the end of line a terminal sends after a request byte. Anything else stays for the request.
+ */
+static void skip_end_of_line(void) {
+  while (console_peek() == '\r' || console_peek() == '\n')
+    console_read();
+}
 
+/**
+ * Runs the request selected by mode_chosen.
+ */
+static void run_request(void) {
+  Console.print(F("Mode chosen: "));  // Display the chosen mode to the user for confirmation.
+  Console.println(mode_chosen);
 
-  while (!Serial.available()) {};            // Wait for any user input.
-  while (Serial.available()) Serial.read();  // Clear the Serial buffer to ensure no residual inputs affect the process.
+  memory_mark();  // Repaint the free SRAM to measure the stack peak of this request alone.
 
-  Serial.println(F("Place your card on the NFC reader ..."));  // Prompt to place the NFC card near the reader.
+  // Execute the operation based on the user's selection.
+  switch (mode_chosen) {
+    case '0':
+      if (authenticated) read_memory();
+      else Console.println(F("Authentication needed."));
+      break;  // Read the memory of the card.
+    case '1':
+      if (authenticated) format_MAD1();
+      else Console.println(F("Authentication needed."));
+      break;  // Format the card to MAD1.
+    case '2':
+      if (authenticated) format_to_default();
+      else Console.println(F("Authentication needed."));
+      break;  // Reset the card to default settings.
+    // case '3':
+    //   if (authenticated) write_ndef();
+    //   else Console.println(F("Authentication needed."));
+    //   break;  // Write an NDEF message to the card.
+    // case '4':
+    //   if (authenticated) write_vCard();
+    //   else Console.println(F("Authentication needed."));
+    //   break;  // Write a vCard to the card.
+    case '5':
+      if (authenticated) break;
+      // Falls through - without a session, '5' is answered like 'a'.
+    case 'a': is_password_protected(); break;  // Checks if the device is password protected
+    case 'b':
+      if (!authenticated) set_authenticated(create_admin_password());  // Create an admin password
+      else Console.println(F("Password already set."));
+      break;
+    case 'c': set_authenticated(authentication()); break;  // Compare the passwords
+    case 'd':
+      if (authenticated) recover_segments();  // Recover the segment keys from eeprom and nfc memory.
+      else Console.println(F("Authentication needed."));
+      break;
+    case 'e':
+      if (authenticated) write_keys();  // write keys to their correct location
+      break;
+#ifdef AES_BENCHMARK
+    case 'g': cipher_benchmark(); break;  // Cycles of each AES backend.
+#endif
+    case 'f':
+      set_authenticated(false);  // Log out and clear the session key schedule.
+      Console.println(F("loggedOut=true"));
+      break;
+    case 'm': memory_report(); break;  // SRAM usage and stack peaks.
+    case 'n':
+      if (authenticated) self_benchmark();  // Throughput and latency of the reader, card and device primitives.
+      else Console.println(F("Authentication needed."));
+      break;
+#ifdef PROFILING
+    case 'p': profile_report(); break;  // Latency of each phase since the last report.
+#endif
+    case 'v': reset_eeprom(); break;
+    case 'w': set_authenticated(auth()); break;
+    case 'x': set_one_key(); break;
+    case 'y': reset_admin_password(); break;
+    case 'z': print_eeprom(); break;
+    default: Console.println(F("Unsupported operation.")); break;  // Handle undefined operations.
+  }
+  memory_record(mode_chosen);
+  arena_reset();  // Zeroizes the buffers of the request, whichever way it returned.
+  Console.flush();  // Ensure all serial communications are completed.
+}
 
-  // Check for an NFC card of ISO14443A type (common types like Mifare Classic or Ultralight).
-  if (nfc_readPassiveTargetID()) {
+/**
+ * Presence task: between requests, tells the app when the card on the reader arrives or leaves, so it
+ * can lock the session as soon as the card is taken away. Stopped until the app asks for it, the events
+ * would otherwise come in the middle of the answers of apps that do not expect them.
+ */
+static void presence_task(void) {
+  if (reader_ready && session_step == SESSION_START && !console_available())
+    presence_poll();
+}
 
-    Serial.println(F("Found a card!"));  // Notify that a card has been detected.
-    if (authenticated) {
-      print_card_info();  // Prints the detected card's information.
+/**
+ * Reads the period of the presence checks and starts or stops them. Answers "presence=<ms>".
+ */
+static void set_presence_cadence(void) {
+  uint8_t units;
+  if (!console_read_bytes(&units, 1, 1000)) {
+    Console.println(F("Invalid input."));
+    return;
+  }
+  if (units) {
+    task_set_period(presence_task_id, units * PRESENCE_UNIT_MS);
+    task_start(presence_task_id);
+  } else {
+    task_stop(presence_task_id);
+  }
+  Console.print(F("presence="));
+  Console.println(units * PRESENCE_UNIT_MS);
+}
 
-      // Serial.println(F("Select the desired operation by entering the corresponding number:"));
-      // Serial.println(F("  • 0 - Read memory"));
-      // Serial.println(F("  • 1 - Format to NDEF"));
-      // Serial.println(F("  • 2 - Format to default"));
-      // Serial.println(F("  • 3 - Update NDEF"));
-      // Serial.println(F("  • 4 - Write vCard"));
-      // Serial.println(F("  • 10 - Is device password protected?"));
-    }
+/**
+ * Session task: the steps of a request, each returning while it waits for the app or for a card. Bytes
+ * received ahead of their step wait in the console, so the mode and its data can be sent along with the
+ * start byte, and the next request during the cooldown of the previous one.
+ */
+static void session_task(void) {
+  switch (session_step) {
+    case SESSION_PROMPT:
+      Console.print(F("Start of the program.\n\r"));  // Prompt user to start the interaction.
+      console_set_state(CONSOLE_IDLE, 0);
+      session_step = SESSION_START;
+      break;
 
+    case SESSION_START: {
+      if (!console_available())  // Wait for any user input.
+        break;
+      last_request = millis();
+      uint8_t start = console_read();
+      if (start == PRESENCE_CADENCE) {
+        set_presence_cadence();  // Before skipping the end of line, 10 is a valid period.
+        break;
+      }
+      if (start == LINK_TEST) {  // Its bytes can be 10 as well.
+        if (!reader_ready) {
+          Console.println(F("reader=down"));
+          break;
+        }
+        console_set_state(CONSOLE_BUSY, start);
+        link_test();
+        session_step = SESSION_PROMPT;
+        break;
+      }
+      skip_end_of_line();
 
-    while (!Serial.available()) {};  // Wait for user input to select an operation.
+      if (start == BATCH_JOB) {
+        batch_enqueue();  // Jobs can be queued before the batch starts.
+        break;
+      }
+      if (start == BRIDGE_START) {
+        if (!authenticated) {
+          Console.println(F("Authentication needed."));
+          break;
+        }
+        console_set_state(CONSOLE_BUSY, start);
+        pn532_bridge();
+        session_step = SESSION_PROMPT;
+        break;
+      }
+      if (start == STORE_FORMAT) {
+        // A store never formatted holds no password to log in with, the format is open then. Not for an
+        // EEPROM still in the old layout: it holds keys.
+        if (!authenticated && key_store_state() != KEY_STORE_UNFORMATTED) {
+          Console.println(F("Authentication needed."));
+          break;
+        }
+        Console.print(F("storeFormatted="));
+        Console.println(key_store_format() ? F("true") : F("false"));
+        set_authenticated(false);  // The password went with the store.
+        break;
+      }
+      if (start == BATCH_START) {
+        if (!authenticated) {
+          Console.println(F("Authentication needed."));
+          break;
+        }
+        batch_mode(true);
+        console_set_state(CONSOLE_BATCH, 0);
+        session_step = SESSION_BATCH;
+        task_start(nfc_task_id);
+        break;
+      }
 
-    if (Serial.available()) {
-      mode_chosen = Serial.read();               // Read the chosen operation mode from Serial input.
-      while (Serial.available()) Serial.read();  // Clear any remaining Serial data.
+      Console.println(F("Place your card on the NFC reader ..."));  // Prompt to place the NFC card near the reader.
+      console_set_state(CONSOLE_DETECTING, 0);
+      session_step = SESSION_DETECT;
+      task_start(nfc_task_id);
+      break;
     }
 
-    Serial.print(F("Mode chosen: "));  // Display the chosen mode to the user for confirmation.
-    Serial.println(mode_chosen);
-
-    // Execute the operation based on the user's selection.
-    switch (mode_chosen) {
-      case '0':
-        if (authenticated) read_memory();
-        else Serial.println(F("Authentication needed."));
-        break;  // Read the memory of the card.
-      case '1':
-        if (authenticated) format_MAD1();
-        else Serial.println(F("Authentication needed."));
-        break;  // Format the card to MAD1.
-      case '2':
-        if (authenticated) format_to_default();
-        else Serial.println(F("Authentication needed."));
-        break;  // Reset the card to default settings.
-      // case '3':
-      //   if (authenticated) write_ndef();
-      //   else Serial.println(F("Authentication needed."));
-      //   break;  // Write an NDEF message to the card.
-      // case '4':
-      //   if (authenticated) write_vCard();
-      //   else Serial.println(F("Authentication needed."));
-      //   break;  // Write a vCard to the card.
-      case '5':
-        if (authenticated) break;
-
-
-      case 'a': is_password_protected(); break;  // Checks if the device is password protected
-      case 'b':
-        if (!authenticated) authenticated = create_admin_password();  // Create an admin password
-        else Serial.println(F("Password already set."));
+    case SESSION_BATCH: {
+      skip_end_of_line();
+      if (!console_available())
         break;
-      case 'c': authenticated = authentication(); break;  // Compare the passwords
-      case 'd':
-        if (authenticated) recover_segments();  // Recover the segment keys from eeprom and nfc memory.
-        else Serial.println(F("Authentication needed."));
-        break;
-      case 'e':
-        if (authenticated) write_keys();  // write keys to their correct location
-        break;
-      case 'v': reset_eeprom(); break;
-      case 'w': authenticated = auth(); break;
-      case 'x': set_one_key(); break;
-      case 'y': reset_admin_password(); break;
-      case 'z': print_eeprom(); break;
-      default: Serial.println(F("Unsupported operation.")); break;  // Handle undefined operations.
+      last_request = millis();
+      uint8_t request = console_read();
+      if (request == BATCH_JOB) {
+        batch_enqueue();  // Topping up the queue while cards are being tapped.
+      } else if (request == BATCH_END) {
+        task_stop(nfc_task_id);
+        batch_mode(false);
+        session_step = SESSION_PROMPT;
+      } else {
+        Console.println(F("Unsupported operation."));
+      }
+      break;
     }
-    Serial.flush();                            // Ensure all serial communications are completed.
-    while (Serial.available()) Serial.read();  // Clear the serial buffer.
-    delay(1000);                               // Delay before restarting the loop, allowing for operations to complete.
+
+    case SESSION_MODE:
+      skip_end_of_line();
+      if (!console_available())  // Wait for user input to select an operation.
+        break;
+      mode_chosen = console_read();  // Read the chosen operation mode from Serial input.
+      skip_end_of_line();
+
+      console_set_state(CONSOLE_BUSY, mode_chosen);
+      run_request();
+
+      console_set_state(CONSOLE_COOLDOWN, 0);
+      session_step = SESSION_PROMPT;
+      task_delay(session_task_id, SESSION_COOLDOWN_MS);
+      break;
+  }
+}
+
+/**
+ * NFC task: polls the reader for an ISO14443A card (common types like Mifare Classic or Ultralight)
+ * while the session waits for one, or for the cards tapped during batch enrollment.
+ */
+static void nfc_task(void) {
+  if (!reader_ready)
+    return;  // The request waits for the reader, then for the card.
+  if (session_step == SESSION_BATCH) {
+    batch_poll();
+    return;
+  }
+  if (!nfc_detect())
+    return;
+  task_stop(nfc_task_id);
+
+  Console.println(F("Found a card!"));  // Notify that a card has been detected.
+  if (authenticated) {
+    print_card_info();  // Prints the detected card's information.
+
+    // Console.println(F("Select the desired operation by entering the corresponding number:"));
+    // Console.println(F("  • 0 - Read memory"));
+    // Console.println(F("  • 1 - Format to NDEF"));
+    // Console.println(F("  • 2 - Format to default"));
+    // Console.println(F("  • 3 - Update NDEF"));
+    // Console.println(F("  • 4 - Write vCard"));
+    // Console.println(F("  • 10 - Is device password protected?"));
+  }
+  console_set_state(CONSOLE_WAITING, 0);
+  session_step = SESSION_MODE;
+}
+
+/**
+ * Reader task: initializes the reader, retrying with an exponential backoff until it answers, then checks
+ * it between requests and starts over once it no longer answers. The app gets "reader=ready,..." and
+ * "reader=down" as the state changes.
+ */
+static void reader_task(void) {
+  if (reader_ready) {
+    // A request or the bridge talks to the reader itself.
+    if (session_step != SESSION_START && session_step != SESSION_DETECT)
+      return;
+    if (nfc_chip_check())
+      return;
+    reader_ready = false;
+    reader_retry_ms = READER_RETRY_MIN_MS;
+  } else if (nfc_chip_connect()) {
+    reader_ready = true;
+    reader_reported = false;
+    console_set_reader(true);
+    task_set_period(reader_task_id, READER_CHECK_MS);
+    return;
+  } else {
+    reader_retry_ms = min(reader_retry_ms * 2, READER_RETRY_MAX_MS);
+  }
+
+  if (!reader_reported) {
+    Console.println(F("reader=down"));
+    reader_reported = true;
+    console_set_reader(false);
+  }
+  task_set_period(reader_task_id, reader_retry_ms);
+}
+
+/**
+ * Timer task: logs out once the session has been idle for too long.
+ */
+static void timeout_task(void) {
+  if (authenticated && millis() - last_request > SESSION_TIMEOUT_MS)
+    set_authenticated(false);
+}
+
+
+void setup() {
+  Serial.begin(9600);  // Initialize serial communication at 9600 bits per second.
+  log_begin();         // Diagnostics go to Serial1, away from the app's protocol.
+  if (!cipher_self_test())  // Known answers of the cipher modes, no session is opened if one is wrong.
+    Console.println(F("Cipher self-test failed."));
+  // No wait for the port to be opened: output sent before is dropped, and the app starts with a request.
+
+  // Index the key store journal, converting the EEPROM if it was written by an older firmware.
+  if (!key_store_begin()) {
+    uint8_t state = key_store_state();
+    if (state == KEY_STORE_LEGACY)
+      Console.println(F("Key storage not converted: too many segments, read-only."));
+    else if (state == KEY_STORE_UNFORMATTED)
+      Console.println(F("Key storage not formatted."));
+    else
+      Console.println(F("Key storage not usable."));
   }
+
+  // The RX and log tasks also run while a request waits, the others between requests.
+  task_add(console_poll, 1, TASK_BACKGROUND);     // Serial RX into the console.
+  task_add(console_tx_task, 1, TASK_BACKGROUND);  // Serial TX of a partial packet.
+  task_add(log_flush, 1, TASK_BACKGROUND);        // Serial1 TX of the queued log records.
+  session_task_id = task_add(session_task, 1, 0);
+  nfc_task_id = task_add(nfc_task, SESSION_DETECT_MS, TASK_STOPPED);
+  task_add(timeout_task, 1000, 0);
+  presence_task_id = task_add(presence_task, SESSION_DETECT_MS, TASK_STOPPED);
+  reader_task_id = task_add(reader_task, READER_RETRY_MIN_MS, 0);  // First run on the first pass.
+}
+
+void loop() {
+  scheduler_run();
 }
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+
+// AES-256 implementations that can replace the Crypto library's AES256 as the session cipher, see
+// AES_BACKEND in encryption.h. They have the same interface as AES256 so encryption.cpp uses them unchanged.
+
+#define AES256_KEY_SIZE 32
+#define AES256_ROUNDS 14
+#define AES256_SCHEDULE_SIZE (16 * (AES256_ROUNDS + 1))  // 15 round keys of 16 bytes.
+
+extern const uint8_t aes_sbox[256] PROGMEM;
+extern const uint8_t aes_inv_sbox[256] PROGMEM;
+
+/**
+ * Multiplies a byte by x in GF(2^8).
+ */
+static inline uint8_t aes_xtime(uint8_t x) {
+  return (x << 1) ^ ((x & 0x80) ? 0x1B : 0x00);
+}
+
+/**
+ * Expands an AES-256 key into its 15 round keys.
+ *
+ * @param schedule Pointer to the AES256_SCHEDULE_SIZE bytes receiving the round keys.
+ * @param key Pointer to the AES256_KEY_SIZE bytes key.
+ */
+void aes256_expand_key(uint8_t* schedule, const uint8_t* key);
+
+
+/**
+ * Byte-oriented AES-256: S-boxes in PROGMEM (512 bytes of flash), MixColumns computed with xtime.
+ * The smallest backend, and the slowest to decrypt.
+ */
+class AES256Compact {
+public:
+  size_t keySize() const { return AES256_KEY_SIZE; }
+  bool setKey(const uint8_t* key, size_t len);
+  void encryptBlock(uint8_t* output, const uint8_t* input);
+  void decryptBlock(uint8_t* output, const uint8_t* input);
+  void clear(void);
+
+private:
+  uint8_t schedule[AES256_SCHEDULE_SIZE];
+};
+
+
+/**
+ * Table-driven AES-256: SubBytes and MixColumns of a round merged into one PROGMEM table per direction
+ * (2 KB of flash on top of the S-boxes). Decryption uses the same round keys as encryption, their
+ * InvMixColumns is computed on the fly so the backend needs no second schedule in RAM.
+ */
+class AES256Table {
+public:
+  size_t keySize() const { return AES256_KEY_SIZE; }
+  bool setKey(const uint8_t* key, size_t len);
+  void encryptBlock(uint8_t* output, const uint8_t* input);
+  void decryptBlock(uint8_t* output, const uint8_t* input);
+  void clear(void);
+
+private:
+  uint8_t schedule[AES256_SCHEDULE_SIZE];
+};
@@ -0,0 +1,108 @@
+#include "aes_backends.h"
+
+// The state is kept as in FIPS-197: byte r + 4 * c is row r of column c.
+
+
+static void add_round_key(uint8_t* state, const uint8_t* roundKey) {
+  for (uint8_t i = 0; i < 16; i++)
+    state[i] ^= roundKey[i];
+}
+
+/**
+ * SubBytes and ShiftRows in one pass: row r of column c comes from column c + r.
+ */
+static void sub_shift_rows(uint8_t* state) {
+  uint8_t t[16];
+  for (uint8_t c = 0; c < 4; c++) {
+    for (uint8_t r = 0; r < 4; r++)
+      t[r + 4 * c] = pgm_read_byte(&aes_sbox[state[r + 4 * ((c + r) & 3)]]);
+  }
+  memcpy(state, t, 16);
+}
+
+/**
+ * InvShiftRows and InvSubBytes in one pass: row r of column c comes from column c - r.
+ */
+static void inv_sub_shift_rows(uint8_t* state) {
+  uint8_t t[16];
+  for (uint8_t c = 0; c < 4; c++) {
+    for (uint8_t r = 0; r < 4; r++)
+      t[r + 4 * c] = pgm_read_byte(&aes_inv_sbox[state[r + 4 * ((c - r) & 3)]]);
+  }
+  memcpy(state, t, 16);
+}
+
+static void mix_columns(uint8_t* state) {
+  for (uint8_t c = 0; c < 16; c += 4) {
+    uint8_t a0 = state[c], a1 = state[c + 1], a2 = state[c + 2], a3 = state[c + 3];
+    uint8_t t = a0 ^ a1 ^ a2 ^ a3;
+    state[c] = a0 ^ t ^ aes_xtime(a0 ^ a1);
+    state[c + 1] = a1 ^ t ^ aes_xtime(a1 ^ a2);
+    state[c + 2] = a2 ^ t ^ aes_xtime(a2 ^ a3);
+    state[c + 3] = a3 ^ t ^ aes_xtime(a3 ^ a0);
+  }
+}
+
+/**
+ * InvMixColumns as a pre-multiplication by {04}x^2 + {05} followed by MixColumns.
+ */
+static void inv_mix_columns(uint8_t* state) {
+  for (uint8_t c = 0; c < 16; c += 4) {
+    uint8_t u = aes_xtime(aes_xtime(state[c] ^ state[c + 2]));
+    uint8_t v = aes_xtime(aes_xtime(state[c + 1] ^ state[c + 3]));
+    state[c] ^= u;
+    state[c + 1] ^= v;
+    state[c + 2] ^= u;
+    state[c + 3] ^= v;
+  }
+  mix_columns(state);
+}
+
+
+bool AES256Compact::setKey(const uint8_t* key, size_t len) {
+  if (len != AES256_KEY_SIZE)
+    return false;
+  aes256_expand_key(schedule, key);
+  return true;
+}
+
+
+void AES256Compact::encryptBlock(uint8_t* output, const uint8_t* input) {
+  uint8_t state[16];
+  memcpy(state, input, 16);
+
+  add_round_key(state, schedule);
+  for (uint8_t round = 1; round < AES256_ROUNDS; round++) {
+    sub_shift_rows(state);
+    mix_columns(state);
+    add_round_key(state, schedule + 16 * round);
+  }
+  sub_shift_rows(state);
+  add_round_key(state, schedule + 16 * AES256_ROUNDS);
+
+  memcpy(output, state, 16);
+  memset(state, 0, sizeof(state));
+}
+
+
+void AES256Compact::decryptBlock(uint8_t* output, const uint8_t* input) {
+  uint8_t state[16];
+  memcpy(state, input, 16);
+
+  add_round_key(state, schedule + 16 * AES256_ROUNDS);
+  for (uint8_t round = AES256_ROUNDS - 1; round > 0; round--) {
+    inv_sub_shift_rows(state);
+    add_round_key(state, schedule + 16 * round);
+    inv_mix_columns(state);
+  }
+  inv_sub_shift_rows(state);
+  add_round_key(state, schedule);
+
+  memcpy(output, state, 16);
+  memset(state, 0, sizeof(state));
+}
+
+
+void AES256Compact::clear(void) {
+  memset(schedule, 0, sizeof(schedule));
+}
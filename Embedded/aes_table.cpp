@@ -0,0 +1,223 @@
+#include "aes_backends.h"
+
+// Round tables: entry x holds the column contributed by an input byte x on row 0, that is
+// MixColumns({S(x), 0, 0, 0}) for encryption and InvMixColumns({S^-1(x), 0, 0, 0}) for decryption.
+// The matrices are circulant, so a byte on row r contributes the same column rotated down by r rows
+// and a single table per direction is enough.
+static const uint8_t aes_te[256][4] PROGMEM = {
+  { 0xc6, 0x63, 0x63, 0xa5 }, { 0xf8, 0x7c, 0x7c, 0x84 }, { 0xee, 0x77, 0x77, 0x99 }, { 0xf6, 0x7b, 0x7b, 0x8d },
+  { 0xff, 0xf2, 0xf2, 0x0d }, { 0xd6, 0x6b, 0x6b, 0xbd }, { 0xde, 0x6f, 0x6f, 0xb1 }, { 0x91, 0xc5, 0xc5, 0x54 },
+  { 0x60, 0x30, 0x30, 0x50 }, { 0x02, 0x01, 0x01, 0x03 }, { 0xce, 0x67, 0x67, 0xa9 }, { 0x56, 0x2b, 0x2b, 0x7d },
+  { 0xe7, 0xfe, 0xfe, 0x19 }, { 0xb5, 0xd7, 0xd7, 0x62 }, { 0x4d, 0xab, 0xab, 0xe6 }, { 0xec, 0x76, 0x76, 0x9a },
+  { 0x8f, 0xca, 0xca, 0x45 }, { 0x1f, 0x82, 0x82, 0x9d }, { 0x89, 0xc9, 0xc9, 0x40 }, { 0xfa, 0x7d, 0x7d, 0x87 },
+  { 0xef, 0xfa, 0xfa, 0x15 }, { 0xb2, 0x59, 0x59, 0xeb }, { 0x8e, 0x47, 0x47, 0xc9 }, { 0xfb, 0xf0, 0xf0, 0x0b },
+  { 0x41, 0xad, 0xad, 0xec }, { 0xb3, 0xd4, 0xd4, 0x67 }, { 0x5f, 0xa2, 0xa2, 0xfd }, { 0x45, 0xaf, 0xaf, 0xea },
+  { 0x23, 0x9c, 0x9c, 0xbf }, { 0x53, 0xa4, 0xa4, 0xf7 }, { 0xe4, 0x72, 0x72, 0x96 }, { 0x9b, 0xc0, 0xc0, 0x5b },
+  { 0x75, 0xb7, 0xb7, 0xc2 }, { 0xe1, 0xfd, 0xfd, 0x1c }, { 0x3d, 0x93, 0x93, 0xae }, { 0x4c, 0x26, 0x26, 0x6a },
+  { 0x6c, 0x36, 0x36, 0x5a }, { 0x7e, 0x3f, 0x3f, 0x41 }, { 0xf5, 0xf7, 0xf7, 0x02 }, { 0x83, 0xcc, 0xcc, 0x4f },
+  { 0x68, 0x34, 0x34, 0x5c }, { 0x51, 0xa5, 0xa5, 0xf4 }, { 0xd1, 0xe5, 0xe5, 0x34 }, { 0xf9, 0xf1, 0xf1, 0x08 },
+  { 0xe2, 0x71, 0x71, 0x93 }, { 0xab, 0xd8, 0xd8, 0x73 }, { 0x62, 0x31, 0x31, 0x53 }, { 0x2a, 0x15, 0x15, 0x3f },
+  { 0x08, 0x04, 0x04, 0x0c }, { 0x95, 0xc7, 0xc7, 0x52 }, { 0x46, 0x23, 0x23, 0x65 }, { 0x9d, 0xc3, 0xc3, 0x5e },
+  { 0x30, 0x18, 0x18, 0x28 }, { 0x37, 0x96, 0x96, 0xa1 }, { 0x0a, 0x05, 0x05, 0x0f }, { 0x2f, 0x9a, 0x9a, 0xb5 },
+  { 0x0e, 0x07, 0x07, 0x09 }, { 0x24, 0x12, 0x12, 0x36 }, { 0x1b, 0x80, 0x80, 0x9b }, { 0xdf, 0xe2, 0xe2, 0x3d },
+  { 0xcd, 0xeb, 0xeb, 0x26 }, { 0x4e, 0x27, 0x27, 0x69 }, { 0x7f, 0xb2, 0xb2, 0xcd }, { 0xea, 0x75, 0x75, 0x9f },
+  { 0x12, 0x09, 0x09, 0x1b }, { 0x1d, 0x83, 0x83, 0x9e }, { 0x58, 0x2c, 0x2c, 0x74 }, { 0x34, 0x1a, 0x1a, 0x2e },
+  { 0x36, 0x1b, 0x1b, 0x2d }, { 0xdc, 0x6e, 0x6e, 0xb2 }, { 0xb4, 0x5a, 0x5a, 0xee }, { 0x5b, 0xa0, 0xa0, 0xfb },
+  { 0xa4, 0x52, 0x52, 0xf6 }, { 0x76, 0x3b, 0x3b, 0x4d }, { 0xb7, 0xd6, 0xd6, 0x61 }, { 0x7d, 0xb3, 0xb3, 0xce },
+  { 0x52, 0x29, 0x29, 0x7b }, { 0xdd, 0xe3, 0xe3, 0x3e }, { 0x5e, 0x2f, 0x2f, 0x71 }, { 0x13, 0x84, 0x84, 0x97 },
+  { 0xa6, 0x53, 0x53, 0xf5 }, { 0xb9, 0xd1, 0xd1, 0x68 }, { 0x00, 0x00, 0x00, 0x00 }, { 0xc1, 0xed, 0xed, 0x2c },
+  { 0x40, 0x20, 0x20, 0x60 }, { 0xe3, 0xfc, 0xfc, 0x1f }, { 0x79, 0xb1, 0xb1, 0xc8 }, { 0xb6, 0x5b, 0x5b, 0xed },
+  { 0xd4, 0x6a, 0x6a, 0xbe }, { 0x8d, 0xcb, 0xcb, 0x46 }, { 0x67, 0xbe, 0xbe, 0xd9 }, { 0x72, 0x39, 0x39, 0x4b },
+  { 0x94, 0x4a, 0x4a, 0xde }, { 0x98, 0x4c, 0x4c, 0xd4 }, { 0xb0, 0x58, 0x58, 0xe8 }, { 0x85, 0xcf, 0xcf, 0x4a },
+  { 0xbb, 0xd0, 0xd0, 0x6b }, { 0xc5, 0xef, 0xef, 0x2a }, { 0x4f, 0xaa, 0xaa, 0xe5 }, { 0xed, 0xfb, 0xfb, 0x16 },
+  { 0x86, 0x43, 0x43, 0xc5 }, { 0x9a, 0x4d, 0x4d, 0xd7 }, { 0x66, 0x33, 0x33, 0x55 }, { 0x11, 0x85, 0x85, 0x94 },
+  { 0x8a, 0x45, 0x45, 0xcf }, { 0xe9, 0xf9, 0xf9, 0x10 }, { 0x04, 0x02, 0x02, 0x06 }, { 0xfe, 0x7f, 0x7f, 0x81 },
+  { 0xa0, 0x50, 0x50, 0xf0 }, { 0x78, 0x3c, 0x3c, 0x44 }, { 0x25, 0x9f, 0x9f, 0xba }, { 0x4b, 0xa8, 0xa8, 0xe3 },
+  { 0xa2, 0x51, 0x51, 0xf3 }, { 0x5d, 0xa3, 0xa3, 0xfe }, { 0x80, 0x40, 0x40, 0xc0 }, { 0x05, 0x8f, 0x8f, 0x8a },
+  { 0x3f, 0x92, 0x92, 0xad }, { 0x21, 0x9d, 0x9d, 0xbc }, { 0x70, 0x38, 0x38, 0x48 }, { 0xf1, 0xf5, 0xf5, 0x04 },
+  { 0x63, 0xbc, 0xbc, 0xdf }, { 0x77, 0xb6, 0xb6, 0xc1 }, { 0xaf, 0xda, 0xda, 0x75 }, { 0x42, 0x21, 0x21, 0x63 },
+  { 0x20, 0x10, 0x10, 0x30 }, { 0xe5, 0xff, 0xff, 0x1a }, { 0xfd, 0xf3, 0xf3, 0x0e }, { 0xbf, 0xd2, 0xd2, 0x6d },
+  { 0x81, 0xcd, 0xcd, 0x4c }, { 0x18, 0x0c, 0x0c, 0x14 }, { 0x26, 0x13, 0x13, 0x35 }, { 0xc3, 0xec, 0xec, 0x2f },
+  { 0xbe, 0x5f, 0x5f, 0xe1 }, { 0x35, 0x97, 0x97, 0xa2 }, { 0x88, 0x44, 0x44, 0xcc }, { 0x2e, 0x17, 0x17, 0x39 },
+  { 0x93, 0xc4, 0xc4, 0x57 }, { 0x55, 0xa7, 0xa7, 0xf2 }, { 0xfc, 0x7e, 0x7e, 0x82 }, { 0x7a, 0x3d, 0x3d, 0x47 },
+  { 0xc8, 0x64, 0x64, 0xac }, { 0xba, 0x5d, 0x5d, 0xe7 }, { 0x32, 0x19, 0x19, 0x2b }, { 0xe6, 0x73, 0x73, 0x95 },
+  { 0xc0, 0x60, 0x60, 0xa0 }, { 0x19, 0x81, 0x81, 0x98 }, { 0x9e, 0x4f, 0x4f, 0xd1 }, { 0xa3, 0xdc, 0xdc, 0x7f },
+  { 0x44, 0x22, 0x22, 0x66 }, { 0x54, 0x2a, 0x2a, 0x7e }, { 0x3b, 0x90, 0x90, 0xab }, { 0x0b, 0x88, 0x88, 0x83 },
+  { 0x8c, 0x46, 0x46, 0xca }, { 0xc7, 0xee, 0xee, 0x29 }, { 0x6b, 0xb8, 0xb8, 0xd3 }, { 0x28, 0x14, 0x14, 0x3c },
+  { 0xa7, 0xde, 0xde, 0x79 }, { 0xbc, 0x5e, 0x5e, 0xe2 }, { 0x16, 0x0b, 0x0b, 0x1d }, { 0xad, 0xdb, 0xdb, 0x76 },
+  { 0xdb, 0xe0, 0xe0, 0x3b }, { 0x64, 0x32, 0x32, 0x56 }, { 0x74, 0x3a, 0x3a, 0x4e }, { 0x14, 0x0a, 0x0a, 0x1e },
+  { 0x92, 0x49, 0x49, 0xdb }, { 0x0c, 0x06, 0x06, 0x0a }, { 0x48, 0x24, 0x24, 0x6c }, { 0xb8, 0x5c, 0x5c, 0xe4 },
+  { 0x9f, 0xc2, 0xc2, 0x5d }, { 0xbd, 0xd3, 0xd3, 0x6e }, { 0x43, 0xac, 0xac, 0xef }, { 0xc4, 0x62, 0x62, 0xa6 },
+  { 0x39, 0x91, 0x91, 0xa8 }, { 0x31, 0x95, 0x95, 0xa4 }, { 0xd3, 0xe4, 0xe4, 0x37 }, { 0xf2, 0x79, 0x79, 0x8b },
+  { 0xd5, 0xe7, 0xe7, 0x32 }, { 0x8b, 0xc8, 0xc8, 0x43 }, { 0x6e, 0x37, 0x37, 0x59 }, { 0xda, 0x6d, 0x6d, 0xb7 },
+  { 0x01, 0x8d, 0x8d, 0x8c }, { 0xb1, 0xd5, 0xd5, 0x64 }, { 0x9c, 0x4e, 0x4e, 0xd2 }, { 0x49, 0xa9, 0xa9, 0xe0 },
+  { 0xd8, 0x6c, 0x6c, 0xb4 }, { 0xac, 0x56, 0x56, 0xfa }, { 0xf3, 0xf4, 0xf4, 0x07 }, { 0xcf, 0xea, 0xea, 0x25 },
+  { 0xca, 0x65, 0x65, 0xaf }, { 0xf4, 0x7a, 0x7a, 0x8e }, { 0x47, 0xae, 0xae, 0xe9 }, { 0x10, 0x08, 0x08, 0x18 },
+  { 0x6f, 0xba, 0xba, 0xd5 }, { 0xf0, 0x78, 0x78, 0x88 }, { 0x4a, 0x25, 0x25, 0x6f }, { 0x5c, 0x2e, 0x2e, 0x72 },
+  { 0x38, 0x1c, 0x1c, 0x24 }, { 0x57, 0xa6, 0xa6, 0xf1 }, { 0x73, 0xb4, 0xb4, 0xc7 }, { 0x97, 0xc6, 0xc6, 0x51 },
+  { 0xcb, 0xe8, 0xe8, 0x23 }, { 0xa1, 0xdd, 0xdd, 0x7c }, { 0xe8, 0x74, 0x74, 0x9c }, { 0x3e, 0x1f, 0x1f, 0x21 },
+  { 0x96, 0x4b, 0x4b, 0xdd }, { 0x61, 0xbd, 0xbd, 0xdc }, { 0x0d, 0x8b, 0x8b, 0x86 }, { 0x0f, 0x8a, 0x8a, 0x85 },
+  { 0xe0, 0x70, 0x70, 0x90 }, { 0x7c, 0x3e, 0x3e, 0x42 }, { 0x71, 0xb5, 0xb5, 0xc4 }, { 0xcc, 0x66, 0x66, 0xaa },
+  { 0x90, 0x48, 0x48, 0xd8 }, { 0x06, 0x03, 0x03, 0x05 }, { 0xf7, 0xf6, 0xf6, 0x01 }, { 0x1c, 0x0e, 0x0e, 0x12 },
+  { 0xc2, 0x61, 0x61, 0xa3 }, { 0x6a, 0x35, 0x35, 0x5f }, { 0xae, 0x57, 0x57, 0xf9 }, { 0x69, 0xb9, 0xb9, 0xd0 },
+  { 0x17, 0x86, 0x86, 0x91 }, { 0x99, 0xc1, 0xc1, 0x58 }, { 0x3a, 0x1d, 0x1d, 0x27 }, { 0x27, 0x9e, 0x9e, 0xb9 },
+  { 0xd9, 0xe1, 0xe1, 0x38 }, { 0xeb, 0xf8, 0xf8, 0x13 }, { 0x2b, 0x98, 0x98, 0xb3 }, { 0x22, 0x11, 0x11, 0x33 },
+  { 0xd2, 0x69, 0x69, 0xbb }, { 0xa9, 0xd9, 0xd9, 0x70 }, { 0x07, 0x8e, 0x8e, 0x89 }, { 0x33, 0x94, 0x94, 0xa7 },
+  { 0x2d, 0x9b, 0x9b, 0xb6 }, { 0x3c, 0x1e, 0x1e, 0x22 }, { 0x15, 0x87, 0x87, 0x92 }, { 0xc9, 0xe9, 0xe9, 0x20 },
+  { 0x87, 0xce, 0xce, 0x49 }, { 0xaa, 0x55, 0x55, 0xff }, { 0x50, 0x28, 0x28, 0x78 }, { 0xa5, 0xdf, 0xdf, 0x7a },
+  { 0x03, 0x8c, 0x8c, 0x8f }, { 0x59, 0xa1, 0xa1, 0xf8 }, { 0x09, 0x89, 0x89, 0x80 }, { 0x1a, 0x0d, 0x0d, 0x17 },
+  { 0x65, 0xbf, 0xbf, 0xda }, { 0xd7, 0xe6, 0xe6, 0x31 }, { 0x84, 0x42, 0x42, 0xc6 }, { 0xd0, 0x68, 0x68, 0xb8 },
+  { 0x82, 0x41, 0x41, 0xc3 }, { 0x29, 0x99, 0x99, 0xb0 }, { 0x5a, 0x2d, 0x2d, 0x77 }, { 0x1e, 0x0f, 0x0f, 0x11 },
+  { 0x7b, 0xb0, 0xb0, 0xcb }, { 0xa8, 0x54, 0x54, 0xfc }, { 0x6d, 0xbb, 0xbb, 0xd6 }, { 0x2c, 0x16, 0x16, 0x3a }
+};
+
+static const uint8_t aes_td[256][4] PROGMEM = {
+  { 0x51, 0xf4, 0xa7, 0x50 }, { 0x7e, 0x41, 0x65, 0x53 }, { 0x1a, 0x17, 0xa4, 0xc3 }, { 0x3a, 0x27, 0x5e, 0x96 },
+  { 0x3b, 0xab, 0x6b, 0xcb }, { 0x1f, 0x9d, 0x45, 0xf1 }, { 0xac, 0xfa, 0x58, 0xab }, { 0x4b, 0xe3, 0x03, 0x93 },
+  { 0x20, 0x30, 0xfa, 0x55 }, { 0xad, 0x76, 0x6d, 0xf6 }, { 0x88, 0xcc, 0x76, 0x91 }, { 0xf5, 0x02, 0x4c, 0x25 },
+  { 0x4f, 0xe5, 0xd7, 0xfc }, { 0xc5, 0x2a, 0xcb, 0xd7 }, { 0x26, 0x35, 0x44, 0x80 }, { 0xb5, 0x62, 0xa3, 0x8f },
+  { 0xde, 0xb1, 0x5a, 0x49 }, { 0x25, 0xba, 0x1b, 0x67 }, { 0x45, 0xea, 0x0e, 0x98 }, { 0x5d, 0xfe, 0xc0, 0xe1 },
+  { 0xc3, 0x2f, 0x75, 0x02 }, { 0x81, 0x4c, 0xf0, 0x12 }, { 0x8d, 0x46, 0x97, 0xa3 }, { 0x6b, 0xd3, 0xf9, 0xc6 },
+  { 0x03, 0x8f, 0x5f, 0xe7 }, { 0x15, 0x92, 0x9c, 0x95 }, { 0xbf, 0x6d, 0x7a, 0xeb }, { 0x95, 0x52, 0x59, 0xda },
+  { 0xd4, 0xbe, 0x83, 0x2d }, { 0x58, 0x74, 0x21, 0xd3 }, { 0x49, 0xe0, 0x69, 0x29 }, { 0x8e, 0xc9, 0xc8, 0x44 },
+  { 0x75, 0xc2, 0x89, 0x6a }, { 0xf4, 0x8e, 0x79, 0x78 }, { 0x99, 0x58, 0x3e, 0x6b }, { 0x27, 0xb9, 0x71, 0xdd },
+  { 0xbe, 0xe1, 0x4f, 0xb6 }, { 0xf0, 0x88, 0xad, 0x17 }, { 0xc9, 0x20, 0xac, 0x66 }, { 0x7d, 0xce, 0x3a, 0xb4 },
+  { 0x63, 0xdf, 0x4a, 0x18 }, { 0xe5, 0x1a, 0x31, 0x82 }, { 0x97, 0x51, 0x33, 0x60 }, { 0x62, 0x53, 0x7f, 0x45 },
+  { 0xb1, 0x64, 0x77, 0xe0 }, { 0xbb, 0x6b, 0xae, 0x84 }, { 0xfe, 0x81, 0xa0, 0x1c }, { 0xf9, 0x08, 0x2b, 0x94 },
+  { 0x70, 0x48, 0x68, 0x58 }, { 0x8f, 0x45, 0xfd, 0x19 }, { 0x94, 0xde, 0x6c, 0x87 }, { 0x52, 0x7b, 0xf8, 0xb7 },
+  { 0xab, 0x73, 0xd3, 0x23 }, { 0x72, 0x4b, 0x02, 0xe2 }, { 0xe3, 0x1f, 0x8f, 0x57 }, { 0x66, 0x55, 0xab, 0x2a },
+  { 0xb2, 0xeb, 0x28, 0x07 }, { 0x2f, 0xb5, 0xc2, 0x03 }, { 0x86, 0xc5, 0x7b, 0x9a }, { 0xd3, 0x37, 0x08, 0xa5 },
+  { 0x30, 0x28, 0x87, 0xf2 }, { 0x23, 0xbf, 0xa5, 0xb2 }, { 0x02, 0x03, 0x6a, 0xba }, { 0xed, 0x16, 0x82, 0x5c },
+  { 0x8a, 0xcf, 0x1c, 0x2b }, { 0xa7, 0x79, 0xb4, 0x92 }, { 0xf3, 0x07, 0xf2, 0xf0 }, { 0x4e, 0x69, 0xe2, 0xa1 },
+  { 0x65, 0xda, 0xf4, 0xcd }, { 0x06, 0x05, 0xbe, 0xd5 }, { 0xd1, 0x34, 0x62, 0x1f }, { 0xc4, 0xa6, 0xfe, 0x8a },
+  { 0x34, 0x2e, 0x53, 0x9d }, { 0xa2, 0xf3, 0x55, 0xa0 }, { 0x05, 0x8a, 0xe1, 0x32 }, { 0xa4, 0xf6, 0xeb, 0x75 },
+  { 0x0b, 0x83, 0xec, 0x39 }, { 0x40, 0x60, 0xef, 0xaa }, { 0x5e, 0x71, 0x9f, 0x06 }, { 0xbd, 0x6e, 0x10, 0x51 },
+  { 0x3e, 0x21, 0x8a, 0xf9 }, { 0x96, 0xdd, 0x06, 0x3d }, { 0xdd, 0x3e, 0x05, 0xae }, { 0x4d, 0xe6, 0xbd, 0x46 },
+  { 0x91, 0x54, 0x8d, 0xb5 }, { 0x71, 0xc4, 0x5d, 0x05 }, { 0x04, 0x06, 0xd4, 0x6f }, { 0x60, 0x50, 0x15, 0xff },
+  { 0x19, 0x98, 0xfb, 0x24 }, { 0xd6, 0xbd, 0xe9, 0x97 }, { 0x89, 0x40, 0x43, 0xcc }, { 0x67, 0xd9, 0x9e, 0x77 },
+  { 0xb0, 0xe8, 0x42, 0xbd }, { 0x07, 0x89, 0x8b, 0x88 }, { 0xe7, 0x19, 0x5b, 0x38 }, { 0x79, 0xc8, 0xee, 0xdb },
+  { 0xa1, 0x7c, 0x0a, 0x47 }, { 0x7c, 0x42, 0x0f, 0xe9 }, { 0xf8, 0x84, 0x1e, 0xc9 }, { 0x00, 0x00, 0x00, 0x00 },
+  { 0x09, 0x80, 0x86, 0x83 }, { 0x32, 0x2b, 0xed, 0x48 }, { 0x1e, 0x11, 0x70, 0xac }, { 0x6c, 0x5a, 0x72, 0x4e },
+  { 0xfd, 0x0e, 0xff, 0xfb }, { 0x0f, 0x85, 0x38, 0x56 }, { 0x3d, 0xae, 0xd5, 0x1e }, { 0x36, 0x2d, 0x39, 0x27 },
+  { 0x0a, 0x0f, 0xd9, 0x64 }, { 0x68, 0x5c, 0xa6, 0x21 }, { 0x9b, 0x5b, 0x54, 0xd1 }, { 0x24, 0x36, 0x2e, 0x3a },
+  { 0x0c, 0x0a, 0x67, 0xb1 }, { 0x93, 0x57, 0xe7, 0x0f }, { 0xb4, 0xee, 0x96, 0xd2 }, { 0x1b, 0x9b, 0x91, 0x9e },
+  { 0x80, 0xc0, 0xc5, 0x4f }, { 0x61, 0xdc, 0x20, 0xa2 }, { 0x5a, 0x77, 0x4b, 0x69 }, { 0x1c, 0x12, 0x1a, 0x16 },
+  { 0xe2, 0x93, 0xba, 0x0a }, { 0xc0, 0xa0, 0x2a, 0xe5 }, { 0x3c, 0x22, 0xe0, 0x43 }, { 0x12, 0x1b, 0x17, 0x1d },
+  { 0x0e, 0x09, 0x0d, 0x0b }, { 0xf2, 0x8b, 0xc7, 0xad }, { 0x2d, 0xb6, 0xa8, 0xb9 }, { 0x14, 0x1e, 0xa9, 0xc8 },
+  { 0x57, 0xf1, 0x19, 0x85 }, { 0xaf, 0x75, 0x07, 0x4c }, { 0xee, 0x99, 0xdd, 0xbb }, { 0xa3, 0x7f, 0x60, 0xfd },
+  { 0xf7, 0x01, 0x26, 0x9f }, { 0x5c, 0x72, 0xf5, 0xbc }, { 0x44, 0x66, 0x3b, 0xc5 }, { 0x5b, 0xfb, 0x7e, 0x34 },
+  { 0x8b, 0x43, 0x29, 0x76 }, { 0xcb, 0x23, 0xc6, 0xdc }, { 0xb6, 0xed, 0xfc, 0x68 }, { 0xb8, 0xe4, 0xf1, 0x63 },
+  { 0xd7, 0x31, 0xdc, 0xca }, { 0x42, 0x63, 0x85, 0x10 }, { 0x13, 0x97, 0x22, 0x40 }, { 0x84, 0xc6, 0x11, 0x20 },
+  { 0x85, 0x4a, 0x24, 0x7d }, { 0xd2, 0xbb, 0x3d, 0xf8 }, { 0xae, 0xf9, 0x32, 0x11 }, { 0xc7, 0x29, 0xa1, 0x6d },
+  { 0x1d, 0x9e, 0x2f, 0x4b }, { 0xdc, 0xb2, 0x30, 0xf3 }, { 0x0d, 0x86, 0x52, 0xec }, { 0x77, 0xc1, 0xe3, 0xd0 },
+  { 0x2b, 0xb3, 0x16, 0x6c }, { 0xa9, 0x70, 0xb9, 0x99 }, { 0x11, 0x94, 0x48, 0xfa }, { 0x47, 0xe9, 0x64, 0x22 },
+  { 0xa8, 0xfc, 0x8c, 0xc4 }, { 0xa0, 0xf0, 0x3f, 0x1a }, { 0x56, 0x7d, 0x2c, 0xd8 }, { 0x22, 0x33, 0x90, 0xef },
+  { 0x87, 0x49, 0x4e, 0xc7 }, { 0xd9, 0x38, 0xd1, 0xc1 }, { 0x8c, 0xca, 0xa2, 0xfe }, { 0x98, 0xd4, 0x0b, 0x36 },
+  { 0xa6, 0xf5, 0x81, 0xcf }, { 0xa5, 0x7a, 0xde, 0x28 }, { 0xda, 0xb7, 0x8e, 0x26 }, { 0x3f, 0xad, 0xbf, 0xa4 },
+  { 0x2c, 0x3a, 0x9d, 0xe4 }, { 0x50, 0x78, 0x92, 0x0d }, { 0x6a, 0x5f, 0xcc, 0x9b }, { 0x54, 0x7e, 0x46, 0x62 },
+  { 0xf6, 0x8d, 0x13, 0xc2 }, { 0x90, 0xd8, 0xb8, 0xe8 }, { 0x2e, 0x39, 0xf7, 0x5e }, { 0x82, 0xc3, 0xaf, 0xf5 },
+  { 0x9f, 0x5d, 0x80, 0xbe }, { 0x69, 0xd0, 0x93, 0x7c }, { 0x6f, 0xd5, 0x2d, 0xa9 }, { 0xcf, 0x25, 0x12, 0xb3 },
+  { 0xc8, 0xac, 0x99, 0x3b }, { 0x10, 0x18, 0x7d, 0xa7 }, { 0xe8, 0x9c, 0x63, 0x6e }, { 0xdb, 0x3b, 0xbb, 0x7b },
+  { 0xcd, 0x26, 0x78, 0x09 }, { 0x6e, 0x59, 0x18, 0xf4 }, { 0xec, 0x9a, 0xb7, 0x01 }, { 0x83, 0x4f, 0x9a, 0xa8 },
+  { 0xe6, 0x95, 0x6e, 0x65 }, { 0xaa, 0xff, 0xe6, 0x7e }, { 0x21, 0xbc, 0xcf, 0x08 }, { 0xef, 0x15, 0xe8, 0xe6 },
+  { 0xba, 0xe7, 0x9b, 0xd9 }, { 0x4a, 0x6f, 0x36, 0xce }, { 0xea, 0x9f, 0x09, 0xd4 }, { 0x29, 0xb0, 0x7c, 0xd6 },
+  { 0x31, 0xa4, 0xb2, 0xaf }, { 0x2a, 0x3f, 0x23, 0x31 }, { 0xc6, 0xa5, 0x94, 0x30 }, { 0x35, 0xa2, 0x66, 0xc0 },
+  { 0x74, 0x4e, 0xbc, 0x37 }, { 0xfc, 0x82, 0xca, 0xa6 }, { 0xe0, 0x90, 0xd0, 0xb0 }, { 0x33, 0xa7, 0xd8, 0x15 },
+  { 0xf1, 0x04, 0x98, 0x4a }, { 0x41, 0xec, 0xda, 0xf7 }, { 0x7f, 0xcd, 0x50, 0x0e }, { 0x17, 0x91, 0xf6, 0x2f },
+  { 0x76, 0x4d, 0xd6, 0x8d }, { 0x43, 0xef, 0xb0, 0x4d }, { 0xcc, 0xaa, 0x4d, 0x54 }, { 0xe4, 0x96, 0x04, 0xdf },
+  { 0x9e, 0xd1, 0xb5, 0xe3 }, { 0x4c, 0x6a, 0x88, 0x1b }, { 0xc1, 0x2c, 0x1f, 0xb8 }, { 0x46, 0x65, 0x51, 0x7f },
+  { 0x9d, 0x5e, 0xea, 0x04 }, { 0x01, 0x8c, 0x35, 0x5d }, { 0xfa, 0x87, 0x74, 0x73 }, { 0xfb, 0x0b, 0x41, 0x2e },
+  { 0xb3, 0x67, 0x1d, 0x5a }, { 0x92, 0xdb, 0xd2, 0x52 }, { 0xe9, 0x10, 0x56, 0x33 }, { 0x6d, 0xd6, 0x47, 0x13 },
+  { 0x9a, 0xd7, 0x61, 0x8c }, { 0x37, 0xa1, 0x0c, 0x7a }, { 0x59, 0xf8, 0x14, 0x8e }, { 0xeb, 0x13, 0x3c, 0x89 },
+  { 0xce, 0xa9, 0x27, 0xee }, { 0xb7, 0x61, 0xc9, 0x35 }, { 0xe1, 0x1c, 0xe5, 0xed }, { 0x7a, 0x47, 0xb1, 0x3c },
+  { 0x9c, 0xd2, 0xdf, 0x59 }, { 0x55, 0xf2, 0x73, 0x3f }, { 0x18, 0x14, 0xce, 0x79 }, { 0x73, 0xc7, 0x37, 0xbf },
+  { 0x53, 0xf7, 0xcd, 0xea }, { 0x5f, 0xfd, 0xaa, 0x5b }, { 0xdf, 0x3d, 0x6f, 0x14 }, { 0x78, 0x44, 0xdb, 0x86 },
+  { 0xca, 0xaf, 0xf3, 0x81 }, { 0xb9, 0x68, 0xc4, 0x3e }, { 0x38, 0x24, 0x34, 0x2c }, { 0xc2, 0xa3, 0x40, 0x5f },
+  { 0x16, 0x1d, 0xc3, 0x72 }, { 0xbc, 0xe2, 0x25, 0x0c }, { 0x28, 0x3c, 0x49, 0x8b }, { 0xff, 0x0d, 0x95, 0x41 },
+  { 0x39, 0xa8, 0x01, 0x71 }, { 0x08, 0x0c, 0xb3, 0xde }, { 0xd8, 0xb4, 0xe4, 0x9c }, { 0x64, 0x56, 0xc1, 0x90 },
+  { 0x7b, 0xcb, 0x84, 0x61 }, { 0xd5, 0x32, 0xb6, 0x70 }, { 0x48, 0x6c, 0x5c, 0x74 }, { 0xd0, 0xb8, 0x57, 0x42 }
+};
+
+
+/**
+ * One full encryption round: SubBytes, ShiftRows and MixColumns through aes_te, then AddRoundKey.
+ */
+static void encrypt_round(uint8_t* state, const uint8_t* roundKey) {
+  uint8_t t[16];
+  memcpy(t, roundKey, 16);
+  for (uint8_t c = 0; c < 4; c++) {
+    for (uint8_t r = 0; r < 4; r++) {
+      const uint8_t* column = aes_te[state[r + 4 * ((c + r) & 3)]];
+      for (uint8_t j = 0; j < 4; j++)
+        t[4 * c + j] ^= pgm_read_byte(&column[(j - r) & 3]);
+    }
+  }
+  memcpy(state, t, 16);
+}
+
+/**
+ * One full round of the equivalent inverse cipher: InvShiftRows, InvSubBytes and InvMixColumns through
+ * aes_td, then the round key passed through InvMixColumns. aes_td[S(k)] is InvMixColumns({k, 0, 0, 0}),
+ * so the round key goes through the same table instead of a second schedule.
+ */
+static void decrypt_round(uint8_t* state, const uint8_t* roundKey) {
+  uint8_t t[16] = { 0 };
+  for (uint8_t c = 0; c < 4; c++) {
+    for (uint8_t r = 0; r < 4; r++) {
+      const uint8_t* column = aes_td[state[r + 4 * ((c - r) & 3)]];
+      const uint8_t* keyColumn = aes_td[pgm_read_byte(&aes_sbox[roundKey[r + 4 * c]])];
+      for (uint8_t j = 0; j < 4; j++)
+        t[4 * c + j] ^= pgm_read_byte(&column[(j - r) & 3]) ^ pgm_read_byte(&keyColumn[(j - r) & 3]);
+    }
+  }
+  memcpy(state, t, 16);
+}
+
+
+bool AES256Table::setKey(const uint8_t* key, size_t len) {
+  if (len != AES256_KEY_SIZE)
+    return false;
+  aes256_expand_key(schedule, key);
+  return true;
+}
+
+
+void AES256Table::encryptBlock(uint8_t* output, const uint8_t* input) {
+  uint8_t state[16];
+  for (uint8_t i = 0; i < 16; i++)
+    state[i] = input[i] ^ schedule[i];
+
+  for (uint8_t round = 1; round < AES256_ROUNDS; round++)
+    encrypt_round(state, schedule + 16 * round);
+
+  // Last round has no MixColumns.
+  const uint8_t* roundKey = schedule + 16 * AES256_ROUNDS;
+  for (uint8_t c = 0; c < 4; c++) {
+    for (uint8_t r = 0; r < 4; r++)
+      output[r + 4 * c] = pgm_read_byte(&aes_sbox[state[r + 4 * ((c + r) & 3)]]) ^ roundKey[r + 4 * c];
+  }
+  memset(state, 0, sizeof(state));
+}
+
+
+void AES256Table::decryptBlock(uint8_t* output, const uint8_t* input) {
+  uint8_t state[16];
+  const uint8_t* roundKey = schedule + 16 * AES256_ROUNDS;
+  for (uint8_t i = 0; i < 16; i++)
+    state[i] = input[i] ^ roundKey[i];
+
+  for (uint8_t round = AES256_ROUNDS - 1; round > 0; round--)
+    decrypt_round(state, schedule + 16 * round);
+
+  // Last round has no InvMixColumns.
+  for (uint8_t c = 0; c < 4; c++) {
+    for (uint8_t r = 0; r < 4; r++)
+      output[r + 4 * c] = pgm_read_byte(&aes_inv_sbox[state[r + 4 * ((c - r) & 3)]]) ^ schedule[r + 4 * c];
+  }
+  memset(state, 0, sizeof(state));
+}
+
+
+void AES256Table::clear(void) {
+  memset(schedule, 0, sizeof(schedule));
+}
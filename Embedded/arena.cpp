@@ -0,0 +1,43 @@
+#include "arena.h"
+
+#include "logging.h"
+
+static uint8_t arena[ARENA_SIZE];
+static uint16_t arena_top = 0;
+static uint16_t arena_high = 0;  // Peak of arena_top.
+
+
+void* arena_alloc(uint16_t size) {
+  if (size > ARENA_SIZE - arena_top) {
+    LOG_ERROR(LOG_ARENA_FULL, size, arena_top);
+    return NULL;
+  }
+  void* buffer = arena + arena_top;
+  arena_top += size;
+  if (arena_top > arena_high)
+    arena_high = arena_top;
+  return buffer;
+}
+
+
+uint16_t arena_mark(void) {
+  return arena_top;
+}
+
+
+void arena_release(uint16_t mark) {
+  if (mark >= arena_top)
+    return;
+  memset(arena + mark, 0, arena_top - mark);
+  arena_top = mark;
+}
+
+
+void arena_reset(void) {
+  arena_release(0);
+}
+
+
+uint16_t arena_peak(void) {
+  return arena_high;
+}
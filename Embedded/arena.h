@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Scratch arena of the requests: a bump allocator over a static buffer, from which the commands take
+// their large buffers instead of the stack. Its size is the peak of the deepest request, so the SRAM it
+// uses is known at link time and the stack peak no longer depends on the call path.
+//
+// Every byte given back is zeroized, the buffers hold key segments and passwords. The arena starts zeroed,
+// so an allocation is always zero-filled.
+
+// The deepest path, the 'e' request: the flag and the two segments read from the app (65 bytes), then the
+// key record written to the card (KEY_TEXT_SIZE and KEY_RECORD_MESSAGE_SIZE), 196 bytes. Checked in main.cpp.
+#define ARENA_SIZE 208
+
+
+/**
+ * Takes a zero-filled buffer from the arena, kept until the arena is released past it.
+ *
+ * @param size Its size in bytes.
+ * @return The buffer, NULL if the arena is full, which the static checks of ARENA_SIZE rule out.
+ */
+void* arena_alloc(uint16_t size);
+
+/**
+ * @return The current top of the arena, to release what is allocated after it with arena_release().
+ */
+uint16_t arena_mark(void);
+
+/**
+ * Zeroizes and frees everything allocated since a mark, used by the functions called by several requests.
+ */
+void arena_release(uint16_t mark);
+
+/**
+ * Zeroizes and frees the whole arena, called at the end of each request.
+ */
+void arena_reset(void);
+
+/**
+ * @return The largest number of bytes used at once since boot.
+ */
+uint16_t arena_peak(void);
@@ -0,0 +1,171 @@
+#include "console.h"
+
+#define CONSOLE_RX_MASK (CONSOLE_RX_SIZE - 1)
+
+static uint8_t rx_buffer[CONSOLE_RX_SIZE];
+static uint8_t rx_head = 0;  // Free running indexes, masked on access.
+static uint8_t rx_tail = 0;
+
+static uint8_t console_state = CONSOLE_IDLE;
+static uint8_t console_mode = 0;
+static bool reading = false;  // A request reads its data.
+static bool raw = false;      // Every byte is data, see console_set_raw().
+static bool reader_ready = true;  // Only reported once it is down.
+
+ConsoleWriter Console;
+
+
+void ConsoleWriter::send(void) {
+  if (length)
+    Serial.write(buffer, length);  // One transaction, a single packet.
+  length = 0;
+}
+
+
+size_t ConsoleWriter::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+
+size_t ConsoleWriter::write(const uint8_t* data, size_t size) {
+  for (size_t done = 0; done < size;) {
+    if (!length)
+      since = millis();
+    uint8_t n = min(size - done, (size_t)(CONSOLE_TX_SIZE - length));
+    memcpy(buffer + length, data + done, n);
+    length += n;
+    done += n;
+    if (length == CONSOLE_TX_SIZE)
+      send();
+  }
+  return size;
+}
+
+
+int ConsoleWriter::availableForWrite(void) {
+  return CONSOLE_TX_SIZE - length;
+}
+
+
+void ConsoleWriter::flush(void) {
+  send();
+  Serial.flush();
+}
+
+
+void ConsoleWriter::poll(void) {
+  if (length && millis() - since >= CONSOLE_TX_TIMEOUT_MS && Serial.availableForWrite() >= length)
+    send();
+}
+
+
+void console_tx_task(void) {
+  Console.poll();
+}
+
+
+static void status_reply(void) {
+  Console.print(F("status="));
+  switch (console_state) {
+    case CONSOLE_DETECTING: Console.print(F("detecting")); break;
+    case CONSOLE_BUSY: Console.print(F("busy")); break;
+    case CONSOLE_WAITING: Console.print(F("waiting")); break;
+    case CONSOLE_COOLDOWN: Console.print(F("cooldown")); break;
+    case CONSOLE_BATCH: Console.print(F("batch")); break;
+    default: Console.print(F("idle")); break;
+  }
+  if (console_mode) {
+    Console.print(F(",mode="));
+    Console.write(console_mode);
+  }
+  if (!reader_ready)
+    Console.print(F(",reader=down"));
+  Console.println();
+  Console.flush();
+}
+
+
+void console_poll(void) {
+  while ((uint8_t)(rx_head - rx_tail) < CONSOLE_RX_SIZE && Serial.available()) {
+    uint8_t c = Serial.read();
+    if (c == CONSOLE_STATUS_QUERY && !reading && !raw && rx_head == rx_tail) {
+      status_reply();
+      continue;
+    }
+    rx_buffer[rx_head++ & CONSOLE_RX_MASK] = c;
+  }
+}
+
+
+void console_set_state(uint8_t state, uint8_t mode) {
+  console_state = state;
+  console_mode = mode;
+}
+
+
+void console_set_reader(bool ready) {
+  reader_ready = ready;
+}
+
+
+void console_set_raw(bool on) {
+  raw = on;
+}
+
+
+uint8_t console_available(void) {
+  console_poll();
+  return rx_head - rx_tail;
+}
+
+
+int console_peek(void) {
+  if (!console_available())
+    return -1;
+  return rx_buffer[rx_tail & CONSOLE_RX_MASK];
+}
+
+
+int console_read(void) {
+  if (!console_available())
+    return -1;
+  return rx_buffer[rx_tail++ & CONSOLE_RX_MASK];
+}
+
+
+void console_wait(void) {
+  uint8_t state = console_state;
+  console_state = CONSOLE_WAITING;
+  Console.flush();  // The app only answers what it has received.
+  while (!console_available())
+    delay(1);  // Runs the background tasks.
+  console_state = state;
+}
+
+
+uint8_t console_read_bytes(uint8_t* buffer, uint8_t length, uint16_t timeout_ms) {
+  uint8_t count = 0;
+  Console.flush();
+  unsigned long last = millis();
+  reading = true;
+  while (count < length) {
+    if (console_available()) {
+      buffer[count++] = console_read();
+      last = millis();
+    } else if (count && timeout_ms && millis() - last >= timeout_ms) {
+      break;
+    } else {
+      delay(1);
+    }
+  }
+  reading = false;
+  return count;
+}
+
+
+void console_clear(void) {
+  do {
+    console_poll();
+    rx_tail = rx_head;
+  } while (Serial.available());
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Serial input and output of the app's protocol. The RX task moves the received bytes into a ring as
+// they arrive, also while a request runs, so a request sent while a card operation is in progress waits
+// there for its turn instead of being lost, and a status query is answered at once.
+//
+// Output goes through Console, which coalesces the many small prints of a reply into full USB packets:
+// each Serial.write() on the 32U4 is a USB transaction of its own, ended by a short packet.
+
+#define CONSOLE_RX_SIZE 64  // Power of 2, up to 128.
+
+#define CONSOLE_TX_SIZE 64        // Bulk IN endpoint size of the CDC interface.
+#define CONSOLE_TX_TIMEOUT_MS 2   // Age of a partial packet after which the TX task sends it.
+
+// Status query: the device answers "status=<state>", followed by ",mode=<request>" while a request runs
+// and by ",reader=down" while the reader does not answer.
+// A '?' is only a query when no other byte is waiting and no request is reading its data or has turned
+// the queries off.
+#define CONSOLE_STATUS_QUERY '?'
+
+// States reported to a status query.
+#define CONSOLE_IDLE 0       // Waiting for a request.
+#define CONSOLE_DETECTING 1  // Waiting for a card.
+#define CONSOLE_BUSY 2       // Running a request.
+#define CONSOLE_WAITING 3    // Waiting for the app: the mode byte, or a confirmation within a request.
+#define CONSOLE_COOLDOWN 4   // Pause after a request.
+#define CONSOLE_BATCH 5      // Batch enrollment, writing the cards tapped.
+
+
+/**
+ * Output of the app's protocol, in place of Serial. Bytes are sent when a packet is full, by flush() at
+ * the end of a reply, before the firmware waits for the app, or by the TX task once the oldest of them
+ * has waited CONSOLE_TX_TIMEOUT_MS.
+ */
+class ConsoleWriter : public Print {
+public:
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* data, size_t size) override;
+  using Print::write;
+
+  /**
+   * @return The bytes that can be written without sending a packet, which may wait for the endpoint.
+   */
+  int availableForWrite(void) override;
+
+  /**
+   * Sends the pending bytes and waits for their transmission.
+   */
+  void flush(void) override;
+
+  /**
+   * Sends the pending bytes if they are older than CONSOLE_TX_TIMEOUT_MS and the endpoint can take them
+   * without waiting.
+   */
+  void poll(void);
+
+private:
+  void send(void);
+
+  uint8_t buffer[CONSOLE_TX_SIZE];
+  uint8_t length = 0;
+  unsigned long since = 0;  // millis() of the first pending byte.
+};
+
+extern ConsoleWriter Console;
+
+
+/**
+ * TX task: sends the partial packet left by a reply, see ConsoleWriter::poll().
+ */
+void console_tx_task(void);
+
+/**
+ * RX task: moves the bytes received by Serial into the ring, answering status queries.
+ */
+void console_poll(void);
+
+/**
+ * Sets the state reported to status queries.
+ *
+ * @param state One of the CONSOLE_ states.
+ * @param mode The request running, 0 if none.
+ */
+void console_set_state(uint8_t state, uint8_t mode);
+
+/**
+ * Sets whether the reader answers, reported to status queries.
+ */
+void console_set_reader(bool ready);
+
+/**
+ * Turns status queries off while a request exchanges binary data with the app, where any byte can be '?'.
+ */
+void console_set_raw(bool raw);
+
+/**
+ * @return The number of bytes received and not read yet.
+ */
+uint8_t console_available(void);
+
+/**
+ * @return The next byte received, without removing it, -1 if there is none.
+ */
+int console_peek(void);
+
+/**
+ * @return The next byte received, -1 if there is none.
+ */
+int console_read(void);
+
+/**
+ * Sends the pending output, then waits for a byte, reporting CONSOLE_WAITING meanwhile. The background
+ * tasks run during the wait.
+ */
+void console_wait(void);
+
+/**
+ * Sends the pending output, then reads the data of a request. A '?' is data here, not a status query.
+ *
+ * @param buffer Buffer receiving the bytes.
+ * @param length Number of bytes to read.
+ * @param timeout_ms Time to wait for each byte after the first, 0 to wait without limit.
+ * @return The number of bytes read, less than length on timeout.
+ */
+uint8_t console_read_bytes(uint8_t* buffer, uint8_t length, uint16_t timeout_ms);
+
+/**
+ * Discards the bytes received and not read yet.
+ */
+void console_clear(void);
@@ -1,97 +1,330 @@
 #include "encryption.h"
+#include "profiling.h"
+#include "logging.h"
+#include "console.h"
+
+SessionAES aes256ECB;  // Create an instance of the selected AES backend to use for ECB encryption
+
+static bool session_active = false;  // Set while aes256ECB holds an expanded key schedule.
+static bool self_test_failed = false;  // Set by cipher_self_test, no session is opened then.
+static uint32_t iv_counter = 0;        // Nonces of the IVs made since startup.
+
+// Known answers of NIST SP 800-38A for AES-256, the first two blocks of F.1.5, F.2.5 and F.5.5.
+static const uint8_t self_test_key[32] PROGMEM = {
+  0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+  0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4
+};
+static const uint8_t self_test_plain[2 * CIPHER_BLOCK_SIZE] PROGMEM = {
+  0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+  0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51
+};
+
+typedef struct {
+  uint8_t mode;  // Encryption mode, the decryption mode follows it except for CTR.
+  uint8_t iv[CIPHER_BLOCK_SIZE];
+  uint8_t cipher[2 * CIPHER_BLOCK_SIZE];
+} CipherVector;
+
+static const CipherVector self_test_vectors[] PROGMEM = {
+  { CIPHER_MODE_ECB_ENCRYPT,
+    { 0 },
+    { 0xf3, 0xee, 0xd1, 0xbd, 0xb5, 0xd2, 0xa0, 0x3c, 0x06, 0x4b, 0x5a, 0x7e, 0x3d, 0xb1, 0x81, 0xf8,
+      0x59, 0x1c, 0xcb, 0x10, 0xd4, 0x10, 0xed, 0x26, 0xdc, 0x5b, 0xa7, 0x4a, 0x31, 0x36, 0x28, 0x70 } },
+  { CIPHER_MODE_CBC_ENCRYPT,
+    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f },
+    { 0xf5, 0x8c, 0x4c, 0x04, 0xd6, 0xe5, 0xf1, 0xba, 0x77, 0x9e, 0xab, 0xfb, 0x5f, 0x7b, 0xfb, 0xd6,
+      0x9c, 0xfc, 0x4e, 0x96, 0x7e, 0xdb, 0x80, 0x8d, 0x67, 0x9f, 0x77, 0x7b, 0xc6, 0x70, 0x2c, 0x7d } },
+  { CIPHER_MODE_CTR,
+    { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff },
+    { 0x60, 0x1e, 0xc3, 0x13, 0x77, 0x57, 0x89, 0xa5, 0xb7, 0xa7, 0xf5, 0x04, 0xbb, 0xf3, 0xd2, 0x28,
+      0xf4, 0x43, 0xe3, 0xca, 0x4d, 0x62, 0xb5, 0x9a, 0xca, 0x84, 0xe9, 0x90, 0xca, 0xca, 0xf5, 0xc5 } },
+};
 
 
 /**
- * @brief Encrypts a block of data using AES-256 ECB mode.
- * 
- * This function takes an input block of plaintext and encrypts it using the AES-256 ECB mode of encryption.
- * It assumes that the input data length is a multiple of the AES block size (16 bytes). It uses provided key
- * to perform the encryption and places the result in the output buffer.
+ * @brief Expands the AES-256 key schedule for a session.
  *
- * @param output Pointer to the buffer where encrypted data should be stored.
- * @param input Pointer to the data to be encrypted.
- * @param len Length of the input data in bytes. Must be a multiple of CIPHER_BLOCK_SIZE.
- * @param key Pointer to the encryption key.
- * @return false if encryption was successful, true if the key was invalid.
+ * The schedule stays in aes256ECB until cipher_session_end() so every buffer processed during the session
+ * reuses it, the key expansion costs as much as several block operations on the ATmega32U4.
+ *
+ * @param key Pointer to the 32 bytes key, can be cleared by the caller once the session is open.
+ * @return true if the session is open, false if the key was invalid.
  */
-bool encrypt(uint8_t *output, const uint8_t *input, uint8_t len, const uint8_t *key) {
-#ifdef DEBUG
-  // Print the size of the input data and the number of AES blocks that will be processed.
-  Serial1.print(F("Taille entree chiffrement: ")); Serial1.print(len); Serial1.println(F(" bytes"));
-  Serial1.print(F("Nombre de boucle: ")); Serial1.print(len / CIPHER_BLOCK_SIZE); Serial1.println(F(""));
-#endif
-
-  // Set the encryption key. If the key is invalid, return false.
-  if(!aes256ECB.setKey(key, aes256ECB.keySize())){
-    Serial1.println(F("Key non valide for encryption!"));
+bool cipher_session_begin(const uint8_t *key) {
+  if (self_test_failed)
     return false;
+  PROFILE_BEGIN(start);
+  session_active = aes256ECB.setKey(key, aes256ECB.keySize());
+  PROFILE_END(PROFILE_CRYPTO, start);
+  if (!session_active) {
+    aes256ECB.clear();
+    LOG_ERROR(LOG_KEY_INVALID);
   }
+  return session_active;
+}
+
 
-  // Encrypt each block of input and write it to the output.
-  for(uint8_t i = 0; i < len / CIPHER_BLOCK_SIZE; i++) {
-    uint8_t tmpBuffer[CIPHER_BLOCK_SIZE]; // Temporary buffer for encryption.
-    // Copy a block of plaintext into the temporary buffer.
-    memcpy(tmpBuffer, input + (i * CIPHER_BLOCK_SIZE), CIPHER_BLOCK_SIZE);
-    // Encrypt the block.
-    aes256ECB.encryptBlock(tmpBuffer, tmpBuffer);
-    // Copy the encrypted block back to the output buffer.
-    memcpy(output + (i * CIPHER_BLOCK_SIZE), tmpBuffer, CIPHER_BLOCK_SIZE);
+/**
+ * @brief Clears the key schedule, to be called on logout or session timeout.
+ */
+void cipher_session_end(void) {
+  aes256ECB.clear();  // Clear AES object's internal state to prevent leakage of sensitive information.
+  session_active = false;
+}
+
+
+bool cipher_session_active(void) {
+  return session_active;
+}
+
+
+/**
+ * @brief Runs a known answer through a mode, encrypting the plaintext of the vectors then decrypting it back.
+ *
+ * @return true if both directions gave the expected answer.
+ */
+static bool self_test_mode(const CipherVector *vector) {
+  CipherVector expected;
+  uint8_t data[2 * CIPHER_BLOCK_SIZE];
+  CipherStream stream;
+  memcpy_P(&expected, vector, sizeof(CipherVector));
+  memcpy_P(data, self_test_plain, sizeof(data));
+
+  // A piece of one block then one of the rest, so the chaining between pieces is checked too.
+  bool passed = cipher_stream_init(&stream, expected.mode, expected.iv)
+                && cipher_stream_update(&stream, data, CIPHER_BLOCK_SIZE)
+                && cipher_stream_update(&stream, data + CIPHER_BLOCK_SIZE, CIPHER_BLOCK_SIZE)
+                && memcmp(data, expected.cipher, sizeof(data)) == 0;
+  uint8_t decryptMode = expected.mode == CIPHER_MODE_CTR ? CIPHER_MODE_CTR : expected.mode + 1;
+  passed = passed && cipher_stream_init(&stream, decryptMode, expected.iv)
+           && cipher_stream_update(&stream, data, sizeof(data))
+           && memcmp_P(data, self_test_plain, sizeof(data)) == 0;
+  cipher_stream_final(&stream);
+  return passed;
+}
+
+
+bool cipher_self_test(void) {
+  uint8_t key[32];
+  memcpy_P(key, self_test_key, sizeof(key));
+  self_test_failed = false;
+  bool passed = cipher_session_begin(key);
+  for (uint8_t i = 0; passed && i < sizeof(self_test_vectors) / sizeof(CipherVector); i++) {
+    passed = self_test_mode(&self_test_vectors[i]);
+    if (!passed)
+      LOG_ERROR(LOG_CIPHER_SELF_TEST, pgm_read_byte(&self_test_vectors[i].mode));
   }
+  cipher_session_end();
+  memset(key, 0, sizeof(key));
+  self_test_failed = !passed;
+  return passed;
+}
+
+
+/**
+ * @brief Encrypts a buffer using AES-256 ECB mode with the session's key schedule.
+ *
+ * @param output Pointer to the buffer where encrypted data should be stored, can be the input buffer.
+ * @param input Pointer to the data to be encrypted.
+ * @param len Length of the input data in bytes. Must be a multiple of CIPHER_BLOCK_SIZE.
+ * @return true if encryption was successful, false if no session is open.
+ */
+bool cipher_session_encrypt(uint8_t *output, const uint8_t *input, uint16_t len) {
+  // Log the size of the input data and the number of AES blocks that will be processed.
+  LOG_DEBUG(LOG_ENCRYPT_SIZE, len, len / CIPHER_BLOCK_SIZE);
+
+  if (!session_active)
+    return false;
 
-  // Clear AES object's internal state to prevent leakage of sensitive information.
-  aes256ECB.clear();
+  // Encrypt each block in place, the AES object supports the same buffer for input and output.
+  PROFILE_BEGIN(start);
+  for (uint16_t i = 0; i < len / CIPHER_BLOCK_SIZE; i++)
+    aes256ECB.encryptBlock(output + (i * CIPHER_BLOCK_SIZE), input + (i * CIPHER_BLOCK_SIZE));
+  PROFILE_END(PROFILE_CRYPTO, start);
 
   return true;  // Indicate successful encryption.
 }
 
 
 /**
- * @brief Decrypts a block of data using AES-256 ECB mode.
- * 
- * This function takes an input block of ciphertext and decrypts it using the AES-256 ECB mode of decryption.
- * It assumes that the input data length is a multiple of the AES block size (16 bytes). It uses the provided key
- * to perform the decryption and places the result in the output buffer.
+ * @brief Decrypts a buffer using AES-256 ECB mode with the session's key schedule.
  *
- * @param output Pointer to the buffer where decrypted data should be stored.
+ * @param output Pointer to the buffer where decrypted data should be stored, can be the input buffer.
  * @param input Pointer to the data to be decrypted.
  * @param len Length of the input data in bytes. Must be a multiple of CIPHER_BLOCK_SIZE.
- * @param key Pointer to the decryption key.
- * @return false if decryption was successful, true if the key was invalid.
+ * @return true if decryption was successful, false if no session is open.
  */
-bool decrypt(uint8_t* output, const uint8_t* input, uint8_t len, const uint8_t* key) {
-#ifdef DEBUG
-  // Debug output for the size of the input data and the number of AES blocks to be processed.
-  Serial1.print(F("Taille entree dechiffrement: "));
-  Serial1.print(len);
-  Serial1.println(F(" bytes"));
-  Serial1.print(F("Nombre de boucle: "));
-  Serial1.print(len / CIPHER_BLOCK_SIZE);
-  Serial1.println(F(""));
-#endif
+bool cipher_session_decrypt(uint8_t *output, const uint8_t *input, uint16_t len) {
+  // Log the size of the input data and the number of AES blocks to be processed.
+  LOG_DEBUG(LOG_DECRYPT_SIZE, len, len / CIPHER_BLOCK_SIZE);
+
+  if (!session_active)
+    return false;
+
+  // Decrypt each block in place.
+  PROFILE_BEGIN(start);
+  for (uint16_t i = 0; i < len / CIPHER_BLOCK_SIZE; i++)
+    aes256ECB.decryptBlock(output + (i * CIPHER_BLOCK_SIZE), input + (i * CIPHER_BLOCK_SIZE));
+  PROFILE_END(PROFILE_CRYPTO, start);
+
+  return true;  // Indicate successful decryption.
+}
+
 
-  // Set the decryption key. Return true if the key is invalid, indicating an error.
-  if (!aes256ECB.setKey(key, aes256ECB.keySize())) {
-    Serial1.println(F("Key non valide for decryption!"));
-    return true;  // Indicate an error in key setup.
+/**
+ * @brief Makes the IV of a new CBC record from a nonce: the first 8 bytes of the salt, micros() and a counter
+ * of the IVs made since startup. The counter keeps the nonces of a boot distinct, the salt and the time
+ * those of different cards and boots.
+ *
+ * @param iv Pointer to the buffer receiving the CIPHER_BLOCK_SIZE bytes IV.
+ * @param salt Pointer to bytes telling the record apart from those of other cards, the card UID.
+ * @param len Length of the salt, only its first 8 bytes are used.
+ * @return true if the IV is ready, false if no session is open.
+ */
+bool cipher_session_iv(uint8_t *iv, const uint8_t *salt, uint8_t len) {
+  if (!session_active)
+    return false;
+
+  uint32_t now = micros();
+  uint32_t count = iv_counter++;
+  memset(iv, 0, CIPHER_BLOCK_SIZE);
+  memcpy(iv, salt, len < 8 ? len : 8);
+  memcpy(iv + 8, &now, sizeof(now));
+  memcpy(iv + 12, &count, sizeof(count));
+  aes256ECB.encryptBlock(iv, iv);
+  return true;
+}
+
+
+/**
+ * @brief Increments a counter block, as a 128-bit big-endian number.
+ */
+static void counter_increment(uint8_t *counter) {
+  for (int8_t i = CIPHER_BLOCK_SIZE - 1; i >= 0; i--) {
+    if (++counter[i])
+      break;
   }
+}
 
-  // Decrypt each block of input and write it to the output.
-  for (uint8_t i = 0; i < len / CIPHER_BLOCK_SIZE; i++) {
-#ifdef DEBUG
-    // Debug output for the byte offset of the current block.
-    Serial1.print(F("Decalage addresse: "));
-    Serial1.print((i * CIPHER_BLOCK_SIZE));
-    Serial1.println(F(" bytes"));
-#endif
-    uint8_t tmpBuffer[CIPHER_BLOCK_SIZE]; // Temporary buffer for decryption.
-    // Copy a block of ciphertext into the temporary buffer.
-    memcpy(tmpBuffer, input + (i * CIPHER_BLOCK_SIZE), CIPHER_BLOCK_SIZE);
-    // Decrypt the block.
-    aes256ECB.decryptBlock(tmpBuffer, tmpBuffer);
-    // Copy the decrypted block back to the output buffer.
-    memcpy(output + (i * CIPHER_BLOCK_SIZE), tmpBuffer, CIPHER_BLOCK_SIZE);
+
+bool cipher_stream_init(CipherStream *stream, uint8_t mode, const uint8_t *iv) {
+  memset(stream, 0, sizeof(CipherStream));
+  if (!session_active || mode > CIPHER_MODE_CTR)
+    return false;
+
+  stream->mode = mode;
+  if (mode != CIPHER_MODE_ECB_ENCRYPT && mode != CIPHER_MODE_ECB_DECRYPT)
+    memcpy(stream->chain, iv, CIPHER_BLOCK_SIZE);
+  stream->used = CIPHER_BLOCK_SIZE;  // No keystream computed yet.
+  return true;
+}
+
+
+bool cipher_stream_update(CipherStream *stream, uint8_t *data, uint16_t len) {
+  if (!session_active)
+    return false;
+
+  if (stream->mode == CIPHER_MODE_CTR) {
+    for (uint16_t i = 0; i < len; i++) {
+      if (stream->used == CIPHER_BLOCK_SIZE) {
+        aes256ECB.encryptBlock(stream->keystream, stream->chain);
+        counter_increment(stream->chain);
+        stream->used = 0;
+      }
+      data[i] ^= stream->keystream[stream->used++];
+    }
+    return true;
   }
 
-  aes256ECB.clear();  // Clear AES object's internal state to prevent leakage of sensitive information.
-  return false;  // Indicate successful decryption.
-}
\ No newline at end of file
+  if (len % CIPHER_BLOCK_SIZE)
+    return false;  // Block modes only take whole blocks, nothing is processed.
+
+  for (uint16_t offset = 0; offset < len; offset += CIPHER_BLOCK_SIZE) {
+    uint8_t *block = data + offset;
+    switch (stream->mode) {
+      case CIPHER_MODE_ECB_ENCRYPT:
+        aes256ECB.encryptBlock(block, block);
+        break;
+      case CIPHER_MODE_ECB_DECRYPT:
+        aes256ECB.decryptBlock(block, block);
+        break;
+      case CIPHER_MODE_CBC_ENCRYPT:
+        for (uint8_t i = 0; i < CIPHER_BLOCK_SIZE; i++)
+          block[i] ^= stream->chain[i];
+        aes256ECB.encryptBlock(block, block);
+        memcpy(stream->chain, block, CIPHER_BLOCK_SIZE);
+        break;
+      case CIPHER_MODE_CBC_DECRYPT:
+        {
+          uint8_t cipherBlock[CIPHER_BLOCK_SIZE];  // The ciphertext chains the next block, keep it before overwriting.
+          memcpy(cipherBlock, block, CIPHER_BLOCK_SIZE);
+          aes256ECB.decryptBlock(block, block);
+          for (uint8_t i = 0; i < CIPHER_BLOCK_SIZE; i++)
+            block[i] ^= stream->chain[i];
+          memcpy(stream->chain, cipherBlock, CIPHER_BLOCK_SIZE);
+        }
+        break;
+    }
+  }
+  return true;
+}
+
+
+void cipher_stream_final(CipherStream *stream) {
+  memset(stream, 0, sizeof(CipherStream));  // The keystream and chaining block are derived from the key.
+}
+
+
+#ifdef AES_BENCHMARK
+
+#define BENCHMARK_ROUNDS 32  // Operations timed together, micros() only has a 4 us resolution.
+
+/**
+ * Converts the time of BENCHMARK_ROUNDS operations to CPU cycles per operation.
+ */
+static unsigned long benchmark_cycles(unsigned long elapsed) {
+  return elapsed * (F_CPU / 1000000UL) / BENCHMARK_ROUNDS;
+}
+
+template<class Backend>
+static void benchmark_backend(const __FlashStringHelper *name) {
+  Backend aes;
+  uint8_t key[32];
+  uint8_t block[CIPHER_BLOCK_SIZE] = { 0 };
+  for (uint8_t i = 0; i < sizeof(key); i++)
+    key[i] = i;
+
+  unsigned long start = micros();
+  for (uint8_t i = 0; i < BENCHMARK_ROUNDS; i++)
+    aes.setKey(key, sizeof(key));
+  unsigned long keySetup = micros() - start;
+
+  start = micros();
+  for (uint8_t i = 0; i < BENCHMARK_ROUNDS; i++)
+    aes.encryptBlock(block, block);
+  unsigned long encryption = micros() - start;
+
+  start = micros();
+  for (uint8_t i = 0; i < BENCHMARK_ROUNDS; i++)
+    aes.decryptBlock(block, block);
+  unsigned long decryption = micros() - start;
+
+  aes.clear();
+
+  Console.print(name);
+  Console.print(F(": keySetup="));
+  Console.print(benchmark_cycles(keySetup));
+  Console.print(F(" encryptBlock="));
+  Console.print(benchmark_cycles(encryption));
+  Console.print(F(" decryptBlock="));
+  Console.print(benchmark_cycles(decryption));
+  Console.println(F(" cycles"));
+}
+
+void cipher_benchmark(void) {
+  benchmark_backend<AES256>(F("crypto"));
+  benchmark_backend<AES256Compact>(F("compact"));
+  benchmark_backend<AES256Table>(F("table"));
+}
+
+#endif
@@ -1,7 +1,144 @@
+#pragma once
+
 #include <Crypto.h> // Include the Crypto library for cryptographic operations
 #include <AES.h>    // Include the AES library specific for AES encryption methods
 #include "hardwareSerial.h"
 
+#include "aes_backends.h"  // Alternative AES-256 implementations.
+
 #define CIPHER_BLOCK_SIZE 16  // Define the block size for AES encryption, which is 16 bytes for AES-256
 
-AES256 aes256ECB;  // Create an instance of AES256 to use for ECB encryption
\ No newline at end of file
+// AES-256 implementation used by the session cipher, trading flash for speed.
+#define AES_BACKEND_CRYPTO 0   // AES256 from the Crypto library.
+#define AES_BACKEND_COMPACT 1  // AES256Compact: S-boxes only, smallest.
+#define AES_BACKEND_TABLE 2    // AES256Table: round tables in PROGMEM, 2 KB more flash, fewer operations per round.
+
+#ifndef AES_BACKEND
+#define AES_BACKEND AES_BACKEND_CRYPTO
+#endif
+
+// Builds the 'g' request measuring the key setup and block cycles of every backend. It links all of them.
+// #define AES_BENCHMARK
+
+#if AES_BACKEND == AES_BACKEND_CRYPTO
+typedef AES256 SessionAES;
+#elif AES_BACKEND == AES_BACKEND_COMPACT
+typedef AES256Compact SessionAES;
+#elif AES_BACKEND == AES_BACKEND_TABLE
+typedef AES256Table SessionAES;
+#else
+#error "Unknown AES_BACKEND"
+#endif
+
+// Chaining modes of a cipher stream.
+#define CIPHER_MODE_ECB_ENCRYPT 0  // Blocks encrypted independently: key store slots, and key records of older firmware.
+#define CIPHER_MODE_ECB_DECRYPT 1
+#define CIPHER_MODE_CBC_ENCRYPT 2  // Each block chained to the previous ciphertext, starting from the IV: key records.
+#define CIPHER_MODE_CBC_DECRYPT 3
+#define CIPHER_MODE_CTR 4          // Keystream from an encrypted counter, the same operation both ways.
+
+extern SessionAES aes256ECB;  // AES instance holding the session's key schedule.
+
+/**
+ * State of a stream encrypted or decrypted piece by piece with the session's key schedule.
+ * The data is processed in place, the stream only keeps the chaining block.
+ */
+typedef struct {
+  uint8_t mode;                        // One of the CIPHER_MODE_ values.
+  uint8_t chain[CIPHER_BLOCK_SIZE];    // CBC: previous ciphertext block. CTR: next counter block.
+  uint8_t keystream[CIPHER_BLOCK_SIZE];  // CTR: keystream of the current counter block.
+  uint8_t used;                        // CTR: keystream bytes already consumed, CIPHER_BLOCK_SIZE when none is left.
+} CipherStream;
+
+
+/**
+ * @brief Expands the AES-256 key schedule once for the whole admin session.
+ *
+ * @param key Pointer to the 32 bytes key.
+ * @return true if the session is open, false if the key was invalid.
+ */
+bool cipher_session_begin(const uint8_t *key);
+
+/**
+ * @brief Checks every mode against the known answers of NIST SP 800-38A, to be called once at startup before
+ * any session. Sessions are refused afterwards if a mode gave a wrong answer.
+ *
+ * @return true if every mode gave the expected ciphertext and plaintext back.
+ */
+bool cipher_self_test(void);
+
+/**
+ * @brief Zeroizes the session's key schedule.
+ */
+void cipher_session_end(void);
+
+bool cipher_session_active(void);
+
+/**
+ * @brief Encrypts a buffer using AES-256 ECB mode with the session's key schedule. Any number of
+ * buffers can be processed during a session without expanding the key again.
+ *
+ * @param output Pointer to the buffer where encrypted data should be stored, can be the input buffer.
+ * @param input Pointer to the data to be encrypted.
+ * @param len Length of the input data in bytes. Must be a multiple of CIPHER_BLOCK_SIZE.
+ * @return true if encryption was successful, false if no session is open.
+ */
+bool cipher_session_encrypt(uint8_t *output, const uint8_t *input, uint16_t len);
+
+/**
+ * @brief Decrypts a buffer using AES-256 ECB mode with the session's key schedule.
+ *
+ * @param output Pointer to the buffer where decrypted data should be stored, can be the input buffer.
+ * @param input Pointer to the data to be decrypted.
+ * @param len Length of the input data in bytes. Must be a multiple of CIPHER_BLOCK_SIZE.
+ * @return true if decryption was successful, false if no session is open.
+ */
+bool cipher_session_decrypt(uint8_t *output, const uint8_t *input, uint16_t len);
+
+/**
+ * @brief Makes the IV of a new CBC record: a nonce encrypted with the session's key schedule (NIST SP 800-38A,
+ * appendix C), so it cannot be predicted without the key.
+ *
+ * @param iv Pointer to the buffer receiving the CIPHER_BLOCK_SIZE bytes IV.
+ * @param salt Pointer to bytes telling the record apart from those of other cards, the card UID.
+ * @param len Length of the salt, only its first 8 bytes are used.
+ * @return true if the IV is ready, false if no session is open.
+ */
+bool cipher_session_iv(uint8_t *iv, const uint8_t *salt, uint8_t len);
+
+/**
+ * @brief Starts a stream with the session's key schedule.
+ *
+ * @param stream Stream state to initialize.
+ * @param mode One of the CIPHER_MODE_ values.
+ * @param iv Pointer to the CIPHER_BLOCK_SIZE bytes IV of the record (CBC) or initial counter block (CTR),
+ *           ignored in ECB. It must never be reused with the same key for another record.
+ * @return true if the stream is ready, false if no session is open or the mode is unknown.
+ */
+bool cipher_stream_init(CipherStream *stream, uint8_t mode, const uint8_t *iv);
+
+/**
+ * @brief Encrypts or decrypts the next piece of a stream, in place.
+ *
+ * CTR accepts pieces of any length. ECB and CBC work on whole blocks, so their pieces must be a multiple
+ * of CIPHER_BLOCK_SIZE, which is the size of a card block.
+ *
+ * @param stream Stream state.
+ * @param data Pointer to the data, overwritten with the result.
+ * @param len Length of the data in bytes.
+ * @return true if the data has been processed, false if the session was closed or the length is not allowed.
+ */
+bool cipher_stream_update(CipherStream *stream, uint8_t *data, uint16_t len);
+
+/**
+ * @brief Ends a stream and zeroizes its state.
+ */
+void cipher_stream_final(CipherStream *stream);
+
+#ifdef AES_BENCHMARK
+/**
+ * @brief Measures every AES backend and prints, for each one, the CPU cycles of a key setup and of a block
+ * encryption and decryption. The session's key schedule is not touched.
+ */
+void cipher_benchmark(void);
+#endif
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "aes_backends.h"
+
+// The Crypto library is not part of the repository: on the host, its AES256 is the firmware's own
+// byte-oriented implementation, which has the same interface.
+class AES256 : public AES256Compact {};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Wire.h>
+
+// Host replacement of the BusIO I2C device: transactions go to the HostI2cPeer attached to the device's
+// address (see host.h). An address without peer does not acknowledge.
+class Adafruit_I2CDevice {
+public:
+  Adafruit_I2CDevice(uint8_t addr, TwoWire* theWire = &Wire) : _addr(addr) { (void)theWire; }
+
+  uint8_t address(void) { return _addr; }
+  bool begin(bool addr_detect = true);
+  bool detected(void);
+  bool read(uint8_t* buffer, size_t len, bool stop = true);
+  bool write(const uint8_t* buffer, size_t len, bool stop = true, const uint8_t* prefix_buffer = nullptr,
+             size_t prefix_len = 0);
+  bool write_then_read(const uint8_t* write_buffer, size_t write_len, uint8_t* read_buffer, size_t read_len,
+                       bool stop = false);
+
+private:
+  uint8_t _addr;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <SPI.h>
+
+// Host replacement of the BusIO SPI device: transfers go to the HostSpiPeer attached to the device's chip
+// select pin (see host.h) instead of pins. A chip select without peer reads 0xFF, like a floating MISO.
+
+typedef enum {
+  SPI_BITORDER_MSBFIRST = MSBFIRST,
+  SPI_BITORDER_LSBFIRST = LSBFIRST,
+} BusIOBitOrder;
+
+class Adafruit_SPIDevice {
+public:
+  Adafruit_SPIDevice(int8_t cspin, uint32_t freq = 1000000, BusIOBitOrder dataOrder = SPI_BITORDER_MSBFIRST,
+                     uint8_t dataMode = SPI_MODE0, SPIClass* theSPI = &SPI);
+  Adafruit_SPIDevice(int8_t cspin, int8_t sck, int8_t miso, int8_t mosi, uint32_t freq = 1000000,
+                     BusIOBitOrder dataOrder = SPI_BITORDER_MSBFIRST, uint8_t dataMode = SPI_MODE0);
+
+  bool begin(void) { return true; }
+  bool read(uint8_t* buffer, size_t len, uint8_t sendvalue = 0xFF);
+  bool write(const uint8_t* buffer, size_t len, const uint8_t* prefix_buffer = nullptr, size_t prefix_len = 0);
+  bool write_then_read(const uint8_t* write_buffer, size_t write_len, uint8_t* read_buffer, size_t read_len,
+                       uint8_t sendvalue = 0xFF);
+  bool write_and_read(uint8_t* buffer, size_t len);
+
+  uint8_t transfer(uint8_t send);
+  void transfer(uint8_t* buffer, size_t len);
+  void beginTransaction(void) {}
+  void endTransaction(void) {}
+  void beginTransactionWithAssertingCS(void);
+  void endTransactionWithDeassertingCS(void);
+
+private:
+  int8_t _cs;
+};
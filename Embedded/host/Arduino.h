@@ -0,0 +1,141 @@
+#pragma once
+
+// Host replacement of the Arduino core: just what the firmware and the PN532 driver use, with time running
+// on a virtual clock. See host.h for the controls only the host build has.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+// Program memory is ordinary memory on the host.
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_byte_near(p) pgm_read_byte(p)
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#define pgm_read_ptr(p) (*(void* const*)(p))
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define strlen_P strlen
+#define strcpy_P strcpy
+
+#define F_CPU 16000000UL
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+typedef enum {
+  LSBFIRST = 0,
+  MSBFIRST = 1
+} BitOrder;
+
+// Same macros as the AVR core. Standard C++ headers must be included before this file.
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+class __FlashStringHelper;
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void yield(void);  // Called by delay() while it waits, empty unless the firmware defines it.
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+static inline void interrupts(void) {}
+static inline void noInterrupts(void) {}
+
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+  virtual int availableForWrite(void) { return 0; }
+  virtual void flush(void) {}
+
+  size_t print(const __FlashStringHelper* str) { return write((const char*)str); }
+  size_t print(const char* str) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(int value, int base = DEC) { return print((long)value, base); }
+  size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+
+  size_t println(void) { return write("\r\n"); }
+  size_t println(const __FlashStringHelper* str) { return print(str) + println(); }
+  size_t println(const char* str) { return print(str) + println(); }
+  size_t println(char c) { return print(c) + println(); }
+  size_t println(unsigned char value, int base = DEC) { return print(value, base) + println(); }
+  size_t println(int value, int base = DEC) { return print(value, base) + println(); }
+  size_t println(unsigned int value, int base = DEC) { return print(value, base) + println(); }
+  size_t println(long value, int base = DEC) { return print(value, base) + println(); }
+  size_t println(unsigned long value, int base = DEC) { return print(value, base) + println(); }
+  size_t println(double value, int digits = 2) { return print(value, digits) + println(); }
+};
+
+
+class Stream : public Print {
+public:
+  virtual int available(void) = 0;
+  virtual int read(void) = 0;
+  virtual int peek(void) = 0;
+  size_t readBytes(uint8_t* buffer, size_t length);
+  size_t readBytes(char* buffer, size_t length) { return readBytes((uint8_t*)buffer, length); }
+};
+
+
+/**
+ * Serial port of the host build. Serial reads from and writes to the byte stream set up by host_main.cpp
+ * (stdin/stdout, a pty, or an in-process feed), Serial1 is the debug port and writes to stderr.
+ */
+class HardwareSerial : public Stream {
+public:
+  explicit HardwareSerial(uint8_t port) : port(port) {}
+
+  void begin(unsigned long baud) { (void)baud; }
+  void end(void) {}
+  int available(void) override;
+  int read(void) override;
+  int peek(void) override;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  int availableForWrite(void) override { return 64; }  // One USB packet, the host never blocks.
+  void flush(void) override {}
+  operator bool() { return true; }
+
+private:
+  uint8_t port;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+
+// Sketch entry points, defined in Embedded.ino.
+void setup(void);
+void loop(void);
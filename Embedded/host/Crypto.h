@@ -0,0 +1,3 @@
+#pragma once
+
+// Nothing needed from the Crypto library's common header on the host, see AES.h.
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Arduino.h>
+
+// 1 KB of EEPROM like the ATmega32U4, blank (0xFF) unless host_eeprom_open() loaded an image.
+#define HOST_EEPROM_SIZE 1024
+
+uint8_t host_eeprom_read(int address);
+void host_eeprom_write(int address, uint8_t value);
+
+struct EERef {
+  int index;
+
+  operator uint8_t() const { return host_eeprom_read(index); }
+  EERef& operator=(uint8_t value) {
+    host_eeprom_write(index, value);
+    return *this;
+  }
+};
+
+class EEPROMClass {
+public:
+  uint8_t read(int address) { return host_eeprom_read(address); }
+  void write(int address, uint8_t value) { host_eeprom_write(address, value); }
+  void update(int address, uint8_t value) {
+    if (host_eeprom_read(address) != value)
+      host_eeprom_write(address, value);
+  }
+  EERef operator[](int address) { return EERef{ address }; }
+  uint16_t length(void) { return HOST_EEPROM_SIZE; }
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Only the definitions the drivers refer to, SPI devices are emulated by Adafruit_SPIDevice.h.
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+class SPIClass {};
+
+extern SPIClass SPI;
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <Arduino.h>
+
+// No I2C on the host, the PN532 is wired over SPI.
+class TwoWire {};
+
+extern TwoWire Wire;
@@ -0,0 +1,12 @@
+#pragma once
+
+// Host replacement of avr-libc's sleep modes: the CPU sleeping until the next interrupt is the virtual
+// clock moving to the next Timer0 tick, see sleep_cpu() in host_arduino.cpp.
+
+#define SLEEP_MODE_IDLE 0
+
+#define set_sleep_mode(mode) ((void)(mode))
+#define sleep_enable()
+#define sleep_disable()
+
+void sleep_cpu(void);
@@ -0,0 +1,3 @@
+#pragma once
+
+#include <Arduino.h>  // HardwareSerial is declared by the host Arduino.h.
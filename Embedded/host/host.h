@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Controls of the host build that the firmware never calls: how the serial port is connected, when an
+// idle run ends, and which emulated chips sit on the SPI bus.
+
+// Virtual time a run may spend without serial input once the input is closed before it exits, long
+// enough for a card operation to finish and short enough to end a scripted run quickly.
+#define HOST_IDLE_EXIT_MS 60000UL
+
+// Silence of the firmware after which a script sends its next packet: longer than the 200 ms the
+// firmware waits before clearing its input at the end of a request.
+#define HOST_SERIAL_QUIET_MS 500
+
+/**
+ * Device on the emulated SPI bus, answering one byte per byte clocked by the firmware.
+ */
+class HostSpiPeer {
+public:
+  virtual ~HostSpiPeer() {}
+  virtual void select(void) {}                  // Chip select asserted, a new transaction starts.
+  virtual uint8_t exchange(uint8_t mosi) = 0;   // @return The MISO byte clocked out with mosi.
+  virtual void deselect(void) {}                // Chip select released.
+};
+
+/**
+ * Device on the emulated I2C bus. Each call is one transaction, from start to stop condition.
+ */
+class HostI2cPeer {
+public:
+  virtual ~HostI2cPeer() {}
+  virtual bool i2c_write(const uint8_t* data, size_t len) = 0;
+  virtual bool i2c_read(uint8_t* data, size_t len) = 0;
+};
+
+/**
+ * Connects a peer to a chip select pin, replacing the previous one. nullptr disconnects the pin.
+ */
+void host_spi_attach(int8_t cs, HostSpiPeer* peer);
+
+/**
+ * Connects a peer to a 7 bits I2C address, replacing the previous one. nullptr disconnects it.
+ */
+void host_i2c_attach(uint8_t address, HostI2cPeer* peer);
+
+/**
+ * Connects Serial to file descriptors: requests are read from in_fd and replies written to out_fd.
+ *
+ * @param closable false for a pty, whose input never ends, true for a pipe or file whose end of file
+ *                 means no more requests: the run then exits once idle for HOST_IDLE_EXIT_MS.
+ */
+void host_serial_open(int in_fd, int out_fd, bool closable);
+
+/**
+ * Queues bytes as if received by Serial, for a driver running in the same process. Each call is
+ * delivered as one USB packet, so a request and its arguments sent in separate calls stay separate.
+ */
+void host_serial_feed(const uint8_t* data, size_t len);
+
+/**
+ * @return The virtual time of the last byte written to Serial, when the last reply was complete.
+ */
+unsigned long long host_serial_last_output(void);
+
+/**
+ * @return The number of USB packets Serial has sent, each write starting a new one.
+ */
+unsigned long host_serial_packets(void);
+
+/**
+ * Sets the virtual idle time after which a closed input ends the run, 0 to never exit.
+ */
+void host_set_idle_exit(unsigned long ms);
+
+/**
+ * Loads the EEPROM image from a file and writes every later change through to it. A missing or short
+ * file starts with a blank EEPROM.
+ *
+ * @return false if the file cannot be created.
+ */
+bool host_eeprom_open(const char* path);
+
+/**
+ * @return The virtual time in microseconds, without advancing it like micros() does.
+ */
+unsigned long long host_clock(void);
+
+/**
+ * Advances the virtual clock, for peers modelling the time an operation takes.
+ */
+void host_clock_advance(unsigned long us);
@@ -0,0 +1,501 @@
+#include <deque>
+#include <string>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host.h"
+#include <avr/sleep.h>
+#include <EEPROM.h>
+#include <SPI.h>
+#include <Wire.h>
+#include <Adafruit_I2CDevice.h>
+#include <Adafruit_SPIDevice.h>
+
+// Runtime of the host build. Time is virtual: delay() advances the clock instead of waiting, and every
+// clock read moves it by 1 us so the firmware's polling loops always make progress.
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+EEPROMClass EEPROM;
+TwoWire Wire;
+SPIClass SPI;
+
+static unsigned long long clock_us = 0;
+
+static int serial_in = -1;
+static int serial_out = STDOUT_FILENO;
+static bool serial_closable = true;    // End of file on serial_in ends the run once idle.
+static bool serial_eof = false;
+static std::string serial_pending;     // Bytes read from serial_in and not yet delivered as a packet.
+static std::deque<std::string> serial_feed;  // Packets queued by host_serial_feed().
+static std::string rx_packet;          // Packet the firmware is reading.
+static size_t rx_pos = 0;
+static unsigned long long last_input_us = 0;
+static unsigned long long last_output_us = 0;
+static unsigned long long last_empty_poll_us = 0;
+static unsigned long serial_packets = 0;
+static unsigned long idle_exit_ms = HOST_IDLE_EXIT_MS;
+
+static uint8_t eeprom[HOST_EEPROM_SIZE];
+static bool eeprom_ready = false;
+static FILE* eeprom_file = NULL;
+
+static uint8_t pin_level[32];
+
+#define HOST_SPI_PINS 32
+static HostSpiPeer* spi_peers[HOST_SPI_PINS];
+static HostI2cPeer* i2c_peers[128];
+
+
+unsigned long long host_clock(void) {
+  return clock_us;
+}
+
+void host_clock_advance(unsigned long us) {
+  clock_us += us;
+}
+
+void host_set_idle_exit(unsigned long ms) {
+  idle_exit_ms = ms;
+}
+
+
+/**
+ * Ends the run once the input is closed, every request has been consumed and the firmware has been
+ * waiting for HOST_IDLE_EXIT_MS of virtual time: nothing it does from there on can depend on the input.
+ */
+static void idle_check(void) {
+  if (!serial_closable || !serial_eof || idle_exit_ms == 0)
+    return;
+  if (rx_pos < rx_packet.size() || !serial_feed.empty() || !serial_pending.empty())
+    return;
+  if (clock_us - last_input_us < (unsigned long long)idle_exit_ms * 1000)
+    return;
+  exit(0);
+}
+
+
+/**
+ * Moves the next request bytes from serial_in to the packet queue. A pty delivers what has arrived, up
+ * to a USB packet of 64 bytes; a pipe or file is read line by line, each line without its end of line
+ * being one packet, so a script sends a request and its arguments as separate lines.
+ */
+static void serial_poll(int timeout_ms) {
+  if (serial_in >= 0 && !serial_eof) {
+    struct pollfd pfd = { serial_in, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout_ms) > 0) {
+      char buffer[64];
+      ssize_t n = read(serial_in, buffer, sizeof(buffer));
+      if (n > 0)
+        serial_pending.append(buffer, n);
+      else if (n == 0 || (errno != EINTR && errno != EAGAIN))
+        serial_eof = serial_closable;  // A pty whose client went away is reopened by the next client.
+    }
+  }
+
+  if (!serial_closable) {
+    if (!serial_pending.empty()) {
+      serial_feed.push_back(serial_pending.substr(0, 64));
+      serial_pending.erase(0, 64);
+    }
+    return;
+  }
+
+  size_t end;
+  while ((end = serial_pending.find('\n')) != std::string::npos) {
+    std::string line = serial_pending.substr(0, end);
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.erase(line.size() - 1);
+    if (!line.empty())
+      serial_feed.push_back(line);
+    serial_pending.erase(0, end + 1);
+  }
+  if (serial_eof && !serial_pending.empty()) {
+    serial_feed.push_back(serial_pending);
+    serial_pending.clear();
+  }
+}
+
+
+/**
+ * Makes the next packet readable once the firmware has consumed the current one, like the USB endpoint
+ * which only accepts a packet when the previous one has been read. A packet arrives at most once per 1 ms
+ * USB frame: polling again within the frame of an empty poll moves the clock to the next frame, so a
+ * waiting loop makes progress, while the polls a delay() or a sleep already spaced out cost nothing.
+ *
+ * A script's packet is only delivered once the firmware has been quiet for HOST_SERIAL_QUIET_MS, like the
+ * desktop app which sends the next request after reading the whole reply: the firmware clears its input
+ * at the end of a request, a request sent earlier would be swallowed.
+ */
+static void serial_receive(void) {
+  if (rx_pos < rx_packet.size())
+    return;
+
+  if (serial_feed.empty())
+    serial_poll(serial_closable ? 0 : 1);
+  unsigned long long quiet_since = last_output_us > last_input_us ? last_output_us : last_input_us;
+  if (serial_feed.empty() || (serial_closable && clock_us - quiet_since < HOST_SERIAL_QUIET_MS * 1000ULL)) {
+    if (clock_us - last_empty_poll_us < 1000)
+      clock_us = last_empty_poll_us + 1000;
+    last_empty_poll_us = clock_us;
+    idle_check();
+    return;
+  }
+
+  rx_packet = serial_feed.front();
+  serial_feed.pop_front();
+  rx_pos = 0;
+  last_input_us = clock_us;
+}
+
+
+void host_serial_open(int in_fd, int out_fd, bool closable) {
+  serial_in = in_fd;
+  serial_out = out_fd;
+  serial_closable = closable;
+  serial_eof = in_fd < 0;
+}
+
+unsigned long long host_serial_last_output(void) {
+  return last_output_us;
+}
+
+unsigned long host_serial_packets(void) {
+  return serial_packets;
+}
+
+void host_serial_feed(const uint8_t* data, size_t len) {
+  serial_feed.push_back(std::string((const char*)data, len));
+}
+
+
+int HardwareSerial::available(void) {
+  if (port != 0)
+    return 0;
+  serial_receive();
+  return rx_packet.size() - rx_pos;
+}
+
+int HardwareSerial::read(void) {
+  if (!available())
+    return -1;
+  return (uint8_t)rx_packet[rx_pos++];
+}
+
+int HardwareSerial::peek(void) {
+  if (!available())
+    return -1;
+  return (uint8_t)rx_packet[rx_pos];
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  if (port == 0) {
+    last_output_us = clock_us;
+    serial_packets += (size + 63) / 64;  // A write is a transaction of its own, its last packet short.
+  }
+  int fd = port == 0 ? serial_out : STDERR_FILENO;
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = ::write(fd, buffer + done, size - done);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR)
+        continue;
+      break;
+    }
+    done += n;
+  }
+  return size;
+}
+
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(unsigned long value, int base) {
+  char buffer[8 * sizeof(long) + 1];
+  char* p = &buffer[sizeof(buffer) - 1];
+  *p = '\0';
+  if (base < 2)
+    base = 10;
+  do {
+    uint8_t digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value);
+  return write(p);
+}
+
+size_t Print::print(long value, int base) {
+  if (base == 10 && value < 0)
+    return print('-') + print((unsigned long)-value, base);
+  return print((unsigned long)value, base);
+}
+
+size_t Print::print(double value, int digits) {
+  char buffer[48];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+  return write(buffer);
+}
+
+
+size_t Stream::readBytes(uint8_t* buffer, size_t length) {
+  // Same 1 s timeout as the Arduino core, in virtual time.
+  size_t count = 0;
+  unsigned long start = millis();
+  while (count < length) {
+    int c = read();
+    if (c < 0) {
+      if (millis() - start >= 1000)
+        break;
+      continue;
+    }
+    buffer[count++] = c;
+  }
+  return count;
+}
+
+
+unsigned long micros(void) {
+  return (unsigned long)(clock_us++);
+}
+
+unsigned long millis(void) {
+  return (unsigned long)(clock_us++ / 1000);
+}
+
+/**
+ * A pty session is driven by a person or the desktop app, so its delays also take real time; a scripted
+ * run goes as fast as it can.
+ */
+static void real_sleep(unsigned long us) {
+  if (serial_closable || us == 0)
+    return;
+  struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+  nanosleep(&ts, NULL);
+}
+
+/**
+ * Like the AVR core, calls yield() while it waits: once per millisecond of virtual time.
+ */
+void delay(unsigned long ms) {
+  unsigned long long end = clock_us + (unsigned long long)ms * 1000;
+  do {
+    yield();
+    unsigned long long step = end > clock_us ? end - clock_us : 0;
+    clock_us += step < 1000 ? step : 1000;
+  } while (clock_us < end);
+  real_sleep(ms * 1000);
+  idle_check();
+}
+
+/**
+ * Default of the core, which the firmware replaces to run its background tasks.
+ */
+__attribute__((weak)) void yield(void) {}
+
+/**
+ * Sleeping until the next interrupt is sleeping until the next Timer0 tick, the virtual clock is moved to
+ * the next millisecond.
+ */
+void sleep_cpu(void) {
+  unsigned long long next = (clock_us / 1000 + 1) * 1000;
+  real_sleep(next - clock_us);
+  clock_us = next;
+  idle_check();
+}
+
+void delayMicroseconds(unsigned int us) {
+  clock_us += us;
+}
+
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin, (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < sizeof(pin_level))
+    pin_level[pin] = value ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  return pin < sizeof(pin_level) ? pin_level[pin] : LOW;
+}
+
+
+static void eeprom_init(void) {
+  if (eeprom_ready)
+    return;
+  memset(eeprom, 0xFF, sizeof(eeprom));
+  eeprom_ready = true;
+}
+
+bool host_eeprom_open(const char* path) {
+  eeprom_init();
+  eeprom_file = fopen(path, "r+b");
+  if (eeprom_file) {
+    // A short image keeps the blank bytes after its end.
+    size_t n = fread(eeprom, 1, sizeof(eeprom), eeprom_file);
+    (void)n;
+  } else {
+    eeprom_file = fopen(path, "w+b");
+    if (!eeprom_file)
+      return false;
+  }
+  fseek(eeprom_file, 0, SEEK_SET);
+  fwrite(eeprom, 1, sizeof(eeprom), eeprom_file);
+  fflush(eeprom_file);
+  return true;
+}
+
+uint8_t host_eeprom_read(int address) {
+  eeprom_init();
+  if (address < 0 || address >= HOST_EEPROM_SIZE)
+    return 0xFF;
+  return eeprom[address];
+}
+
+void host_eeprom_write(int address, uint8_t value) {
+  eeprom_init();
+  if (address < 0 || address >= HOST_EEPROM_SIZE)
+    return;
+  eeprom[address] = value;
+  clock_us += 3400;  // Erase and write time of an EEPROM byte.
+  if (eeprom_file) {
+    fseek(eeprom_file, address, SEEK_SET);
+    fputc(value, eeprom_file);
+    fflush(eeprom_file);
+  }
+}
+
+
+void host_spi_attach(int8_t cs, HostSpiPeer* peer) {
+  if (cs >= 0 && cs < HOST_SPI_PINS)
+    spi_peers[cs] = peer;
+}
+
+static HostSpiPeer* spi_peer(int8_t cs) {
+  return cs >= 0 && cs < HOST_SPI_PINS ? spi_peers[cs] : NULL;
+}
+
+Adafruit_SPIDevice::Adafruit_SPIDevice(int8_t cspin, uint32_t freq, BusIOBitOrder dataOrder, uint8_t dataMode,
+                                       SPIClass* theSPI)
+  : _cs(cspin) {
+  (void)freq, (void)dataOrder, (void)dataMode, (void)theSPI;
+}
+
+Adafruit_SPIDevice::Adafruit_SPIDevice(int8_t cspin, int8_t sck, int8_t miso, int8_t mosi, uint32_t freq,
+                                       BusIOBitOrder dataOrder, uint8_t dataMode)
+  : _cs(cspin) {
+  (void)sck, (void)miso, (void)mosi, (void)freq, (void)dataOrder, (void)dataMode;
+}
+
+void Adafruit_SPIDevice::beginTransactionWithAssertingCS(void) {
+  digitalWrite(_cs, LOW);
+  if (HostSpiPeer* peer = spi_peer(_cs))
+    peer->select();
+}
+
+void Adafruit_SPIDevice::endTransactionWithDeassertingCS(void) {
+  if (HostSpiPeer* peer = spi_peer(_cs))
+    peer->deselect();
+  digitalWrite(_cs, HIGH);
+}
+
+uint8_t Adafruit_SPIDevice::transfer(uint8_t send) {
+  clock_us += 8;  // One byte at 1 MHz.
+  HostSpiPeer* peer = spi_peer(_cs);
+  return peer ? peer->exchange(send) : 0xFF;
+}
+
+void Adafruit_SPIDevice::transfer(uint8_t* buffer, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    buffer[i] = transfer(buffer[i]);
+}
+
+bool Adafruit_SPIDevice::read(uint8_t* buffer, size_t len, uint8_t sendvalue) {
+  beginTransactionWithAssertingCS();
+  for (size_t i = 0; i < len; i++)
+    buffer[i] = transfer(sendvalue);
+  endTransactionWithDeassertingCS();
+  return true;
+}
+
+bool Adafruit_SPIDevice::write(const uint8_t* buffer, size_t len, const uint8_t* prefix_buffer, size_t prefix_len) {
+  beginTransactionWithAssertingCS();
+  for (size_t i = 0; i < prefix_len; i++)
+    transfer(prefix_buffer[i]);
+  for (size_t i = 0; i < len; i++)
+    transfer(buffer[i]);
+  endTransactionWithDeassertingCS();
+  return true;
+}
+
+bool Adafruit_SPIDevice::write_then_read(const uint8_t* write_buffer, size_t write_len, uint8_t* read_buffer,
+                                         size_t read_len, uint8_t sendvalue) {
+  beginTransactionWithAssertingCS();
+  for (size_t i = 0; i < write_len; i++)
+    transfer(write_buffer[i]);
+  for (size_t i = 0; i < read_len; i++)
+    read_buffer[i] = transfer(sendvalue);
+  endTransactionWithDeassertingCS();
+  return true;
+}
+
+bool Adafruit_SPIDevice::write_and_read(uint8_t* buffer, size_t len) {
+  beginTransactionWithAssertingCS();
+  transfer(buffer, len);
+  endTransactionWithDeassertingCS();
+  return true;
+}
+
+
+void host_i2c_attach(uint8_t address, HostI2cPeer* peer) {
+  if (address < 128)
+    i2c_peers[address] = peer;
+}
+
+/**
+ * Every byte, address included, takes 9 clocks at 400 kHz.
+ */
+static HostI2cPeer* i2c_transaction(uint8_t address, size_t len) {
+  clock_us += (len + 1) * 45 / 2;
+  return address < 128 ? i2c_peers[address] : NULL;
+}
+
+bool Adafruit_I2CDevice::begin(bool addr_detect) {
+  return !addr_detect || detected();
+}
+
+bool Adafruit_I2CDevice::detected(void) {
+  return i2c_transaction(_addr, 0) != NULL;
+}
+
+bool Adafruit_I2CDevice::read(uint8_t* buffer, size_t len, bool stop) {
+  (void)stop;
+  HostI2cPeer* peer = i2c_transaction(_addr, len);
+  return peer && peer->i2c_read(buffer, len);
+}
+
+bool Adafruit_I2CDevice::write(const uint8_t* buffer, size_t len, bool stop, const uint8_t* prefix_buffer,
+                               size_t prefix_len) {
+  (void)stop;
+  HostI2cPeer* peer = i2c_transaction(_addr, prefix_len + len);
+  if (!peer)
+    return false;
+  std::string data((const char*)prefix_buffer, prefix_buffer ? prefix_len : 0);
+  data.append((const char*)buffer, len);
+  return peer->i2c_write((const uint8_t*)data.data(), data.size());
+}
+
+bool Adafruit_I2CDevice::write_then_read(const uint8_t* write_buffer, size_t write_len, uint8_t* read_buffer,
+                                         size_t read_len, bool stop) {
+  return write(write_buffer, write_len, stop) && read(read_buffer, read_len);
+}
@@ -0,0 +1,332 @@
+#include <stdio.h>
+
+#include "host_card.h"
+
+#include <Adafruit_PN532.h>
+
+#define NTAG_CMD_GET_VERSION 0x60
+
+// Rights checked against the access conditions, bit 0 for key A and bit 1 for key B.
+#define RIGHT_READ 0          // Data block.
+#define RIGHT_WRITE 1
+#define RIGHT_WRITE_KEY_A 0   // Sector trailer.
+#define RIGHT_READ_ACCESS 1
+#define RIGHT_WRITE_ACCESS 2
+#define RIGHT_READ_KEY_B 3
+#define RIGHT_WRITE_KEY_B 4
+
+#define KEY_A 1
+#define KEY_B 2
+#define KEY_AB 3
+
+// Access conditions C1C2C3 of the MIFARE Classic datasheet, indexed by (C1 << 2) | (C2 << 1) | C3.
+static const uint8_t data_rights[8][2] = {
+  { KEY_AB, KEY_AB },  // 000
+  { KEY_AB, 0 },       // 001
+  { KEY_AB, 0 },       // 010
+  { KEY_B, KEY_B },    // 011
+  { KEY_AB, KEY_B },   // 100
+  { KEY_B, 0 },        // 101
+  { KEY_AB, KEY_B },   // 110
+  { 0, 0 },            // 111
+};
+
+static const uint8_t trailer_rights[8][5] = {
+  { KEY_A, KEY_A, 0, KEY_A, KEY_A },         // 000
+  { KEY_A, KEY_A, KEY_A, KEY_A, KEY_A },     // 001, transport configuration
+  { 0, KEY_A, 0, KEY_A, 0 },                 // 010
+  { KEY_B, KEY_AB, KEY_B, 0, KEY_B },        // 011
+  { KEY_B, KEY_AB, 0, 0, KEY_B },            // 100
+  { 0, KEY_AB, KEY_B, 0, 0 },                // 101
+  { 0, KEY_AB, 0, 0, 0 },                    // 110
+  { 0, KEY_AB, 0, 0, 0 },                    // 111
+};
+
+static const uint8_t transport_trailer[16] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x07, 0x80, 0x69, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+
+bool HostCard::attach_file(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (f) {
+    // A short dump keeps the blank card's memory after its end.
+    size_t n = fread(memory, 1, memory_size, f);
+    (void)n;
+    fclose(f);
+  }
+  file = path;
+  f = fopen(path, "r+b");
+  if (!f)
+    f = fopen(path, "w+b");
+  if (!f)
+    return false;
+  fclose(f);
+  save();
+  return true;
+}
+
+
+void HostCard::save(void) {
+  if (!file)
+    return;
+  FILE* f = fopen(file, "wb");
+  if (!f)
+    return;
+  fwrite(memory, 1, memory_size, f);
+  fclose(f);
+}
+
+
+HostClassicCard::HostClassicCard(uint16_t blocks, const uint8_t* card_uid)
+  : HostCard(new uint8_t[blocks * 16], blocks * 16), blocks(blocks) {
+  memcpy(uid, card_uid, 4);
+  uid_len = 4;
+  sens_res = blocks > 64 ? 0x0002 : 0x0004;
+  sel_res = blocks > 64 ? 0x18 : 0x08;
+  program_us = 2500;
+
+  memset(memory, 0, memory_size);
+  for (uint16_t block = 0; block < blocks; block++) {
+    if (trailer_block(block) == block)
+      memcpy(&memory[block * 16], transport_trailer, 16);
+  }
+  // Manufacturer block: UID, BCC, SAK and ATQA.
+  memcpy(memory, uid, 4);
+  memory[4] = uid[0] ^ uid[1] ^ uid[2] ^ uid[3];
+  memory[5] = sel_res;
+  memory[6] = sens_res;
+  memory[7] = sens_res >> 8;
+}
+
+HostClassicCard::~HostClassicCard() {
+  delete[] memory;
+}
+
+
+void HostClassicCard::select(void) {
+  HostCard::select();
+  auth_trailer = -1;
+}
+
+
+/**
+ * Sectors 0 to 31 have 4 blocks, the 8 last sectors of a 4K card have 16.
+ */
+uint8_t HostClassicCard::trailer_block(uint8_t block) const {
+  return block < 128 ? block | 0x03 : block | 0x0F;
+}
+
+
+/**
+ * @return The access condition C1C2C3 of a block, 0xFF if the access bits of its sector are inconsistent.
+ */
+uint8_t HostClassicCard::access_condition(uint8_t block) const {
+  const uint8_t* access = &memory[trailer_block(block) * 16 + 6];
+  if ((access[0] & 0x0F) != (~access[1] >> 4 & 0x0F) || (access[0] >> 4) != (~access[2] & 0x0F)
+      || (access[1] & 0x0F) != (~access[2] >> 4 & 0x0F))
+    return 0xFF;
+
+  uint8_t group;
+  if (block < 128)
+    group = block & 0x03;
+  else
+    group = (block & 0x0F) == 0x0F ? 3 : (block & 0x0F) / 5;  // Data blocks of large sectors by groups of 5.
+
+  uint8_t c1 = access[1] >> (4 + group) & 1;
+  uint8_t c2 = access[2] >> group & 1;
+  uint8_t c3 = access[2] >> (4 + group) & 1;
+  return c1 << 2 | c2 << 1 | c3;
+}
+
+
+bool HostClassicCard::allowed(uint8_t block, uint8_t right) const {
+  if (auth_trailer != trailer_block(block))
+    return false;
+  uint8_t condition = access_condition(block);
+  if (condition == 0xFF)
+    return false;
+
+  uint8_t trailer_condition = access_condition(trailer_block(block));
+  if (auth_key_b && trailer_rights[trailer_condition][RIGHT_READ_KEY_B])
+    return false;  // A readable key B is data, it grants no access.
+
+  uint8_t keys = block == trailer_block(block) ? trailer_rights[condition][right] : data_rights[condition][right];
+  return keys & (auth_key_b ? KEY_B : KEY_A);
+}
+
+
+uint8_t HostClassicCard::exchange(const uint8_t* cmd, uint8_t len, uint8_t* response, uint8_t* response_len,
+                                  bool* programmed) {
+  *response_len = 0;
+  if (halted || len < 2 || cmd[1] >= blocks)
+    return HOST_CARD_TIMEOUT;
+
+  uint8_t block = cmd[1];
+  uint8_t trailer = trailer_block(block);
+  uint8_t* data = &memory[block * 16];
+
+  switch (cmd[0]) {
+    case MIFARE_CMD_AUTH_A:
+    case MIFARE_CMD_AUTH_B: {
+      if (len < 12)
+        return HOST_CARD_TIMEOUT;
+      const uint8_t* key = &memory[trailer * 16 + (cmd[0] == MIFARE_CMD_AUTH_A ? 0 : 10)];
+      if (memcmp(&cmd[2], key, 6) != 0 || memcmp(&cmd[8], uid, 4) != 0) {
+        halted = true;  // A failed authentication leaves the card waiting to be selected again.
+        auth_trailer = -1;
+        return HOST_CARD_AUTH_ERROR;
+      }
+      auth_trailer = trailer;
+      auth_key_b = cmd[0] == MIFARE_CMD_AUTH_B;
+      return HOST_CARD_OK;
+    }
+
+    case MIFARE_CMD_READ:
+      if (block == trailer) {
+        if (auth_trailer != trailer)
+          break;
+        // Key A never reads back, key B and the access bits only with the right to read them.
+        memset(response, 0, 16);
+        if (allowed(block, RIGHT_READ_ACCESS))
+          memcpy(&response[6], &data[6], 4);
+        if (allowed(block, RIGHT_READ_KEY_B))
+          memcpy(&response[10], &data[10], 6);
+      } else {
+        if (!allowed(block, RIGHT_READ))
+          break;
+        memcpy(response, data, 16);
+      }
+      *response_len = 16;
+      return HOST_CARD_OK;
+
+    case MIFARE_CMD_WRITE:
+      if (len < 18 || block == 0)
+        break;
+      if (block == trailer) {
+        if (auth_trailer != trailer)
+          break;
+        // Each part of the trailer is only written with the right to write it, the others are kept.
+        bool key_a = allowed(block, RIGHT_WRITE_KEY_A);
+        bool access = allowed(block, RIGHT_WRITE_ACCESS);
+        bool key_b = allowed(block, RIGHT_WRITE_KEY_B);
+        if (!key_a && !access && !key_b)
+          break;
+        if (key_a)
+          memcpy(&data[0], &cmd[2], 6);
+        if (access)
+          memcpy(&data[6], &cmd[8], 4);
+        if (key_b)
+          memcpy(&data[10], &cmd[12], 6);
+      } else {
+        if (!allowed(block, RIGHT_WRITE))
+          break;
+        memcpy(data, &cmd[2], 16);
+      }
+      *programmed = true;
+      save();
+      return HOST_CARD_OK;
+  }
+
+  // Refused command: the card answers NAK and goes back to idle.
+  halted = true;
+  auth_trailer = -1;
+  return HOST_CARD_TIMEOUT;
+}
+
+
+HostNtagCard::HostNtagCard(uint16_t pages, const uint8_t* card_uid)
+  : HostCard(new uint8_t[pages * 4], pages * 4), pages(pages) {
+  memcpy(uid, card_uid, 7);
+  uid_len = 7;
+  sens_res = 0x0044;
+  sel_res = 0x00;
+  program_us = 4100;
+
+  memset(memory, 0, memory_size);
+  memcpy(&memory[0], uid, 3);
+  memory[3] = 0x88 ^ uid[0] ^ uid[1] ^ uid[2];  // BCC0 includes the cascade tag.
+  memcpy(&memory[4], &uid[3], 4);
+  memory[8] = uid[3] ^ uid[4] ^ uid[5] ^ uid[6];
+  memory[9] = 0x48;
+
+  // Capability container with the size of the NDEF area in 8 bytes units, and an empty NDEF message.
+  static const uint8_t cc[4] = { 0xE1, 0x10, 0x12, 0x00 };
+  memcpy(&memory[12], cc, 4);
+  memory[14] = pages > 135 ? 0x6D : pages > 45 ? 0x3E : 0x12;
+  static const uint8_t ndef[4] = { 0x03, 0x00, 0xFE, 0x00 };
+  memcpy(&memory[16], ndef, 4);
+
+  // Dynamic lock bytes, CFG0 with AUTH0 past the end (no password protection), CFG1, PWD and PACK.
+  uint8_t* config = &memory[(pages - 5) * 4];
+  config[3] = 0xBD;
+  config[4] = 0x04;
+  config[7] = 0xFF;
+  memset(&config[12], 0xFF, 4);
+}
+
+HostNtagCard::~HostNtagCard() {
+  delete[] memory;
+}
+
+
+uint8_t HostNtagCard::exchange(const uint8_t* cmd, uint8_t len, uint8_t* response, uint8_t* response_len,
+                               bool* programmed) {
+  *response_len = 0;
+  if (halted || len < 1)
+    return HOST_CARD_TIMEOUT;
+
+  uint16_t pwd_page = pages - 2;
+  switch (cmd[0]) {
+    case NTAG_CMD_GET_VERSION:
+      if (len > 1)
+        return HOST_CARD_AUTH_ERROR;  // MIFARE Classic authentication, which the PN532 runs itself.
+      {
+        uint8_t version[8] = { 0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x0F, 0x03 };
+        version[6] = pages > 135 ? 0x13 : pages > 45 ? 0x11 : 0x0F;
+        memcpy(response, version, 8);
+      }
+      *response_len = 8;
+      return HOST_CARD_OK;
+
+    case MIFARE_CMD_AUTH_B:
+      return HOST_CARD_AUTH_ERROR;
+
+    case MIFARE_CMD_READ:
+      if (len < 2 || cmd[1] >= pages)
+        break;
+      // 4 pages, rolling over to page 0 at the end of the memory. PWD and PACK always read as 0.
+      for (uint8_t i = 0; i < 4; i++) {
+        uint16_t page = (cmd[1] + i) % pages;
+        if (page >= pwd_page)
+          memset(&response[i * 4], 0, 4);
+        else
+          memcpy(&response[i * 4], &memory[page * 4], 4);
+      }
+      *response_len = 16;
+      return HOST_CARD_OK;
+
+    case MIFARE_ULTRALIGHT_CMD_WRITE:
+    case MIFARE_CMD_WRITE: {  // Compatibility write: 16 bytes, only the first 4 are written.
+      uint8_t data_len = cmd[0] == MIFARE_CMD_WRITE ? 16 : 4;
+      if (len < 2 + data_len || cmd[1] < 2 || cmd[1] >= pages)
+        break;
+      uint8_t* page = &memory[cmd[1] * 4];
+      if (cmd[1] == 2) {
+        page[2] |= cmd[4];  // Static lock bytes.
+        page[3] |= cmd[5];
+      } else if (cmd[1] == 3) {
+        for (uint8_t i = 0; i < 4; i++)
+          page[i] |= cmd[2 + i];  // One-time programmable capability container.
+      } else {
+        memcpy(page, &cmd[2], 4);
+      }
+      *programmed = true;
+      save();
+      return HOST_CARD_OK;
+    }
+  }
+
+  halted = true;
+  return HOST_CARD_TIMEOUT;
+}
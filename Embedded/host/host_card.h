@@ -0,0 +1,118 @@
+#pragma once
+
+#include "host.h"
+
+// Virtual cards presented by HostPN532: MIFARE Classic 1K/4K with sector keys and access bits, and
+// NTAG21x tags. A card answers the bytes the PN532 relays to it with InDataExchange.
+
+// Status bytes of an InDataExchange response.
+#define HOST_CARD_OK 0x00
+#define HOST_CARD_TIMEOUT 0x01     // The card has not answered: refused command, halted or wrong type.
+#define HOST_CARD_AUTH_ERROR 0x14  // MIFARE authentication failed.
+
+/**
+ * Card in the field of the reader.
+ */
+class HostCard {
+public:
+  virtual ~HostCard() {}
+
+  uint8_t uid[7];
+  uint8_t uid_len;
+  uint16_t sens_res;   // ATQA.
+  uint8_t sel_res;     // SAK.
+  unsigned long program_us;  // Time the card takes to program its EEPROM for a write.
+
+  /**
+   * Selects the card, as InListPassiveTarget does: a halted card is woken up, authentication is reset.
+   */
+  virtual void select(void) { halted = false; }
+
+  bool selected(void) const { return !halted; }
+
+  /**
+   * Executes a card command.
+   *
+   * @param cmd Command byte followed by its parameters.
+   * @param len Length of cmd in bytes.
+   * @param response Buffer receiving the data answered by the card.
+   * @param response_len Set to the length of the data.
+   * @param programmed Set to true if the command has written the card's EEPROM.
+   * @return One of the HOST_CARD_ status bytes.
+   */
+  virtual uint8_t exchange(const uint8_t* cmd, uint8_t len, uint8_t* response, uint8_t* response_len,
+                           bool* programmed) = 0;
+
+  /**
+   * Loads the memory from a dump file, and saves it back after every write. A missing file is created
+   * with the blank card's memory.
+   *
+   * @return false if the file cannot be created.
+   */
+  bool attach_file(const char* path);
+
+protected:
+  HostCard(uint8_t* memory, uint16_t memory_size) : memory(memory), memory_size(memory_size) {}
+
+  void save(void);
+
+  bool halted = false;
+  uint8_t* memory;
+  uint16_t memory_size;
+
+private:
+  const char* file = nullptr;
+};
+
+
+/**
+ * MIFARE Classic 1K (16 sectors of 4 blocks) or 4K (32 sectors of 4 blocks then 8 of 16). Sector
+ * trailers hold key A, the access bits and key B; access to data blocks and trailers follows the
+ * conditions of the datasheet. Inconsistent access bits lock their sector, like on a real card.
+ */
+class HostClassicCard : public HostCard {
+public:
+  /**
+   * Creates a card in transport configuration: all keys FFFFFFFFFFFF, access bits FF 07 80.
+   *
+   * @param blocks 64 for a 1K card, 256 for a 4K card.
+   * @param card_uid Pointer to the 4 bytes UID.
+   */
+  HostClassicCard(uint16_t blocks, const uint8_t* card_uid);
+  ~HostClassicCard();
+
+  void select(void) override;
+  uint8_t exchange(const uint8_t* cmd, uint8_t len, uint8_t* response, uint8_t* response_len,
+                   bool* programmed) override;
+
+private:
+  uint8_t trailer_block(uint8_t block) const;
+  uint8_t access_condition(uint8_t block) const;
+  bool allowed(uint8_t block, uint8_t right) const;
+
+  uint16_t blocks;
+  int16_t auth_trailer = -1;  // Trailer of the authenticated sector, -1 if none.
+  bool auth_key_b = false;
+};
+
+
+/**
+ * NTAG213, NTAG215 or NTAG216: 4 bytes pages read 4 at a time and written one at a time. The UID and
+ * static lock pages cannot be written, lock bytes and the capability container are one-time programmable
+ * (written bits are ORed). Password protection is not emulated.
+ */
+class HostNtagCard : public HostCard {
+public:
+  /**
+   * @param pages 45 for an NTAG213, 135 for an NTAG215, 231 for an NTAG216.
+   * @param card_uid Pointer to the 7 bytes UID.
+   */
+  HostNtagCard(uint16_t pages, const uint8_t* card_uid);
+  ~HostNtagCard();
+
+  uint8_t exchange(const uint8_t* cmd, uint8_t len, uint8_t* response, uint8_t* response_len,
+                   bool* programmed) override;
+
+private:
+  uint16_t pages;
+};
@@ -0,0 +1,174 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "host.h"
+#include "host_pn532.h"
+
+// Runs the unchanged sketch on Linux. By default the requests are read from stdin, one per line, and the
+// replies written to stdout; Serial1 debug output goes to stderr.
+//
+//   --pty          Serve the serial port on a new pseudo terminal, whose path is printed on stderr, for the
+//                  desktop app or a terminal program.
+//   --eeprom FILE  Keep the EEPROM in FILE between runs.
+//   --idle-exit MS Virtual idle time before a run whose input has ended exits, 0 to never exit.
+//   --card TYPE    Put a card on the reader: classic1k, classic4k, ntag213, ntag215 or ntag216.
+//   --uid HEX      UID of the card, 4 bytes for a MIFARE Classic and 7 for an NTAG.
+//   --dump FILE    Keep the card's memory in FILE between runs, as a raw dump.
+//   --no-latency   Answer every PN532 command at once instead of modelling its time.
+//   --unplug MS:MS Take the reader off the bus between these two points of virtual time, then put it back.
+//   --stats        Print the virtual time of the last reply, the number of PN532 commands and of USB
+//                  packets sent on exit.
+
+static HostPN532 pn532;
+static HostCard* card = NULL;
+
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [--pty] [--eeprom FILE] [--idle-exit MS] [--card TYPE [--uid HEX] [--dump FILE]]\n"
+          "          [--no-latency] [--unplug MS:MS] [--stats]\n",
+          name);
+  exit(2);
+}
+
+
+/**
+ * Creates the card given by --card.
+ *
+ * @return nullptr if the type is unknown or the UID has the wrong length.
+ */
+static HostCard* card_create(const char* type, const char* uid_hex) {
+  uint8_t uid[7] = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+  uint8_t uid_len = 0;
+  if (uid_hex) {
+    for (; uid_hex[0] && uid_hex[1] && uid_len < sizeof(uid); uid_hex += 2) {
+      unsigned value;
+      if (sscanf(uid_hex, "%2x", &value) != 1)
+        return NULL;
+      uid[uid_len++] = value;
+    }
+    if (*uid_hex)
+      return NULL;
+  }
+
+  bool classic = strncmp(type, "classic", 7) == 0;
+  if (uid_len && uid_len != (classic ? 4 : 7))
+    return NULL;
+  if (!uid_len && classic)
+    memcpy(uid, "\xDE\xAD\xBE\xEF", 4);
+
+  if (strcmp(type, "classic1k") == 0)
+    return new HostClassicCard(64, uid);
+  if (strcmp(type, "classic4k") == 0)
+    return new HostClassicCard(256, uid);
+  if (strcmp(type, "ntag213") == 0)
+    return new HostNtagCard(45, uid);
+  if (strcmp(type, "ntag215") == 0)
+    return new HostNtagCard(135, uid);
+  if (strcmp(type, "ntag216") == 0)
+    return new HostNtagCard(231, uid);
+  return NULL;
+}
+
+
+static void stats_print(void) {
+  fprintf(stderr, "Last reply at %.3f ms of virtual time, %lu PN532 commands, %lu USB packets\n",
+          host_serial_last_output() / 1000.0, pn532.commands, host_serial_packets());
+}
+
+
+/**
+ * Opens a pseudo terminal in raw mode. The slave side is kept open so the port survives clients closing it.
+ *
+ * @return The master side, -1 on failure.
+ */
+static int pty_open(void) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+    return -1;
+
+  const char* path = ptsname(master);
+  int slave = path ? open(path, O_RDWR | O_NOCTTY) : -1;
+  if (slave < 0)
+    return -1;
+  struct termios tio;
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+
+  fprintf(stderr, "Serial port: %s\n", path);
+  return master;
+}
+
+
+int main(int argc, char** argv) {
+  bool pty = false;
+  const char* card_type = NULL;
+  const char* card_uid = NULL;
+  const char* card_dump = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--pty") == 0) {
+      pty = true;
+    } else if (strcmp(argv[i], "--card") == 0 && i + 1 < argc) {
+      card_type = argv[++i];
+    } else if (strcmp(argv[i], "--uid") == 0 && i + 1 < argc) {
+      card_uid = argv[++i];
+    } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+      card_dump = argv[++i];
+    } else if (strcmp(argv[i], "--no-latency") == 0) {
+      memset(&pn532.timing, 0, sizeof(pn532.timing));
+    } else if (strcmp(argv[i], "--unplug") == 0 && i + 1 < argc) {
+      char* end;
+      unsigned long from = strtoul(argv[++i], &end, 10);
+      if (*end != ':')
+        usage(argv[0]);
+      pn532.unplug(from * 1000ULL, strtoul(end + 1, NULL, 10) * 1000ULL);
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      atexit(stats_print);
+    } else if (strcmp(argv[i], "--eeprom") == 0 && i + 1 < argc) {
+      if (!host_eeprom_open(argv[++i])) {
+        perror(argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--idle-exit") == 0 && i + 1 < argc) {
+      host_set_idle_exit(strtoul(argv[++i], NULL, 10));
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  if (pty) {
+    int master = pty_open();
+    if (master < 0) {
+      perror("pty");
+      return 1;
+    }
+    host_serial_open(master, master, false);
+  } else {
+    host_serial_open(STDIN_FILENO, STDOUT_FILENO, true);
+  }
+
+  if (card_type) {
+    card = card_create(card_type, card_uid);
+    if (!card) {
+      fprintf(stderr, "%s: unknown card type or bad UID\n", card_type);
+      return 2;
+    }
+    if (card_dump && !card->attach_file(card_dump)) {
+      perror(card_dump);
+      return 1;
+    }
+    pn532.place(card);
+  } else if (card_uid || card_dump) {
+    usage(argv[0]);
+  }
+
+  host_spi_attach(HOST_PN532_CS, &pn532);
+  host_i2c_attach(HOST_PN532_I2C_ADDRESS, &pn532);
+
+  setup();
+  for (;;)
+    loop();
+}
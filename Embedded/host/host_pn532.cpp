@@ -0,0 +1,268 @@
+#include "host_pn532.h"
+
+#include <Adafruit_PN532.h>
+
+static const uint8_t ack_frame[] = { 0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00 };
+
+
+HostPN532::HostPN532(void) {
+  timing.command_us = 400;
+  timing.detect_us = 3000;
+  timing.rf_us = 600;
+  timing.rf_byte_us = 90;
+  timing.auth_us = 1500;
+}
+
+
+bool HostPN532::plugged(void) {
+  unsigned long long now = host_clock();
+  if (now >= unplug_from && now < unplug_to) {
+    unplugged = true;
+    return false;
+  }
+  if (unplugged) {  // Power-on state.
+    unplugged = false;
+    passive_retries = 0xFF;
+    out_len = out_pos = 0;
+    pending_len = 0;
+  }
+  return true;
+}
+
+
+bool HostPN532::ready(void) const {
+  return out_pos < out_len && host_clock() >= out_ready;
+}
+
+
+void HostPN532::select(void) {
+  first = true;
+  in_len = 0;
+}
+
+
+uint8_t HostPN532::exchange(uint8_t mosi) {
+  if (!plugged())
+    return 0xFF;  // Floating MISO.
+  if (first) {
+    first = false;
+    op = mosi;
+    return 0x00;
+  }
+
+  switch (op) {
+    case PN532_SPI_STATREAD:
+      return ready() ? PN532_SPI_READY : 0x00;
+    case PN532_SPI_DATAREAD:
+      return ready() ? out[out_pos++] : 0x00;
+    case PN532_SPI_DATAWRITE:
+      if (in_len < sizeof(in))
+        in[in_len++] = mosi;
+      return 0x00;
+    default:
+      return 0x00;
+  }
+}
+
+
+void HostPN532::deselect(void) {
+  if (!plugged()) {
+    op = 0;
+    return;
+  }
+  if (op == PN532_SPI_DATAWRITE)
+    frame_received(in, in_len);
+  else if (op == PN532_SPI_DATAREAD && out_pos > 0)
+    frame_read();
+  op = 0;
+}
+
+
+bool HostPN532::i2c_write(const uint8_t* data, size_t len) {
+  if (!plugged())
+    return false;  // No acknowledge.
+  frame_received(data, len);
+  return true;
+}
+
+
+/**
+ * Every I2C read starts with the status byte, followed by the frame when it is ready.
+ */
+bool HostPN532::i2c_read(uint8_t* data, size_t len) {
+  if (!plugged())
+    return false;
+  if (len == 0)
+    return true;
+  bool is_ready = ready();
+  data[0] = is_ready ? PN532_I2C_READY : 0x00;
+  for (size_t i = 1; i < len; i++)
+    data[i] = is_ready && out_pos < out_len ? out[out_pos++] : 0x00;
+  if (out_pos > 0)
+    frame_read();
+  return true;
+}
+
+
+/**
+ * A frame is read once, the response becomes readable after its ACK.
+ */
+void HostPN532::frame_read(void) {
+  memcpy(out, pending, pending_len);
+  out_len = pending_len;
+  out_pos = 0;
+  out_ready = pending_ready;
+  pending_len = 0;
+}
+
+
+/**
+ * Checks a frame written by the driver, acknowledges it and prepares the response.
+ * A frame with a bad checksum is ignored, the driver then times out like with a real chip.
+ */
+void HostPN532::frame_received(const uint8_t* frame, uint16_t len) {
+  uint16_t i = 0;
+  while (i + 1 < len && !(frame[i] == PN532_STARTCODE1 && frame[i + 1] == PN532_STARTCODE2))
+    i++;
+  if (i + 4 >= len)
+    return;
+
+  uint8_t data_len = frame[i + 2];
+  if ((uint8_t)(data_len + frame[i + 3]) != 0 || data_len < 2 || i + 5 + data_len > len)
+    return;
+  const uint8_t* data = &frame[i + 4];
+  uint8_t sum = 0;
+  for (uint8_t j = 0; j <= data_len; j++)
+    sum += data[j];  // TFI, command, parameters and DCS add up to 0.
+  if (sum != 0 || data[0] != PN532_HOSTTOPN532)
+    return;
+
+  commands++;
+  memcpy(out, ack_frame, sizeof(ack_frame));
+  out_len = sizeof(ack_frame);
+  out_pos = 0;
+  out_ready = host_clock() + timing.command_us / 4;  // The ACK comes before the command is executed.
+  pending_len = 0;
+
+  uint8_t response[HOST_PN532_FRAME_SIZE];
+  busy_us = timing.command_us;
+  uint8_t response_len = command(data + 1, data_len - 1, response);
+  if (response_len) {
+    answer(response, response_len);
+    pending_ready = host_clock() + busy_us;
+  }
+}
+
+
+/**
+ * Wraps a response in a normal information frame.
+ */
+void HostPN532::answer(const uint8_t* data, uint8_t len) {
+  uint8_t* p = pending;
+  *p++ = PN532_PREAMBLE;
+  *p++ = PN532_STARTCODE1;
+  *p++ = PN532_STARTCODE2;
+  *p++ = len + 1;
+  *p++ = ~(len + 1) + 1;
+  *p++ = PN532_PN532TOHOST;
+  uint8_t sum = PN532_PN532TOHOST;
+  for (uint8_t i = 0; i < len; i++) {
+    *p++ = data[i];
+    sum += data[i];
+  }
+  *p++ = ~sum + 1;
+  *p++ = PN532_POSTAMBLE;
+  pending_len = p - pending;
+}
+
+
+/**
+ * Relays an InDataExchange to the card and times it.
+ *
+ * @return The length of the response data following the status byte.
+ */
+uint8_t HostPN532::data_exchange(const uint8_t* cmd, uint8_t len, uint8_t* response) {
+  uint8_t response_len = 0;
+  bool programmed = false;
+  response[0] = card && card->selected() ? card->exchange(cmd, len, &response[1], &response_len, &programmed)
+                                         : HOST_CARD_TIMEOUT;
+
+  busy_us += timing.rf_us + (len + response_len) * timing.rf_byte_us;
+  if (cmd[0] == MIFARE_CMD_AUTH_A || cmd[0] == MIFARE_CMD_AUTH_B)
+    busy_us += timing.auth_us;
+  if (programmed)
+    busy_us += card->program_us;
+  return response_len;
+}
+
+
+uint8_t HostPN532::command(const uint8_t* cmd, uint8_t len, uint8_t* response) {
+  response[0] = cmd[0] + 1;
+
+  switch (cmd[0]) {
+    case PN532_COMMAND_GETFIRMWAREVERSION:
+      response[1] = 0x32;  // PN532.
+      response[2] = 1;     // Firmware 1.6.
+      response[3] = 6;
+      response[4] = 0x07;  // ISO/IEC 14443 type A and B, ISO 18092.
+      return 5;
+
+    case PN532_COMMAND_SAMCONFIGURATION:
+      return 1;
+
+    case PN532_COMMAND_RFCONFIGURATION:
+      if (len >= 5 && cmd[1] == 5)  // Item 5: MxRtyATR, MxRtyPSL, MxRtyPassiveActivation.
+        passive_retries = cmd[4];
+      return 1;
+
+    case PN532_COMMAND_INLISTPASSIVETARGET:
+      if (!card) {
+        if (passive_retries == 0xFF)
+          return 0;  // No card on the reader: the chip keeps waiting.
+        busy_us += (passive_retries + 1UL) * timing.detect_us;
+        response[1] = 0;  // No target found.
+        return 2;
+      }
+      card->select();
+      busy_us += timing.detect_us;
+      response[1] = 1;  // One target, number 1.
+      response[2] = 1;
+      response[3] = card->sens_res >> 8;
+      response[4] = card->sens_res;
+      response[5] = card->sel_res;
+      response[6] = card->uid_len;
+      memcpy(&response[7], card->uid, card->uid_len);
+      return 7 + card->uid_len;
+
+    case PN532_COMMAND_DIAGNOSE:
+      if (len >= 2 && cmd[1] == 0x00) {  // Communication line test: the test number and parameters come back.
+        memcpy(&response[1], &cmd[1], len - 1);
+        return len;
+      }
+      if (len == 2 && (cmd[1] == 0x01 || cmd[1] == 0x02)) {  // ROM and RAM self-tests, which pass.
+        response[1] = 0x00;
+        return 2;
+      }
+      if (len < 2 || cmd[1] != 0x06) {  // Test 6, the attention request of the selected target.
+        response[1] = 0x27;
+        return 2;
+      }
+      busy_us += timing.rf_us;
+      if (!card || !card->selected())
+        response[1] = HOST_CARD_TIMEOUT;
+      else
+        response[1] = card->sel_res & 0x20 ? 0x00 : 0x27;  // ISO14443-4 targets only.
+      return 2;
+
+    case PN532_COMMAND_INDATAEXCHANGE:
+      if (len < 3) {
+        response[1] = 0x27;  // Command not acceptable in this context.
+        return 2;
+      }
+      return 2 + data_exchange(&cmd[2], len - 2, &response[1]);
+
+    default:
+      response[1] = HOST_CARD_TIMEOUT;
+      return 2;
+  }
+}
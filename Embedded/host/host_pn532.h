@@ -0,0 +1,95 @@
+#pragma once
+
+#include "host.h"
+#include "host_card.h"
+
+#define HOST_PN532_CS 10             // Chip select of the PN532 in main.cpp.
+#define HOST_PN532_I2C_ADDRESS 0x24  // PN532_I2C_ADDRESS of the driver.
+#define HOST_PN532_FRAME_SIZE 264    // Largest normal information frame, preamble to postamble.
+
+/**
+ * Time the PN532 and the card take, in microseconds of virtual time. A response becomes ready only once
+ * it has elapsed, so the driver's polling and the number of card exchanges show in the virtual clock.
+ * The defaults are the orders of magnitude of the datasheets.
+ */
+typedef struct {
+  unsigned long command_us;   // Frame decoding and answer of any command.
+  unsigned long detect_us;    // REQA, anticollision and selection of a card.
+  unsigned long rf_us;        // Fixed cost of a card exchange: frame delay times and the card's processing.
+  unsigned long rf_byte_us;   // Each byte sent or received over the air at 106 kbit/s.
+  unsigned long auth_us;      // MIFARE Classic three-pass authentication, on top of its exchange.
+} HostPN532Timing;
+
+/**
+ * PN532 answering the frames of the Adafruit driver over SPI or I2C: each command frame is
+ * acknowledged, then answered once the modelled time has elapsed. With no card, InListPassiveTarget
+ * answers no target once its activation retries have failed, and is never answered with the default
+ * 0xFF retries, like a real PN532 waiting for a target.
+ */
+class HostPN532 : public HostSpiPeer, public HostI2cPeer {
+public:
+  HostPN532(void);
+
+  /**
+   * Puts a card on the reader, replacing the previous one. nullptr removes it.
+   */
+  void place(HostCard* card) { this->card = card; }
+
+  /**
+   * Takes the reader off the bus between two points of virtual time: its pins float, and it comes back
+   * reset, as if it had been reseated.
+   */
+  void unplug(unsigned long long from_us, unsigned long long to_us) {
+    unplug_from = from_us;
+    unplug_to = to_us;
+  }
+
+  HostPN532Timing timing;
+  unsigned long commands = 0;  // Commands executed since the start.
+
+  void select(void) override;
+  uint8_t exchange(uint8_t mosi) override;
+  void deselect(void) override;
+
+  bool i2c_write(const uint8_t* data, size_t len) override;
+  bool i2c_read(uint8_t* data, size_t len) override;
+
+protected:
+  /**
+   * Executes a command.
+   *
+   * @param cmd Command code followed by its parameters.
+   * @param len Length of cmd in bytes.
+   * @param response Buffer receiving the response code (command code + 1) followed by the response data.
+   * @return The length of the response, 0 to not answer.
+   */
+  virtual uint8_t command(const uint8_t* cmd, uint8_t len, uint8_t* response);
+
+  unsigned long busy_us = 0;  // Time the command being executed takes, set by command().
+
+private:
+  bool plugged(void);
+  bool ready(void) const;
+  void frame_received(const uint8_t* frame, uint16_t len);
+  void frame_read(void);
+  void answer(const uint8_t* data, uint8_t len);
+  uint8_t data_exchange(const uint8_t* cmd, uint8_t len, uint8_t* response);
+
+  HostCard* card = nullptr;
+  uint8_t passive_retries = 0xFF;  // MxRtyPassiveActivation of RFConfiguration.
+  unsigned long long unplug_from = 0;
+  unsigned long long unplug_to = 0;
+  bool unplugged = false;  // The last access found it unplugged, it is reset once back.
+
+  uint8_t op = 0;              // SPI operation byte of the current transaction.
+  bool first = false;          // The next byte of the transaction is its operation byte.
+  uint8_t in[HOST_PN532_FRAME_SIZE];
+  uint16_t in_len = 0;
+  uint8_t out[HOST_PN532_FRAME_SIZE];  // Frame returned by data reads: an ACK or a response.
+  uint16_t out_len = 0;
+  uint16_t out_pos = 0;
+  unsigned long long out_ready = 0;    // Virtual time the frame can be read from.
+  uint8_t pending[HOST_PN532_FRAME_SIZE];  // Response frame following the ACK being read.
+  uint16_t pending_len = 0;
+  unsigned long long pending_ready = 0;
+};
@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../log_tokens.h"
+
+// Turns the log records of the firmware (logging.h) back into text, one line per record:
+//
+//   build/embedded 2>&1 >/dev/null | build/log_decode     Host build, whose Serial1 is stderr.
+//   build/log_decode < /dev/ttyUSB0                        Board, through a USB-UART adapter on pins 0 and 1.
+//
+// Bytes that do not start a record are copied as they are, so text sharing the stream stays readable.
+
+#define LOG_SYNC 0xA0
+
+#define LOG_TOKEN_FORMAT(token, format) format,
+
+static const char* const formats[] = { LOG_TOKENS(LOG_TOKEN_FORMAT) };
+static const char levels[] = "-EWID";
+
+
+/**
+ * Prints a record's format with its arguments: %u and %c take 16-bit little endian values, %h the
+ * remaining bytes in hex.
+ */
+static void record_print(uint8_t level, uint8_t token, const uint8_t* args, uint8_t len) {
+  printf("[%c] ", levels[level]);
+  uint8_t pos = 0;
+  for (const char* f = formats[token]; *f; f++) {
+    if (*f != '%' || !f[1]) {
+      putchar(*f);
+      continue;
+    }
+    f++;
+    if (*f == 'u' || *f == 'c') {
+      unsigned value = pos + 2 <= len ? args[pos] | args[pos + 1] << 8 : 0;
+      pos += 2;
+      if (*f == 'u')
+        printf("%u", value);
+      else
+        putchar(value);
+    } else if (*f == 'h') {
+      for (; pos < len; pos++)
+        printf(pos + 1 < len ? "%02X " : "%02X", args[pos]);
+    } else {
+      putchar(*f);
+    }
+  }
+  putchar('\n');
+  fflush(stdout);
+}
+
+
+int main(void) {
+  int c;
+  while ((c = getchar()) != EOF) {
+    uint8_t level = c & 0x0F;
+    if ((c & 0xF0) != LOG_SYNC || level < 1 || level > 4) {
+      putchar(c);
+      continue;
+    }
+
+    int token = getchar();
+    int len = getchar();
+    if (token == EOF || len == EOF)
+      break;
+    uint8_t args[255];
+    if (fread(args, 1, len, stdin) != (size_t)len)
+      break;
+    if (token >= LOG_TOKEN_COUNT)
+      printf("[%c] unknown token %d\n", levels[level], token);
+    else
+      record_print(level, token, args, len);
+  }
+  return 0;
+}
@@ -0,0 +1,20 @@
+#include "key_store.h"
+
+// Helpers shared by the storage backends, the backend itself is in key_store_eeprom.cpp,
+// key_store_fram.cpp or key_store_ram.cpp depending on KEY_STORE_BACKEND.
+
+
+uint16_t key_store_crc16(uint16_t crc, uint8_t data) {
+  crc ^= (uint16_t)data << 8;
+  for (uint8_t i = 0; i < 8; i++)
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+  return crc;
+}
+
+
+uint8_t key_store_fingerprint(const uint8_t* segment) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < SEGMENT_SIZE; i++)
+    crc = key_store_crc16(crc, segment[i]);
+  return crc & 0xFF;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Size of a stored secret: a key segment or the admin password.
+#define SEGMENT_SIZE 32
+
+// Storage backends. The key store API below is the same for all of them, one is selected at build time.
+#define KEY_STORE_EEPROM 0  // Journal in the ATmega32U4's internal EEPROM, up to 25 key segments.
+#define KEY_STORE_FRAM 1    // External SPI FRAM on its own chip select, hundreds to thousands of key segments.
+#define KEY_STORE_RAM 2     // RAM image, optionally saved to a file, for host builds only.
+
+#ifndef KEY_STORE_BACKEND
+#define KEY_STORE_BACKEND KEY_STORE_EEPROM
+#endif
+
+// Slot identifiers. Slot 0 holds the admin password, key segments use the slots from KEY_SLOT_FIRST.
+// On the EEPROM, ids match the former fixed layout where slot i lived at address i * 32,
+// so cards written before the journal was introduced still point to the right segment.
+#define KEY_SLOT_ADMIN_PASSWORD 0
+#define KEY_SLOT_FIRST 1
+#define KEY_SLOT_NONE 0  // Returned when no key slot matches or none is free.
+
+// State of the store, set by key_store_begin and key_store_format.
+#define KEY_STORE_READY 0        // Usable.
+#define KEY_STORE_UNFORMATTED 1  // FRAM answering without the format marker: holds no key of this firmware.
+#define KEY_STORE_LEGACY 2       // EEPROM in the old layout, which cannot be converted in place: read-only.
+#define KEY_STORE_FAILED 3       // FRAM not answering, or an EEPROM conversion whose copy could not be verified.
+
+#if KEY_STORE_BACKEND == KEY_STORE_EEPROM
+
+// The EEPROM is a journal of fixed size records written round-robin over the free positions:
+//  - byte 0:      slot id, any other value (KEY_RECORD_DEAD after an update or an erase) marks a stale record,
+//  - bytes 1-2:   sequence number of the write, the newest copy wins if an update was interrupted,
+//  - bytes 3-34:  the SEGMENT_SIZE bytes of data,
+//  - bytes 35-36: CRC-16 of bytes 0 to 34, a torn write never passes it.
+// An update writes a new record in a free position before killing the old one, so a power cut leaves
+// either the old or the new content but never a mix of both.
+#define KEY_SLOT_LAST 30
+#define KEY_RECORD_SIZE (1 + 2 + SEGMENT_SIZE + 2)
+#define KEY_RECORD_COUNT 27
+#define KEY_RECORD_DEAD 0xFE
+#define KEY_RECORD_NONE 0xFF  // Position of a slot without record.
+
+// Format marker written after the last record once the journal has been initialized.
+#define KEY_STORE_HEADER_ADDRESS 1008
+#define KEY_STORE_MAGIC_SIZE 4
+
+// Number of key segments the journal can hold: one position is kept free so an update always has
+// somewhere to go, one is used by the admin password.
+#define KEY_SLOT_CAPACITY (KEY_RECORD_COUNT - 2)
+
+#elif KEY_STORE_BACKEND == KEY_STORE_FRAM
+
+// SPI FRAM (FM25V02, MB85RS256 and alike) sharing the PN532's software SPI pins, selected by its own pin.
+// FRAM writes at bus speed and does not wear out, so every slot has a fixed place:
+//  - bytes 0-3:  format marker,
+//  - then one directory byte per slot: 0 when the slot is empty, otherwise a fingerprint of its data,
+//  - then two copies of each slot's record (sequence number, data, CRC-16). An update overwrites the
+//    older copy, so a power cut leaves the newer one intact.
+#ifndef KEY_STORE_FRAM_CS
+#define KEY_STORE_FRAM_CS 9
+#endif
+#ifndef KEY_STORE_FRAM_SIZE
+#define KEY_STORE_FRAM_SIZE 32768UL  // Size of the part in bytes, 256 Kbit by default.
+#endif
+#define KEY_STORE_MAGIC_SIZE 4
+#define KEY_RECORD_SIZE (2 + SEGMENT_SIZE + 2)
+// Slot ids are 16-bit, the slots of parts larger than 4 MB past the last id are left unused.
+#define KEY_STORE_FRAM_SLOTS ((KEY_STORE_FRAM_SIZE - KEY_STORE_MAGIC_SIZE) / (1 + 2 * KEY_RECORD_SIZE))
+#define KEY_SLOT_LAST (KEY_STORE_FRAM_SLOTS > 0xFFFF ? 0xFFFF : KEY_STORE_FRAM_SLOTS - 1)
+#define KEY_SLOT_CAPACITY (KEY_SLOT_LAST - KEY_SLOT_FIRST + 1)
+
+#elif KEY_STORE_BACKEND == KEY_STORE_RAM
+
+#ifndef KEY_STORE_RAM_SLOTS
+#define KEY_STORE_RAM_SLOTS 1024
+#endif
+// #define KEY_STORE_FILE "key_store.bin"  // Keeps the RAM image in a file across runs when defined.
+#define KEY_SLOT_LAST (KEY_STORE_RAM_SLOTS - 1)
+#define KEY_SLOT_CAPACITY (KEY_SLOT_LAST - KEY_SLOT_FIRST + 1)
+
+#else
+#error "Unknown KEY_STORE_BACKEND"
+#endif
+
+
+/**
+ * Prepares the selected backend, must be called once at startup before any other key_store function.
+ * The EEPROM journal is scanned to build the RAM index of the slots, interrupted updates are resolved in
+ * favor of the newest complete record. An EEPROM without the journal's format marker (fixed layout
+ * written by an older firmware, or blank chip) is converted in place, keeping the password and the segments.
+ * The conversion survives a power cut, it resumes at the next startup. An old layout holding more segments
+ * than the journal (KEY_SLOT_CAPACITY), or too full to be converted in place, is left as it is and stays
+ * readable: the password still logs in and the cards can be recovered, until the admin formats the store.
+ * A FRAM without format marker is left untouched until key_store_format is requested.
+ *
+ * @return true if the store is usable, false if the backend cannot be used, see key_store_state. Every
+ *         access fails then.
+ */
+bool key_store_begin(void);
+
+/**
+ * @return The state found by key_store_begin, or left by key_store_format: one of the KEY_STORE_ values.
+ */
+uint8_t key_store_state(void);
+
+/**
+ * Initializes an empty store, erasing every slot including the admin password. Used after the whole
+ * EEPROM has been wiped, and on the admin's request for a FRAM.
+ *
+ * @return true if the store is usable, false if the FRAM does not answer.
+ */
+bool key_store_format(void);
+
+/**
+ * Looks for a key slot already holding the given segment.
+ *
+ * @param segment Pointer to the SEGMENT_SIZE bytes to look for.
+ * @return The index of the slot holding an identical segment, KEY_SLOT_NONE if there is none.
+ */
+uint16_t key_store_find(const uint8_t* segment);
+
+/**
+ * Finds the first free key slot.
+ *
+ * @return The index of the first free slot, KEY_SLOT_NONE if the storage is full.
+ */
+uint16_t key_store_allocate(void);
+
+/**
+ * Checks if a slot holds data.
+ *
+ * @param slot Index of the slot, KEY_SLOT_ADMIN_PASSWORD or between KEY_SLOT_FIRST and KEY_SLOT_LAST.
+ */
+bool key_store_has(uint16_t slot);
+
+/**
+ * Writes the content of a slot and verifies it. The previous content of the
+ * slot is only discarded once the new record is complete.
+ *
+ * @param slot Index of the slot, KEY_SLOT_ADMIN_PASSWORD or between KEY_SLOT_FIRST and KEY_SLOT_LAST.
+ * @param segment Pointer to the SEGMENT_SIZE bytes to store.
+ * @return true if the record has been written and verified, false otherwise (the slot keeps its previous content).
+ */
+bool key_store_write(uint16_t slot, const uint8_t* segment);
+
+/**
+ * Reads the content of a slot.
+ *
+ * @param slot Index of the slot, KEY_SLOT_ADMIN_PASSWORD or between KEY_SLOT_FIRST and KEY_SLOT_LAST.
+ * @param segment Pointer to a SEGMENT_SIZE bytes buffer receiving the data, zeroed if the slot is empty.
+ * @return true if the slot holds data, false otherwise.
+ */
+bool key_store_read(uint16_t slot, uint8_t* segment);
+
+/**
+ * Discards the content of a slot.
+ *
+ * @param slot Index of the slot, KEY_SLOT_ADMIN_PASSWORD or between KEY_SLOT_FIRST and KEY_SLOT_LAST.
+ */
+void key_store_erase(uint16_t slot);
+
+
+// /////////////////////////////Backend helpers//////////////////////////////////////////
+
+/**
+ * Updates a CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) with one byte.
+ */
+uint16_t key_store_crc16(uint16_t crc, uint8_t data);
+
+/**
+ * Computes the fingerprint of a segment: the low byte of its CRC-16. Backends keep it per slot
+ * so a lookup only reads the segments that may match.
+ */
+uint8_t key_store_fingerprint(const uint8_t* segment);
@@ -0,0 +1,509 @@
+#include "key_store.h"
+
+#if KEY_STORE_BACKEND == KEY_STORE_EEPROM
+
+#include <EEPROM.h>  // Key segments and the admin password live in the ATmega32U4's internal EEPROM.
+
+// Slots of the layout used before the journal: slot i at address i * SEGMENT_SIZE, slot 0 being the password.
+#define LEGACY_SLOT_COUNT 31
+
+// State of a conversion in progress, after the journal's format marker: the bitmap of the old slots holding
+// data, then a marker telling it is complete. The order the records are copied in only depends on the bitmap,
+// so a conversion cut by a power loss resumes with the same plan.
+#define MIGRATION_USED_ADDRESS (KEY_STORE_HEADER_ADDRESS + KEY_STORE_MAGIC_SIZE)
+#define MIGRATION_MAGIC_ADDRESS (MIGRATION_USED_ADDRESS + 4)
+
+static_assert(MIGRATION_MAGIC_ADDRESS + KEY_STORE_MAGIC_SIZE <= 1024, "Conversion state past the EEPROM");
+static_assert(LEGACY_SLOT_COUNT <= 32 && KEY_RECORD_COUNT <= 32, "Conversion bitmaps are 32-bit");
+
+static const uint8_t key_store_magic[KEY_STORE_MAGIC_SIZE] = { 'C', 'H', 'J', 1 };
+static const uint8_t migration_magic[KEY_STORE_MAGIC_SIZE] = { 'C', 'H', 'M', 1 };
+
+static uint8_t store_state = KEY_STORE_FAILED;            // KEY_STORE_READY once the journal has been scanned or converted.
+static uint8_t slot_position[KEY_SLOT_LAST + 1];          // Journal position of each slot's record, KEY_RECORD_NONE if empty.
+static uint8_t slot_fingerprint[KEY_SLOT_LAST + 1];       // Low byte of the CRC of each slot's data, spares EEPROM reads on lookups.
+static uint8_t used_positions[(KEY_RECORD_COUNT + 7) / 8];  // Bitmap of the positions holding a live record.
+static uint8_t cursor = 0;                                // Next position tried for a write, rotates over the free positions.
+static uint16_t next_sequence = 0;                        // Sequence number of the next record written.
+
+
+static uint16_t record_address(uint8_t position) {
+  return (uint16_t)position * KEY_RECORD_SIZE;
+}
+
+static bool position_is_used(uint8_t position) {
+  return used_positions[position / 8] & (1 << (position % 8));
+}
+
+static void position_set_used(uint8_t position, bool used) {
+  if (used)
+    used_positions[position / 8] |= (1 << (position % 8));
+  else
+    used_positions[position / 8] &= ~(1 << (position % 8));
+}
+
+/**
+ * Reads a record and checks its CRC.
+ *
+ * @param position Position of the record in the journal.
+ * @param slot Receives the slot id of the record.
+ * @param sequence Receives the sequence number of the record.
+ * @param fp Receives the fingerprint of the record's data.
+ * @return true if the record is complete and belongs to a slot, false for a stale, torn or blank record.
+ */
+static bool record_check(uint8_t position, uint8_t* slot, uint16_t* sequence, uint8_t* fp) {
+  uint16_t address = record_address(position);
+  uint16_t crc = 0xFFFF;
+  uint16_t dataCrc = 0xFFFF;
+
+  for (uint8_t i = 0; i < KEY_RECORD_SIZE - 2; i++) {
+    uint8_t b = EEPROM.read(address + i);
+    crc = key_store_crc16(crc, b);
+    if (i >= 3)
+      dataCrc = key_store_crc16(dataCrc, b);
+  }
+  uint16_t stored = ((uint16_t)EEPROM.read(address + KEY_RECORD_SIZE - 2) << 8) | EEPROM.read(address + KEY_RECORD_SIZE - 1);
+
+  *slot = EEPROM.read(address);
+  *sequence = ((uint16_t)EEPROM.read(address + 1) << 8) | EEPROM.read(address + 2);
+  *fp = dataCrc & 0xFF;
+  return crc == stored && *slot <= KEY_SLOT_LAST;
+}
+
+/**
+ * Writes a complete record. The slot id is written last: until then the position still reads as
+ * stale, so a torn write is never mistaken for a record even before its CRC is checked.
+ */
+static void record_write(uint8_t position, uint8_t slot, uint16_t sequence, const uint8_t* segment) {
+  uint16_t address = record_address(position);
+  uint16_t crc = key_store_crc16(0xFFFF, slot);
+
+  EEPROM.update(address, KEY_RECORD_DEAD);
+  EEPROM.update(address + 1, sequence >> 8);
+  crc = key_store_crc16(crc, sequence >> 8);
+  EEPROM.update(address + 2, sequence & 0xFF);
+  crc = key_store_crc16(crc, sequence & 0xFF);
+  for (uint8_t i = 0; i < SEGMENT_SIZE; i++) {
+    EEPROM.update(address + 3 + i, segment[i]);
+    crc = key_store_crc16(crc, segment[i]);
+  }
+  EEPROM.update(address + KEY_RECORD_SIZE - 2, crc >> 8);
+  EEPROM.update(address + KEY_RECORD_SIZE - 1, crc & 0xFF);
+  EEPROM.update(address, slot);
+}
+
+/**
+ * Marks a record as stale. A single byte write, so discarding a record is atomic.
+ */
+static void record_kill(uint8_t position) {
+  EEPROM.update(record_address(position), KEY_RECORD_DEAD);
+  position_set_used(position, false);
+}
+
+static void index_clear(void) {
+  memset(slot_position, KEY_RECORD_NONE, sizeof(slot_position));
+  memset(slot_fingerprint, 0, sizeof(slot_fingerprint));
+  memset(used_positions, 0, sizeof(used_positions));
+  cursor = 0;
+  next_sequence = 0;
+}
+
+/**
+ * Builds the RAM index from the journal. When an update has been interrupted between writing the new
+ * record and killing the old one, both are complete: the older one is killed now.
+ */
+static void index_build(void) {
+  bool any = false;
+  uint16_t newest = 0;
+
+  index_clear();
+
+  for (uint8_t position = 0; position < KEY_RECORD_COUNT; position++) {
+    uint8_t slot, fp;
+    uint16_t sequence;
+    if (!record_check(position, &slot, &sequence, &fp))
+      continue;
+
+    if (slot_position[slot] != KEY_RECORD_NONE) {
+      uint16_t address = record_address(slot_position[slot]);
+      uint16_t other = ((uint16_t)EEPROM.read(address + 1) << 8) | EEPROM.read(address + 2);
+      if ((int16_t)(sequence - other) < 0) {
+        record_kill(position);
+        continue;
+      }
+      record_kill(slot_position[slot]);
+    }
+
+    slot_position[slot] = position;
+    slot_fingerprint[slot] = fp;
+    position_set_used(position, true);
+
+    // Resume writing after the newest record so the wear keeps rotating across reboots.
+    if (!any || (int16_t)(sequence - newest) > 0) {
+      newest = sequence;
+      cursor = (position + 1) % KEY_RECORD_COUNT;
+      any = true;
+    }
+  }
+
+  next_sequence = any ? newest + 1 : 0;
+}
+
+static bool header_is_valid(void) {
+  for (uint8_t i = 0; i < KEY_STORE_MAGIC_SIZE; i++) {
+    if (EEPROM.read(KEY_STORE_HEADER_ADDRESS + i) != key_store_magic[i])
+      return false;
+  }
+  return true;
+}
+
+static void header_write(void) {
+  for (uint8_t i = 0; i < KEY_STORE_MAGIC_SIZE; i++)
+    EEPROM.update(KEY_STORE_HEADER_ADDRESS + i, key_store_magic[i]);
+}
+
+/**
+ * Reads a slot of the old fixed layout.
+ *
+ * @return true if the slot holds data (neither zeroed nor blank).
+ */
+static bool legacy_slot_read(uint8_t slot, uint8_t* segment) {
+  bool zeroed = true;
+  bool blank = true;
+  for (uint8_t j = 0; j < SEGMENT_SIZE; j++) {
+    segment[j] = EEPROM.read((uint16_t)slot * SEGMENT_SIZE + j);
+    if (segment[j] != 0x00)
+      zeroed = false;
+    if (segment[j] != 0xFF)
+      blank = false;
+  }
+  return !zeroed && !blank;
+}
+
+static bool migration_is_pending(void) {
+  for (uint8_t i = 0; i < KEY_STORE_MAGIC_SIZE; i++) {
+    if (EEPROM.read(MIGRATION_MAGIC_ADDRESS + i) != migration_magic[i])
+      return false;
+  }
+  return true;
+}
+
+static void migration_clear(void) {
+  for (uint8_t i = 0; i < 4 + KEY_STORE_MAGIC_SIZE; i++)
+    EEPROM.update(MIGRATION_USED_ADDRESS + i, 0);
+}
+
+/**
+ * Old slots overwritten by the record at a journal position: first and last.
+ */
+static uint8_t footprint_first(uint8_t position) {
+  return record_address(position) / SEGMENT_SIZE;
+}
+
+static uint8_t footprint_last(uint8_t position) {
+  return (record_address(position) + KEY_RECORD_SIZE - 1) / SEGMENT_SIZE;
+}
+
+/**
+ * Positions a record can be written to without losing data: not taken yet, and covering no old slot whose
+ * data is still waiting to be copied.
+ *
+ * @param pending Bitmap of the old slots not copied yet.
+ * @param taken Bitmap of the positions already holding a copied record.
+ */
+static uint32_t migration_free_positions(uint32_t pending, uint32_t taken) {
+  uint32_t free = 0;
+  for (uint8_t position = 0; position < KEY_RECORD_COUNT; position++) {
+    if (taken & (1UL << position))
+      continue;
+    bool clear = true;
+    for (uint8_t slot = footprint_first(position); slot <= footprint_last(position); slot++) {
+      if (pending & (1UL << slot))
+        clear = false;
+    }
+    if (clear)
+      free |= 1UL << position;
+  }
+  return free;
+}
+
+static uint8_t bit_count(uint32_t bits) {
+  uint8_t n = 0;
+  for (; bits; bits &= bits - 1)
+    n++;
+  return n;
+}
+
+/**
+ * Picks the next old slot to copy, and its position: of the slots which have a free position outside their
+ * own data, the one whose copy frees the most positions for the following ones.
+ *
+ * @return false if no slot can be copied without overwriting data not copied yet.
+ */
+static bool migration_step(uint32_t pending, uint32_t taken, uint8_t* slot, uint8_t* position) {
+  uint32_t free = migration_free_positions(pending, taken);
+  int8_t bestGain = -1;
+
+  for (int8_t s = LEGACY_SLOT_COUNT - 1; s >= 0; s--) {
+    if (!(pending & (1UL << s)))
+      continue;
+    int8_t p = KEY_RECORD_COUNT - 1;
+    while (p >= 0 && (!(free & (1UL << p)) || (s >= footprint_first(p) && s <= footprint_last(p))))
+      p--;
+    if (p < 0)
+      continue;
+    int8_t gain = bit_count(migration_free_positions(pending & ~(1UL << s), taken | (1UL << p)));
+    if (gain > bestGain) {
+      bestGain = gain;
+      *slot = s;
+      *position = p;
+    }
+  }
+  return bestGain >= 0;
+}
+
+/**
+ * Copies an old slot into its journal record and reads the record back. A record left complete by an
+ * interrupted conversion is kept: the old slot may have been overwritten since.
+ *
+ * @return true if the record holds the slot's data.
+ */
+static bool migration_copy(uint8_t slot, uint8_t position) {
+  uint8_t segment[SEGMENT_SIZE];
+  uint8_t stored, fp;
+  uint16_t sequence;
+
+  if (record_check(position, &stored, &sequence, &fp) && stored == slot && sequence == position)
+    return true;
+
+  legacy_slot_read(slot, segment);
+  record_write(position, slot, position, segment);
+  bool copied = record_check(position, &stored, &sequence, &fp) && stored == slot && sequence == position;
+  for (uint8_t i = 0; i < SEGMENT_SIZE; i++) {
+    if (EEPROM.read(record_address(position) + 3 + i) != segment[i])
+      copied = false;
+  }
+  memset(segment, 0, sizeof(segment));
+  return copied;
+}
+
+/**
+ * Runs the conversion plan of a set of old slots.
+ *
+ * @param used Bitmap of the old slots holding data.
+ * @param copy false to only check that every slot has a place, nothing is written then.
+ * @return false if a slot has no place, or a copy could not be verified.
+ */
+static bool migration_run(uint32_t used, bool copy) {
+  uint32_t pending = used;
+  uint32_t taken = 0;
+
+  while (pending) {
+    uint8_t slot, position;
+    if (!migration_step(pending, taken, &slot, &position))
+      return false;
+    if (copy && !migration_copy(slot, position))
+      return false;
+    pending &= ~(1UL << slot);
+    taken |= 1UL << position;
+  }
+
+  // Every old slot is in the journal now, old data left in the other positions must never pass for a record.
+  if (copy) {
+    for (uint8_t p = 0; p < KEY_RECORD_COUNT; p++) {
+      if (!(taken & (1UL << p)))
+        EEPROM.update(record_address(p), KEY_RECORD_DEAD);
+    }
+  }
+  return true;
+}
+
+/**
+ * Converts the old fixed layout into journal records, in place and restartable. Each record is written over
+ * old slots already copied or empty only, and read back before the next one, so a power cut leaves every
+ * slot either in the old layout or in a verified record. The journal's format marker is written last.
+ *
+ * @return KEY_STORE_READY once converted. KEY_STORE_LEGACY if the old layout cannot be converted in place
+ *         (more segments than the journal holds, or no order of the copies avoiding the data not copied yet),
+ *         nothing is written then. KEY_STORE_FAILED if a copy could not be verified, the conversion resumes
+ *         at the next startup.
+ */
+static uint8_t migrate_legacy_layout(void) {
+  uint32_t used = 0;
+
+  if (migration_is_pending()) {
+    for (uint8_t i = 0; i < 4; i++)
+      used |= (uint32_t)EEPROM.read(MIGRATION_USED_ADDRESS + i) << (8 * i);
+  } else {
+    uint8_t segment[SEGMENT_SIZE];
+    uint8_t segments = 0;
+    for (uint8_t slot = 0; slot < LEGACY_SLOT_COUNT; slot++) {
+      if (legacy_slot_read(slot, segment)) {
+        used |= 1UL << slot;
+        if (slot >= KEY_SLOT_FIRST)
+          segments++;
+      }
+    }
+    memset(segment, 0, sizeof(segment));
+    if (segments > KEY_SLOT_CAPACITY || !migration_run(used, false))
+      return KEY_STORE_LEGACY;
+
+    // The bitmap first, the marker saying it is complete last.
+    for (uint8_t i = 0; i < 4; i++)
+      EEPROM.update(MIGRATION_USED_ADDRESS + i, used >> (8 * i));
+    for (uint8_t i = 0; i < KEY_STORE_MAGIC_SIZE; i++)
+      EEPROM.update(MIGRATION_MAGIC_ADDRESS + i, migration_magic[i]);
+  }
+
+  if (!migration_run(used, true))
+    return KEY_STORE_FAILED;
+  header_write();
+  migration_clear();
+  return KEY_STORE_READY;
+}
+
+
+bool key_store_begin(void) {
+  index_clear();
+
+  store_state = header_is_valid() ? KEY_STORE_READY : migrate_legacy_layout();
+  if (store_state != KEY_STORE_READY)
+    return false;
+  migration_clear();  // Left over when a power cut followed the format marker.
+
+  index_build();
+  return true;
+}
+
+
+uint8_t key_store_state(void) {
+  return store_state;
+}
+
+
+bool key_store_format(void) {
+  for (uint8_t p = 0; p < KEY_RECORD_COUNT; p++)
+    EEPROM.update(record_address(p), KEY_RECORD_DEAD);
+  header_write();
+  migration_clear();
+  index_clear();
+  store_state = KEY_STORE_READY;
+  return true;
+}
+
+
+uint16_t key_store_find(const uint8_t* segment) {
+  uint8_t fp = key_store_fingerprint(segment);
+
+  for (uint8_t slot = KEY_SLOT_FIRST; slot <= KEY_SLOT_LAST; slot++) {
+    if (slot_position[slot] == KEY_RECORD_NONE || slot_fingerprint[slot] != fp)
+      continue;  // Empty slot or different content, no need to read the EEPROM.
+
+    // Fingerprints can collide, confirm with the record's content.
+    uint16_t address = record_address(slot_position[slot]) + 3;
+    uint8_t j = 0;
+    while (j < SEGMENT_SIZE && EEPROM.read(address + j) == segment[j])
+      j++;
+    if (j == SEGMENT_SIZE)
+      return slot;
+  }
+  return KEY_SLOT_NONE;
+}
+
+
+uint16_t key_store_allocate(void) {
+  if (store_state != KEY_STORE_READY)
+    return KEY_SLOT_NONE;
+
+  uint8_t segments = 0;
+  uint16_t firstFree = KEY_SLOT_NONE;
+  for (uint8_t slot = KEY_SLOT_FIRST; slot <= KEY_SLOT_LAST; slot++) {
+    if (slot_position[slot] != KEY_RECORD_NONE)
+      segments++;
+    else if (firstFree == KEY_SLOT_NONE)
+      firstFree = slot;
+  }
+  return segments < KEY_SLOT_CAPACITY ? firstFree : KEY_SLOT_NONE;
+}
+
+
+bool key_store_has(uint16_t slot) {
+  if (store_state == KEY_STORE_LEGACY && slot < LEGACY_SLOT_COUNT) {
+    uint8_t segment[SEGMENT_SIZE];
+    bool has = legacy_slot_read(slot, segment);
+    memset(segment, 0, sizeof(segment));
+    return has;
+  }
+  return slot <= KEY_SLOT_LAST && slot_position[slot] != KEY_RECORD_NONE;
+}
+
+
+bool key_store_write(uint16_t slot, const uint8_t* segment) {
+  if (store_state != KEY_STORE_READY || slot > KEY_SLOT_LAST)
+    return false;
+
+  // Take the next free position after the last write, so writes rotate over the whole journal.
+  uint8_t position = cursor;
+  uint8_t tries = 0;
+  while (position_is_used(position)) {
+    position = (position + 1) % KEY_RECORD_COUNT;
+    if (++tries == KEY_RECORD_COUNT)
+      return false;
+  }
+
+  record_write(position, slot, next_sequence, segment);
+
+  uint8_t checkSlot, fp;
+  uint16_t checkSequence;
+  bool written = record_check(position, &checkSlot, &checkSequence, &fp) && checkSlot == slot && fp == key_store_fingerprint(segment);
+  for (uint8_t j = 0; written && j < SEGMENT_SIZE; j++)
+    written = EEPROM.read(record_address(position) + 3 + j) == segment[j];
+
+  cursor = (position + 1) % KEY_RECORD_COUNT;
+  next_sequence++;
+  if (!written) {
+    record_kill(position);
+    return false;
+  }
+
+  // The new record is complete, the old one can go.
+  position_set_used(position, true);
+  if (slot_position[slot] != KEY_RECORD_NONE)
+    record_kill(slot_position[slot]);
+  slot_position[slot] = position;
+  slot_fingerprint[slot] = fp;
+  return true;
+}
+
+
+bool key_store_read(uint16_t slot, uint8_t* segment) {
+  // An old layout that could not be converted stays readable, so the admin can still log in and recover
+  // the segments of the cards before formatting the store.
+  if (store_state == KEY_STORE_LEGACY && slot < LEGACY_SLOT_COUNT) {
+    if (legacy_slot_read(slot, segment))
+      return true;
+    memset(segment, 0, SEGMENT_SIZE);
+    return false;
+  }
+  if (!key_store_has(slot)) {
+    memset(segment, 0, SEGMENT_SIZE);
+    return false;
+  }
+
+  uint16_t address = record_address(slot_position[slot]) + 3;
+  for (uint8_t j = 0; j < SEGMENT_SIZE; j++)
+    segment[j] = EEPROM.read(address + j);
+  return true;
+}
+
+
+void key_store_erase(uint16_t slot) {
+  if (store_state != KEY_STORE_READY || !key_store_has(slot))
+    return;
+
+  record_kill(slot_position[slot]);
+  slot_position[slot] = KEY_RECORD_NONE;
+  slot_fingerprint[slot] = 0;
+}
+
+#endif
@@ -0,0 +1,309 @@
+#include "key_store.h"
+
+#if KEY_STORE_BACKEND == KEY_STORE_FRAM
+
+#include <Adafruit_SPIDevice.h>  // Same software SPI driver as the PN532.
+
+// FRAM opcodes, common to the Cypress/Infineon and Fujitsu parts.
+#define FRAM_WREN 0x06   // Set the write enable latch, cleared by the part after every write.
+#define FRAM_WRITE 0x02  // Write from the given address on.
+#define FRAM_READ 0x03   // Read from the given address on.
+#define FRAM_WRDI 0x04   // Clear the write enable latch.
+#define FRAM_RDSR 0x05   // Read the status register.
+#define FRAM_WEL 0x02    // Write enable latch bit of the status register.
+
+// Reads of the format marker before the part is taken as unformatted.
+#define FRAM_MAGIC_TRIES 3
+
+// Parts up to 512 Kbit take a 2-byte address, larger ones a 3-byte address.
+#define FRAM_ADDRESS_BYTES (KEY_STORE_FRAM_SIZE > 65536UL ? 3 : 2)
+
+#define FRAM_DIRECTORY_ADDRESS KEY_STORE_MAGIC_SIZE
+#define FRAM_RECORDS_ADDRESS (FRAM_DIRECTORY_ADDRESS + (uint32_t)KEY_SLOT_LAST + 1)
+
+// Directory chunk read at once while scanning.
+#define FRAM_SCAN_CHUNK 32
+
+static const uint8_t key_store_magic[KEY_STORE_MAGIC_SIZE] = { 'C', 'H', 'F', 1 };
+
+// The FRAM sits on the PN532's SCK, MISO and MOSI pins (15, 14, 16) with its own chip select, both
+// devices use SPI mode 0. MSB first for the FRAM, the PN532 driver sets LSB first for itself.
+static Adafruit_SPIDevice fram(KEY_STORE_FRAM_CS, 15, 14, 16, 1000000, SPI_BITORDER_MSBFIRST, SPI_MODE0);
+
+static uint8_t store_state = KEY_STORE_FAILED;  // KEY_STORE_READY once the FRAM answered with a valid format marker.
+
+
+/**
+ * Builds the opcode and address sent before a transfer.
+ *
+ * @return The number of bytes of the command.
+ */
+static uint8_t fram_command(uint8_t* command, uint8_t opcode, uint32_t address) {
+  uint8_t n = 0;
+  command[n++] = opcode;
+  if (FRAM_ADDRESS_BYTES == 3)
+    command[n++] = address >> 16;
+  command[n++] = address >> 8;
+  command[n++] = address & 0xFF;
+  return n;
+}
+
+static void fram_read(uint32_t address, uint8_t* data, uint16_t len) {
+  uint8_t command[4];
+  uint8_t n = fram_command(command, FRAM_READ, address);
+  fram.write_then_read(command, n, data, len);
+}
+
+static void fram_write(uint32_t address, const uint8_t* data, uint16_t len) {
+  uint8_t command[4];
+  uint8_t wren = FRAM_WREN;
+  fram.write(&wren, 1);
+  uint8_t n = fram_command(command, FRAM_WRITE, address);
+  fram.write(data, len, command, n);
+}
+
+static void fram_fill(uint32_t address, uint8_t value, uint32_t len) {
+  uint8_t chunk[FRAM_SCAN_CHUNK];
+  memset(chunk, value, sizeof(chunk));
+  while (len) {
+    uint16_t n = len < sizeof(chunk) ? len : sizeof(chunk);
+    fram_write(address, chunk, n);
+    address += n;
+    len -= n;
+  }
+}
+
+static uint32_t record_address(uint16_t slot, uint8_t copy) {
+  return FRAM_RECORDS_ADDRESS + ((uint32_t)slot * 2 + copy) * KEY_RECORD_SIZE;
+}
+
+/**
+ * Directory value of a segment. 0 is kept for empty slots, so a fingerprint of 0 is stored as 1.
+ */
+static uint8_t directory_value(const uint8_t* segment) {
+  uint8_t fp = key_store_fingerprint(segment);
+  return fp ? fp : 1;
+}
+
+static uint8_t directory_read(uint16_t slot) {
+  uint8_t value;
+  fram_read(FRAM_DIRECTORY_ADDRESS + slot, &value, 1);
+  return value;
+}
+
+static void directory_write(uint16_t slot, uint8_t value) {
+  fram_write(FRAM_DIRECTORY_ADDRESS + slot, &value, 1);
+}
+
+/**
+ * Reads one copy of a slot's record and checks its CRC.
+ *
+ * @return true if the copy is complete, its sequence number and data are then returned.
+ */
+static bool record_read(uint16_t slot, uint8_t copy, uint16_t* sequence, uint8_t* segment) {
+  uint8_t record[KEY_RECORD_SIZE];
+  uint16_t crc = 0xFFFF;
+
+  fram_read(record_address(slot, copy), record, KEY_RECORD_SIZE);
+  for (uint8_t i = 0; i < KEY_RECORD_SIZE - 2; i++)
+    crc = key_store_crc16(crc, record[i]);
+
+  bool valid = crc == (((uint16_t)record[KEY_RECORD_SIZE - 2] << 8) | record[KEY_RECORD_SIZE - 1]);
+  if (valid) {
+    *sequence = ((uint16_t)record[0] << 8) | record[1];
+    memcpy(segment, record + 2, SEGMENT_SIZE);
+  }
+  memset(record, 0, sizeof(record));
+  return valid;
+}
+
+/**
+ * Finds the newest complete copy of a slot's record.
+ *
+ * @return The copy index (0 or 1), -1 if neither copy is complete.
+ */
+static int8_t record_newest(uint16_t slot, uint16_t* sequence, uint8_t* segment) {
+  uint8_t other[SEGMENT_SIZE];
+  uint16_t otherSequence;
+  int8_t newest = -1;
+
+  if (record_read(slot, 0, sequence, segment))
+    newest = 0;
+  if (record_read(slot, 1, &otherSequence, other) && (newest < 0 || (int16_t)(otherSequence - *sequence) > 0)) {
+    *sequence = otherSequence;
+    memcpy(segment, other, SEGMENT_SIZE);
+    newest = 1;
+  }
+  memset(other, 0, sizeof(other));
+  return newest;
+}
+
+static bool header_is_valid(void) {
+  uint8_t magic[KEY_STORE_MAGIC_SIZE];
+  fram_read(0, magic, KEY_STORE_MAGIC_SIZE);
+  return memcmp(magic, key_store_magic, KEY_STORE_MAGIC_SIZE) == 0;
+}
+
+static uint8_t status_read(void) {
+  uint8_t opcode = FRAM_RDSR;
+  uint8_t status;
+  fram.write_then_read(&opcode, 1, &status, 1);
+  return status;
+}
+
+/**
+ * Checks that a part answers on the chip select, without writing to its memory: the write enable latch
+ * has to follow WREN and WRDI, which a floating or shorted MISO cannot do. Unlike the device ID, every
+ * SPI FRAM has the latch.
+ */
+static bool fram_answers(void) {
+  uint8_t opcode = FRAM_WREN;
+  fram.write(&opcode, 1);
+  bool set = status_read() & FRAM_WEL;
+  opcode = FRAM_WRDI;
+  fram.write(&opcode, 1);
+  return set && !(status_read() & FRAM_WEL);
+}
+
+
+bool key_store_begin(void) {
+  fram.begin();
+  store_state = KEY_STORE_FAILED;
+  if (!fram_answers())
+    return false;
+
+  // A blank part, or one formatted for another layout, is left as it is for an explicit format: a
+  // marker misread on a noisy bus must not cost the keys.
+  store_state = KEY_STORE_UNFORMATTED;
+  for (uint8_t i = 0; i < FRAM_MAGIC_TRIES && store_state != KEY_STORE_READY; i++) {
+    if (header_is_valid())
+      store_state = KEY_STORE_READY;
+  }
+  return store_state == KEY_STORE_READY;
+}
+
+
+uint8_t key_store_state(void) {
+  return store_state;
+}
+
+
+bool key_store_format(void) {
+  store_state = KEY_STORE_FAILED;
+  if (!fram_answers())
+    return false;
+
+  // Records are wiped too so no key material is left behind, a few seconds on the software SPI.
+  fram_fill(FRAM_DIRECTORY_ADDRESS, 0, FRAM_RECORDS_ADDRESS - FRAM_DIRECTORY_ADDRESS);
+  fram_fill(FRAM_RECORDS_ADDRESS, 0, ((uint32_t)KEY_SLOT_LAST + 1) * 2 * KEY_RECORD_SIZE);
+  fram_write(0, key_store_magic, KEY_STORE_MAGIC_SIZE);
+  store_state = header_is_valid() ? KEY_STORE_READY : KEY_STORE_FAILED;
+  return store_state == KEY_STORE_READY;
+}
+
+
+uint16_t key_store_find(const uint8_t* segment) {
+  uint8_t directory[FRAM_SCAN_CHUNK];
+  uint8_t stored[SEGMENT_SIZE];
+  uint8_t value = directory_value(segment);
+  uint16_t found = KEY_SLOT_NONE;
+
+  if (store_state != KEY_STORE_READY)
+    return KEY_SLOT_NONE;
+
+  for (uint16_t base = KEY_SLOT_FIRST; base <= KEY_SLOT_LAST && found == KEY_SLOT_NONE; base += FRAM_SCAN_CHUNK) {
+    uint16_t n = KEY_SLOT_LAST + 1 - base < FRAM_SCAN_CHUNK ? KEY_SLOT_LAST + 1 - base : FRAM_SCAN_CHUNK;
+    fram_read(FRAM_DIRECTORY_ADDRESS + base, directory, n);
+
+    for (uint16_t i = 0; i < n && found == KEY_SLOT_NONE; i++) {
+      if (directory[i] != value)
+        continue;  // Empty slot or different content, the record is not read.
+
+      // Fingerprints can collide, confirm with the record's content.
+      uint16_t sequence;
+      if (record_newest(base + i, &sequence, stored) >= 0 && memcmp(stored, segment, SEGMENT_SIZE) == 0)
+        found = base + i;
+    }
+  }
+  memset(stored, 0, sizeof(stored));
+  return found;
+}
+
+
+uint16_t key_store_allocate(void) {
+  uint8_t directory[FRAM_SCAN_CHUNK];
+
+  if (store_state != KEY_STORE_READY)
+    return KEY_SLOT_NONE;
+
+  for (uint16_t base = KEY_SLOT_FIRST; base <= KEY_SLOT_LAST; base += FRAM_SCAN_CHUNK) {
+    uint16_t n = KEY_SLOT_LAST + 1 - base < FRAM_SCAN_CHUNK ? KEY_SLOT_LAST + 1 - base : FRAM_SCAN_CHUNK;
+    fram_read(FRAM_DIRECTORY_ADDRESS + base, directory, n);
+    for (uint16_t i = 0; i < n; i++) {
+      if (directory[i] == 0)
+        return base + i;
+    }
+  }
+  return KEY_SLOT_NONE;
+}
+
+
+bool key_store_has(uint16_t slot) {
+  return store_state == KEY_STORE_READY && slot <= KEY_SLOT_LAST && directory_read(slot) != 0;
+}
+
+
+bool key_store_write(uint16_t slot, const uint8_t* segment) {
+  uint8_t record[KEY_RECORD_SIZE];
+  uint8_t check[KEY_RECORD_SIZE];
+  uint16_t sequence = 0;
+
+  if (store_state != KEY_STORE_READY || slot > KEY_SLOT_LAST)
+    return false;
+
+  // The new content goes over the older copy, the newest one stays valid until the write is complete.
+  int8_t newest = record_newest(slot, &sequence, check);
+  uint8_t copy = newest == 0 ? 1 : 0;
+  sequence = newest < 0 ? 0 : sequence + 1;
+
+  uint16_t crc = 0xFFFF;
+  record[0] = sequence >> 8;
+  record[1] = sequence & 0xFF;
+  memcpy(record + 2, segment, SEGMENT_SIZE);
+  for (uint8_t i = 0; i < KEY_RECORD_SIZE - 2; i++)
+    crc = key_store_crc16(crc, record[i]);
+  record[KEY_RECORD_SIZE - 2] = crc >> 8;
+  record[KEY_RECORD_SIZE - 1] = crc & 0xFF;
+
+  fram_write(record_address(slot, copy), record, KEY_RECORD_SIZE);
+  fram_read(record_address(slot, copy), check, KEY_RECORD_SIZE);
+  bool written = memcmp(record, check, KEY_RECORD_SIZE) == 0;
+
+  memset(record, 0, sizeof(record));
+  memset(check, 0, sizeof(check));
+  if (written)
+    directory_write(slot, directory_value(segment));
+  return written;
+}
+
+
+bool key_store_read(uint16_t slot, uint8_t* segment) {
+  uint16_t sequence;
+
+  if (!key_store_has(slot) || record_newest(slot, &sequence, segment) < 0) {
+    memset(segment, 0, SEGMENT_SIZE);
+    return false;
+  }
+  return true;
+}
+
+
+void key_store_erase(uint16_t slot) {
+  if (!key_store_has(slot))
+    return;
+
+  directory_write(slot, 0);
+  fram_fill(record_address(slot, 0), 0, 2 * KEY_RECORD_SIZE);  // All-zero copies never pass the CRC.
+}
+
+#endif
@@ -0,0 +1,113 @@
+#include "key_store.h"
+
+#if KEY_STORE_BACKEND == KEY_STORE_RAM
+
+// Host builds only: keeps the slots in RAM, and in KEY_STORE_FILE between runs when it is defined.
+#ifdef KEY_STORE_FILE
+#include <stdio.h>
+#endif
+
+static bool slot_used[KEY_SLOT_LAST + 1];
+static uint8_t slot_data[KEY_SLOT_LAST + 1][SEGMENT_SIZE];
+
+
+/**
+ * Saves the whole image after every change. Nothing to do without KEY_STORE_FILE.
+ */
+static void image_save(void) {
+#ifdef KEY_STORE_FILE
+  FILE* file = fopen(KEY_STORE_FILE, "wb");
+  if (!file)
+    return;
+  fwrite(slot_used, sizeof(slot_used), 1, file);
+  fwrite(slot_data, sizeof(slot_data), 1, file);
+  fclose(file);
+#endif
+}
+
+
+bool key_store_begin(void) {
+  memset(slot_used, 0, sizeof(slot_used));
+  memset(slot_data, 0, sizeof(slot_data));
+#ifdef KEY_STORE_FILE
+  FILE* file = fopen(KEY_STORE_FILE, "rb");
+  if (file) {
+    // A short or foreign file leaves an empty store.
+    if (fread(slot_used, sizeof(slot_used), 1, file) != 1 || fread(slot_data, sizeof(slot_data), 1, file) != 1) {
+      memset(slot_used, 0, sizeof(slot_used));
+      memset(slot_data, 0, sizeof(slot_data));
+    }
+    fclose(file);
+  }
+#endif
+  return true;
+}
+
+
+uint8_t key_store_state(void) {
+  return KEY_STORE_READY;
+}
+
+
+bool key_store_format(void) {
+  memset(slot_used, 0, sizeof(slot_used));
+  memset(slot_data, 0, sizeof(slot_data));
+  image_save();
+  return true;
+}
+
+
+uint16_t key_store_find(const uint8_t* segment) {
+  for (uint16_t slot = KEY_SLOT_FIRST; slot <= KEY_SLOT_LAST; slot++) {
+    if (slot_used[slot] && memcmp(slot_data[slot], segment, SEGMENT_SIZE) == 0)
+      return slot;
+  }
+  return KEY_SLOT_NONE;
+}
+
+
+uint16_t key_store_allocate(void) {
+  for (uint16_t slot = KEY_SLOT_FIRST; slot <= KEY_SLOT_LAST; slot++) {
+    if (!slot_used[slot])
+      return slot;
+  }
+  return KEY_SLOT_NONE;
+}
+
+
+bool key_store_has(uint16_t slot) {
+  return slot <= KEY_SLOT_LAST && slot_used[slot];
+}
+
+
+bool key_store_write(uint16_t slot, const uint8_t* segment) {
+  if (slot > KEY_SLOT_LAST)
+    return false;
+
+  memcpy(slot_data[slot], segment, SEGMENT_SIZE);
+  slot_used[slot] = true;
+  image_save();
+  return true;
+}
+
+
+bool key_store_read(uint16_t slot, uint8_t* segment) {
+  if (!key_store_has(slot)) {
+    memset(segment, 0, SEGMENT_SIZE);
+    return false;
+  }
+  memcpy(segment, slot_data[slot], SEGMENT_SIZE);
+  return true;
+}
+
+
+void key_store_erase(uint16_t slot) {
+  if (!key_store_has(slot))
+    return;
+
+  slot_used[slot] = false;
+  memset(slot_data[slot], 0, SEGMENT_SIZE);
+  image_save();
+}
+
+#endif
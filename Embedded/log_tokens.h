@@ -0,0 +1,34 @@
+#pragma once
+
+// Format strings of the log records, shared by the firmware and the host decoder (host/log_decode.cpp).
+// Only the token, the index of the format here, is sent: append new formats at the end so logs captured
+// from an older firmware still decode. %u takes a 16-bit argument, %h the remaining bytes as hex.
+#define LOG_TOKENS(X) \
+  X(LOG_DROPPED, "%u log records dropped") \
+  X(LOG_KEY_INVALID, "Key non valide!") \
+  X(LOG_ENCRYPT_SIZE, "Taille entree chiffrement: %u bytes, %u blocks") \
+  X(LOG_DECRYPT_SIZE, "Taille entree dechiffrement: %u bytes, %u blocks") \
+  X(LOG_HEX_DUMP, "%h") \
+  X(LOG_CARD_UID, "Card UID %h") \
+  X(LOG_READ_FAILED, "Unable to read block: %u") \
+  X(LOG_WRITE_FAILED, "Unable to write block: %u") \
+  X(LOG_AUTH_FAILED_FIRST, "Failed to authenticate first sector card") \
+  X(LOG_AUTH_FAILED_SECOND, "Failed to authenticate first sector of second card") \
+  X(LOG_SECOND_CARD_MISSING, "Failed to read second card") \
+  X(LOG_DUAL_CARDS, "dualCards: %c") \
+  X(LOG_KEY_SEGMENTS, "Key segments: %h") \
+  X(LOG_SEGMENT_SLOT, "idxSegmVide: %u") \
+  X(LOG_NDEF_RECORD, "Ndef record: %h") \
+  X(LOG_NDEF_AUTH_FAILED, "Failed to authenticate NDEF sector %u") \
+  X(LOG_NDEF_MAD_INVALID, "No valid MAD on the card") \
+  X(LOG_NDEF_AREA_END, "NDEF message continues past the last NDEF sector") \
+  X(LOG_NDEF_INVALID, "No key record, NDEF status %u") \
+  X(LOG_ARENA_FULL, "Arena full: %u bytes asked, %u used") \
+  X(LOG_CIPHER_SELF_TEST, "Cipher self-test failed, mode %u")
+
+#define LOG_TOKEN_ENUM(token, format) token,
+
+enum {
+  LOG_TOKENS(LOG_TOKEN_ENUM)
+  LOG_TOKEN_COUNT
+};
@@ -0,0 +1,55 @@
+#include "logging.h"
+
+static uint8_t ring[LOG_RING_SIZE];
+static uint8_t head = 0;  // Next byte written.
+static uint8_t tail = 0;  // Next byte sent.
+static uint16_t dropped = 0;
+
+
+void log_begin(void) {
+  LOG_PORT.begin(LOG_BAUD);
+}
+
+
+static uint8_t ring_free(void) {
+  return LOG_RING_SIZE - 1 - (uint8_t)((head - tail) & (LOG_RING_SIZE - 1));
+}
+
+
+static void ring_put(uint8_t byte) {
+  ring[head] = byte;
+  head = (head + 1) & (LOG_RING_SIZE - 1);
+}
+
+
+static void ring_record(uint8_t level, uint8_t token, const uint8_t* args, uint8_t len) {
+  ring_put(LOG_SYNC | level);
+  ring_put(token);
+  ring_put(len);
+  while (len--)
+    ring_put(*args++);
+}
+
+
+void log_record(uint8_t level, uint8_t token, const void* args, uint8_t len) {
+  // A record is queued whole or not at all, the count of the dropped ones is queued once there is room.
+  if (dropped && ring_free() >= 3 + sizeof(dropped) + 3 + len) {
+    ring_record(LOG_LEVEL_WARN, LOG_DROPPED, (const uint8_t*)&dropped, sizeof(dropped));
+    dropped = 0;
+  }
+  if (dropped || ring_free() < 3 + len) {
+    if (dropped < 0xFFFF)
+      dropped++;
+    return;
+  }
+  ring_record(level, token, (const uint8_t*)args, len);
+}
+
+
+void log_flush(void) {
+  int room = LOG_PORT.availableForWrite();
+  while (head != tail && room-- > 0) {
+    LOG_PORT.write(ring[tail]);
+    tail = (tail + 1) & (LOG_RING_SIZE - 1);
+  }
+}
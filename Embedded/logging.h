@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "log_tokens.h"
+
+// Diagnostics are sent as binary records on LOG_PORT, never on Serial which carries the app protocol.
+// A record is its level, the token of its format string (log_tokens.h) and its raw arguments; the text
+// is only rebuilt on the host by host/log_decode. Records are queued and sent when the firmware is idle.
+#define LOG_LEVEL_OFF 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Records above this level are compiled out, with their arguments.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_PORT Serial1      // Hardware UART on pins 0 and 1, the USB serial is left to the app.
+#define LOG_BAUD 115200
+#define LOG_RING_SIZE 128     // Queued bytes, a power of 2. Records that do not fit are counted and dropped.
+#define LOG_SYNC 0xA0         // High nibble of the first byte of a record, its low nibble is the level.
+
+/**
+ * Starts the log port.
+ */
+void log_begin(void);
+
+/**
+ * Queues a record.
+ *
+ * @param level One of the LOG_LEVEL_ values.
+ * @param token One of the tokens of log_tokens.h.
+ * @param args Pointer to the arguments, 16-bit values in little endian followed by any hex data.
+ * @param len Length of the arguments in bytes.
+ */
+void log_record(uint8_t level, uint8_t token, const void* args, uint8_t len);
+
+/**
+ * Sends the queued records the log port can take without blocking. Called while waiting for requests.
+ */
+void log_flush(void);
+
+static inline void log_values(uint8_t level, uint8_t token) {
+  log_record(level, token, NULL, 0);
+}
+
+/**
+ * Queues a record whose arguments are all %u.
+ */
+template <typename... Args>
+static inline void log_values(uint8_t level, uint8_t token, Args... args) {
+  uint16_t values[] = { (uint16_t)args... };
+  log_record(level, token, values, sizeof(values));
+}
+
+// LOG_<LEVEL>(token, values...) queues a record with %u arguments, LOG_<LEVEL>_HEX(token, data, len) one
+// with a %h argument. Both compile to nothing above LOG_LEVEL.
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) log_values(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_ERROR_HEX(token, data, len) log_record(LOG_LEVEL_ERROR, token, data, len)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#define LOG_ERROR_HEX(token, data, len) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) log_values(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_WARN_HEX(token, data, len) log_record(LOG_LEVEL_WARN, token, data, len)
+#else
+#define LOG_WARN(...) do {} while (0)
+#define LOG_WARN_HEX(token, data, len) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) log_values(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_INFO_HEX(token, data, len) log_record(LOG_LEVEL_INFO, token, data, len)
+#else
+#define LOG_INFO(...) do {} while (0)
+#define LOG_INFO_HEX(token, data, len) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) log_values(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_DEBUG_HEX(token, data, len) log_record(LOG_LEVEL_DEBUG, token, data, len)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#define LOG_DEBUG_HEX(token, data, len) do {} while (0)
+#endif
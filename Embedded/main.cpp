@@ -4,6 +4,10 @@
 // Pins 15, 14, 16, and 10 correspond to SCK, MISO, MOSI, and SS respectively on the Arduino pro micro.
 Adafruit_PN532 nfc(15, 14, 16, 10);
 
+// The same pins and settings as the driver's own SPI device, to read the responses of commands the driver
+// sends but has no function for.
+static Adafruit_SPIDevice nfc_spi(10, 15, 14, 16, 1000000, SPI_BITORDER_LSBFIRST, SPI_MODE0);
+
 
 uint8_t uidLength = 0;  // Global variable to store the length of the UID (Unique Identifier) of the NFC card.
                         // The length can be either 4 or 7 bytes, depending on the card's compliance with ISO14443A standard.
@@ -15,103 +19,419 @@ uint8_t nb_data_blocks = 0;  // Global variable used for indexing and iterating
                              // It helps in managing the read/write operations to the card's memory blocks.
 
 
-bool nfc_begin(void) {
-  return nfc.begin();
+bool nfc_detect(void) {
+  PROFILE_BEGIN(start);
+  bool found = nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength, NFC_DETECT_TIMEOUT_MS);
+  if (found)
+    PROFILE_END(PROFILE_DETECT, start);  // Only the attempts finding a card, not the empty polls.
+  return found;
 }
 
 bool nfc_readPassiveTargetID() {
-  return nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength);
+  while (!nfc_detect())
+    delay(NFC_POLL_MS);
+  return true;
 }
-#ifdef DEBUG
+
 /**
- * Prints an array of bytes in hexadecimal format to the Serial interface, aiding in debugging.
- * The output is formatted in rows of 16 bytes to enhance readability.
+ * Reads the response frame of the command the PN532 has acknowledged, the driver having waited for it.
  *
- * @param array Pointer to the array of bytes to be printed.
- * @param nbBytes The number of bytes in the array to be printed.
+ * @param frame Buffer receiving the frame, NFC_FRAME_OVERHEAD bytes more than the largest response.
+ * @param size Its size.
+ * @return The length of the response, code included, which starts at frame + 6. 0 if the frame is
+ *         malformed or larger than the buffer.
  */
-void printDebugHex(uint8_t* array, size_t nbBytes) {
-  // Print a header line to clearly separate debug output
-  Serial.println(F("--------------------------------------DEBUG--------------------------------------"));
-
-  // Loop through each byte of the array
-  for (uint8_t i = 0; i < nbBytes; i++) {
-    // Print an additional leading zero for bytes less than 0x10 to maintain consistent formatting
-    if (array[i] < 0x10)
-      Serial.print(F("0"));
-    Serial.print(array[i], HEX);  // Print the byte in hexadecimal
-    Serial.print(F(" "));         // Print a space for separation
+static uint8_t nfc_read_response(uint8_t* frame, uint8_t size) {
+  uint8_t op = PN532_SPI_DATAREAD;
+  nfc_spi.write_then_read(&op, 1, frame, size);
+  uint8_t length = frame[3];  // TFI, code and data.
+  if (frame[0] != PN532_PREAMBLE || frame[1] != PN532_STARTCODE1 || frame[2] != PN532_STARTCODE2
+      || (uint8_t)(length + frame[4]) != 0 || length < 2 || length > size - NFC_FRAME_OVERHEAD + 1
+      || frame[5] != PN532_PN532TOHOST)
+    return 0;
+
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i <= length; i++)
+    sum += frame[5 + i];  // TFI, code, data and checksum add up to 0.
+  return sum ? 0 : length - 1;
+}
 
-    // Every 16 bytes, print a newline to format the output into blocks of 16 bytes each
-    if ((i + 1) % 16 == 0) {
-      Serial.println();
+/**
+ * Runs a Diagnose test of the PN532.
+ *
+ * @param command The Diagnose command code, the test number and its parameters.
+ * @param frame Receives the response frame, the result starts at frame + 7, after the response code.
+ * @return The length of the result, -1 if the PN532 has not answered.
+ */
+static int16_t nfc_diagnose(uint8_t* command, uint8_t length, uint8_t* frame, uint8_t size) {
+  if (!nfc.sendCommandCheckAck(command, length))
+    return -1;
+  uint8_t response = nfc_read_response(frame, size);
+  if (!response || frame[6] != PN532_COMMAND_DIAGNOSE + 1)
+    return -1;
+  return response - 1;
+}
+
+/**
+ * Runs the ROM or RAM self-test of the PN532.
+ *
+ * @param test NFC_DIAGNOSE_ROM or NFC_DIAGNOSE_RAM.
+ * @return NFC_SELF_TEST_OK, NFC_SELF_TEST_FAILED or NFC_SELF_TEST_NO_ANSWER.
+ */
+static uint8_t nfc_self_test(uint8_t test) {
+  uint8_t command[2] = { PN532_COMMAND_DIAGNOSE, test };
+  uint8_t frame[NFC_FRAME_OVERHEAD + 2];
+  if (nfc_diagnose(command, sizeof(command), frame, sizeof(frame)) != 1)
+    return NFC_SELF_TEST_NO_ANSWER;
+  return frame[7];
+}
+
+/**
+ * Checks that the card selected by the last detection is still in the field with the PN532 Diagnose
+ * attention request test: one exchange with the card, no anticollision.
+ *
+ * @return NFC_PROBE_PRESENT, NFC_PROBE_ABSENT, or NFC_PROBE_UNSUPPORTED if the card does not answer the
+ *         test, MIFARE Classic and Ultralight cards only speak ISO14443-3.
+ */
+static uint8_t nfc_probe(void) {
+  uint8_t command[2] = { PN532_COMMAND_DIAGNOSE, NFC_DIAGNOSE_ATTENTION };
+  uint8_t frame[NFC_FRAME_OVERHEAD + 2];  // Response code and status.
+  if (nfc_diagnose(command, sizeof(command), frame, sizeof(frame)) != 1)
+    return NFC_PROBE_UNSUPPORTED;
+
+  uint8_t status = frame[7] & 0x3F;  // Error code, without the NAD and MI bits.
+  if (status == 0x00)
+    return NFC_PROBE_PRESENT;
+  return status == 0x01 ? NFC_PROBE_ABSENT : NFC_PROBE_UNSUPPORTED;  // 0x01: the card did not answer.
+}
+
+static uint8_t presence_uid[7];         // Card on the reader at the last check.
+static uint8_t presence_uid_length = 0;  // 0 if there was none.
+static bool presence_probe = true;       // The card answers the Diagnose test.
+
+void presence_poll(void) {
+  if (presence_uid_length && presence_probe) {
+    uint8_t probe = nfc_probe();
+    if (probe == NFC_PROBE_PRESENT)
+      return;
+    presence_probe = probe != NFC_PROBE_UNSUPPORTED;
+  }
+
+  // Without the test, or to confirm the card has left, select it again.
+  bool found = nfc_detect();
+  if (found && uidLength == presence_uid_length && !memcmp(uid, presence_uid, uidLength))
+    return;
+
+  if (presence_uid_length) {
+    Console.println(F("cardEvent=removed"));
+    presence_uid_length = 0;
+  }
+  if (found) {
+    memcpy(presence_uid, uid, uidLength);
+    presence_uid_length = uidLength;
+    presence_probe = true;
+    Console.print(F("cardEvent=arrived,uid="));
+    for (uint8_t i = 0; i < uidLength; i++) {
+      if (uid[i] < 0x10)
+        Console.print('0');
+      Console.print(uid[i], HEX);
     }
+    Console.println();
   }
+  Console.flush();  // Events are sent at once, the host reacts to them.
+}
+
+// The card operations below go through these wrappers so each one is timed by the profiling probes.
+// They also hand the queued log records to the UART, which sends them during the next card exchange.
+
+/**
+ * Authenticates a sector of the card found by the last nfc_readPassiveTargetID().
+ *
+ * @param block Any block of the sector.
+ * @param keyNumber 0 for key A, 1 for key B.
+ * @param key Pointer to the 6 bytes key.
+ */
+static bool nfc_authenticate_block(uint32_t block, uint8_t keyNumber, uint8_t* key) {
+  PROFILE_BEGIN(start);
+  bool authenticated = nfc.mifareclassic_AuthenticateBlock(uid, uidLength, block, keyNumber, key);
+  PROFILE_END(PROFILE_AUTH, start);
+  log_flush();
+  return authenticated;
+}
 
-  // Print a newline to end the last line of data if it doesn't end exactly at a 16-byte boundary
-  Serial.println();
-  // Print a footer line to clearly end the debug section
-  Serial.println(F("---------------------------------------------------------------------------------"));
+static bool nfc_read_block(uint8_t block, uint8_t* data) {
+  PROFILE_BEGIN(start);
+  bool read = nfc.mifareclassic_ReadDataBlock(block, data);
+  PROFILE_END(PROFILE_READ, start);
+  log_flush();
+  return read;
 }
-#endif
+
+static bool nfc_write_block(uint8_t block, uint8_t* data) {
+  PROFILE_BEGIN(start);
+  bool written = nfc.mifareclassic_WriteDataBlock(block, data);
+  PROFILE_END(PROFILE_WRITE, start);
+  log_flush();
+  return written;
+}
+
 
 /**
- * Initializes the NFC chip connection and checks for its presence by retrieving the firmware version.
- * If the NFC chip is found, the function prints the chip type and firmware version to the Serial monitor.
- * If the chip cannot be found, it prints an error message and halts the program.
+ * Position in the NDEF data area of the card: the data blocks of the sectors the MAD assigns to NDEF.
  */
-void nfc_chip_connect(void) {
-  uint32_t versiondata = nfc.getFirmwareVersion();  // Attempt to retrieve the firmware version of the NFC chip.
-
-  // Check if the firmware data was successfully retrieved.
-  if (!versiondata) {
-    Serial.print(F("Didn't find PN53x board"));  // Inform on the Serial monitor that no NFC board was detected.
-    while (1)
-      ;  // Halt execution indefinitely if no NFC chip is found.
+typedef struct {
+  uint8_t sector;              // Sector being accessed.
+  uint8_t block;               // Block being accessed, 0 before the first one.
+  bool mad_read;               // The MAD has been read into mad.
+  uint8_t mad[NDEF_MAD_SIZE];  // Blocks 1 and 2 of sector 0.
+} NdefCursor;
+
+/**
+ * Reads the MAD1 of the card, with the public MAD key A format_MAD1 gives sector 0.
+ */
+static bool ndef_read_mad(uint8_t* mad) {
+  uint8_t mad_key[6];
+  for (uint8_t i = 0; i < 6; i++) {
+    mad_key[i] = pgm_read_byte_near(&(keys[0][i]));
+  }
+  if (!nfc_authenticate_block(0, 0, mad_key) || !nfc_read_block(1, mad) || !nfc_read_block(2, mad + 16)
+      || !ndef_mad_valid(mad)) {
+    LOG_WARN(LOG_NDEF_MAD_INVALID);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Moves to the next block of the NDEF data area, authenticating each sector it enters with the NDEF key A
+ * format_MAD1 writes: its trailers leave key B readable, so key B grants no access to the data blocks.
+ * Key records start in KEY_RECORD_SECTOR, the MAD is only read when a message continues past it.
+ *
+ * @param cursor Position in the data area, zeroed before the first block.
+ * @return false at the end of the data area or if a sector cannot be accessed.
+ */
+static bool ndef_next_block(NdefCursor* cursor) {
+  if (cursor->block && cursor->block + 1 < BLOCK_NUMBER_OF_SECTOR_TRAILER(cursor->sector)) {
+    cursor->block++;
+    return true;
   }
 
-  // If the firmware data is valid, proceed to print details.
-  Serial.print(F("Found chip PN5"));                // Print the chip model prefix.
-  Serial.println((versiondata >> 24) & 0xFF, HEX);  // Extract and print the major chip version number in hexadecimal.
+  uint8_t sector = KEY_RECORD_SECTOR;
+  if (cursor->block) {
+    if (!cursor->mad_read) {
+      if (!ndef_read_mad(cursor->mad))
+        return false;
+      cursor->mad_read = true;
+    }
+    sector = ndef_mad_next_sector(cursor->mad, cursor->sector);
+    if (!sector) {
+      LOG_WARN(LOG_NDEF_AREA_END);
+      return false;
+    }
+  }
 
-  Serial.print(F("Firmware ver. "));               // Notify that firmware version will be printed next.
-  Serial.print((versiondata >> 16) & 0xFF, DEC);   // Extract and print the major version number.
-  Serial.print('.');                               // Dot to separate major and minor firmware version numbers.
-  Serial.println((versiondata >> 8) & 0xFF, DEC);  // Extract and print the minor version number.
+  uint8_t ndef_key[6];
+  for (uint8_t i = 0; i < 6; i++) {
+    ndef_key[i] = pgm_read_byte_near(&(keys[1][i]));
+  }
+  if (!nfc_authenticate_block(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector), 0, ndef_key)) {
+    LOG_WARN(LOG_NDEF_AUTH_FAILED, sector);
+    return false;
+  }
+  cursor->sector = sector;
+  cursor->block = BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector);
+  return true;
 }
 
+/**
+ * Reads the NDEF message of the card, only up to the block completing it.
+ *
+ * @param message Buffer receiving the message.
+ * @param size Its size.
+ * @return The length of the message, -1 if it cannot be read.
+ */
+static int16_t ndef_read_message(uint8_t* message, uint16_t size) {
+  NdefCursor cursor = {};
+  NdefReader reader;
+  ndef_read_begin(&reader, message, size);
+
+  uint8_t block[NDEF_BLOCK_SIZE];
+  uint8_t result = NDEF_READ_MORE;
+  while (result == NDEF_READ_MORE) {
+    if (!ndef_next_block(&cursor))
+      return -1;
+    if (!nfc_read_block(cursor.block, block)) {
+      LOG_WARN(LOG_READ_FAILED, cursor.block);
+      return -1;
+    }
+    result = ndef_read_feed(&reader, block);
+  }
+  if (result != NDEF_READ_COMPLETE) {
+    LOG_WARN(LOG_NDEF_INVALID, result);
+    return -1;
+  }
+  return reader.length;
+}
 
-#ifdef DEBUG
 /**
- * Prints information about the detected NFC/RFID card to the Serial monitor.
- * This function identifies the type of card based on the UID length and displays the UID in hexadecimal format.
+ * Writes an NDEF message and its terminator to the card, only the blocks they span.
+ *
+ * @param message The NDEF message.
+ * @param length Its length.
  */
-void print_card_info(void) {
+static bool ndef_write_message(const uint8_t* message, uint16_t length) {
+  NdefCursor cursor = {};
+  NdefWriter writer;
+  ndef_write_begin(&writer, message, length);
+
+  uint8_t block[NDEF_BLOCK_SIZE];
+  while (ndef_write_next(&writer, block)) {
+    if (!ndef_next_block(&cursor))
+      return false;
+    if (!nfc_write_block(cursor.block, block)) {
+      LOG_ERROR(LOG_WRITE_FAILED, cursor.block);
+      return false;
+    }
+  }
+  return true;
+}
+
+// The 'e' request holds the key it received while it writes the key record, the deepest use of the arena.
+static_assert(KEY_SEGMENTS_SIZE + KEY_TEXT_SIZE + KEY_RECORD_MESSAGE_SIZE <= ARENA_SIZE, "ARENA_SIZE too small");
+
+// Every slot of the store can be written on a card.
+static_assert(KEY_SLOT_LAST <= CARD_SLOT_MAX, "Key store slots past the card's slot field");
+
+/**
+ * Reads the key record of the card on the reader.
+ *
+ * @param segment Buffer receiving the 32 bytes key segment, decrypted with the session's key schedule.
+ * @param slot Set to the key store slot of a single-card record.
+ * @return The flags byte of the record, -1 if the card holds no readable key record or no session is open.
+ */
+static int16_t read_key_record(char* segment, uint16_t* slot) {
+  uint16_t mark = arena_mark();
+  uint8_t* message = (uint8_t*)arena_alloc(KEY_RECORD_MESSAGE_SIZE);
+  int16_t flags = -1;
+  int16_t length = ndef_read_message(message, KEY_RECORD_MESSAGE_SIZE);
+  if (length >= 0) {
+    LOG_DEBUG_HEX(LOG_NDEF_RECORD, message, length);
+
+    const uint8_t* text;
+    int16_t textLength = ndef_find_text(message, length, &text);
+    if (textLength < KEY_TEXT_LEGACY_SIZE) {
+      LOG_WARN(LOG_NDEF_INVALID, NDEF_READ_NONE);
+    } else {
+      memcpy(segment, text, 32);
+      flags = text[KEY_RECORD_FLAGS];
+      if (textLength < KEY_RECORD_SLOT + 2)
+        *slot = flags & CARD_SLOT_MASK;  // Written by an older firmware.
+      else
+        *slot = ((uint16_t)text[KEY_RECORD_SLOT] << 8) | text[KEY_RECORD_SLOT + 1];
 
-  // Determine the type of card based on the UID length.
-  if (uidLength == 4)
-    Serial.println(F("Card type: MIFARE Classic"));  // If the UID is 4 bytes long, it's likely a MIFARE Classic.
-  else
-    Serial.println(F("Card type: MIFARE Ultralight ou autre"));  // If not, assume MIFARE Ultralight or other types.
-
-  // Display the length of the UID.
-  Serial.print(F("UID Length: "));
-  Serial.print(uidLength, DEC);  // Print the length of the UID in decimal format.
-  Serial.println(F(" bytes"));
-
-  // Display the UID itself.
-  Serial.print(F("UID = "));
-  for (uint8_t i = 0; i < uidLength; i++) {  // Loop through each byte of the UID.
-    if (uid[i] < 0x10)                       // Add a leading zero for single digit hex values for consistency.
-      Serial.print(F("0"));
-    Serial.print(uid[i], HEX);  // Print each byte of the UID in hexadecimal.
-    Serial.print(F(" "));
+      bool decrypted;
+      if (textLength < KEY_TEXT_SIZE) {
+        decrypted = cipher_session_decrypt((uint8_t*)segment, (uint8_t*)segment, 32);  // No IV, encrypted in ECB.
+      } else {
+        CipherStream stream;
+        decrypted = cipher_stream_init(&stream, CIPHER_MODE_CBC_DECRYPT, text + KEY_RECORD_IV)
+                    && cipher_stream_update(&stream, (uint8_t*)segment, 32);
+        cipher_stream_final(&stream);
+      }
+      if (!decrypted) {
+        memset(segment, 0, 32);
+        flags = -1;
+      }
+    }
+  }
+  arena_release(mark);  // The message holds the encrypted segment.
+  return flags;
+}
+
+/**
+ * Writes a key record to the card on the reader.
+ *
+ * @param segment The 32 bytes key segment in clear, encrypted in CBC with the session's key schedule and a new
+ *                IV in the record.
+ * @param flags The flags byte: KEY_RECORD_DUAL and KEY_RECORD_SECOND, 0 for a single card.
+ * @param slot The key store slot of a single card's second segment, KEY_SLOT_NONE for a dual card.
+ */
+static bool write_key_record(const char* segment, uint8_t flags, uint16_t slot) {
+  uint16_t mark = arena_mark();
+  uint8_t* text = (uint8_t*)arena_alloc(KEY_TEXT_SIZE);
+  memcpy(text, segment, 32);
+  text[KEY_RECORD_FLAGS] = flags;
+  text[KEY_RECORD_SLOT] = slot >> 8;
+  text[KEY_RECORD_SLOT + 1] = slot & 0xFF;
+
+  CipherStream stream;
+  bool encrypted = cipher_session_iv(text + KEY_RECORD_IV, uid, uidLength)
+                   && cipher_stream_init(&stream, CIPHER_MODE_CBC_ENCRYPT, text + KEY_RECORD_IV)
+                   && cipher_stream_update(&stream, text, 32);
+  cipher_stream_final(&stream);
+  if (!encrypted) {
+    arena_release(mark);  // Zeroizes the segment left in clear.
+    return false;
   }
-  Serial.println();  // Move to a new line after finishing the UID output.
+
+  uint8_t* message = (uint8_t*)arena_alloc(KEY_RECORD_MESSAGE_SIZE);
+  uint16_t length = ndef_text_message(message, KEY_RECORD_MESSAGE_SIZE, "en", text, KEY_TEXT_SIZE);
+  LOG_DEBUG_HEX(LOG_NDEF_RECORD, message, length);
+  bool written = ndef_write_message(message, length);
+  arena_release(mark);
+  return written;
 }
-#endif
 
 
+bool nfc_chip_check(void) {
+  // Both settings are lost when the reader is reseated: restoring them also tells it is still there.
+  return nfc.SAMConfig() && nfc.setPassiveActivationRetries(NFC_DETECT_RETRIES);
+}
+
+
+bool nfc_chip_connect(void) {
+  nfc.begin();  // Reset, wake-up and SAM configuration, which a reader just plugged in has not received.
+  uint32_t versiondata = nfc.getFirmwareVersion();
+  if (!versiondata || !nfc_chip_check())
+    return false;
+
+  Console.print(F("reader=ready,chip=PN5"));
+  Console.print((versiondata >> 24) & 0xFF, HEX);  // Chip model.
+  Console.print(F(",firmware="));
+  Console.print((versiondata >> 16) & 0xFF, DEC);  // Major and minor firmware version.
+  Console.print('.');
+  Console.println((versiondata >> 8) & 0xFF, DEC);
+  Console.flush();
+  return true;
+}
+
+/**
+ * Logs the UID of the detected NFC/RFID card, its length tells MIFARE Classic (4 bytes) from Ultralight
+ * and NTAG (7 bytes).
+ */
+void print_card_info(void) {
+  LOG_INFO_HEX(LOG_CARD_UID, uid, uidLength);
+}
+
+
+/**
+ * Prints a block in hex then as text, the layout of the PN532 driver's PrintHexChar. It goes through the
+ * Console, so it follows the label queued before it instead of overtaking it on the port.
+ */
+static void print_block(const uint8_t* data) {
+  for (uint8_t i = 0; i < 16; i++) {
+    if (data[i] < 0x10)
+      Console.print(F("0"));
+    Console.print(data[i], HEX);
+    if (i < 15)
+      Console.print(F(" "));
+  }
+  Console.print(F("  "));
+  for (uint8_t i = 0; i < 16; i++)
+    Console.print(data[i] < 0x20 ? '.' : (char)data[i]);
+  Console.println();
+}
+
 /**
  * Reads and prints the memory blocks of a MIFARE RFID card.
  * It uses a default key for authentication and attempts to read each sector's data blocks and the trailer block.
@@ -125,17 +445,15 @@ void read_memory(void) {
     default_key[i] = pgm_read_byte_near(&(keys[2][i]));  // Load each byte of the key using PROGMEM access.
   }
 
-  // If compiled with DEBUG defined, print the key for debugging purposes.
-#ifdef DEBUG
-  printDebugHex(default_key, 6);
-#endif
+  // Log the key at debug level.
+  LOG_DEBUG_HEX(LOG_HEX_DUMP, default_key, 6);
 
   // Iterate over all sectors of the card.
+  uint8_t* data_read = (uint8_t*)arena_alloc(16);  // Buffer to store the data read from each block.
   for (uint8_t sector_index = 0; sector_index <= sector_number; sector_index++) {
-    uint8_t data_read[16];  // Buffer to store the data read from each block.
 
     // Authenticate using the default key before attempting to read blocks.
-    if (nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index), 1, default_key)) {
+    if (nfc_authenticate_block(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index), 1, default_key)) {
       // Determine the number of data blocks in the current sector (short or long sector).
       if (sector_index < 32)
         nb_data_blocks = 3;  // Short sectors have 3 data blocks.
@@ -144,42 +462,42 @@ void read_memory(void) {
 
       // Read and print each data block in the current sector.
       for (uint8_t i = 0; i < nb_data_blocks; i++) {
-        if (nfc.mifareclassic_ReadDataBlock(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i, data_read)) {
-          Serial.print(F("Block: "));
-          Serial.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i);  // Print block number.
-          Serial.print(F("  "));
-          nfc.PrintHexChar(data_read, 16);  // Print data in hex and readable format.
+        if (nfc_read_block(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i, data_read)) {
+          Console.print(F("Block: "));
+          Console.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i);  // Print block number.
+          Console.print(F("  "));
+          print_block(data_read);  // Print data in hex and readable format.
         } else {
-          Serial.print(F("Unable to read block: "));
-          Serial.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i);
-          Serial.println();
+          Console.print(F("Unable to read block: "));
+          Console.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i);
+          Console.println();
           return;  // Exit if any block read fails.
         }
       }
 
       // Read and print the sector trailer block.
-      if (nfc.mifareclassic_ReadDataBlock(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index), data_read)) {
-        Serial.println();
-        Serial.print(F("Block: "));
-        Serial.print(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index));  // Print block number.
-        Serial.print(F("  "));
-        nfc.PrintHexChar(data_read, 16);  // Print data in hex and readable format.
-        Serial.println();
+      if (nfc_read_block(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index), data_read)) {
+        Console.println();
+        Console.print(F("Block: "));
+        Console.print(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index));  // Print block number.
+        Console.print(F("  "));
+        print_block(data_read);  // Print data in hex and readable format.
+        Console.println();
       } else {
-        Serial.print("Unable to read block ");
-        Serial.println(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index));
+        Console.print("Unable to read block ");
+        Console.println(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index));
       }
     } else {
-      Serial.print(F("Sector "));
-      Serial.print(sector_index);
-      Serial.println(F(" authentication failed, this could be a mifare 1k, try again."));
+      Console.print(F("Sector "));
+      Console.print(sector_index);
+      Console.println(F(" authentication failed, this could be a mifare 1k, try again."));
       return;  // Exit if authentication fails.
     }
   }
 
   // Clear the serial buffer and introduce a small delay to stabilize any subsequent operations.
-  Serial.flush();
-  while (Serial.available()) Serial.read();
+  Console.flush();
+  console_clear();
   delay(1000);
 }
 
@@ -196,14 +514,13 @@ void get_ndef_text(char* input) {
   uint8_t i = 0;  // Initialize index to keep track of the input length.
 
   memset(input, 0, MAX_INPUT);              // Initialize the input buffer with zeros to clean previous data.
-  Serial.println(F("Enter your text..."));  // Prompt the user to enter text.
+  Console.println(F("Enter your text..."));  // Prompt the user to enter text.
 
-  while (!Serial.available())  // Wait for the user to start typing.
-    ;                          // Loop does nothing, just waits.
+  console_wait();  // Wait for the user to start typing.
 
   // Read the input from the Serial buffer as long as data is available.
-  while (Serial.available()) {
-    char c = Serial.read();  // Read a single character from the Serial buffer.
+  while (console_available()) {
+    char c = console_read();  // Read a single character from the Serial buffer.
 
     // Check if the character is not a newline, which signifies the end of input,
     // and ensure we do not exceed the buffer limit.
@@ -215,8 +532,8 @@ void get_ndef_text(char* input) {
       i = 0;            // Reset the index for possible future use.
 
       // Output the received input back to the Serial to confirm correct reception.
-      Serial.print(F("You typed: "));
-      Serial.println(input);
+      Console.print(F("You typed: "));
+      Console.println(input);
       break;  // Exit the loop after processing the complete line of input.
     }
   }
@@ -228,7 +545,7 @@ void get_ndef_text(char* input) {
  * It handles the entire process from user input, through NDEF record formatting, to writing the data blocks.
  */
 // void write_ndef(void) {
-//   Serial.println(F("Updating card's ndef..."));  // Inform the user that the NDEF update is starting.
+//   Console.println(F("Updating card's ndef..."));  // Inform the user that the NDEF update is starting.
 
 //   // Allocate and initialize the default MIFARE authentication key from stored keys.
 //   uint8_t default_key[6];
@@ -247,8 +564,8 @@ void get_ndef_text(char* input) {
 //   uint8_t size = strlen(input);  // Calculate the length of the user input.
 
 // #ifdef DEBUG
-//   Serial.print(F("input size :"));  // Debug print the input size.
-//   Serial.println(size);
+//   Console.print(F("input size :"));  // Debug print the input size.
+//   Console.println(size);
 // #endif
 
 //   // Setup the NDEF record header and payload based on the user's input.
@@ -277,14 +594,14 @@ void get_ndef_text(char* input) {
 //     nb_sectors++;
 
 // #ifdef DEBUG
-//   Serial.print(F("nb_sectors:"));  // Debug print the number of sectors required.
-//   Serial.println(nb_sectors);
+//   Console.print(F("nb_sectors:"));  // Debug print the number of sectors required.
+//   Console.println(nb_sectors);
 // #endif
 
 //   // Write the NDEF message to the NFC card by iterating over the necessary sectors and blocks.
 //   for (uint8_t current_sector = 1; current_sector <= nb_sectors; current_sector++) {
-//     if (!nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector), 1, default_key)) {
-//       Serial.println(F("Authentication failed... is this card NDEF formatted? NDEF Record creation failed!"));
+//     if (!nfc_authenticate_block(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector), 1, default_key)) {
+//       Console.println(F("Authentication failed... is this card NDEF formatted? NDEF Record creation failed!"));
 //       return;  // Exit the function if authentication fails.
 //     }
 
@@ -299,17 +616,17 @@ void get_ndef_text(char* input) {
 // #endif
 
 //       // Attempt to write the block to the card.
-//       if (!nfc.mifareclassic_WriteDataBlock(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector) + current_block, temp)) {
-//         Serial.print(F("Writing block "));
-//         Serial.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector) + current_block);
-//         Serial.println(F(" failed, try again."));
+//       if (!nfc_write_block(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector) + current_block, temp)) {
+//         Console.print(F("Writing block "));
+//         Console.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector) + current_block);
+//         Console.println(F(" failed, try again."));
 //         return;  // Exit the function if block writing fails.
 //       }
 //     }
 //   }
 
-//   Serial.println(F("NDEF text written!"));   // Confirm successful writing.
-//   Serial.flush();                            // Flush the serial buffer to ensure all output has been sent.
+//   Console.println(F("NDEF text written!"));   // Confirm successful writing.
+//   Console.flush();                            // Flush the serial buffer to ensure all output has been sent.
 //   while (Serial.available()) Serial.read();  // Clear any remaining input from serial buffer.
 //   delay(1000);                               // Short delay to ensure stability after operations.
 // }
@@ -322,7 +639,7 @@ void get_ndef_text(char* input) {
  */
 // void write_vCard(void) {
 //   // Notify start of vCard creation.
-//   Serial.println(F("Updating card's vCard..."));
+//   Console.println(F("Updating card's vCard..."));
 
 //   // Prepare the variables for assembling the vCard.
 //   size_t decalage = 20;              // Offset for where vCard data starts in the array, after the NDEF message header.
@@ -333,8 +650,8 @@ void get_ndef_text(char* input) {
 //   for (uint8_t type_info = 0; type_info < vCardPrefixCount; type_info++) {
 //     // Debug print current field type index.
 // #ifdef DEBUG
-//     Serial.print(F("type_info: "));
-//     Serial.println(type_info);
+//     Console.print(F("type_info: "));
+//     Console.println(type_info);
 // #endif
 
 //     // Calculate the prefix length for the current field.
@@ -342,8 +659,8 @@ void get_ndef_text(char* input) {
 
 //     // Debug print the length of the current prefix.
 // #ifdef DEBUG
-//     Serial.print(F("prefix_length: "));
-//     Serial.println(prefix_length);
+//     Console.print(F("prefix_length: "));
+//     Console.println(prefix_length);
 // #endif
 
 //     // Copy the prefix from program memory to the vCard buffer at the current position.
@@ -353,8 +670,8 @@ void get_ndef_text(char* input) {
 //     // Handle user input for fields that are not the photo or the end field.
 //     if (type_info > 0 && type_info < (vCardPrefixCount - 2)) {
 //       uint8_t eeprom_cell = 0;  // Index for EEPROM data storage.
-//       Serial.print(F("Enter the following information: "));
-//       Serial.println(type_info);
+//       Console.print(F("Enter the following information: "));
+//       Console.println(type_info);
 //       // Wait for user input to become available.
 //       while (!Serial.available())
 //         ;
@@ -369,14 +686,14 @@ void get_ndef_text(char* input) {
 //           EEPROM.update(eeprom_cell, '\n');
 //           // Optionally, print the typed information in debug mode.
 // #ifdef DEBUG
-//           Serial.print(F("You typed: "));
+//           Console.print(F("You typed: "));
 //           for (uint8_t i = 0; i <= eeprom_cell; i++) {
 //             if (EEPROM[i] < 0x10)
-//               Serial.print(F("0"));
-//             Serial.print(EEPROM[i], HEX);
-//             Serial.print(F(" "));
+//               Console.print(F("0"));
+//             Console.print(EEPROM[i], HEX);
+//             Console.print(F(" "));
 //           }
-//           Serial.println();
+//           Console.println();
 // #endif
 //           // Copy user input from EEPROM to the vCard buffer.
 //           for (uint8_t i = 0; i <= eeprom_cell; i++) {
@@ -415,10 +732,10 @@ void get_ndef_text(char* input) {
 //   // Loop through each sector that needs to be written to store the full vCard.
 //   for (uint8_t current_sector = 1; current_sector <= nb_sectors; current_sector++) {
 //     // Attempt to authenticate the current sector with the default key.
-//     if (!nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector), 1, default_key)) {
-//       Serial.print(F("Sector: "));
-//       Serial.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector));  // Print which sector failed to authenticate.
-//       Serial.println(F(" authentication failed!"));
+//     if (!nfc_authenticate_block(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector), 1, default_key)) {
+//       Console.print(F("Sector: "));
+//       Console.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector));  // Print which sector failed to authenticate.
+//       Console.println(F(" authentication failed!"));
 //       return;  // Exit the function if authentication fails, preventing further write attempts.
 //     }
 
@@ -431,17 +748,17 @@ void get_ndef_text(char* input) {
 //       memcpy(temp, vCard + ((current_sector - 1) * 48) + (current_block * 16), 16);
 
 //       // Write the prepared data block to the NFC card.
-//       if (!nfc.mifareclassic_WriteDataBlock(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector) + current_block, temp)) {
-//         Serial.println(F("Write failed!"));  // Notify on serial if writing the block fails.
+//       if (!nfc_write_block(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(current_sector) + current_block, temp)) {
+//         Console.println(F("Write failed!"));  // Notify on serial if writing the block fails.
 //         return;                              // Exit the function if the write operation fails, preventing partial writes and data corruption.
 //       }
 //     }
 //   }
 
 //   // Print completion message once all intended data blocks have been successfully written.
-//   Serial.println(F("vCard creation done."));
+//   Console.println(F("vCard creation done."));
 //   // Flush any remaining output to the serial.
-//   Serial.flush();
+//   Console.flush();
 //   // Clear the serial buffer to ensure there are no remaining input characters.
 //   while (Serial.available()) Serial.read();
 //   // Delay to ensure all serial communications are complete and to stabilize the system after the write operations.
@@ -462,17 +779,15 @@ void format_MAD1(void) {
     default_key[i] = pgm_read_byte_near(&(keys[2][i]));
   }
 
-#ifdef DEBUG
-  printDebugHex(default_key, 6);  // Debug print the default key.
-#endif
+  LOG_DEBUG_HEX(LOG_HEX_DUMP, default_key, 6);  // Log the default key at debug level.
 
   // Prepare the data for sector 0, based on MAD1 specifications.
-  uint8_t sector0[48];
+  uint8_t* sector0 = (uint8_t*)arena_alloc(48);
   for (uint8_t i = 0; i < 48; i++) {
     if (i < 16)  // First 16 bytes are the MAD1 data for the first block.
       sector0[i] = pgm_read_byte_near(&(MAD1[0][i]));
-    if (i >= 16 && i < 32)  // Repeat MAD1 data for the second block.
-      sector0[i] = pgm_read_byte_near(&(MAD1[0][i - 16]));
+    if (i >= 16 && i < 32)  // MAD1 data for the second block: sectors 8 to 15.
+      sector0[i] = pgm_read_byte_near(&(MAD1[1][i - 16]));
     if (i >= 32 && i < 38)  // Key A for the sector trailer.
       sector0[i] = pgm_read_byte_near(&(keys[0][i - 32]));
     if (i >= 38 && i < 42)  // Access bits for the sector trailer.
@@ -481,12 +796,10 @@ void format_MAD1(void) {
       sector0[i] = pgm_read_byte_near(&(keys[2][i - 42]));
   }
 
-#ifdef DEBUG
-  printDebugHex(sector0, 48);  // Debug print the prepared sector 0 data.
-#endif
+  LOG_DEBUG_HEX(LOG_HEX_DUMP, sector0, 48);  // Log the prepared sector 0 data.
 
   // Prepare the sector trailer block data with specific access bits and keys.
-  uint8_t ndef_trailer_block[16];
+  uint8_t* ndef_trailer_block = (uint8_t*)arena_alloc(16);
   for (uint8_t i = 0; i < 16; i++) {
     if (i < 6)  // Key A for the trailer block.
       ndef_trailer_block[i] = pgm_read_byte_near(&(keys[1][i]));
@@ -496,50 +809,48 @@ void format_MAD1(void) {
       ndef_trailer_block[i] = pgm_read_byte_near(&(keys[2][i - 10]));
   }
 
-#ifdef DEBUG
-  printDebugHex(ndef_trailer_block, 16);  // Debug print the trailer block data.
-#endif
+  LOG_DEBUG_HEX(LOG_HEX_DUMP, ndef_trailer_block, 16);  // Log the trailer block data.
 
   // Authenticate with the default key to format sector 0.
-  if (!nfc.mifareclassic_AuthenticateBlock(uid, uidLength, 0, 0, default_key)) {
-    Serial.println(F("Unable to authenticate block 0 to enable card formatting! Maybe your card is already ndef formatted. If not, format it to default before trying again."));
+  if (!nfc_authenticate_block(0, 0, default_key)) {
+    Console.println(F("Unable to authenticate block 0 to enable card formatting! Maybe your card is already ndef formatted. If not, format it to default before trying again."));
     return;
   }
 
   // Write the prepared data to sector 0's blocks.
-  if (!nfc.mifareclassic_WriteDataBlock(1, sector0)) {
-    Serial.println(F("Unable to format block 1 into MAD1"));
+  if (!nfc_write_block(1, sector0)) {
+    Console.println(F("Unable to format block 1 into MAD1"));
     return;
   }
-  if (!nfc.mifareclassic_WriteDataBlock(2, sector0 + 16)) {
-    Serial.println(F("Unable to format block 2 into MAD1"));
+  if (!nfc_write_block(2, sector0 + 16)) {
+    Console.println(F("Unable to format block 2 into MAD1"));
     return;
   }
-  if (!nfc.mifareclassic_WriteDataBlock(3, sector0 + 32)) {
-    Serial.println(F("Unable to format block 3 into MAD1"));
+  if (!nfc_write_block(3, sector0 + 32)) {
+    Console.println(F("Unable to format block 3 into MAD1"));
     return;
   }
-  Serial.println(F("MAD1 correctly formatted."));
+  Console.println(F("MAD1 correctly formatted."));
 
   // Format all other sector trailers with the predefined ndef configuration.
   for (uint8_t sector_index = 1; sector_index <= sector_number; sector_index++) {
-    if (nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index), 0, default_key)) {
-      if (!nfc.mifareclassic_WriteDataBlock(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index), ndef_trailer_block)) {
-        Serial.print(F("Unable to write trailer block "));
-        Serial.print(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index));
-        Serial.println(F(", Try again."));
+    if (nfc_authenticate_block(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index), 0, default_key)) {
+      if (!nfc_write_block(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index), ndef_trailer_block)) {
+        Console.print(F("Unable to write trailer block "));
+        Console.print(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index));
+        Console.println(F(", Try again."));
         return;
       }
     } else {
-      Serial.print(F("Sector "));
-      Serial.print(sector_index);
-      Serial.println(F(" authentication failed! Verify your access Key. Or this could be a MIFARE 1K."));
+      Console.print(F("Sector "));
+      Console.print(sector_index);
+      Console.println(F(" authentication failed! Verify your access Key. Or this could be a MIFARE 1K."));
       return;
     }
   }
-  Serial.println(F("Keys correctly formatted into ndef values."));
-  Serial.flush();                            // Ensure all serial data has been transmitted.
-  while (Serial.available()) Serial.read();  // Clear any lingering data in the serial buffer.
+  Console.println(F("Keys correctly formatted into ndef values."));
+  Console.flush();                            // Ensure all serial data has been transmitted.
+  console_clear();                           // Clear any lingering data in the serial buffer.
   delay(1000);                               // Pause to stabilize system after formatting.
 }
 
@@ -557,12 +868,10 @@ void format_to_default(void) {
     default_key[i] = pgm_read_byte_near(&(keys[2][i]));
   }
 
-#ifdef DEBUG
-  printDebugHex(default_key, 6);  // Debug print the default key if DEBUG is defined.
-#endif
+  LOG_DEBUG_HEX(LOG_HEX_DUMP, default_key, 6);  // Log the default key at debug level.
 
   // Prepare the default sector trailer block with default keys and access bits.
-  uint8_t default_trailer_block[16];
+  uint8_t* default_trailer_block = (uint8_t*)arena_alloc(16);
   for (uint8_t i = 0; i < 16; i++) {
     if (i < 6)  // First 6 bytes are the Key A.
       default_trailer_block[i] = pgm_read_byte_near(&(keys[2][i]));
@@ -572,9 +881,7 @@ void format_to_default(void) {
       default_trailer_block[i] = pgm_read_byte_near(&(keys[2][i - 10]));
   }
 
-#ifdef DEBUG
-  printDebugHex(default_trailer_block, 16);  // Debug print the prepared trailer block.
-#endif
+  LOG_DEBUG_HEX(LOG_HEX_DUMP, default_trailer_block, 16);  // Log the prepared trailer block.
 
   // Define an array to be used to overwrite existing data with zeros.
   uint8_t blank_data_block[16] = BLANK_DATA_BLOCK;
@@ -582,39 +889,39 @@ void format_to_default(void) {
   // Iterate over all sectors on the card to reset their content.
   for (uint8_t sector_index = 0; sector_index <= sector_number; sector_index++) {
     // Authenticate each sector before attempting to write.
-    if (nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index), 1, default_key)) {
+    if (nfc_authenticate_block(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index), 1, default_key)) {
       // Determine the number of data blocks to clear based on the sector index.
       nb_data_blocks = (sector_index < 32) ? 3 : 15;  // Short sectors have 3 data blocks, long sectors have 15.
 
       // Write zeros to all data blocks in the current sector, skipping block 0 (sector 0's first block).
       for (uint8_t i = 0; i < nb_data_blocks; i++) {
         if (BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i != 0) {  // Skip sector 0 block 0 (reserved for manufacturer).
-          if (!nfc.mifareclassic_WriteDataBlock(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i, blank_data_block)) {
-            Serial.print(F("Unable to write data block "));
-            Serial.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i);
-            Serial.println(F(", Try again."));
+          if (!nfc_write_block(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i, blank_data_block)) {
+            Console.print(F("Unable to write data block "));
+            Console.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector_index) + i);
+            Console.println(F(", Try again."));
             return;  // Exit if a write operation fails.
           }
         }
       }
 
       // Update the sector trailer block with default configuration.
-      if (!nfc.mifareclassic_WriteDataBlock(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index), default_trailer_block)) {
-        Serial.print(F("Unable to write trailer block "));
-        Serial.print(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index));
-        Serial.println(F(", Try again."));
+      if (!nfc_write_block(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index), default_trailer_block)) {
+        Console.print(F("Unable to write trailer block "));
+        Console.print(BLOCK_NUMBER_OF_SECTOR_TRAILER(sector_index));
+        Console.println(F(", Try again."));
         return;  // Exit if writing the trailer block fails.
       }
     } else {
-      Serial.print(F("Sector "));
-      Serial.print(sector_index);
-      Serial.println(F(" authentication failed! Verify your access Key. Or this could be a MIFARE 1K."));
+      Console.print(F("Sector "));
+      Console.print(sector_index);
+      Console.println(F(" authentication failed! Verify your access Key. Or this could be a MIFARE 1K."));
       return;  // Exit if authentication fails.
     }
   }
 
   // Notify completion of formatting operation.
-  Serial.println(F("Data blocks correctly formatted to default values."));
+  Console.println(F("Data blocks correctly formatted to default values."));
   terminate_current_serial();  // Ends serial communication for this function.
 }
 
@@ -622,121 +929,66 @@ void format_to_default(void) {
 
 void recover_segments(void) {
 
-  // Load the default MIFARE authentication key into memory for NFC authentication.
-  uint8_t default_key[6];
-  for (uint8_t i = 0; i < 6; i++) {
-    default_key[i] = pgm_read_byte_near(&(keys[2][i]));
+  char* key_segment1 = (char*)arena_alloc(32);  // Buffer to store the first key segment retrieved from NFC.
+  char* key_segment2 = (char*)arena_alloc(32);  // Buffer to store the second key segment retrieved from NFC.
+
+  uint16_t slot = KEY_SLOT_NONE;
+  int16_t flags = read_key_record(key_segment1, &slot);
+  if (flags < 0) {
+    Console.println(F("No key record on the card! Unable to recover ndef key. Try again."));
+    return;  // Exit if the record cannot be read.
   }
 
-#ifdef DEBUG
-  printDebugHex(default_key, 6);  // Debug print the default key if DEBUG is defined.
-#endif
-
-  char key_segment1[32] = { 0 };   // Buffer to store the first key segment retrieved from NFC.
-  char key_segment2[32] = { 0 };   // Buffer to store the second key segment retrieved from NFC.
-  uint8_t read_block[48] = { 0 };  // Buffer to hold data read from NFC.
-
-  if (nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1), 1, default_key)) {
-    // Read and concatenate data from the first three blocks of the sector into the read_block buffer.
-    for (uint8_t i = 0; i < 3; i++) {
-      if (!nfc.mifareclassic_ReadDataBlock(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1) + i, read_block + (i * 16))) {
-#ifdef DEBUG
-        Serial.print(F("Unable to read block: "));
-        Serial.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1) + i);
-        Serial.println();
-#endif
-        return;  // Exit if any block read fails.
+  bool recovered = true;
+  if (flags & KEY_RECORD_DUAL) {
+    Console.println(F("DualCards=true"));
+    bool second = flags & KEY_RECORD_SECOND;  // The second card of the pair has been presented first.
+    if (second)
+      memcpy(key_segment2, key_segment1, 32);
+    else
+      Console.println(F("Read second card"));
+    console_wait();   // Wait for any user input.
+    console_clear();  // Clear the Serial buffer to ensure no residual inputs affect the process.
+    if (nfc_readPassiveTargetID()) {
+      // The other card of a pair, not the same one presented again.
+      int16_t otherFlags = read_key_record(second ? key_segment1 : key_segment2, &slot);
+      if (otherFlags < 0 || !(otherFlags & KEY_RECORD_DUAL) || (bool)(otherFlags & KEY_RECORD_SECOND) == second) {
+        Console.println(F("Failed to read the key record of the second card"));
+        recovered = false;
       }
+    } else {
+      Console.println(F("Failed to read second card"));
+      recovered = false;
     }
-    bool dualCard = read_block[46] & 0b01000000;
-    if (dualCard) {  // Check the 47th byte of the first sector to know if it is a dual card.
-      Serial.println(F("DualCards=true"));
-      bool i = (read_block[46] & 0b00100000);
-      if (i) {
-        memcpy(key_segment2, read_block + 14, 32);
-        while (!Serial.available()) {};            // Wait for any user input.
-        while (Serial.available()) Serial.read();  // Clear the Serial buffer to ensure no residual inputs affect the process.
-        if (nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength)) {
-          if (nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1), 1, default_key)) {
-
-            // Read and concatenate data from the first three blocks of the sector into the read_block buffer.
-            for (uint8_t i = 0; i < 3; i++) {
-              if (!nfc.mifareclassic_ReadDataBlock(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1) + i, read_block + (i * 16))) {
-#ifdef DEBUG
-                Serial.print(F("Unable to read block: "));
-                Serial.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1) + i);
-                Serial.println();
-#endif
-                return;  // Exit if any block read fails.
-              }
-            }
-            memcpy(key_segment1, read_block + 14, 32);
-          } else
-            Serial.println(F("Failed to authenticate second card"));
-
-        } else
-          Serial.println(F("Failed to read second card"));
-
-      } else {
-#ifdef DEBUG
-        printDebugHex(read_block, 48);
-#endif
-        memcpy(key_segment1, read_block + 14, 32);
-        Serial.println(F("Read second card"));
-        while (!Serial.available()) {};            // Wait for any user input.
-        while (Serial.available()) Serial.read();  // Clear the Serial buffer to ensure no residual inputs affect the process.
-        if (nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength)) {
-          if (nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1), 1, default_key)) {
-            read_block[48] = { 0 };  // Buffer to hold data read from NFC.
-
-            // Read and concatenate data from the first three blocks of the sector into the read_block buffer.
-            for (uint8_t i = 0; i < 3; i++) {
-              if (!nfc.mifareclassic_ReadDataBlock(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1) + i, read_block + (i * 16))) {
-#ifdef DEBUG
-                Serial.print(F("Unable to read block: "));
-                Serial.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1) + i);
-                Serial.println();
-#endif
-                return;  // Exit if any block read fails.
-              }
-            }
-#ifdef DEBUG
-            printDebugHex(read_block, 48);
-#endif
-            memcpy(key_segment2, read_block + 14, 32);
-          } else
-            Serial.println(F("Failed to authenticate second card"));
-
-        } else
-          Serial.println(F("Failed to read second card"));
-      }
 
+  } else {  // This is not a dual card
+    Console.println(F("DualCards=false"));
+    console_wait();   // Wait for any user input.
+    console_clear();  // Clear the Serial buffer to ensure no residual inputs affect the process.
+    PROFILE_BEGIN(storeStart);
+    recovered = key_store_read(slot, (uint8_t*)key_segment2);  // Read the key segment from its key store slot.
+    PROFILE_END(PROFILE_STORE, storeStart);
+    recovered = recovered && cipher_session_decrypt((uint8_t*)key_segment2, (uint8_t*)key_segment2, 32);  // Stored in ECB.
+    if (!recovered)
+      Console.println(F("Failed to read the key segment from the key store"));
+  }
 
-    } else {  // This is not a dual card
-      Serial.println(F("DualCards=false"));
-      while (!Serial.available()) {};            // Wait for any user input.
-      while (Serial.available()) Serial.read();  // Clear the Serial buffer to ensure no residual inputs affect the process.
-      // Copy the key segment from the read_block buffer with an offset to not reader the ndef wrapper and header.
-      memcpy(key_segment1, read_block + 14, 32);
-      uint8_t i = (read_block[46] & 0b00111111);
-      size_t idx = 32 * i;
-      for (uint8_t j = 0; j < 32; j++)
-        key_segment2[j] = EEPROM.read(idx++);  // Read each byte of the key segment directly from EEPROM.
-    }
-    decrypt(key_segment1, key_segment1, 32, "tony\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0");
-    decrypt(key_segment2, key_segment2, 32, "tony\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0");
-    // Transmit both key segments via serial.
-    Serial.print(F("Key segments: "));
-    while (Serial.availableForWrite() < 32)
-      ;
-    Serial.write(key_segment1, 32);
-    Serial.write(key_segment2, 32);
-    Serial.println();
-
-  } else {
-    Serial.println(F("Sector 1 authentication failed! Unable to recover ndef key. Try again."));
-    return;  // Exit if authentication fails.
+  if (!recovered) {
+    // Nothing of the pair is sent, not even the segment already read.
+    memset(key_segment1, 0, 32);
+    memset(key_segment2, 0, 32);
+    Console.println(F("Unable to recover the key segments. Try again."));
+    terminate_current_serial();
+    return;
   }
+  // Transmit both key segments via serial.
+  PROFILE_BEGIN(txStart);
+  Console.print(F("Key segments: "));
+  Console.write(key_segment1, 32);
+  Console.write(key_segment2, 32);
+  Console.println();
+  Console.flush();  // The 80 bytes of the line leave as one full packet and a short one.
+  PROFILE_END(PROFILE_SERIAL_TX, txStart);
 
   terminate_current_serial();  // Ends serial communication for this function.
 }
@@ -744,266 +996,274 @@ void recover_segments(void) {
 
 
 
-bool write_keys(void) {
-
-  // Load the default MIFARE authentication key into memory for NFC authentication.
-  uint8_t default_key[6];
-  for (uint8_t i = 0; i < 6; i++) {
-    default_key[i] = pgm_read_byte_near(&(keys[2][i]));
-  }
+/**
+ * Finds the key store slot of the second segment of a single-card pair: the slot already holding it,
+ * otherwise the first free one. Both lookups go through the slot fingerprints, only the candidate
+ * segments are read.
+ *
+ * @return The slot, KEY_SLOT_NONE if the store is full.
+ */
+static uint16_t key_slot_for(const uint8_t* segment) {
+  PROFILE_BEGIN(lookupStart);
+  uint16_t slot = key_store_find(segment);
+  if (slot == KEY_SLOT_NONE)
+    slot = key_store_allocate();
+  PROFILE_END(PROFILE_STORE, lookupStart);
+  return slot;
+}
 
-#ifdef DEBUG
-  printDebugHex(default_key, 6);  // Debug print the default key if DEBUG is defined.
-#endif
-
-  // Setup the NDEF record header and payload based on the user's input.
-  unsigned char ndef_record[48]{
-    0x03,           // NDEF message start marker.
-    0xFF,           // Indicates the use of a 3-byte length field.
-    0x00,           // MSB of the length of the NDEF message.
-    0x2B,           // LSB of the length of the NDEF message.
-    0xC1,           // NDEF record header: Message Begin and End flags set, TNF=0x2 indicating MIME media.
-    0x01,           // TYPE LENGTH: Length of the 'T' type field (Text).
-    0x00,           // MSB of payload length.
-    0x00,           // Payload length.
-    0x00,           // Payload length.
-    0x24,           // LSB of payload length.
-    'T',            // Type field: 'T' for Text.
-    0x02, 'e', 'n'  // Payload: UTF-8, language code 'en'.
-  };
-  ndef_record[47] = 0xFE;  // NDEF message tlv wrapper terminator.
+bool write_keys(void) {
 
   // Array to hold dualcard flag + keys
-  char key_segments[65] = { 0 };
-
-  while (!Serial.available()) {};  // Wait for any user input.
-
-  uint8_t SerialIndex = 0;
-  while (SerialIndex < 65) {
-    if (Serial.available()) {
-      char c = Serial.read();
-      key_segments[SerialIndex++] = c;
-    } else {
-      delay(10);  // Delay to allow buffer to fill.
-    }
-  }
+  char* key_segments = (char*)arena_alloc(KEY_SEGMENTS_SIZE);
 
-  encrypt(key_segments + 1, key_segments + 1, 64, "tony\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0");
+  console_read_bytes((uint8_t*)key_segments, KEY_SEGMENTS_SIZE, 0);  // Waits for all of them, like the app sends them.
 
+  LOG_DEBUG(LOG_DUAL_CARDS, key_segments[0]);
 
-#ifdef DEBUG
-  Serial.print(F("dualCards: "));
-  Serial.println(key_segments[0]);
-
-  Serial.print(F("Key segments:"));
-  for (uint8_t i = 1; i < 65; i++) {
-    Serial.print(key_segments[i]);
-  }
-  Serial.println();
-#endif
-
-  uint8_t indexSegmentVide = 0;
+  uint16_t keySlot = KEY_SLOT_NONE;
+  uint8_t flags = 0;  // Flags byte of the first card's key record.
 
   if (key_segments[0] == '1')  // Dual cards
-    ndef_record[46] = 0x40;
+    flags = KEY_RECORD_DUAL;
   else {
-    // Go throught every Key Address from EEPROM
-    for (uint16_t EEPROMidx = LOWEST_SEGMENT_ADDRESS; EEPROMidx < HIGHEST_SEGMENT_ADDRESS; EEPROMidx = EEPROMidx + SEGMENT_SIZE) {
-      bool NonNullKey = false;
-#ifdef DEBUG
-      Serial.print(F("EEPROMidx: "));
-      Serial.println(EEPROMidx);
-#endif
-      uint8_t tmp[32];
-      for (uint8_t j = 0; j < SEGMENT_SIZE; j++) {
-        tmp[j] = EEPROM.read(EEPROMidx + j);
-      }
-
-      if (memcmp(key_segments + 33, tmp, 32) == 0) {
-        indexSegmentVide = EEPROMidx;
-        break;
-      }
-      bool isEmpty = true;
-      for (uint8_t j = 0; j < SEGMENT_SIZE; j++) {
-        if (tmp[j] != 0x00) {
-          isEmpty = false;
-          break;
-        }
-      }
-      if (isEmpty) {
-        indexSegmentVide = EEPROMidx;
-        break;
-      }
-      if (EEPROMidx == HIGHEST_SEGMENT_ADDRESS - 1) {
-        Serial.println(F("Key storage full."));
-        return 1;
-      }
+    // The key records encrypt their segment, the key store's is encrypted in ECB so equal segments share a slot.
+    cipher_session_encrypt((uint8_t*)key_segments + 33, (uint8_t*)key_segments + 33, 32);
+    LOG_DEBUG_HEX(LOG_KEY_SEGMENTS, key_segments + 33, 32);
+    keySlot = key_slot_for((uint8_t*)key_segments + 33);
+    if (keySlot == KEY_SLOT_NONE) {
+      Console.println(F("Key storage full."));
+      return true;
     }
-#ifdef DEBUG
-    Serial.print(F("idxSegmVide:"));
-    Serial.println(indexSegmentVide / 32);
-#endif
-
-    ndef_record[46] = indexSegmentVide / 32;  // Divided by 32 so it gives us an index from 1 to 31
+    LOG_DEBUG(LOG_SEGMENT_SLOT, keySlot);
   }
 
-  memcpy(ndef_record + 14, key_segments + 1, 32);  // Copy the first key into the record
-
   /*
 Read the card first to check if at the idex present there is a  (the same) key  and erase it if there is*/
 
-  // Authenticate sector 1 of the first card
-  if (nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1), 1, default_key)) {
-    // write the ndef record containing the ey segment into the sector1 of the first card
-
-    for (uint8_t i = 0; i < 3; i++) {
-      if (!nfc.mifareclassic_WriteDataBlock(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1) + i, ndef_record + (i * 16))) {
-#ifdef DEBUG
-        Serial.print(F("Unable to write block: "));
-        Serial.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1) + i);
-        Serial.println();
-#endif
-        return;  // Exit if any block read fails.
-      }
-    }
-
-  }
-#ifdef DEBUG
-  else {
-    Serial.println(F("Failed to authenticate first sector card"));
+  // Write the key record holding the first segment on the first card.
+  if (!write_key_record(key_segments + 1, flags, keySlot)) {
+    LOG_WARN(LOG_AUTH_FAILED_FIRST);
+    Console.println(F("Failed writing 1st key, try again."));
+    return true;
   }
-#endif
 
-  Serial.println(F("First card written."));
+  Console.println(F("First card written."));
   /// Writing second key
 
-  if (key_segments[0] == '1') {                       // Dual cards
-    memcpy(ndef_record + 14, key_segments + 33, 32);  // Copy the second key into the record
-    ndef_record[46] = 0x60;
-#ifdef DEBUG
-    Serial.println(F("Ndef record:"));
-    printDebugHex(ndef_record, 48);
-#endif
-
-    while (!Serial.available()) {};            // Wait for any user input.
-    while (Serial.available()) Serial.read();  // Clear the Serial buffer to ensure no residual inputs affect the process.
-
-    if (nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength)) {
-
-      if (nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1), 1, default_key)) {
-        // write the ndef record containing the ey segment into the sector1 of the second card
-        for (uint8_t i = 0; i < 3; i++) {
-          if (!nfc.mifareclassic_WriteDataBlock(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1) + i, ndef_record + (i * 16))) {
-#ifdef DEBUG
-            Serial.print(F("Unable to Write block: "));
-            Serial.print(BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(1) + i);
-            Serial.println();
-#endif
-            return;  // Exit if any block read fails.
-          }
-        }
-      }
+  if (key_segments[0] == '1') {  // Dual cards
+    console_wait();   // Wait for any user input.
+    console_clear();  // Clear the Serial buffer to ensure no residual inputs affect the process.
 
-#ifdef DEBUG
-      else {
-        Serial.println(F("Failed to authenticate first sector of second card"));
-      }
-#endif
+    if (!nfc_readPassiveTargetID()) {
+      LOG_WARN(LOG_SECOND_CARD_MISSING);
+      Console.println(F("Failed to read second card"));
+      return true;
     }
-#ifdef DEBUG
-    else {
-      Serial.println(F("Failed to read second card"));
+    // Write the key record holding the second segment on the second card.
+    if (!write_key_record(key_segments + 33, KEY_RECORD_DUAL | KEY_RECORD_SECOND, KEY_SLOT_NONE)) {
+      LOG_WARN(LOG_AUTH_FAILED_SECOND);
+      Console.println(F("Failed writing 2nd key, try again."));
+      return true;
     }
-#endif
-    Serial.println(F("Second card written."));
+    Console.println(F("Second card written."));
 
   } else {
-    Serial.print(F("index:"));
-    Serial.println(indexSegmentVide);
-    for (uint8_t i = 0; i < SEGMENT_SIZE; i++) {
-      EEPROM.update(indexSegmentVide + i, key_segments[33 + i]);
+    Console.print(F("index:"));
+    Console.println((uint32_t)keySlot * SEGMENT_SIZE);
+
+    // Writes and verifies the segment. The slot keeps its previous content on failure.
+    PROFILE_BEGIN(storeStart);
+    bool stored = key_store_write(keySlot, (uint8_t*)key_segments + 33);
+    PROFILE_END(PROFILE_STORE, storeStart);
+    if (!stored) {
+      Console.println(F("Failed writing 2nd key, try again."));
+      Console.println(F("Kthxbye."));
+      return true;
     }
-
-    char write_verification[32];
-
-    EEPROM.get(indexSegmentVide, write_verification);
-
-    for (uint8_t i = 0; i < SEGMENT_SIZE; i++) {
-      if (write_verification[i] != key_segments[33 + i]) {
-        Serial.println(F("Failed writing 2nd key, try again."));
-        Serial.println(F("Kthxbye."));
-        for (uint8_t i = 0; i < SEGMENT_SIZE; i++) {
-          EEPROM.update(indexSegmentVide + i, 0);
-        }
-        return true;
-      }
-    }
-    Serial.println(F("EEPROM written."));
+    Console.println(F("EEPROM written."));
   }
   return false;
 }
 
 /**
- * Checks if the device is password protected by examining a specific section of the EEPROM.
- * This function assumes that the admin password, if set, is stored within the first 32 blocks of the EEPROM.
+ * Checks if the device is password protected by looking for the admin password slot in the key store.
+ * The answer comes from the key store's RAM index, the EEPROM is not read.
  * It prints the password protection status to the serial monitor.
  */
 bool is_password_protected(void) {
-  // Loop through the first 32 blocks from EEPROM where the admin password is potentially stored.
-  for (uint8_t i = 0; i < 32; i++) {
-    // If any block contains a value other than 0, a password is set.
-    if (EEPROM[i] != 0) {
-      Serial.println(F("passwordProtected=true"));
-      terminate_current_serial();  // Ends serial communication for this function.
-      return true;                 // Device is password protected
-    }
-    // If we reach the last block and it is still 0, then no password is set.
-    if (i == 31 && EEPROM[i] == 0) {
-      Serial.println(F("passwordProtected=false"));
-      terminate_current_serial();  // Ends serial communication for this function.
-      return false;                // Device is notpassword protected
-    }
+  if (key_store_has(KEY_SLOT_ADMIN_PASSWORD)) {
+    Console.println(F("passwordProtected=true"));
+    terminate_current_serial();  // Ends serial communication for this function.
+    return true;                 // Device is password protected
+  }
+  Console.println(F("passwordProtected=false"));
+  terminate_current_serial();  // Ends serial communication for this function.
+  return false;                // Device is notpassword protected
+}
+
+
+/**
+ * Key job of the batch enrollment queue: the segments of a card, or of the two cards of a dual pair.
+ */
+typedef struct {
+  uint16_t id;           // Number reported with the results of its cards.
+  bool dual;
+  uint8_t cards_written;  // Cards of a dual pair already written.
+  char segments[64];      // Both segments, encrypted in ECB with the session key.
+} BatchJob;
+
+static BatchJob batch_queue[BATCH_QUEUE_SIZE];
+static uint8_t batch_head = 0;
+static uint8_t batch_count = 0;
+static uint16_t batch_next_id = 1;
+static uint8_t batch_uid[7];             // Card handled last.
+static uint8_t batch_uid_length = 0;     // 0 once it has left the reader.
+
+void batch_enqueue(void) {
+  uint16_t mark = arena_mark();
+  uint8_t* job = (uint8_t*)arena_alloc(KEY_SEGMENTS_SIZE);
+  console_read_bytes(job, KEY_SEGMENTS_SIZE, 0);  // Dual-card flag and the two segments, like the 'e' request.
+
+  BatchJob* entry = &batch_queue[(batch_head + batch_count) % BATCH_QUEUE_SIZE];
+  if (batch_count == BATCH_QUEUE_SIZE) {
+    Console.println(F("batchJob=full"));
+  } else if (!cipher_session_encrypt((uint8_t*)entry->segments, job + 1, 64)) {
+    Console.println(F("Authentication needed."));
+  } else {
+    entry->id = batch_next_id++;
+    entry->dual = job[0] == '1';
+    entry->cards_written = 0;
+    batch_count++;
+    Console.print(F("batchJob="));
+    Console.print(entry->id);
+    Console.print(F(",queued="));
+    Console.println(batch_count);
+  }
+  arena_release(mark);  // Queued between requests, outside their arena reset.
+}
+
+void batch_mode(bool on) {
+  batch_uid_length = 0;  // A card already on the reader counts as tapped.
+  Console.print(on ? F("batch=on,queued=") : F("batch=off,queued="));
+  Console.println(batch_count);
+}
+
+void batch_clear(void) {
+  memset(batch_queue, 0, sizeof(batch_queue));
+  batch_head = 0;
+  batch_count = 0;
+}
+
+/**
+ * Writes the key record of a queued segment, decrypted from the queue into the arena for the time of the write.
+ */
+static bool batch_write_record(const char* queued, uint8_t flags, uint16_t slot) {
+  uint16_t mark = arena_mark();
+  char* segment = (char*)arena_alloc(32);
+  bool written = cipher_session_decrypt((uint8_t*)segment, (const uint8_t*)queued, 32)
+                 && write_key_record(segment, flags, slot);
+  arena_release(mark);
+  return written;
+}
+
+/**
+ * Writes the card found by the last detection from the job at the head of the queue. The job leaves the
+ * queue once all its cards are written, or if the key store has no slot for it.
+ *
+ * @param slot Set to the key store slot of a single card.
+ * @return The status reported for the card.
+ */
+static const __FlashStringHelper* batch_write(BatchJob* job, uint16_t* slot) {
+  if (job->dual) {
+    bool second = job->cards_written;
+    if (!batch_write_record(job->segments + (second ? 32 : 0), KEY_RECORD_DUAL | (second ? KEY_RECORD_SECOND : 0), KEY_SLOT_NONE))
+      return F("failed");
+    job->cards_written++;
+    return second ? F("ok") : F("first");
+  }
+
+  *slot = key_slot_for((uint8_t*)job->segments + 32);
+  if (*slot == KEY_SLOT_NONE) {
+    job->cards_written = 2;
+    return F("storeFull");
+  }
+  if (!batch_write_record(job->segments, 0, *slot))
+    return F("failed");
+  PROFILE_BEGIN(storeStart);
+  bool stored = key_store_write(*slot, (uint8_t*)job->segments + 32);
+  PROFILE_END(PROFILE_STORE, storeStart);
+  if (!stored)
+    return F("storeFailed");
+  job->cards_written = 2;
+  return F("ok");
+}
+
+void batch_poll(void) {
+  if (!nfc_detect()) {
+    batch_uid_length = 0;  // The card has left the reader.
+    return;
+  }
+  if (uidLength == batch_uid_length && !memcmp(uid, batch_uid, uidLength))
+    return;  // Still the card handled last.
+  memcpy(batch_uid, uid, uidLength);
+  batch_uid_length = uidLength;
+
+  Console.print(F("batchCard="));
+  for (uint8_t i = 0; i < uidLength; i++) {
+    if (uid[i] < 0x10)
+      Console.print('0');
+    Console.print(uid[i], HEX);
+  }
+  if (!batch_count) {
+    Console.println(F(",job=0,status=empty"));
+    return;
+  }
+
+  BatchJob* job = &batch_queue[batch_head];
+  uint8_t card = job->cards_written + 1;
+  uint16_t slot = KEY_SLOT_NONE;
+  const __FlashStringHelper* status = batch_write(job, &slot);
+  Console.print(F(",job="));
+  Console.print(job->id);
+  Console.print(F(",card="));
+  Console.print(card);
+  Console.print(F(",slot="));
+  Console.print(slot);
+  Console.print(F(",status="));
+  Console.println(status);
+
+  if (job->cards_written == 2) {  // Done with the job.
+    memset(job, 0, sizeof(BatchJob));
+    batch_head = (batch_head + 1) % BATCH_QUEUE_SIZE;
+    batch_count--;
   }
 }
 
 
 /**
- * Creates an admin password by reading characters from Serial and storing them in EEPROM.
+ * Creates an admin password by reading characters from Serial and storing them in the key store.
  * The password can be up to 32 characters long, it would be padded with zeros if less.
  * The line sent by the password should be terminated by '\n' and followed by a byte 
  * corresponding to the actual length of the password. If the Serial buffer runs out of 
  * characters prematurely, it resets any partial password to ensure security.
  */
 bool create_admin_password(void) {
-  char password[32];              // Buffer to store the password
-  bool passwordCreation = false;  // Flag for succesful operation
-  uint8_t i = 0;
-
-  // Wait for any user input.
-  while (!Serial.available()) {
-    delay(20);
-  }
+  char* password = (char*)arena_alloc(32);  // Buffer to store the password
 
-  // Read up to 32 characters or until newline is found
-  while (i < 32 && Serial.available()) {
-    char c = Serial.read();  // Read a character
-    password[i++] = c;       // Store character in the buffer
-  }
+  // Wait for any user input, then read up to 32 characters sent with it.
+  uint8_t i = console_read_bytes((uint8_t*)password, 32, 20);
 
   // Password received MUST be 32 characters. If the user sets one less than 32 characters long,
   // then it should have been padded with zeros before being sent by the app.
-  if (i == 32) {
-    Serial.println(F("passwordCreation=true"));  // Inform the app of successful operation
-    for (uint8_t j = 0; j < 32; j++)
-      EEPROM.update(j, password[j]);  // Store each character in EEPROM
+  // The journal only replaces the previous password once the new one is completely written.
+  if (i == 32 && key_store_write(KEY_SLOT_ADMIN_PASSWORD, (uint8_t*)password)) {
+    Console.println(F("passwordCreation=true"));  // Inform the app of successful operation
 
     terminate_current_serial();                   // Ends serial communication for this function.
     return true;                                  // Returns positive password creation
   } else {                                        // If less or more than 32 characters were read
-    Serial.println(F("passwordCreation=false"));  // Inform the app of failed operation
-
-    for (uint8_t j = 0; j < 32; j++)
-      EEPROM.update(j, 0);  // Reset the entire password area to be sure no data were written.
+    Console.println(F("passwordCreation=false"));  // Inform the app of failed operation
 
     terminate_current_serial();  // Ends serial communication for this function.
     return false;                // Returns negative password creation value
@@ -1012,37 +1272,59 @@ bool create_admin_password(void) {
 
 
 /**
- * Authenticates the user by comparing the input from the Serial monitor to the password stored in EEPROM.
- * The function reads each character from Serial and checks it against the corresponding EEPROM value.
+ * Authenticates the user by comparing the input from the Serial monitor to the password stored in the key store.
+ * The function reads the 32 characters of the attempt from Serial, then compares all of them.
  */
 bool authentication(void) {
-  bool isCorrect = true;  // Flag to keep track of password correctness.
+  uint8_t* password = (uint8_t*)arena_alloc(32);                      // Stored admin password.
+  bool isCorrect = key_store_read(KEY_SLOT_ADMIN_PASSWORD, password);  // No password set means nothing can match.
 
-  // Loop through each character of the stored password.
-  for (uint8_t i = 0; i < 32; i++) {
-    while (!Serial.available()) {
-      delay(20);  // Wait for characters to be available in the Serial buffer.
-    }
-    if (EEPROM[i] != Serial.read()) {  // Read each character from Serial and compare it to EEPROM.
-      isCorrect = false;               // Set flag to false if any character does not match.
-      break;                           // Exit the loop as there's no need to check further if a mismatch is found.
-    }
-  }
+  uint8_t* input = (uint8_t*)arena_alloc(32);
+  console_read_bytes(input, 32, 0);  // The whole attempt is read, so nothing of it is left for the next request.
+
+  // Compare every character, so the time taken does not tell where the first mismatch is.
+  uint8_t diff = 0;
+  for (uint8_t i = 0; i < 32; i++)
+    diff |= password[i] ^ input[i];
+  isCorrect = isCorrect && !diff;
 
   // Check if the password was correct.
   if (isCorrect) {
     // Inform the app of the successful authentication
-    Serial.println(F("passwordCorrect=true"));
+    Console.println(F("passwordCorrect=true"));
     terminate_current_serial();  // Ends serial communication for this function.
     return true;                 // Return authentication value
   } else {
     // Inform the app of the failed authentication
-    Serial.println(F("passwordCorrect=false"));
+    Console.println(F("passwordCorrect=false"));
     terminate_current_serial();  // Ends serial communication for this function.
     return false;                // Return authentication value
   }
 }
 
+/**
+ * Opens the admin session: the segment key is copied out of PROGMEM just long enough to expand its
+ * AES schedule, which then stays in RAM until session_close().
+ *
+ * @return true if the cipher session is open.
+ */
+bool session_open(void) {
+  uint16_t mark = arena_mark();
+  uint8_t* key = (uint8_t*)arena_alloc(32);
+  memcpy_P(key, segment_key, 32);
+  bool opened = cipher_session_begin(key);
+  arena_release(mark);
+  return opened;
+}
+
+/**
+ * Closes the admin session, zeroizing the key schedule.
+ */
+void session_close(void) {
+  cipher_session_end();
+  batch_clear();  // The queued keys are only kept for the admin who sent them.
+}
+
 /**
  * @brief Terminates the current serial communication cleanly.
  *
@@ -1051,23 +1333,271 @@ bool authentication(void) {
  * the transition between communication sessions, which is necessary for some operations.
  */
 void terminate_current_serial(void) {
-  Serial.flush();  // Waits for the transmission of outgoing serial data to complete.
+  PROFILE_BEGIN(start);
+  Console.flush();  // Waits for the transmission of outgoing serial data to complete.
+  PROFILE_END(PROFILE_SERIAL_TX, start);
 
-  // Continuously read from serial buffer until it's empty.
-  while (Serial.available())
-    Serial.read();  // Reads and discards any remaining characters in the serial buffer.
+  console_clear();  // Discards any remaining characters in the serial buffer.
 
   delay(200);  // Introduces a 200 millisecond delay to ensure any transitions are stabilized.
 }
 
+/**
+ * Scratch data of the self-benchmark's iterations.
+ */
+typedef struct {
+  uint8_t key[6];                   // Key A of the scratch sector.
+  uint8_t block[16];                // Its first block, as last read.
+  bool block_read;                  // block holds the card's data, so writing it back changes nothing.
+  uint8_t cipher[CIPHER_BLOCK_SIZE];
+  uint8_t eeprom;                   // Value of BENCH_EEPROM_ADDRESS, as last read or written.
+} BenchContext;
+static_assert(sizeof(BenchContext) + BENCH_MAX_ITERATIONS * sizeof(uint16_t) <= ARENA_SIZE, "ARENA_SIZE too small");
+
+/**
+ * Runs one iteration of a primitive.
+ *
+ * @return true if it succeeded.
+ */
+static bool bench_step(uint8_t primitive, BenchContext* ctx) {
+  uint8_t block = BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(BENCH_SECTOR);
+  switch (primitive) {
+    case BENCH_DETECT: return nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength);
+    case BENCH_AUTH: return nfc.mifareclassic_AuthenticateBlock(uid, uidLength, block, 0, ctx->key);
+    case BENCH_READ:
+      if (!nfc.mifareclassic_ReadDataBlock(block, ctx->block))
+        return false;
+      ctx->block_read = true;
+      return true;
+    case BENCH_WRITE: return ctx->block_read && nfc.mifareclassic_WriteDataBlock(block, ctx->block);
+    case BENCH_AES: return cipher_session_encrypt(ctx->cipher, ctx->cipher, CIPHER_BLOCK_SIZE);
+    case BENCH_EEPROM_READ:
+      ctx->eeprom = EEPROM.read(BENCH_EEPROM_ADDRESS);
+      return true;
+    default:  // BENCH_EEPROM_UPDATE
+      ctx->eeprom = ~ctx->eeprom;  // Another value each time, so the cell is really programmed.
+      EEPROM.update(BENCH_EEPROM_ADDRESS, ctx->eeprom);
+      return true;
+  }
+}
+
+/**
+ * Finds the key A of the scratch sector, the NDEF one or the factory default, and leaves the sector
+ * authenticated. A failed authentication halts the card, so it is selected again before each try.
+ */
+static bool bench_find_key(uint8_t* key) {
+  for (uint8_t k = 1; k <= 2; k++) {
+    memcpy_P(key, keys[k], 6);
+    if (nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength)
+        && nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(BENCH_SECTOR), 0, key))
+      return true;
+  }
+  return false;
+}
+
+static void bench_write16(uint16_t value) {
+  Console.write((uint8_t)value);
+  Console.write((uint8_t)(value >> 8));
+}
+
+/**
+ * @return The nearest-rank percentile of sorted latencies, 0 if there are none.
+ */
+static uint16_t bench_percentile(const uint16_t* sorted, uint8_t count, uint8_t percent) {
+  if (!count)
+    return 0;
+  uint8_t rank = ((uint16_t)count * percent + 99) / 100;
+  return sorted[rank ? rank - 1 : 0];
+}
+
+/**
+ * Sends the record of a primitive.
+ *
+ * @param samples Latencies of its successful iterations, sorted in place.
+ * @param total Their sum, in us.
+ */
+static void bench_report(uint8_t primitive, uint16_t* samples, uint8_t count, uint8_t failures, uint32_t total) {
+  for (uint8_t i = 1; i < count; i++) {  // Insertion sort, there are at most BENCH_MAX_ITERATIONS.
+    uint16_t sample = samples[i];
+    uint8_t j = i;
+    for (; j && samples[j - 1] > sample; j--)
+      samples[j] = samples[j - 1];
+    samples[j] = sample;
+  }
+  uint32_t rate = total ? count * 1000000UL / total : 0;
+
+  Console.write(primitive);
+  Console.write(failures);
+  bench_write16(count);
+  bench_write16(rate);
+  bench_write16(rate >> 16);
+  bench_write16(bench_percentile(samples, count, 50));
+  bench_write16(bench_percentile(samples, count, 90));
+  bench_write16(bench_percentile(samples, count, 99));
+  bench_write16(count ? samples[count - 1] : 0);
+}
+
+/**
+ * Measures the reader, the card and the device: runs the number of iterations given by the byte following
+ * the request of each primitive, then sends their latencies in one binary response (see BENCH_VERSION).
+ * The scratch sector's block is written back with the data read from it, the card keeps its content, and
+ * the EEPROM cell gets its value back once its updates are measured.
+ */
+void self_benchmark(void) {
+  uint8_t iterations = 0;
+  console_read_bytes(&iterations, 1, 0);
+  if (!iterations || iterations > BENCH_MAX_ITERATIONS)
+    iterations = BENCH_DEFAULT_ITERATIONS;
+
+  BenchContext& ctx = *(BenchContext*)arena_alloc(sizeof(BenchContext));
+  uint8_t eeprom_saved = EEPROM.read(BENCH_EEPROM_ADDRESS);
+  ctx.eeprom = eeprom_saved;
+  bool card_ready = bench_find_key(ctx.key);
+
+  uint16_t* samples = (uint16_t*)arena_alloc(BENCH_MAX_ITERATIONS * sizeof(uint16_t));
+  Console.print(F("Bench: "));
+  Console.write(BENCH_VERSION);
+  Console.write(BENCH_PRIMITIVES);
+  for (uint8_t primitive = 0; primitive < BENCH_PRIMITIVES; primitive++) {
+    uint8_t count = 0;
+    uint8_t failures = 0;
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < iterations; i++) {
+      // Without the sector's key, the card primitives past detection can only fail.
+      bool card_step = primitive >= BENCH_AUTH && primitive <= BENCH_WRITE;
+      unsigned long start = micros();
+      bool done = (card_ready || !card_step) && bench_step(primitive, &ctx);
+      unsigned long elapsed = micros() - start;
+      if (!done) {
+        failures++;
+        continue;
+      }
+      samples[count++] = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+      total += elapsed;
+    }
+    if (primitive == BENCH_DETECT && card_ready)  // Detection selected the card again.
+      card_ready = nfc.mifareclassic_AuthenticateBlock(uid, uidLength, BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(BENCH_SECTOR), 0,
+                                                       ctx.key);
+    if (primitive == BENCH_EEPROM_UPDATE)
+      EEPROM.update(BENCH_EEPROM_ADDRESS, eeprom_saved);
+    bench_report(primitive, samples, count, failures, total);
+  }
+  Console.println();
+  terminate_current_serial();
+}
+
+/**
+ * Payload byte of an iteration of the communication line test, so that each iteration sends different
+ * bits and a stale or shifted echo does not match.
+ */
+static uint8_t link_pattern(uint8_t iteration, uint8_t i) {
+  return (i * 0x1D + iteration) ^ 0x55;
+}
+static_assert(NFC_FRAME_OVERHEAD + 2 + LINK_MAX_PAYLOAD + BENCH_MAX_ITERATIONS * 2 <= ARENA_SIZE, "ARENA_SIZE too small");
+
+void link_test(void) {
+  uint8_t request[2];  // Iterations and number of sizes.
+  uint8_t sizes[LINK_MAX_SIZES];
+  if (console_read_bytes(request, 2, 1000) < 2) {
+    Console.println(F("Invalid input."));
+    return;
+  }
+  uint8_t iterations = request[0];
+  if (!iterations || iterations > BENCH_MAX_ITERATIONS)
+    iterations = BENCH_DEFAULT_ITERATIONS;
+  uint8_t size_count = request[1] > LINK_MAX_SIZES ? LINK_MAX_SIZES : request[1];
+  if (console_read_bytes(sizes, size_count, 1000) < size_count) {
+    Console.println(F("Invalid input."));
+    return;
+  }
+
+  uint16_t mark = arena_mark();
+  // The command, then its echo: the response frame is the larger one.
+  uint8_t* frame = (uint8_t*)arena_alloc(NFC_FRAME_OVERHEAD + 2 + LINK_MAX_PAYLOAD);
+  uint16_t* samples = (uint16_t*)arena_alloc(BENCH_MAX_ITERATIONS * sizeof(uint16_t));
+
+  Console.print(F("Link: "));
+  Console.write(LINK_VERSION);
+  Console.write(nfc_self_test(NFC_DIAGNOSE_ROM));
+  Console.write(nfc_self_test(NFC_DIAGNOSE_RAM));
+  Console.write(size_count);
+  for (uint8_t s = 0; s < size_count; s++) {
+    uint8_t size = sizes[s] > LINK_MAX_PAYLOAD ? LINK_MAX_PAYLOAD : sizes[s];
+    uint8_t count = 0;
+    uint8_t failures = 0;
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < iterations; i++) {
+      frame[0] = PN532_COMMAND_DIAGNOSE;
+      frame[1] = NFC_DIAGNOSE_COMM_LINE;
+      for (uint8_t j = 0; j < size; j++)
+        frame[2 + j] = link_pattern(i, j);
+
+      unsigned long start = micros();
+      int16_t length = nfc_diagnose(frame, 2 + size, frame, NFC_FRAME_OVERHEAD + 2 + LINK_MAX_PAYLOAD);
+      unsigned long elapsed = micros() - start;
+
+      bool echoed = length == 1 + size && frame[7] == NFC_DIAGNOSE_COMM_LINE;  // The test number comes back too.
+      for (uint8_t j = 0; echoed && j < size; j++)
+        echoed = frame[8 + j] == link_pattern(i, j);
+      if (!echoed) {
+        failures++;
+        continue;
+      }
+      samples[count++] = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+      total += elapsed;
+    }
+    bench_report(size, samples, count, failures, total);
+  }
+  Console.println();
+  arena_release(mark);  // Run between requests, outside their arena reset.
+  terminate_current_serial();
+}
+
+void pn532_bridge(void) {
+  uint16_t mark = arena_mark();
+  uint8_t* frame = (uint8_t*)arena_alloc(BRIDGE_FRAME_SIZE);  // The command, then the response frame.
+
+  Console.print(F("bridge=on,command="));
+  Console.print(BRIDGE_COMMAND_SIZE);
+  Console.print(F(",window="));
+  Console.println(CONSOLE_RX_SIZE);
+  console_set_raw(true);  // Any length or command byte can be a '?'.
+
+  unsigned long last = millis();
+  while (millis() - last < BRIDGE_IDLE_MS) {
+    if (!console_available()) {
+      Console.flush();  // The responses coalesced while commands were waiting.
+      delay(1);
+      continue;
+    }
+    uint8_t length = console_read();
+    if (!length || length > BRIDGE_COMMAND_SIZE)  // End, or the framing is lost.
+      break;
+    uint8_t received = console_read_bytes(frame, length, BRIDGE_TIMEOUT_MS);
+    if (received < length)
+      break;
+    last = millis();
+
+    uint8_t response = 0;
+    if (nfc.sendCommandCheckAck(frame, length, BRIDGE_TIMEOUT_MS))
+      response = nfc_read_response(frame, BRIDGE_FRAME_SIZE);
+    // Sent with the next ones while the app has sent more commands, at once otherwise.
+    Console.write(response);
+    Console.write(frame + 6, response);
+  }
+
+  console_set_raw(false);
+  arena_release(mark);  // Run between requests, outside their arena reset.
+  Console.println(F("bridge=off"));
+  terminate_current_serial();
+}
+
 /////////////////////////////DevFunctions//////////////////////////////////////////
 bool auth(void) {
   return true;
 }
 void reset_admin_password(void) {
-  for (size_t i = 0; i < 32; i++) {
-    EEPROM.update(i, 0);
-  }
+  key_store_erase(KEY_SLOT_ADMIN_PASSWORD);
 
   delay(200);  // Delay to ensure transition stability (some functions require it)
 }
@@ -1075,16 +1605,16 @@ void reset_admin_password(void) {
 void reset_eeprom(void) {
   for (size_t i = 0; i < 1024; i++)
     EEPROM.update(i, 0);
+  key_store_format();  // Start an empty journal over the zeroed EEPROM.
   delay(200);
 }
 
 void set_one_key(void) {
-  char key[32] = "9.{Abs6R-C/Svhmw+Ft,5Wjn+R?LUk5K";
-  for (size_t i = 32; i < 64; i++) {
-    Serial.print(key[i]);
-    EEPROM.update(i, key[i - 32]);
-  }
-  Serial.println();
+  char key[] = "9.{Abs6R-C/Svhmw+Ft,5Wjn+R?LUk5K";  // The 32 bytes of the segment, then the string's terminator.
+  for (size_t i = 0; i < 32; i++)
+    Console.print(key[i]);
+  key_store_write(KEY_SLOT_FIRST, (uint8_t*)key);  // Goes through the store so the directory stays in sync.
+  Console.println();
   delay(200);  // Delay to ensure transition stability (some functions require it)
 }
 
@@ -1093,12 +1623,12 @@ void set_one_key(void) {
 void print_eeprom(void) {
   for (size_t i = 0; i < 1024; i++) {
     if (EEPROM[i] < 0x10)
-      Serial.print(F("0"));
-    Serial.print(EEPROM[i], HEX);
-    Serial.print(F(" "));
+      Console.print(F("0"));
+    Console.print(EEPROM[i], HEX);
+    Console.print(F(" "));
     // Every 16 bytes, print a newline to format the output into blocks of 16 bytes each
     if ((i + 1) % 64 == 0) {
-      Serial.println();
+      Console.println();
     }
   }
 
@@ -2,7 +2,60 @@
 
 #include <Adafruit_PN532.h>  // Include the Adafruit PN532 library for interfacing with the NFC controller. This library provides functions for NFC tag reading and writing.
 
-#define DEBUG  // Define the DEBUG preprocessor directive to enable debugging features/output in the code.
+#include "encryption.h"  // AES-256 session cipher.
+
+#include "profiling.h"  // Latency probes.
+
+#include "key_store.h"  // Key segments and admin password, stored in EEPROM or on an external FRAM.
+
+#include "logging.h"  // Tokenized diagnostics on Serial1, LOG_LEVEL selects what is compiled in.
+
+#include "ndef.h"  // NDEF TLV reader and writer, MAD lookups.
+
+#include "console.h"  // Serial input received in the background, status queries.
+
+#include "arena.h"  // Scratch buffers of the requests.
+
+// Card detection. A detection attempt ends after NFC_DETECT_RETRIES activation retries of the PN532 instead
+// of waiting for a card, so the firmware keeps running in between.
+#define NFC_DETECT_RETRIES 10  // MxRtyPassiveActivation, 0xFF waits forever.
+#define NFC_POLL_MS 100        // Time between two detection attempts.
+#define NFC_DETECT_TIMEOUT_MS 1000  // ACK and answer of a detection, so a missing reader cannot block it.
+
+// Presence check of the card already selected, with the Diagnose command.
+#define NFC_DIAGNOSE_ATTENTION 0x06  // Test number: attention request, ISO14443-4 presence check.
+#define NFC_PROBE_PRESENT 0
+#define NFC_PROBE_ABSENT 1
+#define NFC_PROBE_UNSUPPORTED 2  // The card or the answer does not allow the test, select it again instead.
+
+// Diagnose tests of the reader itself.
+#define NFC_DIAGNOSE_COMM_LINE 0x00  // The parameters are sent back unchanged.
+#define NFC_DIAGNOSE_ROM 0x01        // Checksum of the ROM.
+#define NFC_DIAGNOSE_RAM 0x02        // Write and read back of the RAM.
+#define NFC_SELF_TEST_OK 0x00
+#define NFC_SELF_TEST_FAILED 0xFF     // As the PN532 reports it.
+#define NFC_SELF_TEST_NO_ANSWER 0x01  // The test was not answered.
+
+// Link test, the 'L' start byte followed by the number of iterations (0 for BENCH_DEFAULT_ITERATIONS), the
+// number of payload sizes and the sizes: the communication line test is run with each size, then the ROM
+// and RAM self-tests. Its response is "Link: ", a version byte, the ROM and RAM results (NFC_SELF_TEST_),
+// the number of sizes, then one self-benchmark record per size whose first byte is the size instead of a
+// primitive. A failed iteration got no answer or a corrupted echo. Each iteration carries the payload to
+// the PN532 and back, the link throughput is 2 * size * ops/s.
+#define LINK_VERSION 1
+#define LINK_MAX_PAYLOAD 48  // Larger sizes are cut down to it.
+#define LINK_MAX_SIZES 8
+
+// Bridge mode, the 'X' start byte: the app sends PN532 commands, a length byte then the command code and
+// its parameters, and gets back a length byte then the response code and its data, 0 when the PN532 did
+// not answer. A length of 0 ends the bridge. Several commands can be sent ahead of their responses, as
+// long as they fit in the console ring.
+#define BRIDGE_COMMAND_SIZE 32   // Largest command, code included.
+#define BRIDGE_RESPONSE_SIZE 48  // Largest response, code included.
+#define BRIDGE_TIMEOUT_MS 1000   // ACK and response of one command.
+#define BRIDGE_IDLE_MS 10000UL   // The bridge ends without a command for this long, e.g. if the app has quit.
+#define NFC_FRAME_OVERHEAD 7     // Preamble, start code, length and its checksum, TFI, checksum, postamble.
+#define BRIDGE_FRAME_SIZE (NFC_FRAME_OVERHEAD + BRIDGE_RESPONSE_SIZE)
 
 // Define constants related to the structure of Mifare Classic NFC tags.
 #define NR_SHORTSECTOR (32)          // Number of short sectors in Mifare 1K or the first part of Mifare 4K.
@@ -17,17 +70,57 @@
 // Macro to calculate the first block number of a given sector, differentiating between short and long sectors.
 #define BLOCK_NUMBER_OF_SECTOR_1ST_BLOCK(sector) (((sector) < NR_SHORTSECTOR) ? ((sector)*NR_BLOCK_OF_SHORTSECTOR) : (NR_SHORTSECTOR * NR_BLOCK_OF_SHORTSECTOR + (sector - NR_SHORTSECTOR) * NR_BLOCK_OF_LONGSECTOR))
 
+// Key records are the text of an NDEF Text record starting in sector 1: the key segment encrypted in CBC, a
+// flags byte, the key store slot of a single-card record (big endian), then the IV of the segment. Records
+// written by older firmware end after the flags, their segment is encrypted in ECB and their slot is kept in
+// the low bits of the flags. Later record versions can append more fields, they are ignored here.
+#define KEY_RECORD_SECTOR 1         // First NDEF sector, as format_MAD1 writes the MAD.
+#define KEY_RECORD_FLAGS 32         // Offset of the flags byte in the text.
+#define KEY_RECORD_SLOT 33          // Offset of the slot field in the text.
+#define KEY_RECORD_IV 35            // Offset of the IV in the text.
+#define KEY_TEXT_LEGACY_SIZE 33     // Segment and flags.
+#define KEY_TEXT_SIZE 51            // Segment, flags, slot and IV.
+#define KEY_RECORD_MESSAGE_SIZE 80  // Largest NDEF message read from a card, leaves room for new fields.
+#define KEY_RECORD_DUAL 0x40        // Flag of a dual-card record.
+#define KEY_RECORD_SECOND 0x20      // Flag of the second card of a dual pair.
+#define KEY_SEGMENTS_SIZE 65        // Dual-card flag and the two segments, as the app sends a key.
+
+// Bits of the flags byte of a single-card key record holding the index of the key store slot, in the records
+// of older firmware, read when the record has no slot field. Older firmware can no longer recover the records
+// written by this version: their segment is encrypted in CBC.
+#define CARD_SLOT_MASK 0x3F
+#define CARD_SLOT_MAX 0xFFFF  // Largest slot the slot field holds.
+
+// Batch enrollment: key jobs queued ahead of the cards, each written to the next new card tapped. A job
+// takes 68 bytes of SRAM; a full queue answers "batchJob=full", the job is sent again once a card is written.
+#define BATCH_QUEUE_SIZE 2
+
+// Self-benchmark, the 'n' request: iterations of each primitive on the card present. Its response is
+// "Bench: ", a version byte, the number of primitives, then one 16 bytes record per primitive, little
+// endian: primitive, failed iterations, successful iterations (2), ops/s (4), then the 50th, 90th and
+// 99th percentile and the maximum of the latencies in us (2 each, saturated at 65535), then an end of line.
+#define BENCH_VERSION 1
+#define BENCH_MAX_ITERATIONS 64      // Latency samples kept per primitive for the percentiles.
+#define BENCH_DEFAULT_ITERATIONS 32  // When the iteration byte of the request is 0 or too large.
+#define BENCH_SECTOR 15              // Scratch sector: its first block is read, then written back unchanged.
+#define BENCH_EEPROM_ADDRESS 1023    // Past the key store in all its layouts; its value is restored after.
+
+// Primitives of the self-benchmark, in the order they run.
+#define BENCH_DETECT 0         // Card detection and selection.
+#define BENCH_AUTH 1           // Key A authentication of the scratch sector.
+#define BENCH_READ 2           // Read of its first block.
+#define BENCH_WRITE 3          // Write of the same block.
+#define BENCH_AES 4            // One block encrypted with the session key schedule.
+#define BENCH_EEPROM_READ 5
+#define BENCH_EEPROM_UPDATE 6
+#define BENCH_PRIMITIVES 7
+
 // Define a limit for user input length to prevent buffer overflow in user-input handling routines.
 #define MAX_INPUT 100
 
 // Define the total number of sectors in a Mifare Classic 4K card for reference in the code.
 #define sector_number 39
 
-//
-#define SEGMENT_SIZE 32
-#define LOWEST_SEGMENT_ADDRESS 32
-#define HIGHEST_SEGMENT_ADDRESS 992
-
 // Define a blank data block template with 16 bytes set to zero, used for initializing or clearing data blocks.
 #define BLANK_DATA_BLOCK \
   { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }
@@ -41,6 +134,10 @@ const uint8_t keys[3][6] PROGMEM = {
   { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }   // Key set 3: Default factory key (all bytes are 0xFF).
 };
 
+// Key protecting the key segments written on the cards and in the key store, loaded into the cipher
+// session when the admin logs in. Stored in PROGMEM so it only sits in RAM while it is being expanded.
+const uint8_t segment_key[32] PROGMEM = { 't', 'o', 'n', 'y' };
+
 // Define access condition bits for MIFARE sectors, detailing read/write permissions.
 // These are also stored in PROGMEM. Each set configures permissions for one sector.
 const uint8_t accessBits[3][4] PROGMEM = {
@@ -105,33 +202,3 @@ const uint8_t MAD1[2][16] PROGMEM = {
 
 void terminate_current_serial(void);
 
-/**
- * @brief Encrypts a block of data using AES-256 ECB mode.
- * 
- * This function takes an input block of plaintext and encrypts it using the AES-256 ECB mode of encryption.
- * It assumes that the input data length is a multiple of the AES block size (16 bytes). It uses provided key
- * to perform the encryption and places the result in the output buffer.
- *
- * @param output Pointer to the buffer where encrypted data should be stored.
- * @param input Pointer to the data to be encrypted.
- * @param len Length of the input data in bytes. Must be a multiple of CIPHER_BLOCK_SIZE.
- * @param key Pointer to the encryption key.
- * @return false if encryption was successful, true if the key was invalid.
- */
-bool encrypt(uint8_t *output, const uint8_t *input, uint8_t len, const uint8_t *key);
-
-
-/**
- * @brief Decrypts a block of data using AES-256 ECB mode.
- * 
- * This function takes an input block of ciphertext and decrypts it using the AES-256 ECB mode of decryption.
- * It assumes that the input data length is a multiple of the AES block size (16 bytes). It uses the provided key
- * to perform the decryption and places the result in the output buffer.
- *
- * @param output Pointer to the buffer where decrypted data should be stored.
- * @param input Pointer to the data to be decrypted.
- * @param len Length of the input data in bytes. Must be a multiple of CIPHER_BLOCK_SIZE.
- * @param key Pointer to the decryption key.
- * @return false if decryption was successful, true if the key was invalid.
- */
-bool decrypt(uint8_t* output, const uint8_t* input, uint8_t len, const uint8_t* key);
\ No newline at end of file
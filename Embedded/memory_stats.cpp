@@ -0,0 +1,144 @@
+#include "memory_stats.h"
+#include "console.h"
+#include "arena.h"
+
+#ifdef __AVR__
+
+// Linker symbols of the AVR memory layout.
+extern uint8_t __data_start;
+extern uint8_t __data_end;
+extern uint8_t __bss_start;
+extern uint8_t __bss_end;
+extern uint8_t __heap_start;
+extern uint8_t _end;
+extern void* __brkval;  // Top of the heap once malloc has been used, 0 before.
+
+/**
+ * Paints the whole free SRAM before the C runtime starts. Runs in .init3, once the stack pointer and the
+ * zero register are set up; naked and without locals so it does not use the stack it is painting.
+ */
+void memory_paint(void) __attribute__((naked, used, section(".init3")));
+void memory_paint(void) {
+  uint8_t* p = &_end;
+  while (p <= (uint8_t*)RAMEND)
+    *p++ = STACK_CANARY;
+}
+
+static uint8_t* heap_top(void) {
+  return __brkval ? (uint8_t*)__brkval : &__heap_start;
+}
+
+static uint8_t* stack_pointer(void) {
+  return (uint8_t*)SP;
+}
+
+#endif
+
+static uint16_t heap_peak = 0;      // Largest heap size seen when sampling.
+static uint16_t stack_peak = 0;     // Deepest stack use since boot.
+static uint8_t commands[MEMORY_TRACKED_COMMANDS];         // Request bytes with a recorded peak.
+static uint16_t command_peak[MEMORY_TRACKED_COMMANDS];    // Deepest stack use of each of them.
+static uint8_t command_count = 0;
+
+
+/**
+ * Samples the heap size, the heap only grows when the PN532 driver allocates its SPI device.
+ */
+static void heap_sample(void) {
+#ifdef __AVR__
+  uint16_t heap = heap_top() - &__heap_start;
+  if (heap > heap_peak)
+    heap_peak = heap;
+#endif
+}
+
+
+uint16_t memory_stack_peak(void) {
+#ifdef __AVR__
+  // The paint starts at the heap, the first overwritten byte above it is the deepest the stack went.
+  uint8_t* p = heap_top();
+  while (p <= (uint8_t*)RAMEND && *p == STACK_CANARY)
+    p++;
+  return (uint8_t*)RAMEND - p + 1;
+#else
+  return 0;
+#endif
+}
+
+
+uint16_t memory_free(void) {
+#ifdef __AVR__
+  return stack_pointer() - heap_top();
+#else
+  return 0;
+#endif
+}
+
+
+void memory_mark(void) {
+  uint16_t peak = memory_stack_peak();  // Keep what the paint recorded since boot or the last request.
+  if (peak > stack_peak)
+    stack_peak = peak;
+  heap_sample();
+
+#ifdef __AVR__
+  // Everything below the stack pointer is free, this function's frame is above it.
+  uint8_t* p = heap_top();
+  uint8_t* end = stack_pointer();
+  while (p < end)
+    *p++ = STACK_CANARY;
+#endif
+}
+
+
+void memory_record(uint8_t command) {
+  uint16_t peak = memory_stack_peak();
+  if (peak > stack_peak)
+    stack_peak = peak;
+  heap_sample();
+
+  uint8_t i = 0;
+  while (i < command_count && commands[i] != command)
+    i++;
+  if (i == command_count) {
+    if (command_count == MEMORY_TRACKED_COMMANDS)
+      return;  // Table full, only the overall peak is kept.
+    commands[command_count] = command;
+    command_peak[command_count++] = 0;
+  }
+  if (peak > command_peak[i])
+    command_peak[i] = peak;
+}
+
+
+void memory_report(void) {
+  heap_sample();
+
+  Console.print(F("freeRam="));
+  Console.println(memory_free());
+#ifdef __AVR__
+  Console.print(F("data="));
+  Console.println(&__data_end - &__data_start);
+  Console.print(F("bss="));
+  Console.println(&__bss_end - &__bss_start);
+#endif
+  Console.print(F("heap="));
+  Console.println(heap_peak);
+
+  Console.print(F("arena="));
+  Console.print(arena_peak());
+  Console.print('/');
+  Console.println(ARENA_SIZE);
+
+  uint16_t peak = memory_stack_peak();
+  Console.print(F("stackPeak="));
+  Console.println(peak > stack_peak ? peak : stack_peak);
+
+  // One line per request, the request byte as a character as it is sent by the app.
+  for (uint8_t i = 0; i < command_count; i++) {
+    Console.print(F("stack["));
+    Console.write(commands[i]);
+    Console.print(F("]="));
+    Console.println(command_peak[i]);
+  }
+}
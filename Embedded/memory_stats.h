@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+
+// SRAM telemetry. The free SRAM between the heap and the stack is painted with STACK_CANARY, the stack
+// high-water mark is the lowest address where the paint has been overwritten.
+#define STACK_CANARY 0xC5
+
+// Number of request bytes whose stack peak is tracked separately.
+#define MEMORY_TRACKED_COMMANDS 16
+
+
+/**
+ * Repaints the free SRAM below the current stack pointer, called before a request is executed so its
+ * stack peak can be measured on its own. The whole free SRAM is painted at boot, before setup().
+ */
+void memory_mark(void);
+
+/**
+ * Records the stack peak reached since the last memory_mark() as the peak of a request.
+ *
+ * @param command The request byte (mode) that has just been executed.
+ */
+void memory_record(uint8_t command);
+
+/**
+ * @return The number of free bytes between the top of the heap and the stack pointer.
+ */
+uint16_t memory_free(void);
+
+/**
+ * @return The deepest stack use since the last memory_mark(), in bytes.
+ */
+uint16_t memory_stack_peak(void);
+
+/**
+ * Prints the SRAM telemetry: free SRAM, .data, .bss and heap sizes, arena peak, stack peak since boot and the
+ * stack peak of each request executed so far.
+ */
+void memory_report(void);
@@ -0,0 +1,204 @@
+#include "ndef.h"
+
+// States of the TLV parser.
+#define NDEF_STATE_TYPE 0
+#define NDEF_STATE_LENGTH 1       // First length byte, 0xFF announces the 3 bytes form.
+#define NDEF_STATE_LENGTH_HIGH 2
+#define NDEF_STATE_LENGTH_LOW 3
+#define NDEF_STATE_VALUE 4
+
+#define NDEF_TLV_HEADER_SIZE 4  // Type and 3 bytes length of the message TLV written.
+
+
+void ndef_read_begin(NdefReader* reader, uint8_t* message, uint16_t size) {
+  reader->message = message;
+  reader->size = size;
+  reader->length = 0;
+  reader->received = 0;
+  reader->type = 0;
+  reader->state = NDEF_STATE_TYPE;
+}
+
+
+uint8_t ndef_read_feed(NdefReader* reader, const uint8_t* block) {
+  for (uint8_t i = 0; i < NDEF_BLOCK_SIZE; i++) {
+    uint8_t b = block[i];
+    switch (reader->state) {
+      case NDEF_STATE_TYPE:
+        if (b == NDEF_TLV_NULL)
+          continue;
+        if (b == NDEF_TLV_TERMINATOR)
+          return NDEF_READ_NONE;
+        reader->type = b;
+        reader->state = NDEF_STATE_LENGTH;
+        continue;
+
+      case NDEF_STATE_LENGTH:
+        if (b == 0xFF) {
+          reader->state = NDEF_STATE_LENGTH_HIGH;
+          continue;
+        }
+        reader->length = b;
+        break;
+
+      case NDEF_STATE_LENGTH_HIGH:
+        reader->length = (uint16_t)b << 8;
+        reader->state = NDEF_STATE_LENGTH_LOW;
+        continue;
+
+      case NDEF_STATE_LENGTH_LOW:
+        reader->length |= b;
+        if (reader->length == 0xFFFF)
+          return NDEF_READ_NONE;  // Reserved length, the data area is not NDEF formatted.
+        break;
+
+      default:  // NDEF_STATE_VALUE
+        if (reader->type == NDEF_TLV_MESSAGE)
+          reader->message[reader->received] = b;
+        if (++reader->received < reader->length)
+          continue;
+        if (reader->type == NDEF_TLV_MESSAGE)
+          return NDEF_READ_COMPLETE;
+        reader->state = NDEF_STATE_TYPE;  // Lock or memory control TLV, skipped.
+        continue;
+    }
+
+    // The length field is complete.
+    reader->received = 0;
+    if (reader->type == NDEF_TLV_MESSAGE) {
+      if (reader->length > reader->size)
+        return NDEF_READ_OVERFLOW;
+      if (reader->length == 0)
+        return NDEF_READ_COMPLETE;
+    }
+    reader->state = reader->length ? NDEF_STATE_VALUE : NDEF_STATE_TYPE;
+  }
+  return NDEF_READ_MORE;
+}
+
+
+void ndef_write_begin(NdefWriter* writer, const uint8_t* message, uint16_t length) {
+  writer->message = message;
+  writer->length = length;
+  writer->position = 0;
+}
+
+
+bool ndef_write_next(NdefWriter* writer, uint8_t* block) {
+  uint16_t end = NDEF_TLV_HEADER_SIZE + writer->length;  // Position of the terminator.
+  if (writer->position > end)
+    return false;
+
+  for (uint8_t i = 0; i < NDEF_BLOCK_SIZE; i++) {
+    uint16_t p = writer->position + i;
+    if (p == 0)
+      block[i] = NDEF_TLV_MESSAGE;
+    else if (p == 1)
+      block[i] = 0xFF;
+    else if (p == 2)
+      block[i] = writer->length >> 8;
+    else if (p == 3)
+      block[i] = writer->length;
+    else if (p < end)
+      block[i] = writer->message[p - NDEF_TLV_HEADER_SIZE];
+    else if (p == end)
+      block[i] = NDEF_TLV_TERMINATOR;
+    else
+      block[i] = 0x00;
+  }
+  writer->position += NDEF_BLOCK_SIZE;
+  return true;
+}
+
+
+uint16_t ndef_text_message(uint8_t* message, uint16_t size, const char* language, const uint8_t* text,
+                           uint16_t text_len) {
+  uint8_t language_len = strlen(language);
+  uint16_t payload_len = 1 + language_len + text_len;
+  uint16_t length = 7 + payload_len;  // Header, type length, 4 bytes payload length and type.
+  if (length > size)
+    return 0;
+
+  uint8_t* p = message;
+  *p++ = NDEF_RECORD_MB | NDEF_RECORD_ME | NDEF_TNF_WELL_KNOWN;
+  *p++ = 1;  // Type length.
+  *p++ = 0;
+  *p++ = 0;
+  *p++ = payload_len >> 8;
+  *p++ = payload_len;
+  *p++ = 'T';
+  *p++ = language_len;  // Status byte: UTF-8 and the length of the language code.
+  memcpy(p, language, language_len);
+  memcpy(p + language_len, text, text_len);
+  return length;
+}
+
+
+int16_t ndef_find_text(const uint8_t* message, uint16_t length, const uint8_t** text) {
+  uint32_t p = 0;
+  while (p < length) {
+    uint8_t header = message[p++];
+    if (p >= length)
+      return -1;
+    uint8_t type_len = message[p++];
+
+    uint32_t payload_len;
+    if (header & NDEF_RECORD_SR) {
+      if (p + 1 > length)
+        return -1;
+      payload_len = message[p++];
+    } else {
+      if (p + 4 > length)
+        return -1;
+      payload_len = ((uint32_t)message[p] << 24) | ((uint32_t)message[p + 1] << 16) | ((uint16_t)message[p + 2] << 8)
+                    | message[p + 3];
+      p += 4;
+    }
+    uint8_t id_len = 0;
+    if (header & NDEF_RECORD_IL) {
+      if (p + 1 > length)
+        return -1;
+      id_len = message[p++];
+    }
+
+    const uint8_t* type = message + p;
+    p += type_len + id_len;
+    if (p + payload_len > length)
+      return -1;
+    const uint8_t* payload = message + p;
+    p += payload_len;
+
+    if ((header & NDEF_RECORD_TNF) == NDEF_TNF_WELL_KNOWN && !(header & NDEF_RECORD_CF) && type_len == 1
+        && type[0] == 'T' && payload_len > 0) {
+      uint8_t language_len = payload[0] & NDEF_TEXT_LANGUAGE_MASK;
+      if (1u + language_len > payload_len)
+        return -1;
+      *text = payload + 1 + language_len;
+      return payload_len - 1 - language_len;
+    }
+    if (header & NDEF_RECORD_ME)
+      break;
+  }
+  return -1;
+}
+
+
+bool ndef_mad_valid(const uint8_t* mad) {
+  // CRC-8 of the info byte and the application IDs: polynomial x^8 + x^4 + x^3 + x^2 + 1, preset 0xC7.
+  uint8_t crc = 0xC7;
+  for (uint8_t i = 1; i < NDEF_MAD_SIZE; i++) {
+    crc ^= mad[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : crc << 1;
+  }
+  return crc == mad[0];
+}
+
+
+uint8_t ndef_mad_next_sector(const uint8_t* mad, uint8_t sector) {
+  for (uint8_t s = sector + 1; s < NDEF_MAD_SECTORS; s++) {
+    if (mad[2 * s] == NDEF_MAD_AID_LOW && mad[2 * s + 1] == NDEF_MAD_AID_HIGH)
+      return s;
+  }
+  return 0;
+}
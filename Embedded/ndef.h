@@ -0,0 +1,136 @@
+#pragma once
+
+#include <Arduino.h>
+
+// NDEF messages on MIFARE Classic cards, as the NFC Forum application note lays them out: the data blocks
+// of the sectors the MAD assigns to NDEF hold a sequence of TLVs, ended by a terminator TLV. The reader
+// and the writer work one 16 bytes block at a time, so only the sectors a message spans are accessed.
+
+#define NDEF_BLOCK_SIZE 16
+
+// TLV types.
+#define NDEF_TLV_NULL 0x00        // Padding, no length field.
+#define NDEF_TLV_MESSAGE 0x03     // NDEF message.
+#define NDEF_TLV_TERMINATOR 0xFE  // Last TLV of the data area, no length field.
+
+// MAD1: sector 0 blocks 1 and 2, a CRC, the info byte and the application ID of sectors 1 to 15.
+#define NDEF_MAD_SIZE 32
+#define NDEF_MAD_SECTORS 16
+#define NDEF_MAD_AID_LOW 0x03   // Application ID 0xE103 of NDEF sectors, low byte first.
+#define NDEF_MAD_AID_HIGH 0xE1
+
+// Record header bits and the well-known Text type.
+#define NDEF_RECORD_MB 0x80   // Message begin.
+#define NDEF_RECORD_ME 0x40   // Message end.
+#define NDEF_RECORD_CF 0x20   // Chunked.
+#define NDEF_RECORD_SR 0x10   // Short record: 1 byte payload length.
+#define NDEF_RECORD_IL 0x08   // ID length present.
+#define NDEF_RECORD_TNF 0x07  // Type name format.
+#define NDEF_TNF_WELL_KNOWN 0x01
+#define NDEF_TEXT_LANGUAGE_MASK 0x3F  // Length of the language code in the text status byte.
+
+// Results of ndef_read_feed().
+#define NDEF_READ_MORE 0      // The message continues in the next block.
+#define NDEF_READ_COMPLETE 1  // The whole message value has been received.
+#define NDEF_READ_NONE 2      // Terminator or malformed TLV before any message.
+#define NDEF_READ_OVERFLOW 3  // The message is larger than the buffer.
+
+/**
+ * Incremental TLV parser. Blocks are fed in card order; the length fields are decoded as they arrive,
+ * TLVs other than the first message are skipped, and parsing stops once the message value is complete.
+ */
+typedef struct {
+  uint8_t* message;   // Buffer receiving the value of the message TLV.
+  uint16_t size;      // Its size.
+  uint16_t length;    // Length of the current TLV value.
+  uint16_t received;  // Bytes of it already received or skipped.
+  uint8_t type;       // Type of the current TLV.
+  uint8_t state;
+} NdefReader;
+
+/**
+ * Streams a message TLV, then the terminator, as a sequence of blocks. The last block is zero padded.
+ */
+typedef struct {
+  const uint8_t* message;
+  uint16_t length;
+  uint16_t position;  // Bytes of the TLVs already emitted, header included.
+} NdefWriter;
+
+
+/**
+ * Starts parsing a data area.
+ *
+ * @param reader Parser state.
+ * @param message Buffer receiving the message.
+ * @param size Size of the buffer.
+ */
+void ndef_read_begin(NdefReader* reader, uint8_t* message, uint16_t size);
+
+/**
+ * Parses the next block of the data area.
+ *
+ * @param reader Parser state.
+ * @param block The NDEF_BLOCK_SIZE bytes of the block.
+ * @return One of the NDEF_READ_ results, reader->length is the length of a complete message.
+ */
+uint8_t ndef_read_feed(NdefReader* reader, const uint8_t* block);
+
+/**
+ * Starts writing a message. The length always takes the 3 bytes form, so key records keep the layout
+ * of the cards written by the earlier firmware, which reads them at fixed offsets.
+ *
+ * @param writer Writer state.
+ * @param message The NDEF message, kept until the last block is emitted.
+ * @param length Its length, up to 0xFFFE.
+ */
+void ndef_write_begin(NdefWriter* writer, const uint8_t* message, uint16_t length);
+
+/**
+ * Emits the next block of the data area.
+ *
+ * @param writer Writer state.
+ * @param block Buffer receiving NDEF_BLOCK_SIZE bytes.
+ * @return true if a block was emitted, false once the whole data area, terminator included, has been.
+ */
+bool ndef_write_next(NdefWriter* writer, uint8_t* block);
+
+/**
+ * Builds a message of one Text record, with the payload length on 4 bytes like the key records already
+ * on cards.
+ *
+ * @param message Buffer receiving the message.
+ * @param size Its size.
+ * @param language Language code, e.g. "en".
+ * @param text Text of the record.
+ * @param text_len Its length.
+ * @return The length of the message, 0 if it does not fit.
+ */
+uint16_t ndef_text_message(uint8_t* message, uint16_t size, const char* language, const uint8_t* text,
+                           uint16_t text_len);
+
+/**
+ * Finds the first Text record of a message.
+ *
+ * @param message The NDEF message.
+ * @param length Its length.
+ * @param text Set to the text, after the status byte and the language code.
+ * @return The length of the text, -1 if the message has no well formed Text record.
+ */
+int16_t ndef_find_text(const uint8_t* message, uint16_t length, const uint8_t** text);
+
+/**
+ * Checks the CRC of a MAD1.
+ *
+ * @param mad Blocks 1 and 2 of sector 0.
+ */
+bool ndef_mad_valid(const uint8_t* mad);
+
+/**
+ * Finds the NDEF sector following another one in a MAD1.
+ *
+ * @param mad Blocks 1 and 2 of sector 0.
+ * @param sector The current sector.
+ * @return The next NDEF sector, 0 if there is none.
+ */
+uint8_t ndef_mad_next_sector(const uint8_t* mad, uint8_t sector);
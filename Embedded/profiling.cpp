@@ -0,0 +1,94 @@
+#include "profiling.h"
+#include "console.h"
+
+#ifdef PROFILING
+
+typedef struct {
+  uint16_t count;
+  unsigned long min;
+  unsigned long max;
+  unsigned long total;  // Halved together with count and the buckets when it would overflow.
+  uint16_t buckets[PROFILE_BUCKETS];
+} PhaseStats;
+
+static PhaseStats phases[PROFILE_PHASE_COUNT];
+
+static const char phase_detect[] PROGMEM = "detect";
+static const char phase_auth[] PROGMEM = "auth";
+static const char phase_read[] PROGMEM = "read";
+static const char phase_write[] PROGMEM = "write";
+static const char phase_crypto[] PROGMEM = "crypto";
+static const char phase_store[] PROGMEM = "store";
+static const char phase_serial_tx[] PROGMEM = "serialTx";
+
+// Names printed by the report, in the order of the PROFILE_ phases.
+static const char* const phase_names[PROFILE_PHASE_COUNT] PROGMEM = {
+  phase_detect,
+  phase_auth,
+  phase_read,
+  phase_write,
+  phase_crypto,
+  phase_store,
+  phase_serial_tx
+};
+
+
+/**
+ * Halves a phase's counters, keeping its average and histogram shape, so long uptimes never overflow.
+ */
+static void phase_decay(PhaseStats* stats) {
+  stats->count >>= 1;
+  stats->total >>= 1;
+  for (uint8_t i = 0; i < PROFILE_BUCKETS; i++)
+    stats->buckets[i] >>= 1;
+}
+
+
+void profile_record(uint8_t phase, unsigned long elapsed) {
+  PhaseStats* stats = &phases[phase];
+
+  if (stats->count == 0xFFFF || stats->total + elapsed < stats->total)
+    phase_decay(stats);
+
+  if (stats->count == 0 || elapsed < stats->min)
+    stats->min = elapsed;
+  if (elapsed > stats->max)
+    stats->max = elapsed;
+  stats->count++;
+  stats->total += elapsed;
+
+  uint8_t bucket = 0;
+  unsigned long bound = 64;
+  while (bucket < PROFILE_BUCKETS - 1 && elapsed >= bound) {
+    bucket++;
+    bound <<= 2;
+  }
+  stats->buckets[bucket]++;
+}
+
+
+void profile_report(void) {
+  for (uint8_t phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+    PhaseStats* stats = &phases[phase];
+
+    Console.print((const __FlashStringHelper*)pgm_read_ptr(&phase_names[phase]));
+    Console.print(F(": n="));
+    Console.print(stats->count);
+    Console.print(F(" min="));
+    Console.print(stats->min);
+    Console.print(F(" avg="));
+    Console.print(stats->count ? stats->total / stats->count : 0);
+    Console.print(F(" max="));
+    Console.print(stats->max);
+    Console.print(F(" hist="));
+    for (uint8_t i = 0; i < PROFILE_BUCKETS; i++) {
+      if (i)
+        Console.print(',');
+      Console.print(stats->buckets[i]);
+    }
+    Console.println();
+  }
+  memset(phases, 0, sizeof(phases));
+}
+
+#endif
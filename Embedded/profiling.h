@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Latency probes around the phases of the requests. Each phase keeps its count, min, max and total time
+// plus a histogram, the 'p' request prints them. Comment out to compile the probes out entirely.
+#define PROFILING
+
+// Phases measured by the probes.
+#define PROFILE_DETECT 0     // Waiting for and selecting a card.
+#define PROFILE_AUTH 1       // MIFARE sector authentication.
+#define PROFILE_READ 2       // Card block reads.
+#define PROFILE_WRITE 3      // Card block writes.
+#define PROFILE_CRYPTO 4     // AES key setup and block operations.
+#define PROFILE_STORE 5      // Key store reads and writes (EEPROM or FRAM).
+#define PROFILE_SERIAL_TX 6  // Sending results to the app and draining the TX buffer.
+#define PROFILE_PHASE_COUNT 7
+
+// Histogram buckets, bucket i counts the durations below 64 << (2 * i) us: 64 us, 256 us, 1 ms, 4 ms,
+// 16 ms, 65 ms, 262 ms, and everything above in the last one.
+#define PROFILE_BUCKETS 8
+
+#ifdef PROFILING
+
+// PROFILE_BEGIN(start) and PROFILE_END(phase, start) surround a measured section, start names the local
+// holding its start time. A section left early (error return) is not recorded.
+#define PROFILE_BEGIN(start) unsigned long start = micros()
+#define PROFILE_END(phase, start) profile_record(phase, micros() - start)
+
+/**
+ * Adds a duration to the statistics of a phase.
+ *
+ * @param phase One of the PROFILE_ phases.
+ * @param elapsed Duration in microseconds.
+ */
+void profile_record(uint8_t phase, unsigned long elapsed);
+
+/**
+ * Prints the statistics of every phase, in microseconds, then clears them so the next report only covers
+ * the requests executed in between.
+ */
+void profile_report(void);
+
+#else
+
+#define PROFILE_BEGIN(start)
+#define PROFILE_END(phase, start) do {} while (0)
+
+#endif
@@ -0,0 +1,100 @@
+#include "scheduler.h"
+
+#include <avr/sleep.h>
+
+typedef struct {
+  TaskFunction function;
+  uint16_t period;     // ms between two runs.
+  uint8_t flags;
+  unsigned long next;  // millis() of the next run.
+} Task;
+
+static Task tasks[SCHEDULER_MAX_TASKS];
+static uint8_t task_count = 0;
+static bool in_background = false;  // A background task is running, from a pass or from yield().
+
+
+uint8_t task_add(TaskFunction function, uint16_t period_ms, uint8_t flags) {
+  if (task_count == SCHEDULER_MAX_TASKS)
+    return TASK_NONE;
+  Task* task = &tasks[task_count];
+  task->function = function;
+  task->period = period_ms;
+  task->flags = flags;
+  task->next = millis();
+  return task_count++;
+}
+
+
+void task_start(uint8_t task) {
+  tasks[task].flags &= ~TASK_STOPPED;
+  tasks[task].next = millis();
+}
+
+
+void task_stop(uint8_t task) {
+  tasks[task].flags |= TASK_STOPPED;
+}
+
+
+void task_delay(uint8_t task, uint16_t ms) {
+  tasks[task].next = millis() + ms;
+}
+
+
+void task_set_period(uint8_t task, uint16_t period_ms) {
+  tasks[task].period = period_ms;
+}
+
+
+/**
+ * Runs the tasks due having all the flags of a mask.
+ *
+ * @return true if any task ran.
+ */
+static bool run_due(uint8_t mask) {
+  bool ran = false;
+  for (uint8_t i = 0; i < task_count; i++) {
+    Task* task = &tasks[i];
+    unsigned long now = millis();
+    if ((task->flags & (mask | TASK_STOPPED)) != mask || (long)(now - task->next) < 0)
+      continue;
+    task->next = now + task->period;  // Before the call, so the task can delay itself.
+
+    bool background = in_background;
+    if (task->flags & TASK_BACKGROUND)
+      in_background = true;
+    task->function();
+    in_background = background;
+    ran = true;
+  }
+  return ran;
+}
+
+
+void scheduler_run(void) {
+  if (run_due(0))
+    return;
+  // Idle mode keeps the timers and the USB controller running: Timer0 wakes the CPU every 1.024 ms.
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sleep_cpu();
+  sleep_disable();
+}
+
+
+void scheduler_yield(void) {
+  if (in_background)
+    return;
+  in_background = true;
+  run_due(TASK_BACKGROUND);
+  in_background = false;
+}
+
+
+/**
+ * Replaces the empty yield() of the core, called by delay() while it waits.
+ */
+void yield(void) {
+  scheduler_yield();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Cooperative run-to-completion scheduler of the main loop. Each task is a function called when its
+// period has elapsed, which returns as soon as it has nothing left to do; a request still runs to its
+// end inside one task. The CPU sleeps until the next interrupt when no task is due.
+//
+// Background tasks also run while the firmware waits inside delay(), which the core and the PN532
+// driver call in every blocking wait: the serial input keeps being received and the log flushed while a
+// card operation runs.
+
+#define SCHEDULER_MAX_TASKS 8
+#define TASK_NONE 0xFF  // Returned by task_add() when the table is full.
+
+// Flags of a task.
+#define TASK_BACKGROUND 0x01  // Also runs from delay(), see scheduler_yield().
+#define TASK_STOPPED 0x02     // Not run until task_start().
+
+typedef void (*TaskFunction)(void);
+
+
+/**
+ * Adds a task, first run on the next pass unless it is stopped.
+ *
+ * @param function Called each time the task is due.
+ * @param period_ms Time between two runs.
+ * @param flags TASK_ flags.
+ * @return The task number, TASK_NONE if the table is full.
+ */
+uint8_t task_add(TaskFunction function, uint16_t period_ms, uint8_t flags);
+
+/**
+ * Runs a stopped task on the next pass, then at its period.
+ */
+void task_start(uint8_t task);
+
+/**
+ * Stops a task, a task may stop itself.
+ */
+void task_stop(uint8_t task);
+
+/**
+ * Postpones the next run of a task, a task may delay itself instead of calling delay().
+ *
+ * @param task The task number.
+ * @param ms Time from now to its next run.
+ */
+void task_delay(uint8_t task, uint16_t ms);
+
+/**
+ * Changes the time between two runs of a task, from its next run on.
+ */
+void task_set_period(uint8_t task, uint16_t period_ms);
+
+/**
+ * Runs every task due once, or sleeps until the next interrupt if none is. Called by loop().
+ */
+void scheduler_run(void);
+
+/**
+ * Runs the background tasks due. Called by yield(), so from every delay(); a background task calling
+ * delay() is not run again from it.
+ */
+void scheduler_yield(void);